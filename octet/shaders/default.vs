@@ -4,15 +4,41 @@
 //
 
 // matrices
+// when drawing many instances at once, these are worldToProjection and worldToCamera
 uniform mat4 modelToProjection;
 uniform mat4 modelToCamera;
 
+// one matrix per instance for instanced draws, otherwise the identity
+attribute mat4 modelToWorld;
+
 // attributes from vertex buffer
 attribute vec4 pos;
 attribute vec2 uv;
 attribute vec3 normal;
 attribute vec4 color;
 
+#ifdef OCTET_SKINNING
+// bone matrices of skinned meshes: four texels a bone, one row a mesh
+uniform sampler2D bone_palette;
+// x: one over the width of the palette, or zero if the mesh is not skinned. y: this mesh's row
+uniform vec2 bone_palette_coord;
+
+attribute vec3 blendweight;
+attribute vec4 blendindices;
+
+mat4 get_bone(float index) {
+  float du = bone_palette_coord.x;
+  float u = (index * 4.0 + 0.5) * du;
+  float v = bone_palette_coord.y;
+  return mat4(
+    texture2DLod(bone_palette, vec2(u, v), 0.0),
+    texture2DLod(bone_palette, vec2(u + du, v), 0.0),
+    texture2DLod(bone_palette, vec2(u + du * 2.0, v), 0.0),
+    texture2DLod(bone_palette, vec2(u + du * 3.0, v), 0.0)
+  );
+}
+#endif
+
 // outputs
 varying vec3 normal_;
 varying vec2 uv_;
@@ -21,9 +47,26 @@ varying vec3 model_pos_;
 varying vec3 camera_pos_;
 
 void main() {
-  gl_Position = modelToProjection * pos;
-  vec3 tnormal = (modelToCamera * vec4(normal, 0.0)).xyz;
-  vec3 tpos = (modelToCamera * pos).xyz;
+  vec4 mpos = pos;
+  vec3 mnormal = normal;
+#ifdef OCTET_SKINNING
+  if (bone_palette_coord.x > 0.0) {
+    // the bones take the vertex to camera space; modelToCamera is the identity.
+    float blend0 = 1.0 - blendweight.x - blendweight.y - blendweight.z;
+    mat4 skin =
+      get_bone(blendindices.x) * blend0 +
+      get_bone(blendindices.y) * blendweight.x +
+      get_bone(blendindices.z) * blendweight.y +
+      get_bone(blendindices.w) * blendweight.z
+    ;
+    mpos = skin * pos;
+    mnormal = normalize((skin * vec4(normal, 0.0)).xyz);
+  }
+#endif
+  vec4 wpos = modelToWorld * mpos;
+  gl_Position = modelToProjection * wpos;
+  vec3 tnormal = (modelToCamera * (modelToWorld * vec4(mnormal, 0.0))).xyz;
+  vec3 tpos = (modelToCamera * wpos).xyz;
   normal_ = tnormal;
   uv_ = uv;
   color_ = color;
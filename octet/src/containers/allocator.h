@@ -6,7 +6,6 @@
 //
 // game-style memory allocator
 //
-// this is a placeholder for a game-style memory allocator
 // using malloc and free is frowned upon in grown-up circles.
 //
 // these functions are poor for the following reasons:
@@ -14,6 +13,9 @@
 // 1) free() has to compute the size of the block to free
 // 2) these functions use heavy weight locks to guard the heap.
 // 3) implementations are quite variable
+//
+// so we keep pools of small blocks in per-thread free lists and
+// pass the size of the block to free().
 
 // this is a dummy class used to customise the placement new and delete
 struct dynarray_dummy_t {};
@@ -49,60 +51,237 @@ void operator delete(void *ptr, void *place, dynarray_dummy_t x) {}
 
 
 namespace octet { namespace containers {
+  /// Game-style memory allocator.
+  ///
+  /// Small blocks (up to max_pool_size bytes) come from size-class pools with a free list
+  /// per thread, so malloc and free are a handful of instructions and take no locks.
+  /// Larger blocks go to the system heap.
+  ///
+  /// Like the allocators in most games, free() and realloc() are told the size of the block.
+  /// The size must match the one used to allocate the block or it will go back to the wrong pool.
+  ///
+  /// Memory in the pools is never returned to the system, but is recycled through the free lists.
   class allocator {
+  public:
+    enum {
+      /// alignment of all blocks
+      alignment = 16,
+
+      /// largest block size served from the pools.
+      max_pool_size = 4096,
+
+      /// number of size classes: 16 byte steps to 256, 64 byte steps to 1024, 256 byte steps to 4096.
+      num_classes = 16 + 12 + 12,
+
+      /// bytes fetched from the system when a pool runs dry.
+      chunk_size = 0x10000,
+
+      /// the extra "size class" used to report large blocks.
+      large_class = num_classes,
+    };
+
+    /// statistics for one size class. Counters are updated from every thread.
+    struct class_stats {
+      std::atomic<size_t> num_allocs;
+      std::atomic<size_t> num_frees;
+      std::atomic<size_t> num_bytes;
+      std::atomic<size_t> num_chunk_bytes;
+    };
+
+  private:
     // singleton state, a bit like an old-world global variable
     struct state_t {
-      size_t num_bytes;
+      std::atomic<size_t> num_bytes;
+      class_stats stats[num_classes + 1];
     };
 
+    // each thread has its own set of free lists.
+    struct thread_state_t {
+      void *free_list[num_classes];
+    };
+
+    // static objects are zero-initialised before anything else runs.
     static state_t &state() {
       static state_t instance;
       return instance;
     }
 
+    static thread_state_t &thread_state() {
+      static OCTET_THREAD_LOCAL thread_state_t instance;
+      return instance;
+    }
+
+    // fill an empty free list with a new chunk of blocks.
+    static void *refill(unsigned cls) {
+      size_t block_size = get_class_size(cls);
+      uint8_t *chunk = (uint8_t*)system_malloc(chunk_size);
+      if (!chunk) return 0;
+      state().stats[cls].num_chunk_bytes.fetch_add(chunk_size, std::memory_order_relaxed);
+
+      // thread the blocks in the chunk into a list, keep the first one for the caller.
+      size_t num_blocks = chunk_size / block_size;
+      void *head = 0;
+      for (size_t i = num_blocks; i-- > 1; ) {
+        void *block = chunk + i * block_size;
+        *(void**)block = head;
+        head = block;
+      }
+      thread_state().free_list[cls] = head;
+      return chunk;
+    }
+
   public:
-    // todo: implement this from scratch using a pool allocator
-    static void *malloc(size_t size) {
-      state().num_bytes += size;
+    /// get the size class for a block size. Only valid for sizes <= max_pool_size.
+    static unsigned get_class(size_t size) {
+      size = size ? size : 1;
+      if (size <= 256) {
+        return (unsigned)((size + 15) >> 4) - 1;
+      } else if (size <= 1024) {
+        return (unsigned)(15 + ((size - 256 + 63) >> 6));
+      } else {
+        return (unsigned)(27 + ((size - 1024 + 255) >> 8));
+      }
+    }
+
+    /// get the block size for a size class.
+    static size_t get_class_size(unsigned cls) {
+      return cls < 16 ? (cls + 1) * 16 : cls < 28 ? 256 + (cls - 15) * 64 : 1024 + (cls - 27) * 256;
+    }
+
+    /// get memory directly from the system heap.
+    static void *system_malloc(size_t size) {
       #if OCTET_MAC
         void *res = 0;
-        posix_memalign(&res, 16, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_malloc(size, 16);
+        posix_memalign(&res, alignment, size);
+      #elif defined(WIN32)
+        void *res = ::_aligned_malloc(size, alignment);
       #elif OCTET_VITA
-        void *res = ::memalign(size, 16);
+        void *res = ::memalign(size, alignment);
       #else
         void *res = ::malloc(size);
       #endif
-      //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
       return res;
     }
 
-    static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
-      //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
-      #if OCTET_MAC
-        return ::free(ptr);
-      #elif OCTET_SSE
-        return ::_aligned_free(ptr);
+    /// return memory directly to the system heap.
+    static void system_free(void *ptr) {
+      #if defined(WIN32)
+        ::_aligned_free(ptr);
       #else
-        return ::free(ptr);
+        ::free(ptr);
       #endif
     }
 
-    static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
-      #if OCTET_MAC
-        void *res = ::realloc(ptr, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_realloc(ptr, size, 16);
+    /// resize a block on the system heap.
+    static void *system_realloc(void *ptr, size_t size) {
+      #if defined(WIN32)
+        return ::_aligned_realloc(ptr, size, alignment);
       #else
-        void *res = ::realloc(ptr, size);
+        return ::realloc(ptr, size);
       #endif
-      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
+    }
+
+    /// allocate a block of memory, aligned to 16 bytes.
+    static void *malloc(size_t size) {
+      state_t &st = state();
+      st.num_bytes.fetch_add(size, std::memory_order_relaxed);
+      if (size > max_pool_size) {
+        st.stats[large_class].num_allocs.fetch_add(1, std::memory_order_relaxed);
+        st.stats[large_class].num_bytes.fetch_add(size, std::memory_order_relaxed);
+        return system_malloc(size);
+      }
+
+      unsigned cls = get_class(size);
+      st.stats[cls].num_allocs.fetch_add(1, std::memory_order_relaxed);
+      st.stats[cls].num_bytes.fetch_add(size, std::memory_order_relaxed);
+
+      void **free_list = thread_state().free_list;
+      void *res = free_list[cls];
+      if (res) {
+        free_list[cls] = *(void**)res;
+        return res;
+      }
+      return refill(cls);
+    }
+
+    /// free a block of memory. size must be the size the block was allocated with.
+    static void free(void *ptr, size_t size) {
+      if (!ptr) return;
+      state_t &st = state();
+      st.num_bytes.fetch_sub(size, std::memory_order_relaxed);
+      if (size > max_pool_size) {
+        st.stats[large_class].num_frees.fetch_add(1, std::memory_order_relaxed);
+        st.stats[large_class].num_bytes.fetch_sub(size, std::memory_order_relaxed);
+        system_free(ptr);
+        return;
+      }
+
+      unsigned cls = get_class(size);
+      st.stats[cls].num_frees.fetch_add(1, std::memory_order_relaxed);
+      st.stats[cls].num_bytes.fetch_sub(size, std::memory_order_relaxed);
+
+      // the block goes on this thread's list, even if another thread allocated it.
+      void **free_list = thread_state().free_list;
+      *(void**)ptr = free_list[cls];
+      free_list[cls] = ptr;
+    }
+
+    /// change the size of a block, preserving the contents.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      if (!ptr) return malloc(size);
+
+      if (old_size > max_pool_size && size > max_pool_size) {
+        // both on the system heap.
+        state_t &st = state();
+        st.num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        st.stats[large_class].num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        return system_realloc(ptr, size);
+      } else if (old_size <= max_pool_size && size <= max_pool_size && get_class(old_size) == get_class(size)) {
+        // still fits in the same block.
+        state_t &st = state();
+        st.num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        st.stats[get_class(size)].num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        return ptr;
+      }
+
+      void *res = malloc(size);
+      if (res) {
+        memcpy(res, ptr, old_size < size ? old_size : size);
+      }
+      free(ptr, old_size);
       return res;
     }
 
+    /// number of bytes currently allocated, excluding pool overhead.
+    static size_t get_num_bytes() {
+      return state().num_bytes.load(std::memory_order_relaxed);
+    }
+
+    /// statistics for a size class. Use large_class for blocks on the system heap.
+    static const class_stats &get_stats(unsigned cls) {
+      return state().stats[cls];
+    }
+
+    /// write a table of allocations by size class.
+    static void dump_stats(FILE *file) {
+      fprintf(file, "allocator: %u bytes in use\n", (unsigned)get_num_bytes());
+      fprintf(file, "%8s %10s %10s %10s %10s\n", "size", "allocs", "frees", "bytes", "chunks");
+      for (unsigned cls = 0; cls <= large_class; ++cls) {
+        const class_stats &s = get_stats(cls);
+        size_t num_allocs = s.num_allocs.load(std::memory_order_relaxed);
+        if (num_allocs) {
+          fprintf(
+            file, "%8u %10u %10u %10u %10u\n",
+            cls == large_class ? 0 : (unsigned)get_class_size(cls),
+            (unsigned)num_allocs,
+            (unsigned)s.num_frees.load(std::memory_order_relaxed),
+            (unsigned)s.num_bytes.load(std::memory_order_relaxed),
+            (unsigned)s.num_chunk_bytes.load(std::memory_order_relaxed)
+          );
+        }
+      }
+    }
+
     // crude check of stack integrity
     static void test(const char *label) {
       printf("test %s\n", label);
@@ -110,5 +289,125 @@ namespace octet { namespace containers {
       ::free(::malloc(32));
     }
   };
-} }
 
+  /// Linear allocator for temporary data that lives for one frame.
+  ///
+  /// Allocation is a pointer increment and free() does nothing.
+  /// All the memory is recycled when reset() is called at the end of the frame.
+  /// Use it with containers that are thrown away before the end of the frame:
+  ///
+  ///     dynarray<vec3, frame_allocator> temp_positions;
+  ///     hash_map<int, int, hash_map_cmp, frame_allocator> temp_map;
+  ///
+  /// The arena belongs to the main thread; do not use it from worker threads.
+  class frame_allocator {
+    enum { page_size = 0x100000 };
+
+    struct page_t {
+      page_t *next;
+      size_t size;
+    };
+
+    // page headers are padded to keep blocks aligned.
+    enum { header_size = (sizeof(page_t) + allocator::alignment - 1) & ~(allocator::alignment - 1) };
+
+    struct state_t {
+      page_t *pages;
+      uint8_t *ptr;
+      uint8_t *end;
+      uint8_t *last_block;
+      size_t num_bytes;
+      size_t total_bytes;
+      size_t high_water;
+    };
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    static size_t round_up(size_t size) {
+      return (size + allocator::alignment - 1) & ~(size_t)(allocator::alignment - 1);
+    }
+
+    static void new_page(size_t min_size) {
+      state_t &st = state();
+      size_t size = min_size + header_size > page_size ? min_size + header_size : page_size;
+      page_t *page = (page_t*)allocator::system_malloc(size);
+      page->next = st.pages;
+      page->size = size;
+      st.pages = page;
+      st.ptr = (uint8_t*)page + header_size;
+      st.end = (uint8_t*)page + size;
+    }
+
+  public:
+    /// allocate a temporary block.
+    static void *malloc(size_t size) {
+      state_t &st = state();
+      size = round_up(size);
+      if (st.ptr == 0 || (size_t)(st.end - st.ptr) < size) {
+        new_page(size);
+      }
+      uint8_t *res = st.ptr;
+      st.ptr += size;
+      st.last_block = res;
+      st.num_bytes += size;
+      return res;
+    }
+
+    /// blocks are freed by reset()
+    static void free(void *ptr, size_t size) {
+    }
+
+    /// grow a block; this is free if it was the last block allocated.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      state_t &st = state();
+      if (ptr && ptr == st.last_block && (size_t)(st.end - (uint8_t*)ptr) >= round_up(size)) {
+        st.num_bytes += round_up(size) - round_up(old_size);
+        st.ptr = (uint8_t*)ptr + round_up(size);
+        return ptr;
+      }
+      void *res = malloc(size);
+      if (ptr) {
+        memcpy(res, ptr, old_size < size ? old_size : size);
+      }
+      return res;
+    }
+
+    /// recycle all the temporary memory. Called at the end of every frame.
+    ///
+    /// If the frame used more than one page, replace them with one big page
+    /// so that the next frame will fit.
+    static void reset() {
+      state_t &st = state();
+      if (st.num_bytes > st.high_water) st.high_water = st.num_bytes;
+      st.total_bytes += st.num_bytes;
+      if (st.pages && st.pages->next) {
+        size_t size = 0;
+        for (page_t *page = st.pages; page; ) {
+          page_t *next = page->next;
+          size += page->size;
+          allocator::system_free(page);
+          page = next;
+        }
+        st.pages = 0;
+        new_page(size);
+      } else if (st.pages) {
+        st.ptr = (uint8_t*)st.pages + header_size;
+      }
+      st.last_block = 0;
+      st.num_bytes = 0;
+    }
+
+    /// number of bytes allocated since the last reset.
+    static size_t get_num_bytes() {
+      return state().num_bytes;
+    }
+
+    /// largest number of bytes used in one frame.
+    static size_t get_high_water() {
+      return state().high_water;
+    }
+  };
+} }
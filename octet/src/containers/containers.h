@@ -26,7 +26,9 @@
 #define OCTET_CONTAINERS_INCLUDED
 
 #include "../containers/allocator.h"
+#include "../containers/string_pool.h"
 #include "../containers/dictionary.h"
+#include "../containers/string_table.h"
 #include "../containers/hash_map.h"
 #include "../containers/double_list.h"
 #include "../containers/dynarray.h"
@@ -20,32 +20,36 @@ namespace octet { namespace containers {
   ///
   ///     int annes_age = my_dict["anne"];
   ///
+  /// Keys are copied into a string_pool owned by the dictionary, so adding a key
+  /// does not need a heap allocation. Keys from string_table::intern() are not copied at all.
+  ///
+  /// For repeated lookups of the same name, make a string_key once to avoid hashing the name each time:
+  ///
+  ///     string_key anne("anne");
+  ///     int index = my_dict.get_index(anne);
+  ///
   template <class value_t, class allocator_t=allocator> class dictionary {
-    struct entry_t { const char *key; unsigned hash; value_t value; };
+    struct entry_t { const char *key; unsigned hash; unsigned length; value_t value; };
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
-  
-    // hash is a compromise between fewer collisions and
-    // faster hash calculation.
-    unsigned calc_hash( const char *key ) {
-      unsigned hash = 0;
-      for (int i = 0; key[i]; ++i) {
-        hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
-      }
-      return hash;
-    }
+    string_pool<allocator_t> pool;
   
     // internal method to find an entry for a key
-    entry_t *find( const char *key, unsigned hash ) {
+    entry_t *find( const string_key &key ) {
       unsigned mask = max_entries - 1;
+      unsigned hash = key.get_hash();
+      const char *text = key.get_text();
       for (unsigned i = 0; i != max_entries; ++i) {
         entry_t *entry = &entries[ ( i + hash ) & mask ];
         if (!entry->key) {
           return entry;
         }
-        if (entry->hash == hash && !strcmp(entry->key, key)) {
-          return entry;
+        if (entry->hash == hash && entry->length == key.get_length()) {
+          // interned keys are the same pointer, so we can skip the compare.
+          if (entry->key == text || !memcmp(entry->key, text, entry->length)) {
+            return entry;
+          }
         }
       }
       return 0;
@@ -58,24 +62,22 @@ namespace octet { namespace containers {
       entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
       memset(entries, 0, sizeof(entry_t) * max_entries*2);
       max_entries *= 2;
+      unsigned mask = max_entries - 1;
       for (unsigned i = 0; i != old_max_entries; ++i) {
         entry_t *old_entry = &old_entries[i];
         if (old_entry->key) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+          // keys are unique, so we only need to look for an empty slot.
+          unsigned j = old_entry->hash & mask;
+          while (entries[j].key) j = (j + 1) & mask;
+          entries[j] = *old_entry;
         }
       }
       allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
     }
 
     void release() {
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[i];
-        if (entry->key ) {
-          allocator_t::free((void*)entry->key, strlen(entry->key)+1);
-        }
-      }
       allocator_t::free(entries, sizeof(entry_t) * max_entries);
+      pool.reset();
       entries = 0;
       num_entries = 0;
       max_entries = 0;
@@ -97,28 +99,36 @@ namespace octet { namespace containers {
     /// This will create a new element if one does not exist.
     /// For more detail, use get_index(), get_key() and get_value()
     value_t &operator[]( const char *key ) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      return (*this)[string_key(key)];
+    }
+
+    /// Access an element by a key with a precomputed hash.
+    /// This will create a new element if one does not exist.
+    value_t &operator[]( const string_key &key ) {
+      entry_t *entry = find( key );
       if (!entry || !entry->key) {
         // reducing this ratio decreases hot search time at the
         // expense of size (cold search time).
         if (num_entries > max_entries * 3 / 4) {
           expand();
-          entry = find(key, hash);
+          entry = find(key);
         }
         num_entries++;
-        size_t bytes = strlen(key) + 1;
-        entry->key = (char *)allocator_t::malloc(bytes);
-        entry->hash = hash;
-        memcpy((void*)entry->key, key, bytes);
+        entry->key = key.is_interned() ? key.get_text() : pool.add(key.get_text(), key.get_length());
+        entry->hash = key.get_hash();
+        entry->length = key.get_length();
       }
       return entry->value;
     }
 
     /// Return true if the dictionary contains key.
     bool contains(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      return contains(string_key(key));
+    }
+
+    /// Return true if the dictionary contains key.
+    bool contains(const string_key &key) {
+      entry_t *entry = find( key );
       return entry && entry->key;
     }
 
@@ -146,8 +156,12 @@ namespace octet { namespace containers {
 
     /// Get the index for a certain key, or -1 if the key is not found.
     int get_index(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      return get_index(string_key(key));
+    }
+
+    /// Get the index for a key with a precomputed hash, or -1 if the key is not found.
+    int get_index(const string_key &key) {
+      entry_t *entry = find( key );
       return entry && entry->key ? (int)(entry - entries) : -1;
     }
 
@@ -159,7 +173,7 @@ namespace octet { namespace containers {
   
     /// Bye bye dictionary. Use the allocator to free up memory.
     ~dictionary() {
-      reset();
+      release();
     }
   };
 } }
@@ -7,6 +7,20 @@
 
 
 namespace octet { namespace containers {
+  /// Trait: can objects of this type be moved in memory with memcpy/realloc?
+  ///
+  /// This is true of most types that do not point to themselves, even if they have
+  /// constructors and destructors, such as ref<>, string and dynarray<>.
+  /// Specialise this for your own types to make dynarray growth cheaper.
+  template <class item_t> struct is_trivially_relocatable {
+    #if defined(__GLIBCXX__) && !defined(_GLIBCXX_RELEASE)
+      // older libstdc++ does not have is_trivially_copyable
+      enum { value = __has_trivial_copy(item_t) && __has_trivial_destructor(item_t) };
+    #else
+      enum { value = std::is_trivially_copyable<item_t>::value };
+    #endif
+  };
+
   /// Dynamic array class similar to std::vector.
   ///
   /// Example
@@ -24,6 +38,9 @@ namespace octet { namespace containers {
   ///     dynarray<int> ints;          // ok. int is well-behaved.
   ///     dynarray<mesh> meshes;       // bad! mesh contains other arrays.
   ///     dynarray<ref<mesh> > meshes; // ok. managed pointers to meshes.
+  ///
+  /// Arrays of trivially relocatable types grow with realloc rather than copying items one at a time.
+  /// Use std::move to hand an array to a new owner without copying it.
   template <class item_t, class allocator_t=allocator, bool use_new_delete=true> class dynarray {
     item_t *data_;
     typedef unsigned int_size_t;
@@ -33,6 +50,36 @@ namespace octet { namespace containers {
     int_size_t capacity_;
     enum { min_capacity = 8 };
 
+    // make space for at least one more item, doubling the capacity.
+    void grow() {
+      reserve(capacity_ == 0 ? min_capacity : capacity_ * 2);
+    }
+
+    // copy or move an item into uninitialised memory.
+    template <class arg_t> static void construct(item_t *dest, arg_t &&value) {
+      if (use_new_delete) {
+        dynarray_dummy_t x;
+        new (dest, x) item_t(std::forward<arg_t>(value));
+      } else {
+        *dest = value;
+      }
+    }
+
+    // make a copy of rhs in an empty array.
+    void copy_from(const dynarray &rhs) {
+      if (rhs.size_ == 0) return;
+      data_ = (item_t*)allocator_t::malloc(rhs.size_ * sizeof(item_t));
+      size_ = capacity_ = rhs.size_;
+      if (use_new_delete) {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != size_; ++i) {
+          new (data_ + i, x)item_t(rhs.data_[i]);
+        }
+      } else {
+        memcpy(data_, rhs.data_, rhs.size_ * sizeof(item_t));
+      }
+    }
+
   public:
     /// Create a new, empty, dynamic array
     dynarray() {
@@ -43,7 +90,7 @@ namespace octet { namespace containers {
 
     /// Create a new dynamic array of a certain size.
     dynarray(int_size_t size) {
-      data_ = (item_t*)allocator::malloc(size * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(size * sizeof(item_t));
       size_ = capacity_ = size;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -57,16 +104,40 @@ namespace octet { namespace containers {
     ///
     /// Note: this is very slow and will happen frequently in naive code.
     dynarray(const dynarray &rhs) {
-      data_ = (item_t*)allocator::malloc(rhs.size_ * sizeof(item_t));
-      size_ = capacity_ = rhs.size_;
-      if (use_new_delete) {
-        dynarray_dummy_t x;
-        for (int_size_t i = 0; i != size_; ++i) {
-          new (data_ + i, x)item_t(rhs.data_[i]);
-        }
-      } else {
-        memcpy(data_, rhs.data_, rhs.size_ * sizeof(item_t));
+      data_ = 0;
+      size_ = capacity_ = 0;
+      copy_from(rhs);
+    }
+
+    /// Take over the contents of another array, leaving it empty. This does not copy any items.
+    dynarray(dynarray &&rhs) {
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+      capacity_ = rhs.capacity_;
+      rhs.data_ = 0;
+      rhs.size_ = rhs.capacity_ = 0;
+    }
+
+    /// Replace the contents with a copy of another array.
+    dynarray &operator=(const dynarray &rhs) {
+      if (this != &rhs) {
+        reset();
+        copy_from(rhs);
       }
+      return *this;
+    }
+
+    /// Replace the contents with those of another array, leaving it empty.
+    dynarray &operator=(dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        data_ = rhs.data_;
+        size_ = rhs.size_;
+        capacity_ = rhs.capacity_;
+        rhs.data_ = 0;
+        rhs.size_ = rhs.capacity_ = 0;
+      }
+      return *this;
     }
 
     /// Destroy the array and its contents.
@@ -136,9 +207,43 @@ namespace octet { namespace containers {
 
     /// Add an item at the back of the array.
     void push_back(const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      data_[old_length] = new_item;
+      if (size_ == capacity_) {
+        // new_item may be in this array, so copy it before we move the array.
+        item_t tmp(new_item);
+        grow();
+        construct(data_ + size_, std::move(tmp));
+      } else {
+        construct(data_ + size_, new_item);
+      }
+      size_++;
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      if (size_ == capacity_) {
+        item_t tmp(std::move(new_item));
+        grow();
+        construct(data_ + size_, std::move(tmp));
+      } else {
+        construct(data_ + size_, std::move(new_item));
+      }
+      size_++;
+    }
+
+    /// Construct an item in place at the back of the array.
+    ///
+    /// Example
+    ///
+    ///     dynarray<mesh::vertex> vertices;
+    ///     vertices.emplace_back(pos, normal, uvw);
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      if (size_ == capacity_) {
+        grow();
+      }
+      dynarray_dummy_t x;
+      item_t *item = new (data_ + size_, x) item_t(std::forward<args_t>(args)...);
+      size_++;
+      return *item;
     }
 
     /// Get the last element in the array.
@@ -223,23 +328,30 @@ namespace octet { namespace containers {
     /// Use this before you start a loop with push_back calls, for example.
     void reserve(int_size_t new_capacity) {
       if (new_capacity >= size_) {
-        dynarray_dummy_t x;
-        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
-      
-        if (use_new_delete) {
+        if (!use_new_delete || is_trivially_relocatable<item_t>::value) {
+          // the items can be moved with the bytes, so let the allocator do the work.
+          if (data_) {
+            data_ = (item_t *)allocator_t::realloc(data_, capacity_ * sizeof(item_t), sizeof(item_t) * new_capacity);
+          } else {
+            data_ = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+          }
+        } else {
+          dynarray_dummy_t x;
+          item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+
           // initialize new data_ elements from old ones
           for (int_size_t i = 0; i != size_; ++i) {
-            new (new_data + i, x) item_t(data_[i]);
+            new (new_data + i, x) item_t(std::move(data_[i]));
             data_[i].~item_t();
           }
-        }
 
-        // free up data_
-        if (data_) {
-          allocator_t::free(data_, capacity_ * sizeof(item_t));
-        }
+          // free up data_
+          if (data_) {
+            allocator_t::free(data_, capacity_ * sizeof(item_t));
+          }
 
-        data_ = new_data;
+          data_ = new_data;
+        }
         capacity_ = new_capacity;
       }
     }
@@ -267,6 +379,12 @@ namespace octet { namespace containers {
     }
   };
 
+  /// dynarrays only hold a pointer to their data, so can be moved with memcpy.
+  template <class item_t, class allocator_t, bool use_new_delete>
+  struct is_trivially_relocatable<dynarray<item_t, allocator_t, use_new_delete> > {
+    enum { value = 1 };
+  };
+
   inline void vformat(dynarray <char> &ary, const char *fmt, va_list v) {
     unsigned old_size = ary.size();
     #ifdef WIN32
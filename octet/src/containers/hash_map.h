@@ -11,16 +11,36 @@
 namespace octet { namespace containers {
 
   /// A support class for hash_map that is used to implement different kinds of key.
+  ///
+  /// Derive from this to hash your own key types; get_hash() should call fuzz_hash() or mix()
+  /// to spread the bits of the hash over the whole word.
   class hash_map_cmp {
   public:
+    /// 64 bit finalizer from MurmurHash3. Every input bit affects every output bit.
+    static uint64_t mix(uint64_t hash) {
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ULL;
+      hash ^= hash >> 33;
+      return hash;
+    }
+
     // mix in some bits from higher positions to lower positions
-    static unsigned fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
+    static unsigned fuzz_hash(unsigned hash) { return (unsigned)mix(hash); }
 
-    static unsigned get_hash(void *key) { return fuzz_hash((unsigned)(intptr_t)key); }
-    static unsigned get_hash(int key) { return fuzz_hash((unsigned)key); }
-    static unsigned get_hash(unsigned key) { return fuzz_hash((unsigned)key); }
-    static unsigned get_hash(uint64_t key) { return fuzz_hash((unsigned)(key ^ (key >> 32))); }
+    /// Pointers are mostly sequential heap addresses with zeros in the low bits, so shift out the
+    /// alignment and fold in the page bits. Consecutive pointers stay in consecutive slots, which
+    /// is kind to the cache, and page aligned pointers no longer pile up on a few slots.
+    static unsigned get_hash(void *key) {
+      uint64_t k = (uint64_t)(size_t)key;
+      return (unsigned)(k >> 4) ^ (unsigned)(k >> 12);
+    }
+    static unsigned get_hash(int key) { return (unsigned)mix((unsigned)key); }
+    static unsigned get_hash(unsigned key) { return (unsigned)mix(key); }
+    static unsigned get_hash(uint64_t key) { return (unsigned)mix(key); }
 
+    // not used by hash_map any more: keys of zero are allowed.
     static bool is_empty(void *key) { return !key; }
     static bool is_empty(int key) { return !key; }
     static bool is_empty(unsigned key) { return !key; }
@@ -42,48 +62,133 @@ namespace octet { namespace containers {
   ///     int_to_int[9] = 11;
   ///     printf("[5]=%d [9]=%d\n", int_to_int[5], int_to_int[9]);
   ///
-  ///     for (unsigned i = 0; i != int_to_int.size(); ++i) {
-  ///       printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///     for (unsigned i = 0; i != int_to_int.get_num_indices(); ++i) {
+  ///       if (int_to_int.is_used(i)) {
+  ///         printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///       }
   ///     }
+  ///
+  /// The map uses Robin Hood hashing: an entry that has travelled further from its home slot
+  /// takes the place of one that has travelled less. This keeps probe sequences short and
+  /// lets lookups of missing keys stop early, even when the table is nearly full.
+  ///
+  /// Keys and values are plain data: they are moved around with assignment and are not destroyed.
+  /// New values start as zero.
   template <typename key_t, typename value_t, class cmp_t=hash_map_cmp, class allocator_t=allocator> class hash_map {
     // internal gubbins to implement the hash map
+    // a hash of zero means the entry is empty, so hashes of zero are stored as one.
+    // The distance from the home slot is worked out from the hash, which keeps the entries small.
     struct entry_t { key_t key; unsigned hash; value_t value; };
 
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
 
-    // internal method to find an existing key in the map
-    entry_t *find( const key_t &key, unsigned hash ) {
+    // expand when num_entries reaches this.
+    unsigned max_used;
+
+    // max_used as a fraction of max_entries, out of 256
+    unsigned max_load;
+
+    enum { min_entries = 4 };
+
+    static unsigned get_stored_hash(const key_t &key) {
+      unsigned hash = cmp_t::get_hash(key);
+      return hash ? hash : 1;
+    }
+
+    // look for a key. Returns true and its slot in i if it is there, otherwise false and
+    // the slot it would go in, with its distance from its home slot in dist.
+    bool probe( const key_t &key, unsigned hash, unsigned &i, unsigned &dist ) const {
       unsigned mask = max_entries - 1;
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
-        if (cmp_t::is_empty(entry->key)) {
-          return entry;
+      i = hash & mask;
+      for (dist = 0; ; ++dist) {
+        const entry_t *entry = &entries[i];
+        // if we have travelled further than this entry, our key would have displaced it.
+        if (entry->hash == 0 || ((i - entry->hash) & mask) < dist) {
+          return false;
         }
         if (entry->hash == hash && entry->key == key) {
-          return entry;
+          return true;
         }
+        i = (i + 1) & mask;
       }
-      assert(0 && "hash_map: all entries are used. expand() did not get called");
-      return 0;
     }
-  
-    // increase the size of the map if we have run out of space
-    void expand() {
-      entry_t *old_entries = entries;
+
+    // internal method to find an existing key in the map, returns -1 if not found.
+    int find( const key_t &key, unsigned hash ) const {
+      unsigned i, dist;
+      return probe(key, hash, i, dist) ? (int)i : -1;
+    }
+
+    // add an entry whose key is not in the map at slot i, dist slots from its home (see probe).
+    // returns the index of the new entry.
+    unsigned insert( entry_t carry, unsigned i, unsigned dist ) {
+      unsigned mask = max_entries - 1;
+      unsigned result = ~0u;
+      for (; ; ++dist) {
+        entry_t *entry = &entries[i];
+        if (entry->hash == 0) {
+          *entry = carry;
+          return result == ~0u ? i : result;
+        }
+        unsigned entry_dist = (i - entry->hash) & mask;
+        if (entry_dist < dist) {
+          // rob the rich: the carried entry takes this slot and we carry on with the old one.
+          entry_t tmp = *entry;
+          *entry = carry;
+          carry = tmp;
+          dist = entry_dist;
+          if (result == ~0u) result = i;
+        }
+        i = (i + 1) & mask;
+      }
+    }
+
+    // increase the number of slots, max_entries must be a power of two.
+    // The table grows in place so that only the new slots need fresh memory.
+    void rehash(unsigned new_max_entries) {
       unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
-      max_entries *= 2;
-      for (unsigned i = 0; i != old_max_entries; ++i) {
-        entry_t *old_entry = &old_entries[i];
-        if (!cmp_t::is_empty(old_entry->key)) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+      entries = (entry_t *)allocator_t::realloc(entries, sizeof(entry_t) * old_max_entries, sizeof(entry_t) * new_max_entries);
+      memset((void*)(entries + old_max_entries), 0, sizeof(entry_t) * (new_max_entries - old_max_entries));
+      max_entries = new_max_entries;
+      max_used = (unsigned)(((uint64_t)max_entries * max_load) >> 8);
+      max_used = max_used >= max_entries ? max_entries - 1 : max_used;
+
+      // entries before the first empty slot may have wrapped around from the end of the old table.
+      // Take them out and put them back last.
+      unsigned num_wrapped = 0;
+      while (num_wrapped != old_max_entries && entries[num_wrapped].hash) {
+        num_wrapped++;
+      }
+      entry_t *wrapped = 0;
+      if (num_wrapped) {
+        wrapped = (entry_t *)allocator_t::malloc(sizeof(entry_t) * num_wrapped);
+        memcpy((void*)wrapped, (void*)entries, sizeof(entry_t) * num_wrapped);
+        memset((void*)entries, 0, sizeof(entry_t) * num_wrapped);
+      }
+
+      // the rest are in order of their home slot, so every entry lands at or before its old
+      // slot, or in the new slots, and never disturbs the entries we have not moved yet.
+      for (unsigned i = num_wrapped; i < old_max_entries; ++i) {
+        if (entries[i].hash) {
+          entry_t entry = entries[i];
+          entries[i].hash = 0;
+          insert(entry, entry.hash & (max_entries - 1), 0);
         }
       }
-      allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
+
+      for (unsigned i = 0; i != num_wrapped; ++i) {
+        insert(wrapped[i], wrapped[i].hash & (max_entries - 1), 0);
+      }
+      if (wrapped) {
+        allocator_t::free(wrapped, sizeof(entry_t) * num_wrapped);
+      }
+    }
+
+    // increase the size of the map if we have run out of space
+    void expand() {
+      rehash(max_entries * 2);
     }
 
     void release() {
@@ -94,14 +199,15 @@ namespace octet { namespace containers {
     }
 
     void init() {
+      entries = 0;
       num_entries = 0;
-      max_entries = 4;
-      entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
-      memset(entries, 0, sizeof(entry_t) * max_entries);
+      max_entries = 0;
+      rehash(min_entries);
     }
   public:
     // Create an empty map.
     hash_map() {
+      max_load = 192;
       init();
     }
 
@@ -110,39 +216,100 @@ namespace octet { namespace containers {
       release();
       init();
     }
-  
+
+    /// Make space for at least num keys without expanding.
+    void reserve(unsigned num) {
+      unsigned new_max_entries = max_entries;
+      while (((uint64_t)new_max_entries * max_load >> 8) < num + 1) {
+        new_max_entries *= 2;
+      }
+      if (new_max_entries != max_entries) {
+        rehash(new_max_entries);
+      }
+    }
+
+    /// Set the fraction of slots that can be used before the map expands (0.25 to 0.95).
+    /// Lower values make searches faster at the expense of memory.
+    void set_max_load_factor(float value) {
+      value = value < 0.25f ? 0.25f : value > 0.95f ? 0.95f : value;
+      max_load = (unsigned)(value * 256);
+      max_used = (unsigned)(((uint64_t)max_entries * max_load) >> 8);
+      if (num_entries >= max_used) {
+        reserve(num_entries);
+      }
+    }
+
+    /// Get the fraction of slots that can be used before the map expands.
+    float get_max_load_factor() const {
+      return max_load * (1.0f/256);
+    }
+
+    /// Get the fraction of slots currently in use.
+    float get_load_factor() const {
+      return (float)num_entries / max_entries;
+    }
+
     /// Access the map by key
     value_t &operator[]( const key_t &key ) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      if (cmp_t::is_empty(entry->key)) {
+      unsigned hash = get_stored_hash(key);
+      unsigned index, dist;
+      if (!probe(key, hash, index, dist)) {
         // reducing this ratio decreases hot search time at the
         // expense of size (cold search time).
-        if (num_entries >= max_entries * 3 / 4) {
+        if (num_entries >= max_used) {
           expand();
-          entry = find(key, hash);
+          probe(key, hash, index, dist);
         }
         num_entries++;
-        entry->key = key;
-        entry->hash = hash;
+        entry_t entry;
+        memset((void*)&entry, 0, sizeof(entry));
+        entry.key = key;
+        entry.hash = hash;
+        index = insert(entry, index, dist);
       }
-      return entry->value;
+      return entries[index].value;
     }
 
     /// Does the map have this key?
-    bool contains(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return !cmp_t::is_empty(entry->key);
+    bool contains(const key_t &key) const {
+      unsigned hash = get_stored_hash(key);
+      return find( key, hash ) >= 0;
+    }
+
+    /// Remove a key from the map. Returns false if the key was not present.
+    bool erase(const key_t &key) {
+      unsigned hash = get_stored_hash(key);
+      int index = find( key, hash );
+      if (index < 0) {
+        return false;
+      }
+
+      // shift the following entries back one slot until we reach one that is at home.
+      unsigned mask = max_entries - 1;
+      unsigned i = (unsigned)index;
+      for (;;) {
+        unsigned next = (i + 1) & mask;
+        if (entries[next].hash == 0 || ((next - entries[next].hash) & mask) == 0) break;
+        entries[i] = entries[next];
+        i = next;
+      }
+      memset((void*)&entries[i], 0, sizeof(entry_t));
+      num_entries--;
+      return true;
     }
 
-    /// Get an integer that represents the position in the map of this key.
+    /// Get an integer that represents the position in the map of this key, or -1 if the key is not present.
     ///
     /// Note: only valid if the map does not change size.
-    int get_index(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return entry ? (int)(entry - entries) : -1;
+    int get_index(const key_t &key) const {
+      unsigned hash = get_stored_hash(key);
+      return find( key, hash );
+    }
+
+    /// When iterating, is there a key at this index?
+    bool is_used(int index) const {
+      assert((unsigned)index < max_entries);
+      return entries[index].hash != 0;
     }
 
     /// For a specfic index, get the key.
@@ -159,6 +326,12 @@ namespace octet { namespace containers {
       return entries[index].value;
     }
 
+    /// For a specific index, access the value
+    value_t &get_value(int index) {
+      assert((unsigned)index < max_entries);
+      return entries[index].value;
+    }
+
     /// bye bye hash map
     ~hash_map() {
       allocator_t::free(entries, sizeof(entry_t) * max_entries);
@@ -167,11 +340,15 @@ namespace octet { namespace containers {
       max_entries = 0;
     }
 
-    /// Get the maximum number of keys and values in the map.
-    ///
-    /// Used for iteration.
-    unsigned size() { return max_entries; }
-    
+    /// Get the number of keys in the map.
+    unsigned get_size() const { return num_entries; }
+
+    /// Get the number of slots in the map. Used for iteration with is_used().
+    unsigned get_num_indices() const { return max_entries; }
+
+    /// Get the number of slots in the map. Deprecated: use get_num_indices()
+    unsigned size() const { return max_entries; }
+
     //key_t key(unsigned i) { return entries[i].key; }
     //value_t value(unsigned i) { return entries[i].value; }
   };
@@ -90,4 +90,9 @@ namespace octet { namespace containers {
       item = 0;
     }
   };
+
+  /// refs are just pointers and can be moved with memcpy.
+  template <class item_t, class allocator_t> struct is_trivially_relocatable<ref<item_t, allocator_t> > {
+    enum { value = 1 };
+  };
 } }
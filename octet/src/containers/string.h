@@ -24,12 +24,33 @@ namespace octet { namespace containers {
   class string {
     char *data_;
 
+    // bytes allocated for data_, zero for null_string().
+    // The text may hold a zero byte written with operator[], so strlen does not give the size to free.
+    unsigned capacity_;
+
     static char *null_string() { static char c; return &c; }
 
     void release() {
       if (data_ != null_string()) {
-        allocator::free((void*)data_, size() + 1);
+        allocator::free((void*)data_, capacity_);
         data_ = null_string();
+        capacity_ = 0;
+      }
+    }
+
+    // replace a released string with a new block.
+    void alloc(size_t bytes) {
+      data_ = (char*)allocator::malloc(bytes);
+      capacity_ = (unsigned)bytes;
+    }
+
+    // resize the block, keeping its contents.
+    void resize_block(size_t bytes) {
+      if (data_ == null_string()) {
+        alloc(bytes);
+      } else {
+        data_ = (char*)allocator::realloc((void*)data_, capacity_, bytes);
+        capacity_ = (unsigned)bytes;
       }
     }
 
@@ -145,19 +166,19 @@ namespace octet { namespace containers {
     }
   public:
     /// Default constructor: empty string.
-    string() { data_ = null_string(); }
+    string() { data_ = null_string(); capacity_ = 0; }
 
     /// Copy a UTF8 C string
-    string(const char *value) { data_ = null_string(); *this = value; }
+    string(const char *value) { data_ = null_string(); capacity_ = 0; *this = value; }
     
     /// Copy of a UFT16 C string
-    string(const wchar_t *value) { data_ = null_string(); *this = value; }
+    string(const wchar_t *value) { data_ = null_string(); capacity_ = 0; *this = value; }
     
     /// Copy of another string
-    string(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); }
+    string(const string& rhs) { data_ = null_string(); capacity_ = 0; *this = rhs.c_str(); }
     
     /// Copy of a substring
-    string(const char *value, unsigned size) { data_ = null_string(); set(value, size); }
+    string(const char *value, unsigned size) { data_ = null_string(); capacity_ = 0; set(value, size); }
 
     /// Free up memory used by the string.
     ~string() { release(); }
@@ -190,13 +211,8 @@ namespace octet { namespace containers {
         size_t cur_len = strlen(data_);
         int len = _vscprintf(fmt, v);
         if (len) {
-          if (cur_len) {
-            data_ = (char*)allocator::realloc(data_, cur_len+1, cur_len + len + 1);
-            vsprintf_s(data_ + cur_len, len+1, fmt, v);
-          } else {
-            data_ = (char*)allocator::malloc(len+1);
-            vsprintf_s(data_, len+1, fmt, v);
-          }
+          resize_block(cur_len + len + 1);
+          vsprintf_s(data_ + cur_len, len+1, fmt, v);
         }
       #else
         char tmp[1024];
@@ -211,7 +227,7 @@ namespace octet { namespace containers {
       if (value) {
         unsigned size = urldecode_impl(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
+          alloc(size+1);
           urldecode_impl(data_, value);
         }
       }
@@ -224,7 +240,7 @@ namespace octet { namespace containers {
       if (value) {
         unsigned size = urlencode_impl(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
+          alloc(size+1);
           urlencode_impl(data_, value);
         }
       }
@@ -237,7 +253,7 @@ namespace octet { namespace containers {
       if (value) {
         size_t size = strlen(value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
+          alloc(size+1);
           memcpy((char*)data_, value, size+1);
         }
       }
@@ -250,7 +266,7 @@ namespace octet { namespace containers {
       if (value) {
         unsigned size = utf16_to_utf8(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
+          alloc(size+1);
           utf16_to_utf8(data_, value);
         }
       }
@@ -258,14 +274,14 @@ namespace octet { namespace containers {
     }
 
     /// copy another string
-    string &operator=(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); return *this; }
+    string &operator=(const string& rhs) { if (&rhs != this) *this = rhs.c_str(); return *this; }
 
     /// copy a substring
     string &set(const char *value, unsigned size) {
       release();
       if (value) {
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
+          alloc(size+1);
           memcpy((char*)data_, value, size);
           data_[size] = 0;
         }
@@ -277,11 +293,7 @@ namespace octet { namespace containers {
     string &truncate(int new_len) {
       int size = (int)strlen(data_);
       if (new_len < size) {
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(new_len+1);
-        } else {
-          data_ = (char*)allocator::realloc((void*)data_, size+1, new_len+1);
-        }
+        resize_block(new_len+1);
         data_[new_len] = 0;
       }
       return *this;
@@ -301,11 +313,7 @@ namespace octet { namespace containers {
       if (rhs) {
         size_t data_size = strlen(data_);
         size_t rhs_size = strlen(rhs);
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(data_size+rhs_size+1);
-        } else {
-          data_ = (char*)allocator::realloc(data_, data_size + 1, data_size+rhs_size+1);
-        }
+        resize_block(data_size+rhs_size+1);
         memcpy(data_ + data_size, rhs, rhs_size+1);
       }
       return *this;
@@ -322,6 +330,7 @@ namespace octet { namespace containers {
         memcpy(new_data + pos + rhs_size, data_, data_size - pos + 1);
         release();
         data_ = new_data;
+        capacity_ = (unsigned)(data_size+rhs_size+1);
       }
       return *this;
     }
@@ -408,4 +417,9 @@ namespace octet { namespace containers {
       return size() == 0;
     }
   };
+
+  /// strings only hold a pointer to their text and its size, so can be moved with memcpy.
+  template <> struct is_trivially_relocatable<string> {
+    enum { value = 1 };
+  };
 } }
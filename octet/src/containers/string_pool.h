@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// string keys with precomputed hashes and a pool to keep their text in.
+//
+// example:
+//
+//   string_key key("duck");
+//   int index = my_dict.get_index(key); // no need to hash "duck" again
+//
+
+namespace octet { namespace containers {
+  /// A string together with its length and hash.
+  ///
+  /// Make one of these once and use it for many dictionary lookups to avoid hashing the string each time.
+  /// Keys from string_table::intern() are also unique: dictionaries can compare them by pointer.
+  class string_key {
+    const char *text_;
+    unsigned hash_;
+    unsigned length_ : 31;
+    unsigned interned_ : 1;
+
+    static uint64_t rotl(uint64_t x, unsigned r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t load8(const char *src) { uint64_t x; memcpy(&x, src, 8); return x; }
+    static uint32_t load4(const char *src) { uint32_t x; memcpy(&x, src, 4); return x; }
+  public:
+    /// Hash length bytes of text, eight bytes at a time.
+    ///
+    /// This follows the shape of xxHash64: multiply, rotate and a final avalanche
+    /// so that similar names ("bone1", "bone2") land in different slots.
+    static unsigned calc_hash(const char *text, size_t length) {
+      const uint64_t p1 = 0x9e3779b185ebca87ULL;
+      const uint64_t p2 = 0xc2b2ae3d27d4eb4fULL;
+      const uint64_t p3 = 0x165667b19e3779f9ULL;
+      uint64_t hash = p3 + length * p1;
+      const char *src = text, *end = text + length;
+      for (; src + 8 <= end; src += 8) {
+        hash ^= rotl(load8(src) * p2, 31) * p1;
+        hash = rotl(hash, 27) * p1 + p3;
+      }
+      if (src + 4 <= end) {
+        hash ^= load4(src) * p1;
+        hash = rotl(hash, 23) * p2 + p3;
+        src += 4;
+      }
+      for (; src != end; ++src) {
+        hash ^= (uint8_t)*src * p3;
+        hash = rotl(hash, 11) * p1;
+      }
+      hash ^= hash >> 33;
+      hash *= p2;
+      hash ^= hash >> 29;
+      hash *= p3;
+      hash ^= hash >> 32;
+      return (unsigned)hash;
+    }
+
+    /// empty key
+    string_key() : text_(""), hash_(calc_hash("", 0)), length_(0), interned_(0) {
+    }
+
+    /// Make a key for a zero terminated string. The text is not copied and must outlive the key.
+    explicit string_key(const char *text) {
+      text_ = text;
+      size_t length = strlen(text);
+      length_ = (unsigned)length;
+      hash_ = calc_hash(text, length);
+      interned_ = 0;
+    }
+
+    /// Make a key for length bytes of text. The text is not copied and must outlive the key.
+    string_key(const char *text, unsigned length) {
+      text_ = text;
+      length_ = length;
+      hash_ = calc_hash(text, length);
+      interned_ = 0;
+    }
+
+    /// Make a key with a known hash. Used by string_table.
+    string_key(const char *text, unsigned length, unsigned hash, bool interned) {
+      text_ = text;
+      length_ = length;
+      hash_ = hash;
+      interned_ = interned;
+    }
+
+    /// the text of the key (may not be zero terminated if made from a length)
+    const char *get_text() const { return text_; }
+
+    /// the number of bytes in the key
+    unsigned get_length() const { return length_; }
+
+    /// the precomputed hash
+    unsigned get_hash() const { return hash_; }
+
+    /// true if this key came from string_table::intern() and will live forever
+    bool is_interned() const { return interned_ != 0; }
+  };
+
+  /// Storage for many short strings in a few large blocks.
+  ///
+  /// Strings are never freed individually, only all at once with reset().
+  /// This avoids a heap allocation and free for every key in a dictionary.
+  template <class allocator_t=allocator> class string_pool {
+    struct block_t {
+      block_t *next;
+      unsigned size;
+      unsigned used;
+      char *data() { return (char*)(this + 1); }
+    };
+
+    block_t *blocks;
+    unsigned num_bytes;
+
+    enum { min_block_bytes = 256, max_block_bytes = 0x10000 };
+
+    // start a new block big enough for bytes, blocks double in size as the pool grows.
+    void add_block(unsigned bytes) {
+      unsigned total = blocks ? (unsigned)(blocks->size + sizeof(block_t)) * 2 : (unsigned)min_block_bytes;
+      total = total > max_block_bytes ? (unsigned)max_block_bytes : total;
+      unsigned size = total - (unsigned)sizeof(block_t);
+      size = size < bytes ? bytes : size;
+      block_t *b = (block_t*)allocator_t::malloc(sizeof(block_t) + size);
+      b->next = blocks;
+      b->size = size;
+      b->used = 0;
+      blocks = b;
+    }
+
+    // non-copyable
+    string_pool(const string_pool &);
+    string_pool &operator=(const string_pool &);
+  public:
+    /// make an empty pool, no memory is allocated until the first string is added.
+    string_pool() {
+      blocks = 0;
+      num_bytes = 0;
+    }
+
+    /// Copy length bytes of text into the pool and add a zero terminator.
+    const char *add(const char *text, unsigned length) {
+      unsigned bytes = length + 1;
+      if (!blocks || blocks->used + bytes > blocks->size) {
+        add_block(bytes);
+      }
+      char *dest = blocks->data() + blocks->used;
+      memcpy(dest, text, length);
+      dest[length] = 0;
+      blocks->used += bytes;
+      num_bytes += bytes;
+      return dest;
+    }
+
+    /// number of bytes of text stored in the pool
+    unsigned get_num_bytes() const {
+      return num_bytes;
+    }
+
+    /// Free all the strings in the pool.
+    void reset() {
+      while (blocks) {
+        block_t *next = blocks->next;
+        allocator_t::free(blocks, sizeof(block_t) + blocks->size);
+        blocks = next;
+      }
+      num_bytes = 0;
+    }
+
+    /// bye bye pool
+    ~string_pool() {
+      reset();
+    }
+  };
+} }
@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// interned strings: one copy of each name for the whole program.
+//
+// example:
+//
+//   static string_key duck = string_table::global().intern("duck");
+//   mesh *m = dict.get_mesh(duck); // no hashing, no string compare
+//
+
+namespace octet { namespace containers {
+  /// A table of unique strings.
+  ///
+  /// intern() returns the same pointer for the same text every time, so dictionaries can
+  /// compare interned keys by pointer and store them without copying.
+  ///
+  /// The strings live until the table is destroyed, so only intern names that
+  /// stay in use (resource names, atoms, file names), not temporary text.
+  ///
+  /// Not thread safe: intern strings from the main thread.
+  class string_table {
+    struct empty_t {};
+    dictionary<empty_t> dict;
+  public:
+    /// Get the unique copy of a zero terminated string.
+    string_key intern(const char *text) {
+      return intern(string_key(text));
+    }
+
+    /// Get the unique copy of a key, adding it to the table if it is new.
+    string_key intern(const string_key &key) {
+      if (key.is_interned()) return key;
+      int index = dict.get_index(key);
+      if (index < 0) {
+        dict[key];
+        index = dict.get_index(key);
+      }
+      return string_key(dict.get_key(index), key.get_length(), key.get_hash(), true);
+    }
+
+    /// Get the unique copy of a string if it has been interned, otherwise return an ordinary key.
+    /// Unlike intern(), this never adds to the table.
+    string_key find(const char *text) {
+      string_key key(text);
+      int index = dict.get_index(key);
+      return index < 0 ? key : string_key(dict.get_key(index), key.get_length(), key.get_hash(), true);
+    }
+
+    /// number of unique strings in the table
+    unsigned get_size() const {
+      return dict.get_size();
+    }
+
+    /// The string table shared by the whole program.
+    static string_table &global() {
+      static string_table instance;
+      return instance;
+    }
+  };
+} }
@@ -0,0 +1,185 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// animation: a crowd of characters evaluated one channel at a time with eval_chan,
+// all channels at once with key cursors and all characters on many threads.
+// Also checks that saves keep the old layout of the animation data.
+//
+
+namespace octet {
+  class animation_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    struct character {
+      ref<scene_node> root;
+      dynarray<scene_node*> bones;
+      ref<animation_instance> inst;
+    };
+
+    // a chain of bones with a transform channel each, as a collada file has.
+    static void make_character(character &c, unsigned num_bones, unsigned num_keys) {
+      c.root = new scene_node();
+      animation *anim = new animation();
+      dynarray<float> times(num_keys), values(num_keys * 16);
+      for (unsigned k = 0; k != num_keys; ++k) {
+        times[k] = k * (1.0f / 30);
+      }
+
+      scene_node *node = c.root;
+      for (unsigned b = 0; b != num_bones; ++b) {
+        node = new scene_node(node);
+        c.bones.push_back(node);
+        for (unsigned i = 0; i != values.size(); ++i) {
+          values[i] = get_random();
+        }
+        anim->add_channel(node, atom_node, atom_transform, atom_node, times, values);
+      }
+      c.inst = new animation_instance(anim, NULL, true);
+    }
+
+    static void copy_bones(dynarray<mat4t> &result, dynarray<character> &chars) {
+      result.resize(0);
+      for (unsigned i = 0; i != chars.size(); ++i) {
+        for (unsigned b = 0; b != chars[i].bones.size(); ++b) {
+          result.push_back(chars[i].bones[b]->get_nodeToParent());
+        }
+      }
+    }
+
+    static void crowd_test(unsigned num_chars, unsigned num_bones, unsigned num_frames) {
+      char label[80];
+      float delta_time = 1.0f / 60;
+      dynarray<mat4t> by_channel, batched, parallel;
+
+      // one crowd for each test, so that every test starts at time 0.
+      dynarray<character> chars(num_chars);
+      for (unsigned i = 0; i != num_chars; ++i) {
+        make_character(chars[i], num_bones, 60);
+      }
+
+      example_benchmark::timer t;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned i = 0; i != num_chars; ++i) {
+          animation_instance *inst = chars[i].inst;
+          const animation *anim = inst->get_anim();
+          for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
+            anim->eval_chan(ch, inst->get_time(), anim->get_target(ch));
+          }
+          inst->advance(delta_time);
+        }
+      }
+      sprintf(label, "%u characters x %u frames eval_chan", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+      copy_bones(by_channel, chars);
+
+      for (unsigned i = 0; i != num_chars; ++i) {
+        chars[i].inst = new animation_instance((animation*)chars[i].inst->get_anim(), NULL, true);
+      }
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned i = 0; i != num_chars; ++i) {
+          animation_instance *inst = chars[i].inst;
+          inst->eval();
+          inst->mark_moved();
+          inst->advance(delta_time);
+        }
+      }
+      sprintf(label, "%u characters x %u frames all channels", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+      copy_bones(batched, chars);
+
+      // the way visual_scene::update_animations does it.
+      for (unsigned i = 0; i != num_chars; ++i) {
+        chars[i].inst = new animation_instance((animation*)chars[i].inst->get_anim(), NULL, true);
+      }
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        job_scheduler::get().parallel_for(0, num_chars, [&](unsigned i) {
+          chars[i].inst->eval();
+        }, 4);
+        for (unsigned i = 0; i != num_chars; ++i) {
+          chars[i].inst->mark_moved();
+          chars[i].inst->advance(delta_time);
+        }
+      }
+      sprintf(label, "%u characters x %u frames parallel", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+      copy_bones(parallel, chars);
+
+      bool same =
+        by_channel.size() == batched.size() &&
+        !memcmp(by_channel.data(), batched.data(), by_channel.size() * sizeof(mat4t)) &&
+        !memcmp(batched.data(), parallel.data(), batched.size() * sizeof(mat4t))
+      ;
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // save and load an animation with an odd number of keys, so that its times need padding.
+    // The saved data must be the times then the values, as older versions of octet wrote it.
+    static void save_test() {
+      enum { num_keys = 7 };
+      dynarray<float> times(num_keys), values(num_keys * 16);
+      for (unsigned k = 0; k != num_keys; ++k) {
+        times[k] = k * (1.0f / 30);
+      }
+      for (unsigned i = 0; i != values.size(); ++i) {
+        values[i] = get_random();
+      }
+      ref<animation> anim = new animation();
+      anim->add_channel(NULL, atom_node, atom_transform, atom_node, times, values);
+
+      dynarray<unsigned char> old_layout(num_keys * (sizeof(unsigned short) + 16 * sizeof(float)));
+      for (unsigned k = 0; k != num_keys; ++k) {
+        unsigned short key_ms = (unsigned short)(times[k] * 1000);
+        memcpy(&old_layout[k * sizeof(unsigned short)], &key_ms, sizeof(key_ms));
+      }
+      memcpy(&old_layout[num_keys * sizeof(unsigned short)], values.data(), values.size() * sizeof(float));
+
+      FILE *file = tmpfile();
+      {
+        binary_writer writer(file);
+        anim->visit(writer);
+      }
+      dynarray<unsigned char> saved((unsigned)ftell(file));
+      rewind(file);
+      fread(saved.data(), 1, saved.size(), file);
+
+      bool found = false;
+      for (unsigned i = 0; i + old_layout.size() <= saved.size() && !found; ++i) {
+        found = !memcmp(&saved[i], old_layout.data(), old_layout.size());
+      }
+
+      ref<animation> loaded = new animation();
+      rewind(file);
+      {
+        binary_reader reader(file);
+        loaded->visit(reader);
+      }
+      fclose(file);
+
+      bool same = true;
+      ref<scene_node> a = new scene_node(), b = new scene_node();
+      for (unsigned f = 0; f != 13; ++f) {
+        anim->eval_chan(0, f * (1.0f / 60), a);
+        loaded->eval_chan(0, f * (1.0f / 60), b);
+        same = same && !memcmp(&a->get_nodeToParent(), &b->get_nodeToParent(), sizeof(mat4t));
+      }
+      printf("  save %s, load %s\n", found ? "in the old layout" : "(LAYOUT CHANGED)", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      crowd_test(100, 40, 300);
+      crowd_test(1000, 40, 100);
+      save_test();
+    }
+  };
+}
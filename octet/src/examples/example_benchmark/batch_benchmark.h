@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// batch: points, matrix hierarchies and view tests one at a time against the math::batch
+// kernels in each version the CPU can run, which must give exactly the same results.
+//
+
+namespace octet {
+  class batch_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    static mat4t random_matrix() {
+      mat4t result;
+      result.loadIdentity();
+      result.rotateX(get_random() * 180);
+      result.rotateY(get_random() * 180);
+      result.scale(get_random() * 0.5f + 1, get_random() * 0.5f + 1, get_random() * 0.5f + 1);
+      result.translate(get_random() * 10, get_random() * 10, get_random() * 10);
+      return result;
+    }
+
+    // time the one at a time code, then the kernel at each level; each must match the first exactly.
+    template <class operators_fn, class kernel_fn, class same_fn>
+    static void compare(const char *name, unsigned count, unsigned num_loops, operators_fn run_operators, kernel_fn run_kernel, same_fn is_same) {
+      char label[80];
+      example_benchmark::timer t;
+      for (unsigned l = 0; l != num_loops; ++l) {
+        run_operators();
+      }
+      sprintf(label, "%u %s one at a time", count, name);
+      example_benchmark::report(label, t.get_seconds());
+
+      simd::level_t best = simd::get_best_level();
+      bool same = true;
+      for (unsigned level = 0; level <= (unsigned)best; ++level) {
+        simd::set_level((simd::level_t)level);
+        t.reset();
+        for (unsigned l = 0; l != num_loops; ++l) {
+          run_kernel();
+        }
+        sprintf(label, "%u %s %s", count, name, simd::get_level_name((simd::level_t)level));
+        example_benchmark::report(label, t.get_seconds());
+        same = same && is_same();
+      }
+      simd::set_level(best);
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    static void points_test(unsigned count, unsigned num_loops) {
+      dynarray<vec3p> points(count), expected(count), result(count);
+      for (unsigned i = 0; i != count; ++i) {
+        points[i] = vec3p(get_random() * 100, get_random() * 100, get_random() * 100);
+      }
+      mat4t m = random_matrix();
+
+      compare("points", count, num_loops,
+        [&]() { for (unsigned i = 0; i != count; ++i) expected[i] = (vec3)points[i] * m; },
+        [&]() { batch::transform_points(result.data(), points.data(), m, count); },
+        [&]() { return !memcmp(expected.data(), result.data(), count * sizeof(vec3p)); }
+      );
+    }
+
+    // a binary tree of nodes, as skeleton::calc_palette and scene hierarchies make them.
+    static void parents_test(unsigned count, unsigned num_loops) {
+      dynarray<mat4t> local(count), expected(count), result(count);
+      dynarray<int> parents(count);
+      for (unsigned i = 0; i != count; ++i) {
+        local[i] = random_matrix();
+        local[i].scale(0.5f, 0.5f, 0.5f);
+        parents[i] = i ? (int)(i - 1) / 2 : -1;
+      }
+      mat4t root = random_matrix();
+
+      compare("parents", count, num_loops,
+        [&]() { for (unsigned i = 0; i != count; ++i) expected[i] = local[i] * (parents[i] == -1 ? root : expected[parents[i]]); },
+        [&]() { batch::multiply_parents(result.data(), local.data(), parents.data(), root, count); },
+        [&]() { return !memcmp(expected.data(), result.data(), count * sizeof(mat4t)); }
+      );
+    }
+
+    // a camera in the middle of the boxes and spheres, so that about a quarter of them are in view.
+    static void frustum_test(unsigned count, unsigned num_loops) {
+      mat4t cameraToWorld;
+      cameraToWorld.loadIdentity();
+      cameraToWorld.rotateY(30);
+      mat4t cameraToProjection;
+      cameraToProjection.loadIdentity();
+      cameraToProjection.frustum(-0.5f, 0.5f, -0.5f, 0.5f, 1, 200);
+      frustum view(cameraToWorld.inverse3x4() * cameraToProjection);
+
+      dynarray<aabb> boxes(count);
+      dynarray<sphere> spheres(count);
+      for (unsigned i = 0; i != count; ++i) {
+        vec3 center(get_random() * 100, get_random() * 100, get_random() * 100);
+        boxes[i] = aabb(center, vec3(get_random() + 1, get_random() + 1, get_random() + 1));
+        spheres[i] = sphere(center, get_random() + 1);
+      }
+
+      dynarray<uint8_t> expected(count), result(count);
+      unsigned num_visible = 0;
+      compare("frustum aabbs", count, num_loops,
+        [&]() { for (unsigned i = 0; i != count; ++i) expected[i] = view.intersects(boxes[i]); },
+        [&]() { num_visible = batch::intersects(result.data(), view, boxes.data(), count); },
+        [&]() { return !memcmp(expected.data(), result.data(), count); }
+      );
+      printf("  %u visible\n", num_visible);
+
+      compare("frustum spheres", count, num_loops,
+        [&]() { for (unsigned i = 0; i != count; ++i) expected[i] = view.intersects(spheres[i]); },
+        [&]() { num_visible = batch::intersects(result.data(), view, spheres.data(), count); },
+        [&]() { return !memcmp(expected.data(), result.data(), count); }
+      );
+      printf("  %u visible\n", num_visible);
+    }
+
+  public:
+    static void run() {
+      printf("  best: %s\n", simd::get_level_name(simd::get_best_level()));
+      // odd sizes, so that the kernels finish with a few one at a time.
+      points_test(100003, 100);
+      parents_test(10003, 100);
+      frustum_test(100003, 100);
+    }
+  };
+}
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// frustum: culling boxes one plane at a time, four planes at a time and with an aabb_bvh,
+// as visual_scene::render does for mesh instances.
+// visual_scene: meshes built by hand without a box must still be drawn.
+//
+
+namespace octet {
+  class cull_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    // boxes scattered over a large world with a camera in the middle looking down -z.
+    static void view_test(unsigned num_boxes, unsigned num_frames) {
+      char label[80];
+      dynarray<aabb> boxes(num_boxes);
+      aabb_bvh tree;
+      tree.resize(num_boxes);
+      for (unsigned i = 0; i != num_boxes; ++i) {
+        vec3 center = vec3(get_random(), get_random() * 0.1f, get_random()) * 1000.0f;
+        vec3 half = vec3(get_random(), get_random(), get_random()) * 2.0f + vec3(3.0f);
+        boxes[i] = aabb(center, half);
+        tree.set_box(i, center - half, center + half);
+      }
+      tree.build(2);
+
+      mat4t cameraToProjection;
+      cameraToProjection.loadIdentity();
+      cameraToProjection.frustum(-0.1f, 0.1f, -0.1f, 0.1f, 0.1f, 500.0f);
+
+      dynarray<uint8_t> planes(num_boxes), simd(num_boxes), bvh(num_boxes);
+      unsigned num_visible = 0;
+      double planes_time = 0, simd_time = 0, bvh_time = 0;
+      bool same = true;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        // turn the camera a little each frame.
+        mat4t cameraToWorld;
+        cameraToWorld.loadIdentity();
+        cameraToWorld.rotateY(f * 360.0f / num_frames);
+        frustum view(cameraToWorld.inverse3x4() * cameraToProjection);
+
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num_boxes; ++i) {
+          bool in_view = true;
+          for (unsigned p = 0; p != frustum::num_planes; ++p) {
+            in_view = in_view && view.get_plane(p).intersects(boxes[i]);
+          }
+          planes[i] = in_view;
+        }
+        planes_time += t.get_seconds();
+
+        t.reset();
+        for (unsigned i = 0; i != num_boxes; ++i) {
+          simd[i] = view.intersects(boxes[i]);
+        }
+        simd_time += t.get_seconds();
+
+        t.reset();
+        memset(bvh.data(), 0, num_boxes);
+        tree.frustum_query(view, [&](unsigned first, unsigned count, bool is_inside) {
+          for (unsigned i = first; i != first + count; ++i) {
+            unsigned box = tree.get_leaf_box(i);
+            bvh[box] = is_inside || view.intersects(boxes[box]);
+          }
+        });
+        bvh_time += t.get_seconds();
+
+        for (unsigned i = 0; i != num_boxes; ++i) {
+          num_visible += simd[i];
+          // boxes that only touch the view may differ by a rounding error, so only check the clear cases.
+          if (planes[i] != simd[i] && view.intersects(boxes[i].get_center(), boxes[i].get_half_extent() * 0.999f) == view.intersects(boxes[i].get_center(), boxes[i].get_half_extent() * 1.001f)) {
+            same = false;
+          }
+        }
+        same = same && !memcmp(simd.data(), bvh.data(), num_boxes);
+      }
+
+      sprintf(label, "%u boxes x %u one plane at a time", num_boxes, num_frames);
+      example_benchmark::report(label, planes_time);
+      sprintf(label, "%u boxes x %u four planes at a time", num_boxes, num_frames);
+      example_benchmark::report(label, simd_time);
+      sprintf(label, "%u boxes x %u bvh", num_boxes, num_frames);
+      example_benchmark::report(label, bvh_time);
+      printf("  %.1f%% visible, %s\n", num_visible * 100.0 / num_boxes / num_frames, OCTET_SSE2 ? "sse2" : "default");
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // a hand-built mesh with no box and its origin out of view, which must be drawn,
+    // and a mesh with a box out of view, which must be culled, with and without the instance tree.
+    static void hand_built_test() {
+      ref<visual_scene> scene = new visual_scene();
+
+      ref<mesh> hand_built = new mesh();
+      hand_built->add_attribute(attribute_pos, 3, GL_FLOAT, 0);
+      hand_built->set_params(sizeof(vec3p), 0, 0, GL_TRIANGLES, GL_UNSIGNED_INT);
+      scene_node *node = scene->add_scene_node();
+      node->translate(vec3(1000, 0, 0));
+      scene->add_mesh_instance(new mesh_instance(node, hand_built));
+
+      ref<mesh> boxed = new mesh();
+      boxed->set_aabb(aabb(vec3(0, 0, 0), vec3(1, 1, 1)));
+      node = scene->add_scene_node();
+      node->translate(vec3(-1000, 0, 0));
+      scene->add_mesh_instance(new mesh_instance(node, boxed));
+
+      // a camera at the origin looking down -z, which sees neither instance.
+      ref<camera_instance> cam = new camera_instance();
+      cam->set_node(scene->add_scene_node());
+      cam->set_perspective(0, 45, 1, 0.1f, 100.0f);
+
+      bool same = true;
+      for (unsigned use_cull_bvh = 0; use_cull_bvh != 2; ++use_cull_bvh) {
+        scene->set_use_cull_bvh(use_cull_bvh != 0);
+        scene->cull(*cam, 1.0f);
+        same = same && scene->get_num_drawn() == 1 && scene->get_num_culled() == 1;
+      }
+      printf("  hand-built mesh %s\n", same ? "drawn, boxed mesh culled (results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      view_test(10000, 36);
+      view_test(100000, 36);
+      hand_built_test();
+    }
+  };
+}
@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// dictionary against the old one that copied every key to the heap,
+// using names like the ones collada files and zip directories are full of.
+// Also checks that strings with zero bytes in them go back to the right allocator pool.
+//
+
+namespace octet {
+  class dictionary_benchmark {
+    // the dictionary from before string_pool and string_key, kept here for comparison.
+    template <class value_t> class legacy_dictionary {
+      struct entry_t { const char *key; unsigned hash; value_t value; };
+      entry_t *entries;
+      unsigned num_entries;
+      unsigned max_entries;
+
+      unsigned calc_hash( const char *key ) {
+        unsigned hash = 0;
+        for (int i = 0; key[i]; ++i) {
+          hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
+        }
+        return hash;
+      }
+
+      entry_t *find( const char *key, unsigned hash ) {
+        unsigned mask = max_entries - 1;
+        for (unsigned i = 0; i != max_entries; ++i) {
+          entry_t *entry = &entries[ ( i + hash ) & mask ];
+          if (!entry->key) {
+            return entry;
+          }
+          if (entry->hash == hash && !strcmp(entry->key, key)) {
+            return entry;
+          }
+        }
+        return 0;
+      }
+
+      void expand() {
+        entry_t *old_entries = entries;
+        unsigned old_max_entries = max_entries;
+        entries = (entry_t *)allocator::malloc(sizeof(entry_t) * max_entries*2);
+        memset(entries, 0, sizeof(entry_t) * max_entries*2);
+        max_entries *= 2;
+        for (unsigned i = 0; i != old_max_entries; ++i) {
+          entry_t *old_entry = &old_entries[i];
+          if (old_entry->key) {
+            entry_t *new_entry = find(old_entry->key, old_entry->hash);
+            *new_entry = *old_entry;
+          }
+        }
+        allocator::free(old_entries, sizeof(entry_t) * old_max_entries);
+      }
+
+    public:
+      legacy_dictionary() {
+        num_entries = 0;
+        max_entries = 4;
+        entries = (entry_t*)allocator::malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+      }
+
+      ~legacy_dictionary() {
+        for (unsigned i = 0; i != max_entries; ++i) {
+          if (entries[i].key) allocator::free((void*)entries[i].key, strlen(entries[i].key)+1);
+        }
+        allocator::free(entries, sizeof(entry_t) * max_entries);
+      }
+
+      value_t &operator[]( const char *key ) {
+        unsigned hash = calc_hash( key );
+        entry_t *entry = find( key, hash );
+        if (!entry || !entry->key) {
+          if (num_entries > max_entries * 3 / 4) {
+            expand();
+            entry = find(key, hash);
+          }
+          num_entries++;
+          size_t bytes = strlen(key) + 1;
+          entry->key = (char *)allocator::malloc(bytes);
+          entry->hash = hash;
+          memcpy((void*)entry->key, key, bytes);
+        }
+        return entry->value;
+      }
+
+      int get_index(const char *key) {
+        unsigned hash = calc_hash( key );
+        entry_t *entry = find( key, hash );
+        return entry && entry->key ? (int)(entry - entries) : -1;
+      }
+
+      value_t &get_value(unsigned index) {
+        return entries[index].value;
+      }
+    };
+
+    // make num names like "ID1234-lib-geom" or "textures/level3/wall_1234.jpg"
+    static void make_names(dynarray<string> &names, unsigned num, const char *fmt) {
+      names.resize(num);
+      for (unsigned i = 0; i != num; ++i) {
+        names[i].format(fmt, i);
+      }
+    }
+
+    static void names_test(unsigned num, const char *fmt, unsigned passes) {
+      dynarray<string> names;
+      make_names(names, num, fmt);
+
+      dynarray<string_key> keys(num);
+      dynarray<string_key> interned(num);
+      for (unsigned i = 0; i != num; ++i) {
+        keys[i] = string_key(names[i].c_str());
+      }
+
+      char label[80];
+      unsigned legacy_sum = 0, sum = 0, key_sum = 0, interned_sum = 0;
+      {
+        legacy_dictionary<unsigned> dict;
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num; ++i) dict[names[i]] = i;
+        sprintf(label, "%u x %s insert legacy", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+        t.reset();
+        for (unsigned p = 0; p != passes; ++p) {
+          for (unsigned i = 0; i != num; ++i) legacy_sum += dict.get_value(dict.get_index(names[i]));
+        }
+        sprintf(label, "%u x %s lookup legacy", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        dictionary<unsigned> dict;
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num; ++i) dict[names[i]] = i;
+        sprintf(label, "%u x %s insert", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+        t.reset();
+        for (unsigned p = 0; p != passes; ++p) {
+          for (unsigned i = 0; i != num; ++i) sum += dict.get_value(dict.get_index(names[i]));
+        }
+        sprintf(label, "%u x %s lookup", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+        t.reset();
+        for (unsigned p = 0; p != passes; ++p) {
+          for (unsigned i = 0; i != num; ++i) key_sum += dict.get_value(dict.get_index(keys[i]));
+        }
+        sprintf(label, "%u x %s lookup string_key", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        // intern the names first, as callers of resource_dict::set_resource(string_key) can.
+        string_table table;
+        for (unsigned i = 0; i != num; ++i) interned[i] = table.intern(keys[i]);
+        dictionary<unsigned> dict;
+        for (unsigned i = 0; i != num; ++i) dict[interned[i]] = i;
+        example_benchmark::timer t;
+        for (unsigned p = 0; p != passes; ++p) {
+          for (unsigned i = 0; i != num; ++i) interned_sum += dict.get_value(dict.get_index(interned[i]));
+        }
+        sprintf(label, "%u x %s lookup interned", num, fmt);
+        example_benchmark::report(label, t.get_seconds());
+      }
+
+      bool same = legacy_sum == sum && sum == key_sum && sum == interned_sum;
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // strings holding a zero byte from set, urldecode and operator[] must free what they allocated.
+    static void string_test(unsigned num) {
+      size_t num_bytes = allocator::get_num_bytes();
+      {
+        dynarray<string> strings(num * 3);
+        char text[64];
+        for (unsigned i = 0; i != num; ++i) {
+          sprintf(text, "wall_%d.jpg", i);
+          strings[i*3+0].set(text, sizeof(text));
+          strings[i*3+1].urldecode("textures%00level3");
+          strings[i*3+2] = text;
+          strings[i*3+2][2] = 0;
+          strings[i*3+2] += "_x";
+        }
+      }
+      bool same = allocator::get_num_bytes() == num_bytes;
+      printf("  %u strings with zero bytes freed %s\n", num * 3, same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      string_test(1000);
+      names_test(1000, "ID%d", 1000);
+      names_test(1000, "textures/level3/wall_%d.jpg", 1000);
+      names_test(10000, "ID%d-lib-geom-mesh-positions", 100);
+    }
+  };
+}
@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+#include <chrono>
+
+namespace octet {
+  /// Command line benchmark runner. There is no window, results go to stdout.
+  class example_benchmark {
+    int argc;
+    char **argv;
+
+  public:
+    /// Stopwatch for timing benchmark loops.
+    class timer {
+      std::chrono::high_resolution_clock::time_point start;
+    public:
+      timer() {
+        reset();
+      }
+
+      void reset() {
+        start = std::chrono::high_resolution_clock::now();
+      }
+
+      /// time since construction or reset() in seconds.
+      double get_seconds() const {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+      }
+    };
+
+    /// this is called when we construct the class before everything is initialised.
+    example_benchmark(int argc, char **argv) : argc(argc), argv(argv) {
+    }
+
+    /// run a benchmark if it was named on the command line or no names were given.
+    void run(const char *name, void (*fn)()) {
+      bool selected = argc <= 1;
+      for (int i = 1; i < argc; ++i) {
+        selected |= !strcmp(argv[i], name);
+      }
+      if (selected) {
+        printf("\n%s\n", name);
+        fn();
+        fflush(stdout);
+      }
+    }
+
+    /// print one result line: a label, the time taken and optionally a throughput in MB/s.
+    static void report(const char *label, double seconds, double bytes=0) {
+      if (bytes) {
+        printf("  %-40s %10.3f ms %10.1f MB/s\n", label, seconds * 1000, bytes / (seconds * 1024 * 1024));
+      } else {
+        printf("  %-40s %10.3f ms\n", label, seconds * 1000);
+      }
+    }
+  };
+}
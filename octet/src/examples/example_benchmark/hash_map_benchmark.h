@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// hash_map against the old linear probing map, using the same kind
+// of keys as mesh::reindex and the resource writers.
+//
+
+namespace octet {
+  class hash_map_benchmark {
+    // the hash_map from before Robin Hood hashing, kept here for comparison.
+    template <typename key_t, typename value_t, class cmp_t> class legacy_hash_map {
+      struct entry_t { key_t key; unsigned hash; value_t value; };
+
+      entry_t *entries;
+      unsigned num_entries;
+      unsigned max_entries;
+
+      entry_t *find( const key_t &key, unsigned hash ) {
+        unsigned mask = max_entries - 1;
+        for (unsigned i = 0; i != max_entries; ++i) {
+          entry_t *entry = &entries[ ( i + hash ) & mask ];
+          if (cmp_t::is_empty(entry->key)) {
+            return entry;
+          }
+          if (entry->hash == hash && entry->key == key) {
+            return entry;
+          }
+        }
+        return 0;
+      }
+
+      void expand() {
+        entry_t *old_entries = entries;
+        unsigned old_max_entries = max_entries;
+        entries = (entry_t *)allocator::malloc(sizeof(entry_t) * max_entries*2);
+        memset((void*)entries, 0, sizeof(entry_t) * max_entries*2);
+        max_entries *= 2;
+        for (unsigned i = 0; i != old_max_entries; ++i) {
+          entry_t *old_entry = &old_entries[i];
+          if (!cmp_t::is_empty(old_entry->key)) {
+            entry_t *new_entry = find(old_entry->key, old_entry->hash);
+            *new_entry = *old_entry;
+          }
+        }
+        allocator::free(old_entries, sizeof(entry_t) * old_max_entries);
+      }
+
+    public:
+      legacy_hash_map() {
+        num_entries = 0;
+        max_entries = 4;
+        entries = (entry_t*)allocator::malloc(sizeof(entry_t) * max_entries);
+        memset((void*)entries, 0, sizeof(entry_t) * max_entries);
+      }
+
+      ~legacy_hash_map() {
+        allocator::free(entries, sizeof(entry_t) * max_entries);
+      }
+
+      value_t &operator[]( const key_t &key ) {
+        unsigned hash = cmp_t::get_hash(key);
+        entry_t *entry = find( key, hash );
+        if (cmp_t::is_empty(entry->key)) {
+          if (num_entries >= max_entries * 3 / 4) {
+            expand();
+            entry = find(key, hash);
+          }
+          num_entries++;
+          entry->key = key;
+          entry->hash = hash;
+        }
+        return entry->value;
+      }
+
+      bool contains(const key_t &key) {
+        unsigned hash = cmp_t::get_hash(key);
+        entry_t *entry = find( key, hash );
+        return !cmp_t::is_empty(entry->key);
+      }
+    };
+
+    // the old xor-shift hash
+    static unsigned legacy_fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
+
+    // a vertex key like mesh::general_vertex
+    struct vertex_key {
+      const uint8_t *bytes;
+      unsigned size;
+
+      bool operator ==(const vertex_key &rhs) const {
+        return size == rhs.size && memcmp(bytes, rhs.bytes, size) == 0;
+      }
+
+      unsigned get_hash() const {
+        unsigned hash = 0;
+        for (unsigned i = 0; i != size; ++i) {
+          hash = ( hash * 7 ) + ( hash >> 13 ) + bytes[i];
+        }
+        return hash;
+      }
+    };
+
+    struct vertex_cmp : hash_map_cmp {
+      static unsigned get_hash(const vertex_key &key) { return fuzz_hash(key.get_hash()); }
+      static bool is_empty(const vertex_key &key) { return key.bytes == 0; }
+    };
+
+    struct legacy_vertex_cmp {
+      static unsigned get_hash(const vertex_key &key) { return legacy_fuzz_hash(key.get_hash()); }
+      static bool is_empty(const vertex_key &key) { return key.bytes == 0; }
+    };
+
+    struct legacy_cmp {
+      static unsigned get_hash(void *key) { return legacy_fuzz_hash((unsigned)(intptr_t)key); }
+      static bool is_empty(void *key) { return !key; }
+    };
+
+    // make an unindexed grid of triangles, as you would get from a triangle soup,
+    // where every vertex appears up to six times.
+    static void make_soup(dynarray<uint8_t> &vertices, dynarray<uint32_t> &indices, unsigned dim) {
+      unsigned stride = sizeof(mesh::vertex);
+      vertices.resize(dim * dim * 6 * stride);
+      indices.resize(dim * dim * 6);
+      mesh::vertex *vtx = (mesh::vertex*)vertices.data();
+      static const int dx[] = { 0, 0, 1, 1, 0, 1 };
+      static const int dz[] = { 0, 1, 0, 0, 1, 1 };
+      unsigned n = 0;
+      for (unsigned z = 0; z != dim; ++z) {
+        for (unsigned x = 0; x != dim; ++x) {
+          for (unsigned i = 0; i != 6; ++i) {
+            vec3 pos((float)(x + dx[i]), 0, (float)(z + dz[i]));
+            vtx[n] = mesh::vertex(pos, vec3(0, 1, 0), pos * (1.0f / dim));
+            indices[n] = n;
+            n++;
+          }
+        }
+      }
+    }
+
+    // the inner loop of mesh::reindex
+    template <class map_t> static unsigned reindex(map_t &vertex_to_index, const dynarray<uint8_t> &vertices, const dynarray<uint32_t> &indices, dynarray<uint32_t> &dest_indices) {
+      unsigned stride = sizeof(mesh::vertex);
+      unsigned num_vertices = 0;
+      dest_indices.resize(0);
+      for (unsigned i = 0; i != indices.size(); ++i) {
+        vertex_key v = { vertices.data() + indices[i] * stride, stride };
+        unsigned &e = vertex_to_index[v];
+        if (e == 0) {
+          e = ++num_vertices;
+        }
+        dest_indices.push_back(e - 1);
+      }
+      return num_vertices;
+    }
+
+    static void reindex_test(unsigned dim) {
+      dynarray<uint8_t> vertices;
+      dynarray<uint32_t> indices;
+      dynarray<uint32_t> legacy_result;
+      dynarray<uint32_t> result;
+      make_soup(vertices, indices, dim);
+
+      char label[64];
+      unsigned legacy_num = 0, num = 0;
+      {
+        legacy_hash_map<vertex_key, unsigned, legacy_vertex_cmp> map;
+        example_benchmark::timer t;
+        legacy_num = reindex(map, vertices, indices, legacy_result);
+        sprintf(label, "reindex %ux%u legacy", dim, dim);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        // the old hash puts neighbouring vertices in neighbouring slots, which flatters the
+        // old map here, so also time it with the same hash as the new one.
+        legacy_hash_map<vertex_key, unsigned, vertex_cmp> map;
+        example_benchmark::timer t;
+        reindex(map, vertices, indices, result);
+        sprintf(label, "reindex %ux%u legacy + mixed hash", dim, dim);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        hash_map<vertex_key, unsigned, vertex_cmp> map;
+        example_benchmark::timer t;
+        num = reindex(map, vertices, indices, result);
+        sprintf(label, "reindex %ux%u robin hood", dim, dim);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        hash_map<vertex_key, unsigned, vertex_cmp> map;
+        map.reserve((dim + 1) * (dim + 1));
+        example_benchmark::timer t;
+        num = reindex(map, vertices, indices, result);
+        sprintf(label, "reindex %ux%u robin hood + reserve", dim, dim);
+        example_benchmark::report(label, t.get_seconds());
+      }
+
+      bool same = legacy_num == num && legacy_result.size() == result.size();
+      for (unsigned i = 0; same && i != result.size(); ++i) {
+        same = legacy_result[i] == result[i];
+      }
+      printf("  %u indices -> %u vertices %s\n", indices.size(), num, same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // pointer keys, like the refs map in binary_writer.
+    // aligned pointers have zeros in the low bits, which is hard on weak hashes.
+    static void pointer_test(unsigned num, unsigned align) {
+      dynarray<void *> keys(num);
+      for (unsigned i = 0; i != num; ++i) {
+        keys[i] = (void*)(intptr_t)(0x10000 + i * align);
+      }
+
+      char label[64];
+      unsigned legacy_found = 0, found = 0;
+      {
+        legacy_hash_map<void *, int, legacy_cmp> map;
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num; ++i) map[keys[i]] = (int)i;
+        for (unsigned i = 0; i != num * 2; ++i) legacy_found += map.contains((void*)(intptr_t)(0x10000 + i * align / 2));
+        sprintf(label, "%u pointers / %u legacy", num, align);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      {
+        hash_map<void *, int> map;
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num; ++i) map[keys[i]] = (int)i;
+        for (unsigned i = 0; i != num * 2; ++i) found += map.contains((void*)(intptr_t)(0x10000 + i * align / 2));
+        sprintf(label, "%u pointers / %u robin hood", num, align);
+        example_benchmark::report(label, t.get_seconds());
+      }
+      printf("  %u of %u found %s\n", found, num * 2, found == legacy_found ? "(results match)" : "(RESULTS DIFFER)");
+      {
+        hash_map<void *, int> map;
+        for (unsigned i = 0; i != num; ++i) map[keys[i]] = (int)i;
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num; i += 2) map.erase(keys[i]);
+        unsigned left = 0;
+        for (unsigned i = 0; i != num; ++i) left += map.contains(keys[i]);
+        sprintf(label, "%u pointers / %u erase half", num, align);
+        example_benchmark::report(label, t.get_seconds());
+        printf("  %u keys left, load factor %.2f %s\n", map.get_size(), map.get_load_factor(), left == num / 2 ? "(results match)" : "(RESULTS DIFFER)");
+      }
+    }
+
+  public:
+    static void run() {
+      reindex_test(64);
+      reindex_test(256);
+      reindex_test(1024);
+      pointer_test(10000, 64);
+      pointer_test(1000000, 16);
+      pointer_test(1000000, 64);
+      pointer_test(10000, 4096);
+      pointer_test(100000, 4096);
+    }
+  };
+}
@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// job_scheduler: the cost of jobs and parallel_for, and a loop spread over every core.
+//
+
+namespace octet {
+  class job_benchmark {
+    class empty_job : public job {
+    public:
+      void kernel() {
+      }
+    };
+
+    // add many jobs that do nothing and wait for them.
+    static void overhead_test(unsigned num_jobs) {
+      job_scheduler &sch = job_scheduler::get();
+      dynarray<empty_job> jobs(num_jobs);
+      job_counter counter;
+      example_benchmark::timer t;
+      for (unsigned i = 0; i != num_jobs; ++i) {
+        sch.add(&jobs[i], &counter);
+      }
+      sch.wait(counter);
+      char label[80];
+      sprintf(label, "%u empty jobs", num_jobs);
+      example_benchmark::report(label, t.get_seconds());
+    }
+
+    // many small parallel_for calls, as a frame of animation and particles would make.
+    static void parallel_for_overhead_test(unsigned num_calls) {
+      job_scheduler &sch = job_scheduler::get();
+      std::atomic<unsigned> total(0);
+      example_benchmark::timer t;
+      for (unsigned i = 0; i != num_calls; ++i) {
+        sch.parallel_for(0, 64, [&](unsigned j) { total += j; }, 8);
+      }
+      char label[80];
+      sprintf(label, "%u parallel_for x 64", num_calls);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %s\n", total == num_calls * (63 * 64 / 2) ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // a loop with some work in it, on one thread and then on every thread.
+    static void compute_test(unsigned size) {
+      dynarray<float> serial(size), parallel(size);
+      char label[80];
+
+      example_benchmark::timer t;
+      for (unsigned i = 0; i != size; ++i) {
+        serial[i] = sqrtf((float)i) * sinf((float)i);
+      }
+      sprintf(label, "%u sqrt*sin serial", size);
+      example_benchmark::report(label, t.get_seconds(), size * 4.0);
+
+      job_scheduler &sch = job_scheduler::get();
+      t.reset();
+      sch.parallel_for(0, size, [&](unsigned i) {
+        parallel[i] = sqrtf((float)i) * sinf((float)i);
+      }, 4096);
+      unsigned threads = sch.get_num_threads();
+      sprintf(label, "%u sqrt*sin parallel_for, %u thread%s", size, threads, threads == 1 ? "" : "s");
+      example_benchmark::report(label, t.get_seconds(), size * 4.0);
+
+      bool same = !memcmp(serial.data(), parallel.data(), size * sizeof(float));
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      overhead_test(100000);
+      parallel_for_overhead_test(10000);
+      compute_test(1 << 22);
+    }
+  };
+}
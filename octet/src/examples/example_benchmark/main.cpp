@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Microbenchmarks for the framework
+//
+// usage: example_benchmark [name...]
+//
+// with no names, all the benchmarks are run.
+//
+
+// the experimental voxel meshes are benchmarked too.
+#define OCTET_VOXEL_TEST
+#include "../../octet.h"
+
+#include "example_benchmark.h"
+#include "hash_map_benchmark.h"
+#include "dictionary_benchmark.h"
+#include "zip_benchmark.h"
+#include "jpeg_benchmark.h"
+#include "job_benchmark.h"
+#include "ray_cast_benchmark.h"
+#include "transform_benchmark.h"
+#include "cull_benchmark.h"
+#include "animation_benchmark.h"
+#include "skinning_benchmark.h"
+#include "particle_benchmark.h"
+#include "math_benchmark.h"
+#include "batch_benchmark.h"
+#include "voxels_benchmark.h"
+
+/// Run some benchmarks without opening a window
+int main(int argc, char **argv) {
+  octet::example_benchmark bench(argc, argv);
+
+  bench.run("hash_map", octet::hash_map_benchmark::run);
+  bench.run("dictionary", octet::dictionary_benchmark::run);
+  bench.run("zip", octet::zip_benchmark::run);
+  bench.run("jpeg", octet::jpeg_benchmark::run);
+  bench.run("job", octet::job_benchmark::run);
+  bench.run("ray_cast", octet::ray_cast_benchmark::run);
+  bench.run("transform", octet::transform_benchmark::run);
+  bench.run("cull", octet::cull_benchmark::run);
+  bench.run("animation", octet::animation_benchmark::run);
+  bench.run("skinning", octet::skinning_benchmark::run);
+  bench.run("particles", octet::particle_benchmark::run);
+  bench.run("math", octet::math_benchmark::run);
+  bench.run("batch", octet::batch_benchmark::run);
+  bench.run("voxels", octet::voxels_benchmark::run);
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// math: the mat4t operators one at a time against the math::simd kernels
+// in each version the CPU can run, checked against the scalar version.
+//
+
+namespace octet {
+  class math_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    // rotate, scale and translate for inverse3x4. General matrices have a small random last column
+    // so that none are close to singular, which would make the comparisons meaningless.
+    static mat4t random_matrix(bool affine) {
+      mat4t result;
+      result.loadIdentity();
+      result.rotateX(get_random() * 180);
+      result.rotateY(get_random() * 180);
+      result.scale(get_random() * 0.5f + 1, get_random() * 0.5f + 1, get_random() * 0.5f + 1);
+      result.translate(get_random() * 10, get_random() * 10, get_random() * 10);
+      if (!affine) {
+        for (unsigned i = 0; i != 3; ++i) result[i][3] = get_random() * 0.02f;
+        result[3][3] = get_random() * 0.25f + 1;
+      }
+      return result;
+    }
+
+    // the largest difference relative to the size of the numbers.
+    static float max_error(const float *a, const float *b, size_t size) {
+      float result = 0;
+      for (size_t i = 0; i != size; ++i) {
+        result = std::max(result, fabsf(a[i] - b[i]) / (1 + fabsf(a[i])));
+      }
+      return result;
+    }
+
+    enum kernel { k_multiply, k_transform, k_inverse4x4, k_inverse3x4, num_kernels };
+
+    static void run_kernel(kernel k, mat4t *mats, vec4 *vecs, const mat4t *lhs, const mat4t *rhs, const vec4 *src, unsigned count) {
+      switch (k) {
+        case k_multiply: simd::multiply(mats, lhs, rhs, count); break;
+        case k_transform: simd::transform(vecs, src, rhs[0], count); break;
+        case k_inverse4x4: simd::inverse4x4(mats, rhs, count); break;
+        case k_inverse3x4: simd::inverse3x4(mats, lhs, count); break;
+        default: break;
+      }
+    }
+
+    // the mat4t code that the kernels replace.
+    static void run_operators(kernel k, mat4t *mats, vec4 *vecs, const mat4t *lhs, const mat4t *rhs, const vec4 *src, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        switch (k) {
+          case k_multiply: mats[i] = lhs[i] * rhs[i]; break;
+          case k_transform: vecs[i] = src[i] * rhs[0]; break;
+          case k_inverse4x4: mats[i] = rhs[i].inverse4x4(); break;
+          case k_inverse3x4: mats[i] = lhs[i].inverse3x4(); break;
+          default: break;
+        }
+      }
+    }
+
+    static void kernel_test(unsigned count, unsigned num_loops) {
+      static const char *names[] = { "multiply", "transform", "inverse4x4", "inverse3x4" };
+      char label[80];
+
+      dynarray<mat4t> lhs(count), rhs(count);
+      dynarray<vec4> src(count);
+      for (unsigned i = 0; i != count; ++i) {
+        lhs[i] = random_matrix(true);
+        rhs[i] = random_matrix(false);
+        src[i] = vec4(get_random(), get_random(), get_random(), 1);
+      }
+
+      simd::level_t best = simd::get_best_level();
+      dynarray<mat4t> mats(count), scalar_mats(count), operator_mats(count);
+      dynarray<vec4> vecs(count), scalar_vecs(count), operator_vecs(count);
+
+      for (unsigned k = 0; k != num_kernels; ++k) {
+        bool is_vec = k == k_transform;
+        const float *scalar_result = is_vec ? scalar_vecs[0].get() : scalar_mats[0].get();
+        const float *result = is_vec ? vecs[0].get() : mats[0].get();
+        size_t size = count * (is_vec ? 4 : 16);
+        double bytes = (double)count * (is_vec ? sizeof(vec4) * 2 : sizeof(mat4t) * 3) * num_loops;
+
+        example_benchmark::timer t;
+        for (unsigned l = 0; l != num_loops; ++l) {
+          run_operators((kernel)k, operator_mats.data(), operator_vecs.data(), lhs.data(), rhs.data(), src.data(), count);
+        }
+        sprintf(label, "%u %s mat4t", count, names[k]);
+        example_benchmark::report(label, t.get_seconds(), bytes);
+
+        bool same = true;
+        for (unsigned level = 0; level <= (unsigned)best; ++level) {
+          simd::set_level((simd::level_t)level);
+          t.reset();
+          for (unsigned l = 0; l != num_loops; ++l) {
+            run_kernel((kernel)k, level ? mats.data() : scalar_mats.data(), level ? vecs.data() : scalar_vecs.data(), lhs.data(), rhs.data(), src.data(), count);
+          }
+          sprintf(label, "%u %s %s", count, names[k], simd::get_level_name((simd::level_t)level));
+          example_benchmark::report(label, t.get_seconds(), bytes);
+          if (level) {
+            float error = max_error(scalar_result, result, size);
+            printf("  %s against scalar: %g\n", simd::get_level_name((simd::level_t)level), error);
+            same = same && error < 1e-4f;
+          }
+        }
+        simd::set_level(best);
+
+        // products the scalar kernels make exactly as the operators do.
+        float op_error = max_error(is_vec ? operator_vecs[0].get() : operator_mats[0].get(), scalar_result, size);
+        bool exact = k == k_multiply || k == k_transform;
+        same = same && (exact ? op_error == 0 : op_error < 1e-4f);
+        printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+      }
+    }
+
+  public:
+    static void run() {
+      printf("  best: %s\n", simd::get_level_name(simd::get_best_level()));
+      kernel_test(1000, 1000);
+      kernel_test(100000, 10);
+    }
+  };
+}
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// particles: billboards moved by particle_animators against animated billboards,
+// which are kept as arrays of components and moved four at a time on many threads.
+//
+
+namespace octet {
+  class particle_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    struct less_pos {
+      bool operator()(const vec3p &a, const vec3p &b) const {
+        return memcmp(&a, &b, sizeof(a)) < 0;
+      }
+    };
+
+    // the first corner of each quad, sorted, as the two systems keep billboards in different orders.
+    static void get_corners(dynarray<vec3p> &result, const dynarray<mesh::vertex> &vertices, unsigned num_quads) {
+      result.resize(num_quads);
+      for (unsigned i = 0; i != num_quads; ++i) {
+        result[i] = vertices[i * 4].pos;
+      }
+      std::sort(result.data(), result.data() + num_quads, less_pos());
+    }
+
+    static void fountain_test(unsigned num_particles, unsigned num_frames) {
+      char label[80];
+      float delta_time = 1.0f / 60;
+      ref<mesh_particle_system> linked = new mesh_particle_system(aabb(), num_particles, 0, num_particles, 0);
+      ref<mesh_particle_system> animated = new mesh_particle_system(aabb(), 0, 0, 0, num_particles);
+
+      mat4t cameraToWorld;
+      cameraToWorld.loadIdentity();
+      cameraToWorld.rotateY(30);
+      linked->set_cameraToWorld(cameraToWorld);
+      animated->set_cameraToWorld(cameraToWorld);
+
+      for (unsigned i = 0; i != num_particles; ++i) {
+        mesh_particle_system::billboard_particle p;
+        memset(&p, 0, sizeof(p));
+        p.pos = vec3p(get_random(), get_random(), get_random());
+        p.size = vec2p(0.5f, 0.5f);
+        p.uv_bottom_left = vec2p(0, 1);
+        p.uv_top_right = vec2p(0.125f, 1-0.125f);
+        p.enabled = true;
+
+        mesh_particle_system::particle_animator pa;
+        memset(&pa, 0, sizeof(pa));
+        pa.acceleration = vec3p(0, -9.8f, 0);
+        pa.vel = vec3p(get_random() * 3, get_random() * 5 + 10, get_random() * 3);
+        pa.lifetime = (uint32_t)(get_random() * num_frames) + num_frames;
+        pa.spin = 0x1000000;
+
+        pa.link = linked->add_billboard_particle(p);
+        linked->add_particle_animator(pa);
+        animated->add_animated_billboard(p, pa);
+      }
+
+      dynarray<mesh::vertex> linked_vertices(num_particles * 4), animated_vertices(num_particles * 4);
+      unsigned linked_quads = 0, animated_quads = 0;
+
+      example_benchmark::timer t;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        linked->animate(delta_time);
+        linked_quads = linked->write_billboard_vertices(linked_vertices.data());
+      }
+      sprintf(label, "%u particles x %u frames particle_animator", num_particles, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        animated->animate(delta_time);
+        animated_quads = animated->write_billboard_vertices(animated_vertices.data());
+      }
+      double seconds = t.get_seconds();
+      sprintf(label, "%u particles x %u frames animated billboards", num_particles, num_frames);
+      example_benchmark::report(label, seconds);
+
+      dynarray<vec3p> linked_corners, animated_corners;
+      get_corners(linked_corners, linked_vertices, linked_quads);
+      get_corners(animated_corners, animated_vertices, animated_quads);
+      bool same = linked_quads == animated_quads && !memcmp(linked_corners.data(), animated_corners.data(), linked_quads * sizeof(vec3p));
+      printf("  %u alive, %.2f ms a frame, %s\n", animated_quads, seconds * 1000 / num_frames, same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      fountain_test(100000, 60);
+      fountain_test(1000000, 30);
+    }
+  };
+}
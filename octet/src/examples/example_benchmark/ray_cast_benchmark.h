@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// mesh_bvh: building a triangle tree and casting rays against it, compared with testing every triangle.
+// aabb_bvh: the tree of boxes used for the mesh instances in a scene, moving boxes and many rays at once.
+// visual_scene: single picks on a still scene, which should not touch every instance, and on a moving one.
+//
+
+namespace octet {
+  class ray_cast_benchmark {
+    // a bumpy sphere with about 2 * segments^2 triangles.
+    static void make_sphere(dynarray<vec3p> &pos, dynarray<uint32_t> &idx, unsigned segments) {
+      unsigned rows = segments / 2;
+      pos.resize((segments + 1) * (rows + 1));
+      for (unsigned j = 0; j <= rows; ++j) {
+        float lat = j * (3.14159265f / rows);
+        for (unsigned i = 0; i <= segments; ++i) {
+          float lng = i * (2 * 3.14159265f / segments);
+          float r = 1.0f + 0.05f * sinf(lng * 17) * sinf(lat * 13);
+          pos[j * (segments + 1) + i] = vec3(sinf(lat) * cosf(lng), cosf(lat), sinf(lat) * sinf(lng)) * r;
+        }
+      }
+      idx.resize(0);
+      for (unsigned j = 0; j != rows; ++j) {
+        for (unsigned i = 0; i != segments; ++i) {
+          uint32_t a = j * (segments + 1) + i, b = a + 1, c = a + segments + 1, d = c + 1;
+          idx.push_back(a); idx.push_back(b); idx.push_back(c);
+          idx.push_back(b); idx.push_back(d); idx.push_back(c);
+        }
+      }
+    }
+
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x9e3779b9;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    // the loop from mesh::ray_cast without a tree.
+    static bool brute_force(const dynarray<vec3p> &pos, const dynarray<uint32_t> &idx, vec3_in org, vec3_in dir, int indices[], vec4 &bary_numer, float &bary_denom) {
+      float best_denom = 0;
+      vec4 best_numer(0, 0, 0, 0);
+      for (unsigned i = 0; i != idx.size(); i += 3) {
+        vec3 a = (vec3)pos[idx[i+0]] - org;
+        vec3 b = (vec3)pos[idx[i+1]] - org;
+        vec3 c = (vec3)pos[idx[i+2]] - org;
+        vec4 numer;
+        float denom;
+        if (mesh_bvh::intersect(a, b, c, dir, numer, denom)) {
+          rational best_distance(best_numer[3], best_denom);
+          rational new_distance(numer[3], denom);
+          if (!(new_distance > best_distance)) {
+            indices[0] = idx[i+0];
+            indices[1] = idx[i+1];
+            indices[2] = idx[i+2];
+            best_numer = numer;
+            best_denom = denom;
+          }
+        }
+      }
+      bary_numer = best_numer;
+      bary_denom = best_denom;
+      return fabsf(best_denom) >= 1e-6f;
+    }
+
+    static void cast_test(unsigned segments, unsigned num_rays, unsigned num_brute_force) {
+      dynarray<vec3p> pos;
+      dynarray<uint32_t> idx;
+      make_sphere(pos, idx, segments);
+      unsigned num_triangles = idx.size() / 3;
+      char label[80];
+
+      mesh_bvh bvh;
+      example_benchmark::timer t;
+      bvh.build((const uint8_t*)pos.data(), sizeof(vec3p), 0, idx.data(), idx.size());
+      sprintf(label, "build %u triangles", num_triangles);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %u nodes\n", bvh.get_num_nodes());
+
+      // rays from outside the sphere towards points near the middle, some missing.
+      dynarray<vec3> org(num_rays), dir(num_rays);
+      for (unsigned i = 0; i != num_rays; ++i) {
+        org[i] = vec3(get_random(), get_random(), get_random()) * 3.0f;
+        dir[i] = vec3(get_random(), get_random(), get_random()) * 1.2f - org[i];
+      }
+
+      t.reset();
+      unsigned num_hits = 0;
+      for (unsigned i = 0; i != num_rays; ++i) {
+        mesh_bvh::hit hit;
+        num_hits += bvh.ray_cast(org[i], dir[i], hit);
+      }
+      sprintf(label, "%u rays with bvh", num_rays);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %u hits, %.2f us per ray\n", num_hits, t.get_seconds() * 1e6 / num_rays);
+
+      // the brute force loop is slow, so only try a few rays and check that the answers are the same.
+      t.reset();
+      unsigned num_same = 0;
+      for (unsigned i = 0; i != num_brute_force; ++i) {
+        int indices[3] = { 0, 0, 0 };
+        vec4 numer;
+        float denom;
+        bool hit = brute_force(pos, idx, org[i], dir[i], indices, numer, denom);
+        mesh_bvh::hit bvh_hit;
+        bool bvh_found = bvh.ray_cast(org[i], dir[i], bvh_hit) && fabsf(bvh_hit.bary_denom) >= 1e-6f;
+        num_same += hit == bvh_found && (!hit || (
+          !memcmp(&numer, &bvh_hit.bary_numer, sizeof(numer)) && denom == bvh_hit.bary_denom &&
+          indices[0] == bvh_hit.indices[0] && indices[1] == bvh_hit.indices[1] && indices[2] == bvh_hit.indices[2]
+        ));
+      }
+      sprintf(label, "%u rays brute force", num_brute_force);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %.2f us per ray\n", t.get_seconds() * 1e6 / num_brute_force);
+      printf("  %s\n", num_same == num_brute_force ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // where the segment org + lambda * dir, 0 <= lambda <= 1 enters a box, if it does.
+    static bool enter_box(vec3_in org, vec3_in dir, vec3_in bmin, vec3_in bmax, float &lambda) {
+      float tnear = 0, tfar = 1;
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        float inv = dir[axis] != 0 ? 1.0f / dir[axis] : 1e30f;
+        float t0 = (bmin[axis] - org[axis]) * inv;
+        float t1 = (bmax[axis] - org[axis]) * inv;
+        tnear = std::max(tnear, std::min(t0, t1));
+        tfar = std::min(tfar, std::max(t0, t1));
+      }
+      lambda = tnear;
+      return tnear <= tfar;
+    }
+
+    // the nearest box hit by a segment using the tree, ~0 for none.
+    static unsigned nearest_box(const aabb_bvh &tree, vec3_in org, vec3_in dir) {
+      unsigned best = ~0;
+      tree.ray_query(org, dir, 1.0f, [&](unsigned first, unsigned count, float limit) {
+        for (unsigned i = first; i != first + count; ++i) {
+          unsigned box = tree.get_leaf_box(i);
+          float lambda;
+          if (enter_box(org, dir, tree.get_box_min(box), tree.get_box_max(box), lambda) && lambda <= limit) {
+            if (lambda < limit || box < best) best = box;
+            limit = lambda;
+          }
+        }
+        return limit;
+      });
+      return best;
+    }
+
+    // boxes scattered in a world, some moving, and line of sight rays between random points.
+    static void box_test(unsigned num_boxes, unsigned num_rays) {
+      char label[80];
+      aabb_bvh tree;
+      tree.resize(num_boxes);
+      for (unsigned i = 0; i != num_boxes; ++i) {
+        vec3 centre = vec3(get_random(), get_random(), get_random()) * 100.0f;
+        vec3 half = vec3(get_random(), get_random(), get_random()) * 0.5f + vec3(1.0f);
+        tree.set_box(i, centre - half, centre + half);
+      }
+
+      example_benchmark::timer t;
+      tree.build(2);
+      sprintf(label, "build %u boxes", num_boxes);
+      example_benchmark::report(label, t.get_seconds());
+
+      // move a tenth of the boxes a little, as a frame of a game would.
+      t.reset();
+      for (unsigned i = 0; i < num_boxes; i += 10) {
+        vec3 offset = vec3(get_random(), get_random(), get_random());
+        tree.set_box(i, tree.get_box_min(i) + offset, tree.get_box_max(i) + offset);
+      }
+      tree.refit();
+      sprintf(label, "refit %u moved boxes", num_boxes / 10);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %s\n", tree.needs_rebuild() ? "(needs rebuild)" : "(no rebuild needed)");
+
+      dynarray<vec3> org(num_rays), dir(num_rays);
+      for (unsigned i = 0; i != num_rays; ++i) {
+        org[i] = vec3(get_random(), get_random(), get_random()) * 100.0f;
+        dir[i] = vec3(get_random(), get_random(), get_random()) * 100.0f - org[i];
+      }
+
+      dynarray<unsigned> serial(num_rays), parallel(num_rays), brute(num_rays);
+      t.reset();
+      for (unsigned i = 0; i != num_rays; ++i) {
+        serial[i] = nearest_box(tree, org[i], dir[i]);
+      }
+      sprintf(label, "%u rays with bvh", num_rays);
+      example_benchmark::report(label, t.get_seconds());
+
+      job_scheduler &sch = job_scheduler::get();
+      t.reset();
+      sch.parallel_for(0, num_rays, [&](unsigned i) {
+        parallel[i] = nearest_box(tree, org[i], dir[i]);
+      }, 16);
+      sprintf(label, "%u rays with bvh, %u thread%s", num_rays, sch.get_num_threads(), sch.get_num_threads() == 1 ? "" : "s");
+      example_benchmark::report(label, t.get_seconds());
+
+      t.reset();
+      for (unsigned i = 0; i != num_rays; ++i) {
+        float best_lambda = 2;
+        brute[i] = ~0;
+        for (unsigned box = 0; box != num_boxes; ++box) {
+          float lambda;
+          if (enter_box(org[i], dir[i], tree.get_box_min(box), tree.get_box_max(box), lambda) && lambda < best_lambda) {
+            best_lambda = lambda;
+            brute[i] = box;
+          }
+        }
+      }
+      sprintf(label, "%u rays brute force", num_rays);
+      example_benchmark::report(label, t.get_seconds());
+
+      bool same = !memcmp(serial.data(), brute.data(), num_rays * sizeof(unsigned)) && !memcmp(serial.data(), parallel.data(), num_rays * sizeof(unsigned));
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // instances of a mesh with a box and no triangles, so the time is all in the instance tree.
+    static void pick_test(unsigned num_instances, unsigned num_picks) {
+      char label[80];
+      ref<visual_scene> scene = new visual_scene();
+      ref<mesh> msh = new mesh();
+      msh->set_aabb(aabb(vec3(0, 0, 0), vec3(1, 1, 1)));
+      dynarray<scene_node*> nodes(num_instances);
+      for (unsigned i = 0; i != num_instances; ++i) {
+        nodes[i] = new scene_node();
+        nodes[i]->translate(vec3(get_random(), get_random(), get_random()) * 100.0f);
+        scene->add_child(nodes[i]);
+        scene->add_mesh_instance(new mesh_instance(nodes[i], msh));
+      }
+
+      dynarray<ray> rays(num_picks);
+      for (unsigned i = 0; i != num_picks; ++i) {
+        vec3 start = vec3(get_random(), get_random(), get_random()) * 100.0f;
+        rays[i] = ray(start, vec3(get_random(), get_random(), get_random()) * 100.0f);
+      }
+
+      visual_scene::cast_result result;
+      scene->cast_ray(result, rays[0]);
+
+      example_benchmark::timer t;
+      for (unsigned i = 0; i != num_picks; ++i) {
+        scene->cast_ray(result, rays[i]);
+      }
+      sprintf(label, "%u picks, %u still instances", num_picks, num_instances);
+      example_benchmark::report(label, t.get_seconds());
+
+      t.reset();
+      for (unsigned i = 0; i != num_picks; ++i) {
+        nodes[i % num_instances]->translate(vec3(0.01f, 0, 0));
+        scene->cast_ray(result, rays[i]);
+      }
+      sprintf(label, "%u picks, one moved instance each", num_picks);
+      example_benchmark::report(label, t.get_seconds());
+    }
+
+  public:
+    static void run() {
+      cast_test(64, 100000, 1000);
+      cast_test(320, 100000, 100);
+      box_test(10000, 1000);
+      pick_test(10000, 1000);
+    }
+  };
+}
@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// skinning: bone palettes made as calc_transforms used to, with skeleton::calc_palette
+// and on many threads, then vertices skinned on the CPU on one and many threads.
+//
+
+namespace octet {
+  class skinning_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    static mat4t random_matrix() {
+      mat4t result;
+      result.loadIdentity();
+      result.rotateX(get_random() * 180);
+      result.rotateY(get_random() * 180);
+      result.translate(get_random(), get_random(), get_random());
+      return result;
+    }
+
+    struct character {
+      ref<skeleton> skel;
+      ref<skin> skn;
+      dynarray<scene_node*> bones;
+      mat4t modelToCamera;
+    };
+
+    // a tree of bones and a skin with a joint for each.
+    static void make_character(character &c, unsigned num_bones) {
+      c.skel = new skeleton();
+      c.skn = new skin(random_matrix());
+      for (unsigned b = 0; b != num_bones; ++b) {
+        atom_t sid = (atom_t)(0x10000 + b);
+        scene_node *node = new scene_node(random_matrix(), sid);
+        c.bones.push_back(node);
+        c.skel->add_bone(node, b ? (int)(b - 1) / 2 : -1);
+        c.skn->add_joint(random_matrix(), sid);
+      }
+      c.modelToCamera = random_matrix();
+    }
+
+    // the skin to camera matrices as calc_transforms made them before calc_palette.
+    static void old_palette(mat4t *palette, dynarray<mat4t> &boneToNode, const character &c, const dynarray<int> &parents, const dynarray<int> &indices) {
+      unsigned num_nodes = c.skel->get_num_nodes();
+      boneToNode.resize(num_nodes);
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        mat4t nodeToParent = c.bones[i]->get_nodeToParent();
+        boneToNode[i] = parents[i] == -1 ? nodeToParent * c.modelToCamera : nodeToParent * boneToNode[parents[i]];
+      }
+      for (unsigned i = 0; i != c.skn->get_num_joints(); ++i) {
+        palette[i] = indices[i] != -1 ? c.skn->get_modelToBind() * c.skn->get_bindToModel(i) * boneToNode[indices[i]] : c.modelToCamera;
+      }
+    }
+
+    static void palette_test(unsigned num_chars, unsigned num_bones, unsigned num_frames) {
+      char label[80];
+      dynarray<character> chars(num_chars);
+      for (unsigned i = 0; i != num_chars; ++i) {
+        make_character(chars[i], num_bones);
+      }
+
+      dynarray<int> parents(num_bones), indices(num_bones);
+      for (unsigned b = 0; b != num_bones; ++b) {
+        parents[b] = b ? (int)(b - 1) / 2 : -1;
+        indices[b] = chars[0].skel->find_joint(chars[0].skn->get_joint(b));
+      }
+
+      dynarray<mat4t> old_style(num_chars * num_bones), serial(num_chars * num_bones), parallel(num_chars * num_bones);
+      dynarray<mat4t> scratch(num_chars * num_bones);
+
+      example_benchmark::timer t;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned i = 0; i != num_chars; ++i) {
+          old_palette(&old_style[i * num_bones], scratch, chars[i], parents, indices);
+        }
+      }
+      sprintf(label, "%u characters x %u frames old palette", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      for (unsigned i = 0; i != num_chars; ++i) {
+        chars[i].skel->prepare(chars[i].skn);
+      }
+
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned i = 0; i != num_chars; ++i) {
+          chars[i].skel->calc_palette(&serial[i * num_bones], &scratch[i * num_bones], chars[i].modelToCamera, chars[i].skn);
+        }
+      }
+      sprintf(label, "%u characters x %u frames calc_palette", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      // the way visual_scene::skin_meshes does it.
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        job_scheduler::get().parallel_for(0, num_chars, [&](unsigned i) {
+          chars[i].skel->calc_palette(&parallel[i * num_bones], &scratch[i * num_bones], chars[i].modelToCamera, chars[i].skn);
+        }, 1);
+      }
+      sprintf(label, "%u characters x %u frames parallel", num_chars, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      bool same =
+        !memcmp(old_style.data(), serial.data(), serial.size() * sizeof(mat4t)) &&
+        !memcmp(serial.data(), parallel.data(), serial.size() * sizeof(mat4t))
+      ;
+      printf("  %s, %s\n", OCTET_SSE2 ? "sse2" : "default", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // position, normal and four bones per vertex, as the collada loader makes them.
+    struct vertex {
+      vec3p pos;
+      vec3p normal;
+      float weight[3];
+      float index[4];
+    };
+
+    static void vertex_test(unsigned num_vertices, unsigned num_bones, unsigned num_frames) {
+      char label[80];
+      ref<mesh> msh = new mesh();
+      msh->add_attribute(attribute_pos, 3, GL_FLOAT, 0);
+      msh->add_attribute(attribute_normal, 3, GL_FLOAT, 12);
+      msh->add_attribute(attribute_blendweight, 3, GL_FLOAT, 24);
+      msh->add_attribute(attribute_blendindices, 4, GL_FLOAT, 36);
+      msh->set_params(sizeof(vertex), 0, num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
+
+      dynarray<vertex> source(num_vertices), serial(num_vertices), parallel(num_vertices);
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        vertex &v = source[i];
+        v.pos = vec3(get_random(), get_random(), get_random());
+        v.normal = normalize(vec3(get_random(), get_random(), get_random()));
+        float w0 = get_random() * 0.25f + 0.25f, w1 = get_random() * 0.1f + 0.1f;
+        v.weight[0] = w0; v.weight[1] = w1; v.weight[2] = 1 - w0 - w1 - 0.3f;
+        for (unsigned j = 0; j != 4; ++j) {
+          v.index[j] = (float)((i + j * 7) % num_bones);
+        }
+      }
+      dynarray<mat4t> palette(num_bones);
+      for (unsigned b = 0; b != num_bones; ++b) {
+        palette[b] = random_matrix();
+      }
+
+      const uint8_t *src = (const uint8_t*)source.data();
+      example_benchmark::timer t;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        msh->skin_vertices((uint8_t*)serial.data(), src, palette.data(), num_bones, 0, num_vertices);
+      }
+      sprintf(label, "%u vertices x %u frames skin_vertices", num_vertices, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      enum { chunk = 1024 };
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        job_scheduler::get().parallel_for(0, (num_vertices + chunk - 1) / chunk, [&](unsigned c) {
+          unsigned first = c * chunk;
+          msh->skin_vertices((uint8_t*)parallel.data(), src, palette.data(), num_bones, first, std::min((unsigned)chunk, num_vertices - first));
+        }, 1);
+      }
+      sprintf(label, "%u vertices x %u frames parallel", num_vertices, num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      bool same = !memcmp(serial.data(), parallel.data(), num_vertices * sizeof(vertex));
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      palette_test(100, 64, 100);
+      palette_test(100, 256, 100);
+      vertex_test(100000, 64, 20);
+    }
+  };
+}
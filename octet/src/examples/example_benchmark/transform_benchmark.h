@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// scene_node: world matrices of a deep hierarchy, walking to the root every time
+// compared with the cached matrices and a flat parents first update.
+//
+
+namespace octet {
+  class transform_benchmark {
+    // the matrix calcModelToWorld used to make, multiplying all the way up the parent chain.
+    static mat4t walk_to_root(scene_node *node) {
+      mat4t result = node->get_nodeToParent();
+      for (scene_node *p = node->get_parent(); p != NULL; p = p->get_parent()) {
+        result = result * p->get_nodeToParent();
+      }
+      return result;
+    }
+
+    static bool is_close(const mat4t &a, const mat4t &b) {
+      for (unsigned i = 0; i != 4; ++i) {
+        vec4 diff = a[i] - b[i];
+        if (dot(diff, diff) > 1e-6f * (1 + dot(a[i], a[i]))) return false;
+      }
+      return true;
+    }
+
+    // num_chains chains of depth nodes below a root, as a character from a collada file has.
+    // each frame, the top node of every chain moves and the leaves are queried three times
+    // (render, bounding box and ray cast).
+    static void hierarchy_test(unsigned num_chains, unsigned depth, unsigned num_frames) {
+      ref<scene_node> root = new scene_node();
+      dynarray<scene_node*> tops, leaves;
+      for (unsigned c = 0; c != num_chains; ++c) {
+        scene_node *node = root;
+        for (unsigned d = 0; d != depth; ++d) {
+          node = new scene_node(node);
+          node->translate(vec3(0, 0.1f, 0));
+          node->rotate(1.0f * d, vec3(0, 0, 1));
+          if (d == 0) tops.push_back(node);
+        }
+        leaves.push_back(node);
+      }
+      unsigned num_leaves = leaves.size();
+      char label[80];
+
+      dynarray<mat4t> start(num_chains);
+      for (unsigned c = 0; c != num_chains; ++c) {
+        start[c] = tops[c]->get_nodeToParent();
+      }
+
+      dynarray<mat4t> walked(num_leaves), cached(num_leaves), flat(num_leaves);
+      example_benchmark::timer t;
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned c = 0; c != num_chains; ++c) {
+          tops[c]->rotate(1.0f, vec3(0, 1, 0));
+        }
+        for (unsigned q = 0; q != 3; ++q) {
+          for (unsigned i = 0; i != num_leaves; ++i) {
+            walked[i] = walk_to_root(leaves[i]);
+          }
+        }
+      }
+      sprintf(label, "%u frames walk depth %u", num_frames, depth);
+      example_benchmark::report(label, t.get_seconds());
+
+      // put the matrices back so that each test sees the same ones.
+      for (unsigned c = 0; c != num_chains; ++c) {
+        tops[c]->access_nodeToParent() = start[c];
+      }
+
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned c = 0; c != num_chains; ++c) {
+          tops[c]->rotate(1.0f, vec3(0, 1, 0));
+        }
+        for (unsigned q = 0; q != 3; ++q) {
+          for (unsigned i = 0; i != num_leaves; ++i) {
+            cached[i] = leaves[i]->calcModelToWorld();
+          }
+        }
+      }
+      sprintf(label, "%u frames cached", num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      for (unsigned c = 0; c != num_chains; ++c) {
+        tops[c]->access_nodeToParent() = start[c];
+      }
+
+      // the pass visual_scene::update_transforms makes once a frame.
+      dynarray<scene_node*> nodes;
+      dynarray<int> parents;
+      root->get_all_child_nodes(nodes, parents);
+      t.reset();
+      for (unsigned f = 0; f != num_frames; ++f) {
+        for (unsigned c = 0; c != num_chains; ++c) {
+          tops[c]->rotate(1.0f, vec3(0, 1, 0));
+        }
+        for (unsigned i = 0; i != nodes.size(); ++i) {
+          if (parents[i] == -1) {
+            nodes[i]->calcModelToWorld();
+          } else {
+            nodes[i]->update_world(nodes[parents[i]]);
+          }
+        }
+        for (unsigned q = 0; q != 3; ++q) {
+          for (unsigned i = 0; i != num_leaves; ++i) {
+            flat[i] = leaves[i]->calcModelToWorld();
+          }
+        }
+      }
+      sprintf(label, "%u frames flat update", num_frames);
+      example_benchmark::report(label, t.get_seconds());
+
+      bool same = true;
+      for (unsigned i = 0; i != num_leaves; ++i) {
+        same = same && is_close(walked[i], cached[i]) && !memcmp(&cached[i], &flat[i], sizeof(mat4t));
+      }
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      hierarchy_test(100, 20, 100);
+      hierarchy_test(1000, 4, 100);
+    }
+  };
+}
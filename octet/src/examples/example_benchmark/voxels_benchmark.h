@@ -0,0 +1,358 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// voxels: digging into a 256x256x256 mesh_voxels world, which remeshes only the subcubes
+// that change, against remeshing the whole world. The faces must be the same.
+// Then greedy meshing of terraced hills, which must cover exactly what the one voxel faces do.
+// Then rays cast at a large sparse world, skipping empty space with the LODs, against stepping
+// one voxel at a time.
+//
+
+namespace octet {
+  class voxels_benchmark {
+    // -1 to 1, the same every run.
+    static float get_random() {
+      static uint32_t seed = 0x2545f491;
+      seed = seed * 1664525 + 1013904223;
+      return (int32_t)seed * (1.0f / 0x80000000);
+    }
+
+    struct face {
+      vec3p pos[4];
+      vec3p normal;
+    };
+
+    struct less_face {
+      bool operator()(const face &a, const face &b) const {
+        return memcmp(&a, &b, sizeof(a)) < 0;
+      }
+    };
+
+    // the faces that are drawn, sorted, as the slots of the two worlds are different sizes.
+    static void get_faces(dynarray<face> &result, const mesh_voxels *world) {
+      const dynarray<mesh::vertex> &vertices = world->get_cpu_vertices();
+      const dynarray<uint32_t> &indices = world->get_cpu_indices();
+      result.resize(0);
+      for (unsigned i = 0; i != indices.size(); i += 6) {
+        if (indices[i] != indices[i + 1]) {
+          face f;
+          for (unsigned j = 0; j != 4; ++j) {
+            f.pos[j] = vertices[indices[i] + j].pos;
+          }
+          f.normal = vertices[indices[i]].normal;
+          result.push_back(f);
+        }
+      }
+      std::sort(result.data(), result.data() + result.size(), less_face());
+    }
+
+    // a voxel on the surface of the ball, from 0 to 255 on each axis.
+    static ivec3 random_surface(float radius) {
+      vec3 dir = normalize(vec3(get_random(), get_random(), get_random()) + vec3(0.001f));
+      vec3 pos = dir * (radius - 1) + vec3(128);
+      return ivec3((int)pos.x(), (int)pos.y(), (int)pos.z());
+    }
+
+    static void dig_test(unsigned num_voxel_edits, unsigned num_hole_edits) {
+      char label[80];
+      mat4t voxelToWorld;
+      voxelToWorld.loadIdentity();
+      float radius = 120;
+      sphere ball(vec3(0, 0, 0), radius);
+
+      ref<mesh_voxels> world = new mesh_voxels(1.0f/32, ivec3(8, 8, 8));
+      ref<mesh_voxels> rebuilt = new mesh_voxels(1.0f/32, ivec3(8, 8, 8));
+
+      example_benchmark::timer t;
+      world->draw(voxelToWorld, ball);
+      world->update_lod();
+      world->remesh();
+      example_benchmark::report("draw and remesh the world", t.get_seconds());
+      rebuilt->draw(voxelToWorld, ball);
+
+      t.reset();
+      unsigned num_remeshed = 0;
+      for (unsigned i = 0; i != num_voxel_edits; ++i) {
+        ivec3 pos = random_surface(radius);
+        world->set_voxel(pos, false);
+        rebuilt->set_voxel(pos, false);
+        world->update_lod();
+        num_remeshed += world->remesh();
+      }
+      sprintf(label, "%u one voxel edits", num_voxel_edits);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %u subcubes remeshed\n", num_remeshed);
+
+      t.reset();
+      num_remeshed = 0;
+      for (unsigned i = 0; i != num_hole_edits; ++i) {
+        vec3 centre = vec3(random_surface(radius)) - vec3(127.5f);
+        world->erase(voxelToWorld, sphere(centre, 6));
+        rebuilt->erase(voxelToWorld, sphere(centre, 6));
+        world->update_lod();
+        num_remeshed += world->remesh();
+      }
+      sprintf(label, "%u holes", num_hole_edits);
+      example_benchmark::report(label, t.get_seconds());
+      printf("  %u subcubes remeshed\n", num_remeshed);
+
+      // what every edit cost before.
+      t.reset();
+      rebuilt->update_lod();
+      rebuilt->remesh();
+      example_benchmark::report("remesh the whole world", t.get_seconds());
+
+      dynarray<face> faces, rebuilt_faces;
+      get_faces(faces, world);
+      get_faces(rebuilt_faces, rebuilt);
+      printf("  %u faces\n", faces.size());
+      bool same = faces.size() == rebuilt_faces.size() && !memcmp(faces.data(), rebuilt_faces.data(), sizeof(face) * faces.size());
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // terraces of hills, below about 16 voxels high.
+    struct hills {
+      static float get_height(float x, float z) {
+        return floorf((sinf(x * 0.05f) * cosf(z * 0.07f) * 12 + sinf(z * 0.2f) * 2) * (1.0f/3)) * 3;
+      }
+
+      bool intersects(const vec3 &pos) const {
+        return pos.y() < get_height(pos.x(), pos.z());
+      }
+
+      bool intersects(const aabb &box) const {
+        return box.get_min().y() < 16;
+      }
+    };
+
+    // checks that the rectangles of mesh_greedy_faces have only solid voxels with their key.
+    class key_checker {
+    public:
+      const mesh_voxel_subcube *subcube;
+      bool ok;
+      unsigned num_faces;
+
+      key_checker() { ok = true; num_faces = 0; }
+
+      void add_rect(unsigned face, ivec3_in pos, int width, int height, unsigned key) {
+        ivec3 du = face < voxel_bottom ? ivec3(0, 1, 0) : ivec3(1, 0, 0);
+        ivec3 dv = face < voxel_back ? ivec3(0, 0, 1) : ivec3(0, 1, 0);
+        for (int v = 0; v != height; ++v) {
+          for (int u = 0; u != width; ++u) {
+            ivec3 voxel = pos + du * u + dv * v;
+            ok = ok && subcube->get_voxel(voxel) && subcube->get_key(voxel) == key;
+          }
+        }
+        num_faces++;
+      }
+    };
+
+    // count the times each voxel face is drawn: six directions, dim + 1 planes of dim * dim faces.
+    // Quads wound the other way around the normal count 16.
+    static void rasterize(dynarray<uint8_t> &coverage, const mesh_voxels *world, int dim) {
+      const dynarray<mesh::vertex> &vertices = world->get_cpu_vertices();
+      const dynarray<uint32_t> &indices = world->get_cpu_indices();
+      coverage.resize(6 * (dim + 1) * dim * dim);
+      memset(coverage.data(), 0, coverage.size());
+      for (unsigned i = 0; i != indices.size(); i += 6) {
+        if (indices[i] == indices[i + 1]) continue;
+        const mesh::vertex *vtx = &vertices[indices[i]];
+        vec3 normal = vtx->normal;
+        int axis = normal.x() != 0 ? 0 : normal.y() != 0 ? 1 : 2;
+        int dir = axis * 2 + (normal[axis] > 0);
+
+        // the corners in voxels from the corner of the world.
+        int lo[3] = { dim, dim, dim }, hi[3] = { 0, 0, 0 };
+        for (unsigned j = 0; j != 4; ++j) {
+          vec3 pos = vtx[j].pos;
+          for (int k = 0; k != 3; ++k) {
+            int c = (int)floorf(pos[k] + dim * 0.5f + 0.5f);
+            lo[k] = std::min(lo[k], c);
+            hi[k] = std::max(hi[k], c);
+          }
+        }
+
+        vec3 p0 = vtx[0].pos, p1 = vtx[1].pos, p3 = vtx[3].pos;
+        uint8_t count = dot(cross(p1 - p0, p3 - p0), normal) > 0 ? 1 : 16;
+        int ua = (axis + 1) % 3, va = (axis + 2) % 3;
+        for (int u = lo[ua]; u != hi[ua]; ++u) {
+          for (int v = lo[va]; v != hi[va]; ++v) {
+            coverage[((dir * (dim + 1) + lo[axis]) * dim + u) * dim + v] += count;
+          }
+        }
+      }
+    }
+
+    static void greedy_test() {
+      char label[80];
+      mat4t voxelToWorld;
+      voxelToWorld.loadIdentity();
+      int dim = 128;
+
+      ref<mesh_voxels> faces = new mesh_voxels(1, ivec3(4, 4, 4));
+      ref<mesh_voxels> greedy = new mesh_voxels(1, ivec3(4, 4, 4));
+      greedy->set_greedy(true);
+      mesh_voxels *worlds[] = { faces, greedy };
+      for (unsigned w = 0; w != 2; ++w) {
+        worlds[w]->draw(voxelToWorld, hills());
+      }
+
+      // a rock layer, with ore here and there; faces of different keys must not be joined.
+      for (int z = 0; z != dim; ++z) {
+        for (int y = 0; y != dim / 2 - 6; ++y) {
+          for (int x = 0; x != dim; ++x) {
+            unsigned key = (x * 7 + y * 13 + z * 5) % 97 == 0 ? 2 : 1;
+            for (unsigned w = 0; w != 2; ++w) {
+              worlds[w]->set_key(ivec3(x, y, z), key);
+            }
+          }
+        }
+      }
+
+      unsigned sizes[2];
+      dynarray<uint8_t> coverage[2];
+      for (unsigned w = 0; w != 2; ++w) {
+        example_benchmark::timer t;
+        worlds[w]->remesh();
+        sprintf(label, "remesh hills %s", w ? "greedy" : "one voxel faces");
+        example_benchmark::report(label, t.get_seconds());
+        sizes[w] = worlds[w]->get_cpu_vertices().size() * sizeof(mesh::vertex) + worlds[w]->get_cpu_indices().size() * sizeof(uint32_t);
+        rasterize(coverage[w], worlds[w], dim);
+      }
+
+      bool keys_ok = true;
+      unsigned num_faces = 0, num_greedy_faces = 0;
+      for (int i = 0; i != 4 * 4 * 4; ++i) {
+        mesh_greedy_faces<key_checker, 32> check;
+        check.subcube = greedy->get_subcube(ivec3(i & 3, (i >> 2) & 3, i >> 4));
+        if (!check.subcube) continue;
+        check.subcube->add_greedy_faces(check);
+        keys_ok = keys_ok && check.ok;
+        num_greedy_faces += check.num_faces;
+      }
+      for (unsigned i = 0; i != coverage[0].size(); ++i) {
+        num_faces += coverage[0][i] % 15;
+      }
+
+      printf("  %u faces, %u greedy faces\n", num_faces, num_greedy_faces);
+      printf("  %.1f MB of buffers, %.1f MB greedy\n", sizes[0] / (1024.0 * 1024), sizes[1] / (1024.0 * 1024));
+      bool same = keys_ok && !memcmp(coverage[0].data(), coverage[1].data(), coverage[0].size());
+      printf("  %s\n", same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // the first solid voxel on the ray, one voxel at a time.
+    static bool step_voxels(const mesh_voxels *world, ivec3_in dim, vec3_in org, vec3_in dir, float max_lambda, mesh_voxels::hit &result) {
+      vec3 o = org + vec3(dim) * 0.5f;
+      float t = 0, t_max = max_lambda;
+      int axis = -1;
+      for (int k = 0; k != 3; ++k) {
+        if (dir[k] == 0) {
+          if (o[k] < 0 || o[k] >= dim[k]) return false;
+        } else {
+          float ta = (0 - o[k]) / dir[k], tb = (dim[k] - o[k]) / dir[k];
+          if (ta > tb) std::swap(ta, tb);
+          if (ta > t) { t = ta; axis = k; }
+          t_max = std::min(t_max, tb);
+        }
+      }
+      if (t > t_max) return false;
+
+      ivec3 cell;
+      for (int k = 0; k != 3; ++k) {
+        cell[k] = std::max(0, std::min(dim[k] - 1, (int)floorf(o[k] + t * dir[k])));
+      }
+
+      for (;;) {
+        if (world->get_voxel(cell)) {
+          result.voxel = cell;
+          result.normal = vec3(0, 0, 0);
+          if (axis != -1) result.normal[axis] = dir[axis] > 0 ? -1.0f : 1.0f;
+          result.distance = t;
+          return true;
+        }
+        float t_exit = 1e30f;
+        for (int k = 0; k != 3; ++k) {
+          if (dir[k] != 0) {
+            float tk = ((dir[k] > 0 ? cell[k] + 1 : cell[k]) - o[k]) / dir[k];
+            if (tk < t_exit) { t_exit = tk; axis = k; }
+          }
+        }
+        t = std::max(t, t_exit);
+        if (t > t_max) return false;
+        cell[axis] += dir[axis] > 0 ? 1 : -1;
+        if (cell[axis] < 0 || cell[axis] >= dim[axis]) return false;
+      }
+    }
+
+    static void ray_test(unsigned num_rays) {
+      char label[80];
+      mat4t voxelToWorld;
+      voxelToWorld.loadIdentity();
+      ivec3 size(16, 8, 16);
+      ivec3 dim = size * 32;
+
+      example_benchmark::timer t;
+      ref<mesh_voxels> world = new mesh_voxels(1, size);
+      world->draw(voxelToWorld, hills());
+      world->update_lod();
+      sprintf(label, "draw %dx%dx%d hills", dim.x(), dim.y(), dim.z());
+      example_benchmark::report(label, t.get_seconds());
+      unsigned num_subcubes = size.x() * size.y() * size.z(), num_stored = world->get_num_stored_subcubes();
+      printf("  %u of %u subcubes stored, %.1f MB instead of %.1f MB\n", num_stored, num_subcubes,
+        num_stored * sizeof(mesh_voxel_subcube) / (1024.0 * 1024), num_subcubes * sizeof(mesh_voxel_subcube) / (1024.0 * 1024)
+      );
+
+      // picking rays from the sky and lines of sight across the hills.
+      dynarray<vec3> orgs(num_rays), dirs(num_rays);
+      for (unsigned i = 0; i != num_rays; ++i) {
+        if (i & 1) {
+          orgs[i] = vec3(get_random() * dim.x() * 0.5f, 100, get_random() * dim.z() * 0.5f);
+          dirs[i] = normalize(vec3(get_random(), -1, get_random()));
+        } else {
+          orgs[i] = vec3(get_random() * dim.x() * 0.5f, get_random() * 10 + 5, get_random() * dim.z() * 0.5f);
+          dirs[i] = normalize(vec3(get_random(), get_random() * 0.05f, get_random()));
+        }
+      }
+
+      dynarray<mesh_voxels::hit> hits(num_rays), expected(num_rays);
+      dynarray<uint8_t> found(num_rays), expected_found(num_rays);
+      t.reset();
+      for (unsigned i = 0; i != num_rays; ++i) {
+        expected_found[i] = step_voxels(world, dim, orgs[i], dirs[i], 1000, expected[i]);
+      }
+      sprintf(label, "%u rays one voxel at a time", num_rays);
+      example_benchmark::report(label, t.get_seconds());
+
+      t.reset();
+      for (unsigned i = 0; i != num_rays; ++i) {
+        found[i] = world->ray_cast(orgs[i], dirs[i], 1000, hits[i]);
+      }
+      sprintf(label, "%u rays mesh_voxels::ray_cast", num_rays);
+      example_benchmark::report(label, t.get_seconds());
+
+      unsigned num_hits = 0, num_different = 0;
+      for (unsigned i = 0; i != num_rays; ++i) {
+        num_hits += found[i];
+        if (found[i] != expected_found[i]) {
+          num_different++;
+        } else if (found[i]) {
+          const mesh_voxels::hit &a = hits[i], &b = expected[i];
+          bool same = all(a.voxel == b.voxel) && all(a.normal == b.normal) && a.distance == b.distance;
+          num_different += !same;
+        }
+      }
+      printf("  %u hits, %u different\n", num_hits, num_different);
+      printf("  %s\n", num_different == 0 ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      dig_test(100, 20);
+      greedy_test();
+      ray_test(20000);
+    }
+  };
+}
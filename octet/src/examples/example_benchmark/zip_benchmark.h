@@ -0,0 +1,526 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// inflate speed of zip_decoder against the old decoder, over the zip files in assets/
+// and the deflate streams inside PNG files.
+//
+
+namespace octet {
+  class zip_benchmark {
+    // the decoder from before the table driven version, kept here for comparison.
+    // debug output is turned off, it printed every symbol and header field.
+    class legacy_zip_decoder {
+      enum { debug = 0 };
+
+      struct huffman_table {
+        uint8_t min_lit_length;
+        uint8_t max_lit_length;
+        uint8_t min_dist_length;
+        uint8_t max_dist_length;
+
+        //uint8_t lit_lengths[288];
+        uint16_t lit_codes[288];
+        uint16_t lit_limits[18];
+        uint16_t lit_base[18];
+
+        //uint8_t dist_lengths[32];
+        uint16_t dist_codes[32];
+        uint16_t dist_limits[18];
+        uint16_t dist_base[18];
+      };
+
+      huffman_table fixed_;
+      huffman_table var_;
+
+      // on ARM we can do this faster with the "rev" instruction
+      inline static uint16_t rev16(uint16_t value) {
+        // small table version.
+        //static const uint8_t r16[] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
+        //return r16[value&0x0f] * 0x1000 | r16[(value>>4)&0x0f] * 0x100 | r16[(value>>8)&0x0f] * 0x10 | r16[value>>12];
+
+        // this table is probably too big to be efficient. L1 cache misses are very expensive.
+        static const uint8_t r256[] = {
+          0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 
+          0x00+0x10, 0x80+0x10, 0x40+0x10, 0xc0+0x10, 0x20+0x10, 0xa0+0x10, 0x60+0x10, 0xe0+0x10, 
+          0x00+8, 0x80+8, 0x40+8, 0xc0+8, 0x20+8, 0xa0+8, 0x60+8, 0xe0+8, 
+          0x00+0x10+8, 0x80+0x10+8, 0x40+0x10+8, 0xc0+0x10+8, 0x20+0x10+8, 0xa0+0x10+8, 0x60+0x10+8, 0xe0+0x10+8, 
+          0x00+ 4, 0x80+ 4, 0x40+ 4, 0xc0+ 4, 0x20+ 4, 0xa0+ 4, 0x60+ 4, 0xe0+ 4, 
+          0x00+0x10+ 4, 0x80+0x10+ 4, 0x40+0x10+ 4, 0xc0+0x10+ 4, 0x20+0x10+ 4, 0xa0+0x10+ 4, 0x60+0x10+ 4, 0xe0+0x10+ 4, 
+          0x00+8+ 4, 0x80+8+ 4, 0x40+8+ 4, 0xc0+8+ 4, 0x20+8+ 4, 0xa0+8+ 4, 0x60+8+ 4, 0xe0+8+ 4, 
+          0x00+0x10+8+ 4, 0x80+0x10+8+ 4, 0x40+0x10+8+ 4, 0xc0+0x10+8+ 4, 0x20+0x10+8+ 4, 0xa0+0x10+8+ 4, 0x60+0x10+8+ 4, 0xe0+0x10+8+ 4, 
+          0x00+ 2, 0x80+ 2, 0x40+ 2, 0xc0+ 2, 0x20+ 2, 0xa0+ 2, 0x60+ 2, 0xe0+ 2, 
+          0x00+0x10+ 2, 0x80+0x10+ 2, 0x40+0x10+ 2, 0xc0+0x10+ 2, 0x20+0x10+ 2, 0xa0+0x10+ 2, 0x60+0x10+ 2, 0xe0+0x10+ 2, 
+          0x00+8+ 2, 0x80+8+ 2, 0x40+8+ 2, 0xc0+8+ 2, 0x20+8+ 2, 0xa0+8+ 2, 0x60+8+ 2, 0xe0+8+ 2, 
+          0x00+0x10+8+ 2, 0x80+0x10+8+ 2, 0x40+0x10+8+ 2, 0xc0+0x10+8+ 2, 0x20+0x10+8+ 2, 0xa0+0x10+8+ 2, 0x60+0x10+8+ 2, 0xe0+0x10+8+ 2, 
+          0x00+ 4+ 2, 0x80+ 4+ 2, 0x40+ 4+ 2, 0xc0+ 4+ 2, 0x20+ 4+ 2, 0xa0+ 4+ 2, 0x60+ 4+ 2, 0xe0+ 4+ 2, 
+          0x00+0x10+ 4+ 2, 0x80+0x10+ 4+ 2, 0x40+0x10+ 4+ 2, 0xc0+0x10+ 4+ 2, 0x20+0x10+ 4+ 2, 0xa0+0x10+ 4+ 2, 0x60+0x10+ 4+ 2, 0xe0+0x10+ 4+ 2, 
+          0x00+8+ 4+ 2, 0x80+8+ 4+ 2, 0x40+8+ 4+ 2, 0xc0+8+ 4+ 2, 0x20+8+ 4+ 2, 0xa0+8+ 4+ 2, 0x60+8+ 4+ 2, 0xe0+8+ 4+ 2, 
+          0x00+0x10+8+ 4+ 2, 0x80+0x10+8+ 4+ 2, 0x40+0x10+8+ 4+ 2, 0xc0+0x10+8+ 4+ 2, 0x20+0x10+8+ 4+ 2, 0xa0+0x10+8+ 4+ 2, 0x60+0x10+8+ 4+ 2, 0xe0+0x10+8+ 4+ 2, 
+          0x00+ 1, 0x80+ 1, 0x40+ 1, 0xc0+ 1, 0x20+ 1, 0xa0+ 1, 0x60+ 1, 0xe0+ 1, 
+          0x00+0x10+ 1, 0x80+0x10+ 1, 0x40+0x10+ 1, 0xc0+0x10+ 1, 0x20+0x10+ 1, 0xa0+0x10+ 1, 0x60+0x10+ 1, 0xe0+0x10+ 1, 
+          0x00+8+ 1, 0x80+8+ 1, 0x40+8+ 1, 0xc0+8+ 1, 0x20+8+ 1, 0xa0+8+ 1, 0x60+8+ 1, 0xe0+8+ 1, 
+          0x00+0x10+8+ 1, 0x80+0x10+8+ 1, 0x40+0x10+8+ 1, 0xc0+0x10+8+ 1, 0x20+0x10+8+ 1, 0xa0+0x10+8+ 1, 0x60+0x10+8+ 1, 0xe0+0x10+8+ 1, 
+          0x00+ 4+ 1, 0x80+ 4+ 1, 0x40+ 4+ 1, 0xc0+ 4+ 1, 0x20+ 4+ 1, 0xa0+ 4+ 1, 0x60+ 4+ 1, 0xe0+ 4+ 1, 
+          0x00+0x10+ 4+ 1, 0x80+0x10+ 4+ 1, 0x40+0x10+ 4+ 1, 0xc0+0x10+ 4+ 1, 0x20+0x10+ 4+ 1, 0xa0+0x10+ 4+ 1, 0x60+0x10+ 4+ 1, 0xe0+0x10+ 4+ 1, 
+          0x00+8+ 4+ 1, 0x80+8+ 4+ 1, 0x40+8+ 4+ 1, 0xc0+8+ 4+ 1, 0x20+8+ 4+ 1, 0xa0+8+ 4+ 1, 0x60+8+ 4+ 1, 0xe0+8+ 4+ 1, 
+          0x00+0x10+8+ 4+ 1, 0x80+0x10+8+ 4+ 1, 0x40+0x10+8+ 4+ 1, 0xc0+0x10+8+ 4+ 1, 0x20+0x10+8+ 4+ 1, 0xa0+0x10+8+ 4+ 1, 0x60+0x10+8+ 4+ 1, 0xe0+0x10+8+ 4+ 1, 
+          0x00+ 2+ 1, 0x80+ 2+ 1, 0x40+ 2+ 1, 0xc0+ 2+ 1, 0x20+ 2+ 1, 0xa0+ 2+ 1, 0x60+ 2+ 1, 0xe0+ 2+ 1, 
+          0x00+0x10+ 2+ 1, 0x80+0x10+ 2+ 1, 0x40+0x10+ 2+ 1, 0xc0+0x10+ 2+ 1, 0x20+0x10+ 2+ 1, 0xa0+0x10+ 2+ 1, 0x60+0x10+ 2+ 1, 0xe0+0x10+ 2+ 1, 
+          0x00+8+ 2+ 1, 0x80+8+ 2+ 1, 0x40+8+ 2+ 1, 0xc0+8+ 2+ 1, 0x20+8+ 2+ 1, 0xa0+8+ 2+ 1, 0x60+8+ 2+ 1, 0xe0+8+ 2+ 1, 
+          0x00+0x10+8+ 2+ 1, 0x80+0x10+8+ 2+ 1, 0x40+0x10+8+ 2+ 1, 0xc0+0x10+8+ 2+ 1, 0x20+0x10+8+ 2+ 1, 0xa0+0x10+8+ 2+ 1, 0x60+0x10+8+ 2+ 1, 0xe0+0x10+8+ 2+ 1, 
+          0x00+ 4+ 2+ 1, 0x80+ 4+ 2+ 1, 0x40+ 4+ 2+ 1, 0xc0+ 4+ 2+ 1, 0x20+ 4+ 2+ 1, 0xa0+ 4+ 2+ 1, 0x60+ 4+ 2+ 1, 0xe0+ 4+ 2+ 1, 
+          0x00+0x10+ 4+ 2+ 1, 0x80+0x10+ 4+ 2+ 1, 0x40+0x10+ 4+ 2+ 1, 0xc0+0x10+ 4+ 2+ 1, 0x20+0x10+ 4+ 2+ 1, 0xa0+0x10+ 4+ 2+ 1, 0x60+0x10+ 4+ 2+ 1, 0xe0+0x10+ 4+ 2+ 1, 
+          0x00+8+ 4+ 2+ 1, 0x80+8+ 4+ 2+ 1, 0x40+8+ 4+ 2+ 1, 0xc0+8+ 4+ 2+ 1, 0x20+8+ 4+ 2+ 1, 0xa0+8+ 4+ 2+ 1, 0x60+8+ 4+ 2+ 1, 0xe0+8+ 4+ 2+ 1, 
+          0x00+0x10+8+ 4+ 2+ 1, 0x80+0x10+8+ 4+ 2+ 1, 0x40+0x10+8+ 4+ 2+ 1, 0xc0+0x10+8+ 4+ 2+ 1, 0x20+0x10+8+ 4+ 2+ 1, 0xa0+0x10+8+ 4+ 2+ 1, 0x60+0x10+8+ 4+ 2+ 1, 0xe0+0x10+8+ 4+ 2+ 1, 
+        };
+        return r256[value&0xff] << 8 | r256[(value>>8)&0xff];
+
+        //value = ( ( value >> 1 ) & 0x5555 ) | ( ( value & 0x5555 ) << 1 );
+        //value = ( ( value >> 2 ) & 0x3333 ) | ( ( value & 0x3333 ) << 2 );
+        //value = ( ( value >> 4 ) & 0x0f0f ) | ( ( value & 0x0f0f ) << 4 );
+        //value = ( ( value >> 8 ) & 0x00ff ) | ( ( value & 0x00ff ) << 8 );
+        //return value;
+      }
+
+      bool build_huffman(uint8_t *lengths, unsigned num_lengths, uint8_t &min_length, uint8_t &max_length, uint16_t *codes, uint16_t *limits, uint16_t *base) {
+        min_length = 16;
+        max_length = 0;
+        for (unsigned i = 0; i != num_lengths; ++i) {
+          if (debug) printf("%d,", lengths[i]);
+          if (lengths[i]) {
+            if (min_length > lengths[i]) min_length = lengths[i];
+            if (max_length < lengths[i]) max_length = lengths[i];
+          }
+        }
+        if (debug) printf("\n");
+
+        if (debug) printf("min_length=%d\n", min_length);
+        if (debug) printf("max_length=%d\n", max_length);
+
+        if ( min_length <= 0 || min_length > max_length || max_length > 16 ) {
+          return false;
+        }
+
+        unsigned code = 0;
+        unsigned huffcode = 0;
+        for (unsigned length = min_length; length <= max_length; ++length) {
+          base[length-min_length] = huffcode - code;
+          for (unsigned i = 0; i != num_lengths; ++i) {
+            if (lengths[i] == length) {
+              codes[code++] = i;
+              //dump_bits(huffcode << (16-length), 16, "huffcode");
+              huffcode++;
+            }
+          }
+          limits[length-min_length] = (uint16_t)( ( huffcode << (16-length) ) - 1 );
+          if (debug) printf("length %d: lim=%04x base=%04x\n", length, ( huffcode << (16-length) ) - 1, base[length-min_length]);
+          if (( huffcode << (16-length) ) - 1 > 0xffff) {
+            if (debug) printf("invalid huffman table\n");
+            return false;
+          }
+          huffcode *= 2;
+        }
+
+        // prevent escape from bitstream decoding loop.
+        limits[max_length+1-min_length] = 0xffff;
+        return true;
+      }
+
+      /// debug function for dumping bit fields
+      void dump_bits(unsigned value, unsigned bits, const char *name) {
+        char tmp[64];
+        assert(bits<63);
+        for (unsigned i = 0; i != bits; ++i) tmp[i] = ( ( value >> (bits-1-i) ) & 1 ) + '0';
+        tmp[bits] = 0;
+        printf("[%s] %s\n", tmp, name);
+      }
+
+      /// peek a fixed number of little-endian bits from the bitstream
+      /// note: this will have to be fixed on PPC and other big-endian devices
+      unsigned peek(const uint8_t *src, unsigned bitptr, unsigned bits, const char *name) {
+        unsigned i = bitptr >> 3, j = bitptr & 7;
+        unsigned value = ( (unsigned&)src[i] >> j ) & ( (1u << bits) - 1 );
+        if (debug && name) dump_bits(value, bits, name);
+        return value;
+      }
+
+      unsigned decode_uncompressed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
+        bitptr = ( bitptr + 7 ) & ~7;
+        unsigned bytes_to_copy = peek(src, bitptr, 16, "bytes_to_copy");
+        unsigned clength = peek(src, bitptr + 16, 16, "store length check");
+        bitptr += 32;
+
+        if (bytes_to_copy != (clength^0xffff)) return ~0;
+        if (dest + bytes_to_copy > dest_max) return ~0;
+        if ((src + bitptr/8) + bytes_to_copy > src_max) return ~0;
+
+        memcpy(dest, src + bitptr/8, bytes_to_copy);
+        dest += bytes_to_copy;
+        bitptr += bytes_to_copy * 8;
+        return bitptr;
+      }
+
+      unsigned decode_lz77(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr, huffman_table *table_) {
+        for(;;) {
+          if (src + bitptr/8 > src_max) return ~0;
+          unsigned peek16 = peek(src, bitptr, 16, NULL);
+          unsigned value = rev16(peek16);
+          unsigned index = 0;
+          while (value > table_->lit_limits[index]) {
+            index++;
+          }
+          unsigned length = table_->min_lit_length + index;
+          unsigned offset = ( value >> ( 16 - length ) );
+          unsigned code = table_->lit_codes[offset - table_->lit_base[index]];
+          bitptr += length;
+          if (debug) dump_bits(peek16, length, "code");
+
+          if (code < 256) {
+            if (dest+1 > dest_max) return ~0;
+            *dest++ = code;
+            if (debug) printf("%02x\n", code);
+          } else if (code == 256) {
+            return bitptr;
+          } else {
+            unsigned block_length;
+            unsigned distance;
+            {
+              if (debug) printf("[%d]\n", code);
+              static const uint8_t extra[] = {
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+              };
+              static const uint8_t base[] = {
+                3-3, 4-3, 5-3, 6-3, 7-3, 8-3, 9-3, 10-3,
+                11-3, 13-3, 15-3, 17-3, 19-3, 23-3, 27-3, 31-3,
+                35-3, 43-3, 51-3, 59-3, 67-3, 83-3, 99-3, 115-3,
+                131-3, 163-3, 195-3, 227-3, 258-3,
+              };
+              if (code-257 > sizeof(extra)) return ~0;
+              unsigned extra_length = extra[ code-257 ];
+              block_length = base[ code-257 ] + 3 + peek(src, bitptr, extra_length, "extra");
+              bitptr += extra_length;
+            }
+            {
+              //if (src + (bitptr + table_->max_dist_length)/8 > src_max ) return ~0;
+              unsigned peek16 = peek(src, bitptr, 16, NULL);
+              unsigned value = rev16(peek16);
+              unsigned index = 0;
+              while (value > table_->dist_limits[index]) {
+                index++;
+              }
+              unsigned length = table_->min_dist_length + index;
+              unsigned offset = ( value >> ( 16 - length ) );
+              unsigned code = table_->dist_codes[offset - table_->dist_base[index]];
+              bitptr += length;
+
+              if (debug) printf("{%d}\n", code);
+              static const uint8_t extra[] = {
+                0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0, 0,
+              };
+              static const uint16_t base[] = {
+                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+              };
+              if (code > sizeof(extra)) return ~0;
+              unsigned extra_length = extra[ code ];
+              distance = base[ code ] + peek(src, bitptr, extra_length, "extra");
+              bitptr += extra_length;
+            }
+
+            if (debug) printf("length=%d distance=%d\n", block_length, distance);
+
+            if (dest+block_length > dest_max) return ~0;
+
+            for(unsigned i = 0; i != block_length; ++i) {
+              dest[0] = dest[-(int)distance];
+              dest++;
+            }
+          }
+        }
+      }
+
+      unsigned decode_fixed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
+        return decode_lz77(dest, dest_max, src, src_max, bitptr, &fixed_);
+      }
+
+      unsigned decode_variable(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
+        unsigned num_lit_codes = peek(src, bitptr, 5, "num_lit_codes") + 257;
+        unsigned num_dist_codes = peek(src, bitptr+5, 5, "num_dist_codes") + 1;
+        unsigned num_length_codes = peek(src, bitptr+10, 4, "num_length_codes") + 4;
+      
+        bitptr += 14;
+
+        uint8_t lengths[288 + 32];
+        memset(lengths, 0, 20);
+        if (src + bitptr/8 + num_length_codes > src_max ) return ~0;
+        for (unsigned i = 0; i != num_length_codes; ++i) {
+          static const uint8_t order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+          lengths[order[i]] = peek(src, bitptr, 3, "length code lenghs");
+          bitptr += 3;
+        }
+      
+        uint16_t codes[19];
+        uint16_t limits[18];
+        uint16_t base[18];
+        uint8_t min_length;
+        uint8_t max_length;
+        if (!build_huffman(lengths, 19, min_length, max_length, codes, limits, base)) return ~0;
+      
+        unsigned todo = num_lit_codes + num_dist_codes;
+        for(unsigned done = 0; done < todo;) {
+          if (src + bitptr/8 + max_length > src_max ) return ~0;
+          unsigned peek16 = peek(src, bitptr, 16, NULL);
+          unsigned value = rev16(peek16);
+          unsigned index = 0;
+          while (value > limits[index]) {
+            index++;
+          }
+          unsigned length = min_length + index;
+          unsigned offset = ( value >> ( 16 - length ) );
+          unsigned code = codes[offset - base[index]];
+          bitptr += length;
+          if (debug) dump_bits(peek16, length, "length");
+          //fprintf(source_.debug(), "code=%03x\n", code);
+          unsigned copy = 1;
+          if (code < 16) {
+          } else if(code == 16) {
+            if (src + (bitptr+2)/8 > src_max ) return ~0;
+            copy = peek(src, bitptr, 2, NULL) + 3;
+            bitptr += 2;
+            if (done == 0) return ~0;
+            code = lengths[ done-1 ];
+          } else if(code == 17) {
+            if (src + (bitptr+3)/8 > src_max ) return ~0;
+            copy = peek(src, bitptr, 3, NULL) + 3;
+            bitptr += 3;
+            code = 0;
+          } else if(code == 18) {
+            if (src + (bitptr+7)/8 > src_max ) return ~0;
+            copy = peek(src, bitptr, 7, NULL) + 11;
+            bitptr += 7;
+            code = 0;
+          } else {
+            return ~0;
+          }
+          if (done + copy > todo) return ~0;
+          do {
+            lengths[done++] = code;
+          } while( --copy );
+        }
+
+        if (debug) printf("lengths done\n");
+
+        if(
+          !build_huffman(lengths, num_lit_codes, var_.min_lit_length, var_.max_lit_length, var_.lit_codes, var_.lit_limits, var_.lit_base) ||
+          !build_huffman(lengths+num_lit_codes, num_dist_codes, var_.min_dist_length, var_.max_dist_length, var_.dist_codes, var_.dist_limits, var_.dist_base)
+        ) {
+          return ~0;
+        }
+        return decode_lz77(dest, dest_max, src, src_max, bitptr, &var_);
+      }
+    public:
+      legacy_zip_decoder() {
+        uint8_t lit_lengths[288];
+        uint8_t dist_lengths[32];
+        memset(lit_lengths +   0, 8, 144 - 0);
+        memset(lit_lengths + 144, 9, 256-144);
+        memset(lit_lengths + 256, 7, 280-256);
+        memset(lit_lengths + 280, 8, 288-280);
+        memset(dist_lengths, 5, 32);
+        build_huffman(lit_lengths, 288, fixed_.min_lit_length, fixed_.max_lit_length, fixed_.lit_codes, fixed_.lit_limits, fixed_.lit_base);
+        build_huffman(dist_lengths, 32, fixed_.min_dist_length, fixed_.max_dist_length, fixed_.dist_codes, fixed_.dist_limits, fixed_.dist_base);
+      }
+
+      void decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
+        unsigned bitptr = 0;
+        unsigned is_last_block;
+
+        // for each "deflate" block:
+        do {
+          // prevent (bitptr / 8) from overflowing (>512Mib)
+          src += bitptr / 8;
+          bitptr %= 8;
+
+          // three bits determine kind and exit condition
+          is_last_block = peek(src, bitptr, 1, "deflate last") != 0;
+          unsigned kind = peek(src, bitptr + 1, 2, "deflate kind");
+
+          bitptr += 3;
+          switch (kind) {
+          case 0: bitptr = decode_uncompressed(dest, dest_max, src, src_max, bitptr); break;
+          case 1: bitptr = decode_fixed(dest, dest_max, src, src_max, bitptr); break;
+          case 2: bitptr = decode_variable(dest, dest_max, src, src_max, bitptr); break;
+          default: return;
+          }
+        } while( !is_last_block && bitptr != ~0);
+      }
+    };
+
+
+    // a compressed stream and its size when inflated
+    struct stream {
+      string name;
+      dynarray<uint8_t> comp;
+      unsigned usize;
+    };
+
+    static unsigned u4(const uint8_t *src) {
+      return src[0] + src[1] * 256 + src[2] * 65536 + src[3] * 0x1000000;
+    }
+
+    static unsigned u2(const uint8_t *src) {
+      return src[0] + src[1] * 256;
+    }
+
+    static unsigned b4(const uint8_t *src) {
+      return src[0] * 0x1000000 + src[1] * 65536 + src[2] * 256 + src[3];
+    }
+
+    // add the deflated entries of a zip file, using the central directory like zip_file does.
+    static void add_zip(dynarray<stream*> &streams, const char *url) {
+      mapped_url file;
+      app_utils::get_url(file, url);
+      const uint8_t *src = file.get_src();
+      size_t size = file.get_size();
+      for (size_t i = size < 22 ? 0 : size - 22; size >= 22 && i != (size_t)-1; --i) {
+        if (u4(src + i) != 0x06054b50) continue;
+        const uint8_t *p = src + u4(src + i + 16);
+        const uint8_t *end = p + u4(src + i + 12);
+        while (p + 46 <= end && u4(p) == 0x02014b50) {
+          unsigned compression = u2(p + 10);
+          unsigned csize = u4(p + 20);
+          unsigned usize = u4(p + 24);
+          unsigned name_len = u2(p + 28);
+          const uint8_t *local = src + u4(p + 42);
+          if (compression == 8) {
+            stream *s = new stream();
+            s->name.format("%s/%.*s", url, name_len, (const char*)p + 46);
+            const uint8_t *data = local + 30 + u2(local + 26) + u2(local + 28);
+            s->comp.resize(csize + 4); // the old decoder reads up to four bytes past the end
+            memcpy(s->comp.data(), data, csize);
+            s->comp.resize(csize);
+            s->usize = usize;
+            streams.push_back(s);
+          }
+          p += 46 + name_len + u2(p + 30) + u2(p + 32);
+        }
+        break;
+      }
+    }
+
+    // add the image data of a non-interlaced PNG file, which is a zlib stream split into IDAT chunks.
+    static void add_png(dynarray<stream*> &streams, const char *url) {
+      mapped_url file;
+      app_utils::get_url(file, url);
+      const uint8_t *src = file.get_src();
+      const uint8_t *src_max = file.get_src_max();
+      if (file.get_size() < 8 || memcmp(src, "\x89PNG", 4)) return;
+      stream *s = new stream();
+      s->name = url;
+      s->usize = 0;
+      dynarray<uint8_t> zlib;
+      for (const uint8_t *p = src + 8; p + 12 <= src_max; p += 12 + b4(p)) {
+        unsigned length = b4(p);
+        if (!memcmp(p + 4, "IHDR", 4)) {
+          static const uint8_t channels[] = { 1, 0, 3, 1, 2, 0, 4 };
+          unsigned width = b4(p + 8), height = b4(p + 12), depth = p[16], colour = p[17];
+          s->usize = height * (1 + (width * channels[colour < 7 ? colour : 0] * depth + 7) / 8);
+        } else if (!memcmp(p + 4, "IDAT", 4)) {
+          for (unsigned i = 0; i != length; ++i) zlib.push_back(p[8 + i]);
+        }
+      }
+      if (zlib.size() < 2 || !s->usize) { delete s; return; }
+      // skip the two byte zlib header.
+      s->comp.resize(zlib.size() + 4);
+      memcpy(s->comp.data(), zlib.data() + 2, zlib.size() - 2);
+      s->comp.resize(zlib.size() - 2);
+      streams.push_back(s);
+    }
+
+    static void inflate_test(stream *s, unsigned reps) {
+      dynarray<uint8_t> legacy_result(s->usize);
+      dynarray<uint8_t> result(s->usize);
+      char label[80];
+      double bytes = (double)s->usize * reps;
+      const uint8_t *src = s->comp.data();
+      const uint8_t *src_max = src + s->comp.size();
+
+      {
+        legacy_zip_decoder dec;
+        example_benchmark::timer t;
+        for (unsigned r = 0; r != reps; ++r) {
+          dec.decode(legacy_result.data(), legacy_result.data() + s->usize, src, src_max);
+        }
+        sprintf(label, "%s legacy", s->name.c_str());
+        example_benchmark::report(label, t.get_seconds(), bytes);
+      }
+
+      bool ok = true;
+      {
+        zip_decoder dec;
+        example_benchmark::timer t;
+        for (unsigned r = 0; r != reps; ++r) {
+          ok &= dec.decode(result.data(), result.data() + s->usize, src, src_max);
+        }
+        sprintf(label, "%s tables", s->name.c_str());
+        example_benchmark::report(label, t.get_seconds(), bytes);
+      }
+
+      bool same = ok && !memcmp(legacy_result.data(), result.data(), s->usize);
+      printf("  %u -> %u bytes %s\n", s->comp.size(), s->usize, same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+    // get every file of big.zip many times, one at a time and then in parallel with get_files().
+    static void batch_test(unsigned reps) {
+      static const char *const names[] = { "big.fnt", "big_0.gif", "big_0.png", "big.bmfc" };
+      enum { num_names = sizeof(names) / sizeof(names[0]) };
+      unsigned num_files = num_names * reps;
+      dynarray<const char *> files(num_files);
+      for (unsigned i = 0; i != num_files; ++i) files[i] = names[i % num_names];
+
+      zip_file *zip = app_utils::get_zip_file("assets/big.zip");
+      dynarray<dynarray<uint8_t> > serial(num_files);
+      dynarray<dynarray<uint8_t> > parallel(num_files);
+      double bytes = 0;
+      char label[80];
+
+      {
+        example_benchmark::timer t;
+        for (unsigned i = 0; i != num_files; ++i) {
+          zip->get_file(serial[i], files[i]);
+          bytes += serial[i].size();
+        }
+        sprintf(label, "big.zip %u files get_file", num_files);
+        example_benchmark::report(label, t.get_seconds(), bytes);
+      }
+
+      {
+        example_benchmark::timer t;
+        zip->get_files(parallel.data(), files.data(), num_files);
+        sprintf(label, "big.zip %u files get_files", num_files);
+        example_benchmark::report(label, t.get_seconds(), bytes);
+      }
+
+      bool same = true;
+      for (unsigned i = 0; i != num_files; ++i) {
+        same &= serial[i].size() != 0 && serial[i].size() == parallel[i].size() && !memcmp(serial[i].data(), parallel[i].data(), serial[i].size());
+      }
+      printf("  %u threads %s\n", job_scheduler::get().get_num_threads(), same ? "(results match)" : "(RESULTS DIFFER)");
+    }
+
+  public:
+    static void run() {
+      dynarray<stream*> streams;
+      add_zip(streams, "assets/big.zip");
+      add_png(streams, "assets/big_0.png");
+      add_png(streams, "src/examples/lasertrap/resources/level1/tilesheet.png");
+      for (unsigned i = 0; i != streams.size(); ++i) {
+        inflate_test(streams[i], 200);
+        delete streams[i];
+      }
+      batch_test(256);
+    }
+  };
+}
@@ -8,9 +8,10 @@
 
 namespace octet { namespace helpers {
   /// Class for picking objects using mouse clicks.
+  /// Clicking on a mesh instance selects it, which draws its bounding box.
   class object_picker {
     app *the_app;
-    dynarray<ref<mesh_instance> > objects;
+    ref<mesh_instance> selected;
   public:
     object_picker() {
     }
@@ -19,9 +20,15 @@ namespace octet { namespace helpers {
       this->the_app = the_app;
     }
 
+    /// get the selected mesh instance, NULL if there is none.
+    mesh_instance *get_selected() const {
+      return selected;
+    }
+
+    /// call this once a frame to pick with the left mouse button.
     void update(visual_scene *the_scene) {
-      bool is_mouse_down = the_app->is_key_down(key_lmb);
-      if (is_mouse_down) {
+      bool is_mouse_going_down = the_app->is_key_going_down(key_lmb);
+      if (is_mouse_going_down) {
         int mx = 0, my = 0;
         int vx = 0, vy = 0;
         the_app->get_mouse_pos(mx, my);
@@ -39,7 +46,12 @@ namespace octet { namespace helpers {
 
         visual_scene::cast_result res;
         the_scene->cast_ray(res, the_ray);
-        if (res.mi) {
+        if (selected) {
+          selected->set_flags(selected->get_flags() & ~mesh_instance::flag_selected);
+        }
+        selected = res.mi;
+        if (selected) {
+          selected->set_flags(selected->get_flags() | mesh_instance::flag_selected);
           //printf("%s\n", res.depth.toString());
         }
       }
@@ -32,6 +32,15 @@ namespace octet { namespace loaders {
     unsigned num_mcu_blocks;
     unsigned num_components_in_scan;
 
+    // number of MCUs between RSTn markers from the DRI chunk, zero if there are none.
+    unsigned restart_interval;
+
+    // threads to decode large images with, zero for one per core.
+    unsigned num_threads;
+
+    // end of the file data
+    const uint8_t *file_end;
+
     // skip a number of bits in the file.
     // there is a special case where every 0xff byte is followed by 0x00
     static void skip_bits(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
@@ -69,13 +78,12 @@ namespace octet { namespace loaders {
       uint8_t dc_table;
       unsigned width_in_blocks;
       unsigned height_in_blocks;
-      int last_dc;
     } scan_components[4];
 
     // quantisation table. We multiply the dc and ac coefficients by these numbers.
     // this is the lossy part of the compression
     struct quant_table {
-      float table[64];
+      uint16_t table[64];
     } quant_tables[4];
 
     // A huffman table maps variable length codes to lengths and values.
@@ -113,11 +121,48 @@ namespace octet { namespace loaders {
       huffman_table *dc_table;
       huffman_table *ac_table;
       quant_table *quant;
-      scan_component *scan_comp;
+      unsigned scan_index;
+
+      // where the block goes in mcu_context::pixels
+      unsigned pixel_offset;
+      unsigned pixel_stride;
     } mcu_blocks[8];
 
-    float dct_coeffs[8*64];
-    float ycrcb_values[8*64];
+    // Pixels between the inverse DCT and colour conversion.
+    // Without SSE2 the old floating point path is faster than the 16 bit fixed point one,
+    // so the pixels stay as floats (with 128 added but not clamped) until colour conversion.
+    #if OCTET_SSE2
+      typedef uint8_t pixel_t;
+    #else
+      typedef float pixel_t;
+    #endif
+
+    // What one thread needs to decode MCUs.
+    // The decoder's own tables are only read, so many threads can use them.
+    struct mcu_context {
+      // DC terms are coded relative to the previous block of the same component.
+      int last_dc[4];
+
+      // dequantised coefficients of the blocks of one MCU
+      int16_t coeffs[8*64];
+
+      // pixels of one MCU after the inverse DCT: a 16x16 Y plane (8x8 for 4:4:4), then Cb and Cr.
+      pixel_t pixels[16*16 + 8*8 + 8*8];
+    };
+
+    enum { cb_offset = 16*16, cr_offset = 16*16 + 8*8 };
+
+    // the current scan
+    uint8_t *image_base;
+    int image_stride;
+    unsigned mcus_x;
+    unsigned mcus_y;
+
+    // start of the entropy coded data of each restart interval in the current scan
+    dynarray<const uint8_t *> interval_starts;
+
+    // use SSE2 for the inverse DCT and colour conversion. The scalar code gives identical results.
+    bool use_simd;
 
     unsigned u2(const uint8_t *src) {
       return src[0] * 256 + src[1];
@@ -143,12 +188,12 @@ namespace octet { namespace loaders {
     static int extend(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
       uint16_t acc16 = acc >> shift;
       unsigned v = acc16 >> (16 - bits);
-      return v < ( 1u << ( bits-1 ) ) ? (int)v + ( -1 << bits ) + 1 : (int)v;
+      return v < ( 1u << ( bits-1 ) ) ? (int)v - ( 1 << bits ) + 1 : (int)v;
     }
 
     // decode one block of an MCU which may contain many blocks
     // The Y component may have four blocks, for example, and only one each of Cr, Cb
-    void decode_mcu_block(unsigned block_num, unsigned &acc, const uint8_t *&src, int &shift, float *outptr) {
+    void decode_mcu_block(unsigned block_num, unsigned &acc, const uint8_t *&src, int &shift, int *last_dc, int16_t *outptr) {
       mcu_block &block = mcu_blocks[block_num];
 
       unsigned value = block.dc_table->decode(acc, src, shift);
@@ -159,8 +204,8 @@ namespace octet { namespace loaders {
         skip_bits(value, acc, src, shift);
         //if (debug) printf("dc=%d\n", dc);
       }
-      int abs_dc = block.scan_comp->last_dc += dc;
-      outptr[0] = abs_dc * block.quant->table[0];
+      int abs_dc = last_dc[block.scan_index] += dc;
+      outptr[0] = (int16_t)(abs_dc * block.quant->table[0]);
 
       for (int ac_coef = 1; ac_coef < 64; ++ac_coef) {
         unsigned value = block.ac_table->decode(acc, src, shift);
@@ -172,7 +217,7 @@ namespace octet { namespace loaders {
           int ac = extend(value, acc, src, shift);
           skip_bits(value, acc, src, shift);
           //if (debug) printf("ac=%d,%d coef=%d zig_zag=%d\n", skip, ac, ac_coef, zig_zag(ac_coef));
-          outptr[zig_zag(ac_coef)] = (float)ac * block.quant->table[ac_coef];
+          outptr[zig_zag(ac_coef)] = (int16_t)(ac * block.quant->table[ac_coef]);
         } else if (skip != 15) {
           break;
         }
@@ -180,175 +225,592 @@ namespace octet { namespace loaders {
       if (debug) {
         for (int j = 0; j != 8; ++j) {
           for (int i = 0; i != 8; ++i) {
-            printf("%3.0f ", outptr[i+j*8]);
+            printf("%4d ", outptr[i+j*8]);
           }
           printf("\n");
         }
       }
     }
 
-    // one dimensional inverse DCT.
-    // c0 is the DC term and c1..c7 increase in frequency
-    // example: c0 = 128, c1..c7 = 0 -> 128, 128, 128, 128, 128, 128, 128, 128
-    // todo: improve this!
-    OCTET_HOT void idct(float &c0, float &c1, float &c2, float &c3, float &c4, float &c5, float &c6, float &c7) {
-      float c2c6_1 = (c2 + c6) * 0.541196100f;
-      float c2c6_2 = c2c6_1 + c6 * -1.847759065f;
-      float c2c6_3 = c2c6_1 + c2 * 0.765366865f;
-    
-      float c0c4_1 = c0 + c4;
-      float c0c4_2 = c0 - c4;
-    
-      float ceven_1 = c0c4_1 + c2c6_3;
-      float ceven_2 = c0c4_1 - c2c6_3;
-      float ceven_3 = c0c4_2 + c2c6_2;
-      float ceven_4 = c0c4_2 - c2c6_2;
-    
-      float c1c7 = c7 + c1;
-      float c3c5 = c5 + c3;
-      float c7c3 = c7 + c3;
-      float c5c1 = c5 + c1;
-      float codd_0 = (c7c3 + c5c1) * 1.175875602f;
-    
-      float codd_4 = c7 * 0.298631336f;
-      float codd_3 = c5 * 2.053119869f;
-      float codd_2 = c3 * 3.072711026f;
-      float codd_1 = c1 * 1.501321110f;
-      c1c7 = c1c7 * -0.899976223f;
-      c3c5 = c3c5 * -2.562915447f;
-      c7c3 = c7c3 * -1.961570560f;
-      c5c1 = c5c1 * -0.390180644f;
-    
-      c7c3 += codd_0;
-      c5c1 += codd_0;
-    
-      codd_4 += c1c7 + c7c3;
-      codd_3 += c3c5 + c5c1;
-      codd_2 += c3c5 + c7c3;
-      codd_1 += c1c7 + c5c1;
-    
-      c0 = ceven_1 + codd_1;
-      c7 = ceven_1 - codd_1;
-      c1 = ceven_3 + codd_2;
-      c6 = ceven_3 - codd_2;
-      c2 = ceven_4 + codd_3;
-      c5 = ceven_4 - codd_3;
-      c3 = ceven_2 + codd_4;
-      c4 = ceven_2 - codd_4;
+    // Integer inverse DCT constants: cos() terms of the Loeffler, Ligtenberg and Moschytz
+    // factorisation, scaled by 4096 and combined in pairs for the SSE2 multiply-add.
+    enum {
+      idct_c2 = 2217,     // 0.541196100
+      idct_c6 = -7568,    // -1.847759065
+      idct_c2b = 3135,    // 0.765366865
+      idct_odd = 4816,    // 1.175875602
+      idct_o7 = 1223,     // 0.298631336
+      idct_o5 = 8410,     // 2.053119869
+      idct_o3 = 12586,    // 3.072711026
+      idct_o1 = 6149,     // 1.501321110
+      idct_o17 = -3686,   // -0.899976223
+      idct_o35 = -10498,  // -2.562915447
+      idct_o73 = -8035,   // -1.961570560
+      idct_o51 = -1598,   // -0.390180644
+
+      // rounding and scale of the two passes. The second pass also adds 128 to centre the pixels.
+      idct_pass1_shift = 10,
+      idct_pass1_bias = 1 << (idct_pass1_shift - 1),
+      idct_pass2_shift = 17,
+      idct_pass2_bias = (1 << (idct_pass2_shift - 1)) + (128 << idct_pass2_shift),
+    };
+
+    // one dimensional inverse DCT of eight values spaced step apart.
+    // This is the reference for idct_block_sse2 and does exactly the same arithmetic:
+    // the sums cast to int16_t wrap like the 16 bit SSE2 lanes.
+    static OCTET_HOT void idct_1d(int *dest, const int16_t *src, unsigned step, int bias) {
+      int s0 = src[0*step], s1 = src[1*step], s2 = src[2*step], s3 = src[3*step];
+      int s4 = src[4*step], s5 = src[5*step], s6 = src[6*step], s7 = src[7*step];
+
+      // even part
+      int t2 = s2 * idct_c2 + s6 * (idct_c2 + idct_c6);
+      int t3 = s2 * (idct_c2 + idct_c2b) + s6 * idct_c2;
+      int t0 = (int16_t)(s0 + s4) * 4096 + bias;
+      int t1 = (int16_t)(s0 - s4) * 4096 + bias;
+      int x0 = t0 + t3, x3 = t0 - t3;
+      int x1 = t1 + t2, x2 = t1 - t2;
+
+      // odd part
+      int sum17 = (int16_t)(s1 + s7);
+      int sum35 = (int16_t)(s3 + s5);
+      int p1 = sum17 * (idct_odd + idct_o17) + sum35 * idct_odd;
+      int p2 = sum17 * idct_odd + sum35 * (idct_odd + idct_o35);
+      int o0 = s7 * (idct_o73 + idct_o7) + s3 * idct_o73 + p1;
+      int o1 = s5 * (idct_o51 + idct_o5) + s1 * idct_o51 + p2;
+      int o2 = s7 * idct_o73 + s3 * (idct_o73 + idct_o3) + p2;
+      int o3 = s5 * idct_o51 + s1 * (idct_o51 + idct_o1) + p1;
+
+      dest[0] = x0 + o3; dest[7] = x0 - o3;
+      dest[1] = x1 + o2; dest[6] = x1 - o2;
+      dest[2] = x2 + o1; dest[5] = x2 - o1;
+      dest[3] = x3 + o0; dest[4] = x3 - o0;
+    }
+
+    static int clamp_int(int v, int min, int max) {
+      return v < min ? min : v > max ? max : v;
     }
 
-    // Two dimensional inverse DCT
-    // we can do the rows and columns separately.
-    // Optimisations include spotting blank rows and columns, but this
-    // is just a reference design.
-    void inverse_dct(float *inptr) {
-      // do rows
+    // Two dimensional inverse DCT: columns, then rows.
+    // Writes 8x8 pixels with 128 added and clamped to 0..255.
+    static void idct_block_scalar(uint8_t *dest, unsigned stride, const int16_t *src) {
+      int16_t tmp[64];
+      int values[8];
       for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*0+i], inptr[8*1+i], inptr[8*2+i], inptr[8*3+i], inptr[8*4+i], inptr[8*5+i], inptr[8*6+i], inptr[8*7+i]);
+        const int16_t *col = src + i;
+        if ((col[8] | col[16] | col[24] | col[32] | col[40] | col[48] | col[56]) == 0) {
+          // most columns only have a DC term: every value of the full calculation is the same.
+          int16_t dc = (int16_t)clamp_int((col[0] * 4096 + idct_pass1_bias) >> idct_pass1_shift, -32768, 32767);
+          for (unsigned j = 0; j != 8; ++j) {
+            tmp[j*8+i] = dc;
+          }
+          continue;
+        }
+        idct_1d(values, col, 8, idct_pass1_bias);
+        for (unsigned j = 0; j != 8; ++j) {
+          tmp[j*8+i] = (int16_t)clamp_int(values[j] >> idct_pass1_shift, -32768, 32767);
+        }
+      }
+      for (unsigned j = 0; j != 8; ++j) {
+        idct_1d(values, tmp + j*8, 1, idct_pass2_bias);
+        for (unsigned i = 0; i != 8; ++i) {
+          dest[j*stride+i] = (uint8_t)clamp_int(values[i] >> idct_pass2_shift, 0, 255);
+        }
       }
+    }
 
-      // do columns
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*i+0], inptr[8*i+1], inptr[8*i+2], inptr[8*i+3], inptr[8*i+4], inptr[8*i+5], inptr[8*i+6], inptr[8*i+7]);
+    #if !OCTET_SSE2
+      // one dimensional floating point inverse DCT.
+      // c0 is the DC term and c1..c7 increase in frequency. The result has a scale of 8.
+      static OCTET_HOT void idct_float(float &c0, float &c1, float &c2, float &c3, float &c4, float &c5, float &c6, float &c7) {
+        float c2c6_1 = (c2 + c6) * 0.541196100f;
+        float c2c6_2 = c2c6_1 + c6 * -1.847759065f;
+        float c2c6_3 = c2c6_1 + c2 * 0.765366865f;
+
+        float c0c4_1 = c0 + c4;
+        float c0c4_2 = c0 - c4;
+
+        float ceven_1 = c0c4_1 + c2c6_3;
+        float ceven_2 = c0c4_1 - c2c6_3;
+        float ceven_3 = c0c4_2 + c2c6_2;
+        float ceven_4 = c0c4_2 - c2c6_2;
+
+        float c1c7 = c7 + c1;
+        float c3c5 = c5 + c3;
+        float c7c3 = c7 + c3;
+        float c5c1 = c5 + c1;
+        float codd_0 = (c7c3 + c5c1) * 1.175875602f;
+
+        float codd_4 = c7 * 0.298631336f;
+        float codd_3 = c5 * 2.053119869f;
+        float codd_2 = c3 * 3.072711026f;
+        float codd_1 = c1 * 1.501321110f;
+        c1c7 = c1c7 * -0.899976223f;
+        c3c5 = c3c5 * -2.562915447f;
+        c7c3 = c7c3 * -1.961570560f;
+        c5c1 = c5c1 * -0.390180644f;
+
+        c7c3 += codd_0;
+        c5c1 += codd_0;
+
+        codd_4 += c1c7 + c7c3;
+        codd_3 += c3c5 + c5c1;
+        codd_2 += c3c5 + c7c3;
+        codd_1 += c1c7 + c5c1;
+
+        c0 = ceven_1 + codd_1;
+        c7 = ceven_1 - codd_1;
+        c1 = ceven_3 + codd_2;
+        c6 = ceven_3 - codd_2;
+        c2 = ceven_4 + codd_3;
+        c5 = ceven_4 - codd_3;
+        c3 = ceven_2 + codd_4;
+        c4 = ceven_2 - codd_4;
       }
 
-      if (debug) {
-        for (int j = 0; j != 8; ++j) {
-          for (int i = 0; i != 8; ++i) {
-            printf("%f ", inptr[i+j*8]);
+      // Two dimensional floating point inverse DCT: columns, then rows.
+      // Writes 8x8 pixels with 128 added, clamped later by colour conversion.
+      static void idct_block_float(float *dest, unsigned stride, const int16_t *src) {
+        float tmp[64];
+        for (unsigned i = 0; i != 64; ++i) {
+          tmp[i] = src[i];
+        }
+        for (unsigned i = 0; i != 8; ++i) {
+          idct_float(tmp[8*0+i], tmp[8*1+i], tmp[8*2+i], tmp[8*3+i], tmp[8*4+i], tmp[8*5+i], tmp[8*6+i], tmp[8*7+i]);
+        }
+        for (unsigned j = 0; j != 8; ++j) {
+          float *row = tmp + j*8;
+          idct_float(row[0], row[1], row[2], row[3], row[4], row[5], row[6], row[7]);
+          for (unsigned i = 0; i != 8; ++i) {
+            dest[j*stride+i] = row[i] * 0.125f + 128;
           }
-          printf("\n");
         }
       }
-    }
+    #endif
 
-    // clamp to 0..255 range without using branches.
-    // fabsf is usually implemented in hardware (with fast math options)
-    OCTET_HOT uint8_t clamp(float v) {
-      // v + fabsf(v) = 2v when v > 0
-      // v + fabsf(v) = 0  when v < 0
-      float clamp0 = v + fabsf(v);
+    #if OCTET_SSE2
+      // multiply-add pairs from a and b by (k0, k1) giving four 32 bit results for each half.
+      static OCTET_HOT void idct_rotate(__m128i &lo, __m128i &hi, __m128i a, __m128i b, int k0, int k1) {
+        __m128i k = _mm_setr_epi16((short)k0, (short)k1, (short)k0, (short)k1, (short)k0, (short)k1, (short)k0, (short)k1);
+        lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k);
+        hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k);
+      }
 
-      // v - fabsf(v-n) = n when v > n
-      // v - fabsf(v-n) = 2v - n when v < n
-      return (uint8_t)( ( clamp0 - fabsf( clamp0 - (255.999f * 2) ) ) * 0.25f + 128 );
-    }
+      // a 16 bit value times 4096 as 32 bit values
+      static OCTET_HOT void idct_widen(__m128i &lo, __m128i &hi, __m128i a) {
+        lo = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), a), 4);
+        hi = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), a), 4);
+      }
 
-    // convert from Y to RGB
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444_greyscale(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
+      // (a + b) >> shift and (a - b) >> shift, packed back to 16 bits with saturation.
+      static OCTET_HOT void idct_butterfly(__m128i &sum, __m128i &dif, __m128i alo, __m128i ahi, __m128i blo, __m128i bhi, int shift) {
+        __m128i count = _mm_cvtsi32_si128(shift);
+        sum = _mm_packs_epi32(_mm_sra_epi32(_mm_add_epi32(alo, blo), count), _mm_sra_epi32(_mm_add_epi32(ahi, bhi), count));
+        dif = _mm_packs_epi32(_mm_sra_epi32(_mm_sub_epi32(alo, blo), count), _mm_sra_epi32(_mm_sub_epi32(ahi, bhi), count));
+      }
+
+      // one dimensional inverse DCT of eight columns at once, r[0..7] are the rows.
+      static OCTET_HOT void idct_pass_sse2(__m128i *r, int bias, int shift) {
+        __m128i t2l, t2h, t3l, t3h, t0l, t0h, t1l, t1h;
+        idct_rotate(t2l, t2h, r[2], r[6], idct_c2, idct_c2 + idct_c6);
+        idct_rotate(t3l, t3h, r[2], r[6], idct_c2 + idct_c2b, idct_c2);
+        idct_widen(t0l, t0h, _mm_add_epi16(r[0], r[4]));
+        idct_widen(t1l, t1h, _mm_sub_epi16(r[0], r[4]));
+        __m128i b = _mm_set1_epi32(bias);
+        t0l = _mm_add_epi32(t0l, b); t0h = _mm_add_epi32(t0h, b);
+        t1l = _mm_add_epi32(t1l, b); t1h = _mm_add_epi32(t1h, b);
+        __m128i x0l = _mm_add_epi32(t0l, t3l), x0h = _mm_add_epi32(t0h, t3h);
+        __m128i x3l = _mm_sub_epi32(t0l, t3l), x3h = _mm_sub_epi32(t0h, t3h);
+        __m128i x1l = _mm_add_epi32(t1l, t2l), x1h = _mm_add_epi32(t1h, t2h);
+        __m128i x2l = _mm_sub_epi32(t1l, t2l), x2h = _mm_sub_epi32(t1h, t2h);
+
+        __m128i sum17 = _mm_add_epi16(r[1], r[7]);
+        __m128i sum35 = _mm_add_epi16(r[3], r[5]);
+        __m128i p1l, p1h, p2l, p2h, o0l, o0h, o1l, o1h, o2l, o2h, o3l, o3h;
+        idct_rotate(p1l, p1h, sum17, sum35, idct_odd + idct_o17, idct_odd);
+        idct_rotate(p2l, p2h, sum17, sum35, idct_odd, idct_odd + idct_o35);
+        idct_rotate(o0l, o0h, r[7], r[3], idct_o73 + idct_o7, idct_o73);
+        idct_rotate(o1l, o1h, r[5], r[1], idct_o51 + idct_o5, idct_o51);
+        idct_rotate(o2l, o2h, r[7], r[3], idct_o73, idct_o73 + idct_o3);
+        idct_rotate(o3l, o3h, r[5], r[1], idct_o51, idct_o51 + idct_o1);
+        o0l = _mm_add_epi32(o0l, p1l); o0h = _mm_add_epi32(o0h, p1h);
+        o1l = _mm_add_epi32(o1l, p2l); o1h = _mm_add_epi32(o1h, p2h);
+        o2l = _mm_add_epi32(o2l, p2l); o2h = _mm_add_epi32(o2h, p2h);
+        o3l = _mm_add_epi32(o3l, p1l); o3h = _mm_add_epi32(o3h, p1h);
+
+        idct_butterfly(r[0], r[7], x0l, x0h, o3l, o3h, shift);
+        idct_butterfly(r[1], r[6], x1l, x1h, o2l, o2h, shift);
+        idct_butterfly(r[2], r[5], x2l, x2h, o1l, o1h, shift);
+        idct_butterfly(r[3], r[4], x3l, x3h, o0l, o0h, shift);
+      }
+
+      // swap rows and columns of eight registers of eight 16 bit values.
+      static OCTET_HOT void transpose_sse2(__m128i *r) {
+        __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+        __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+        __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+        __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+        __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+        __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+        __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+        __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+        r[0] = _mm_unpacklo_epi64(b0, b4); r[1] = _mm_unpackhi_epi64(b0, b4);
+        r[2] = _mm_unpacklo_epi64(b1, b5); r[3] = _mm_unpackhi_epi64(b1, b5);
+        r[4] = _mm_unpacklo_epi64(b2, b6); r[5] = _mm_unpackhi_epi64(b2, b6);
+        r[6] = _mm_unpacklo_epi64(b3, b7); r[7] = _mm_unpackhi_epi64(b3, b7);
+      }
+
+      // SSE2 version of idct_block_scalar.
+      static void idct_block_sse2(uint8_t *dest, unsigned stride, const int16_t *src) {
+        __m128i r[8];
         for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f);
-          outptr[1] = clamp(128 + y * 0.125f);
-          outptr[2] = clamp(128 + y * 0.125f);
-          outptr[3] = 0xff;
-          outptr += 4;
+          r[i] = _mm_loadu_si128((const __m128i*)(src + i*8));
+        }
+        idct_pass_sse2(r, idct_pass1_bias, idct_pass1_shift);
+        transpose_sse2(r);
+        idct_pass_sse2(r, idct_pass2_bias, idct_pass2_shift);
+        transpose_sse2(r);
+        for (unsigned j = 0; j != 8; j += 2) {
+          __m128i p = _mm_packus_epi16(r[j], r[j+1]);
+          _mm_storel_epi64((__m128i*)(dest + j*stride), p);
+          _mm_storel_epi64((__m128i*)(dest + (j+1)*stride), _mm_srli_si128(p, 8));
         }
-        outptr += stride - 32;
       }
+    #endif
+
+    void inverse_dct(pixel_t *dest, unsigned stride, const int16_t *src) {
+      #if OCTET_SSE2
+        if (use_simd) {
+          idct_block_sse2(dest, stride, src);
+          return;
+        }
+        idct_block_scalar(dest, stride, src);
+      #else
+        idct_block_float(dest, stride, src);
+      #endif
     }
 
-    // convert from YCrCb to RGB
+    // YCbCr to RGB constants scaled by 4096.
     // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          float cb = inptr[64];
-          float cr = inptr[128];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
+    enum {
+      cr_to_r = 5743,   // 1.402
+      cb_to_g = -1410,  // -0.34414
+      cr_to_g = -2925,  // -0.71414
+      cb_to_b = 7258,   // 1.772
+    };
+
+    // convert count pixels from YCbCr to RGBA.
+    // This is the reference for color_convert_sse2 and mirrors its 16 bit arithmetic:
+    // y is scaled by 16 with rounding, chroma by 256 and multiplied keeping the top 16 bits.
+    static void color_convert_scalar(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        int yw = y[i] * 16 + 8;
+        int cbw = (cb[i] - 128) * 256;
+        int crw = (cr[i] - 128) * 256;
+        dest[0] = (uint8_t)clamp_int((yw + ((crw * cr_to_r) >> 16)) >> 4, 0, 255);
+        dest[1] = (uint8_t)clamp_int((yw + ((cbw * cb_to_g) >> 16) + ((crw * cr_to_g) >> 16)) >> 4, 0, 255);
+        dest[2] = (uint8_t)clamp_int((yw + ((cbw * cb_to_b) >> 16)) >> 4, 0, 255);
+        dest[3] = 0xff;
+        dest += 4;
+      }
+    }
+
+    #if !OCTET_SSE2
+      // truncate to an integer and clamp to 0..255. Clamping the integer is cheaper than clamping the float.
+      static OCTET_HOT uint8_t clamp_float(float v) {
+        return (uint8_t)clamp_int((int)v, 0, 255);
+      }
+
+      // convert count floating point pixels from YCbCr to RGBA.
+      static void color_convert_float(uint8_t *dest, const float *y, const float *cb, const float *cr, unsigned count) {
+        for (unsigned i = 0; i != count; ++i) {
+          float cbf = cb[i] - 128;
+          float crf = cr[i] - 128;
+          dest[0] = clamp_float(y[i] + crf * 1.402f);
+          dest[1] = clamp_float(y[i] - cbf * 0.34414f - crf * 0.71414f);
+          dest[2] = clamp_float(y[i] + cbf * 1.772f);
+          dest[3] = 0xff;
+          dest += 4;
+        }
+      }
+
+      // convert count floating point greyscale pixels to RGBA.
+      static void grey_convert_float(uint8_t *dest, const float *y, unsigned count) {
+        for (unsigned i = 0; i != count; ++i) {
+          dest[0] = dest[1] = dest[2] = clamp_float(y[i]);
+          dest[3] = 0xff;
+          dest += 4;
         }
-        outptr += stride - 32;
+      }
+    #endif
+
+    // convert count greyscale pixels to RGBA.
+    static void grey_convert_scalar(uint8_t *dest, const uint8_t *y, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        dest[0] = dest[1] = dest[2] = y[i];
+        dest[3] = 0xff;
+        dest += 4;
       }
     }
 
-    // convert from YCrCb to RGB
-    // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_411(uint8_t *outptr, int stride, float *inptr) {
+    #if OCTET_SSE2
+      // convert count pixels from YCbCr to RGBA, eight at a time.
+      static void color_convert_sse2(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned count) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i round = _mm_set1_epi16(8);
+        __m128i bias = _mm_set1_epi8(-128);
+        __m128i alpha = _mm_set1_epi16(255);
+        __m128i k_cr_r = _mm_set1_epi16(cr_to_r);
+        __m128i k_cb_g = _mm_set1_epi16(cb_to_g);
+        __m128i k_cr_g = _mm_set1_epi16(cr_to_g);
+        __m128i k_cb_b = _mm_set1_epi16(cb_to_b);
+        for (unsigned i = 0; i != count; i += 8) {
+          __m128i yw = _mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + i)), zero), 4), round);
+          __m128i cbw = _mm_unpacklo_epi8(zero, _mm_xor_si128(_mm_loadl_epi64((const __m128i*)(cb + i)), bias));
+          __m128i crw = _mm_unpacklo_epi8(zero, _mm_xor_si128(_mm_loadl_epi64((const __m128i*)(cr + i)), bias));
+          __m128i r = _mm_add_epi16(yw, _mm_mulhi_epi16(crw, k_cr_r));
+          __m128i g = _mm_add_epi16(_mm_add_epi16(yw, _mm_mulhi_epi16(cbw, k_cb_g)), _mm_mulhi_epi16(crw, k_cr_g));
+          __m128i b = _mm_add_epi16(yw, _mm_mulhi_epi16(cbw, k_cb_b));
+          __m128i rb = _mm_packus_epi16(_mm_srai_epi16(r, 4), _mm_srai_epi16(b, 4));
+          __m128i ga = _mm_packus_epi16(_mm_srai_epi16(g, 4), alpha);
+          __m128i rg = _mm_unpacklo_epi8(rb, ga);
+          __m128i ba = _mm_unpackhi_epi8(rb, ga);
+          _mm_storeu_si128((__m128i*)(dest + i*4), _mm_unpacklo_epi16(rg, ba));
+          _mm_storeu_si128((__m128i*)(dest + i*4 + 16), _mm_unpackhi_epi16(rg, ba));
+        }
+      }
+
+      // convert count greyscale pixels to RGBA, eight at a time.
+      static void grey_convert_sse2(uint8_t *dest, const uint8_t *y, unsigned count) {
+        __m128i alpha = _mm_set1_epi8(-1);
+        for (unsigned i = 0; i != count; i += 8) {
+          __m128i v = _mm_loadl_epi64((const __m128i*)(y + i));
+          __m128i yy = _mm_unpacklo_epi8(v, v);
+          __m128i ya = _mm_unpacklo_epi8(v, alpha);
+          _mm_storeu_si128((__m128i*)(dest + i*4), _mm_unpacklo_epi16(yy, ya));
+          _mm_storeu_si128((__m128i*)(dest + i*4 + 16), _mm_unpackhi_epi16(yy, ya));
+        }
+      }
+    #endif
+
+    void color_convert(uint8_t *dest, const pixel_t *y, const pixel_t *cb, const pixel_t *cr, unsigned count) {
+      #if OCTET_SSE2
+        if (use_simd) {
+          color_convert_sse2(dest, y, cb, cr, count);
+          return;
+        }
+        color_convert_scalar(dest, y, cb, cr, count);
+      #else
+        color_convert_float(dest, y, cb, cr, count);
+      #endif
+    }
+
+    void grey_convert(uint8_t *dest, const pixel_t *y, unsigned count) {
+      #if OCTET_SSE2
+        if (use_simd) {
+          grey_convert_sse2(dest, y, count);
+          return;
+        }
+        grey_convert_scalar(dest, y, count);
+      #else
+        grey_convert_float(dest, y, count);
+      #endif
+    }
+
+    // double the width of a row of eight chroma samples
+    void upsample_row(pixel_t *dest, const pixel_t *src) {
+      #if OCTET_SSE2
+        if (use_simd) {
+          __m128i v = _mm_loadl_epi64((const __m128i*)src);
+          _mm_storeu_si128((__m128i*)dest, _mm_unpacklo_epi8(v, v));
+          return;
+        }
+      #endif
+      for (unsigned i = 0; i != 8; ++i) {
+        dest[i*2] = dest[i*2+1] = src[i];
+      }
+    }
+
+    // convert an 8x8 greyscale MCU to RGBA
+    void color_convert_444_greyscale(uint8_t *outptr, int stride, const pixel_t *pixels) {
       for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y0 = inptr[0x00];
-          float y1 = inptr[0x40];
-          float y2 = inptr[0x80];
-          float y3 = inptr[0xc0];
-          float cb = inptr[0x100];
-          float cr = inptr[0x140];
-          inptr++;
-          outptr[0] = clamp(128 + y0 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y0 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y0 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y1 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y1 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y1 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += stride - 4;
-          outptr[0] = clamp(128 + y2 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y2 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y2 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y3 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y3 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y3 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += -stride + 4;
+        grey_convert(outptr + (int)j * stride, pixels + j * 8, 8);
+      }
+    }
+
+    // convert an 8x8 YCbCr MCU to RGBA
+    void color_convert_444(uint8_t *outptr, int stride, const pixel_t *pixels) {
+      for (unsigned j = 0; j != 8; ++j) {
+        color_convert(outptr + (int)j * stride, pixels + j * 8, pixels + cb_offset + j * 8, pixels + cr_offset + j * 8, 8);
+      }
+    }
+
+    // convert a 16x16 MCU with 2x2 Y blocks and one Cb and Cr block (4:2:0) to RGBA.
+    // Each chroma sample covers 2x2 pixels.
+    void color_convert_411(uint8_t *outptr, int stride, const pixel_t *pixels) {
+      pixel_t cb_row[16], cr_row[16];
+      for (unsigned j = 0; j != 16; ++j) {
+        if ((j & 1) == 0) {
+          upsample_row(cb_row, pixels + cb_offset + j / 2 * 8);
+          upsample_row(cr_row, pixels + cr_offset + j / 2 * 8);
         }
-        outptr += stride*2 - 64;
+        color_convert(outptr + (int)j * stride, pixels + j * 16, cb_row, cr_row, 16);
+      }
+    }
+
+    // entropy decode the blocks of one MCU
+    void decode_mcu(int16_t *coeffs, int *last_dc, unsigned &acc, const uint8_t *&src, int &shift) {
+      memset(coeffs, 0, 64 * num_mcu_blocks * sizeof(int16_t));
+      for (unsigned b = 0; b < num_mcu_blocks; ++b) {
+        decode_mcu_block(b, acc, src, shift, last_dc, coeffs + b * 64);
       }
     }
 
+    // inverse DCT and colour conversion of one MCU into the image
+    void convert_mcu(pixel_t *pixels, const int16_t *coeffs, unsigned mcu) {
+      for (unsigned b = 0; b < num_mcu_blocks; ++b) {
+        inverse_dct(pixels + mcu_blocks[b].pixel_offset, mcu_blocks[b].pixel_stride, coeffs + b * 64);
+      }
+      unsigned x = mcu % mcus_x;
+      unsigned y = mcu / mcus_x;
+      if (num_mcu_blocks == 1) {
+        // assume 4:4:4 Greyscale
+        color_convert_444_greyscale(&image_base[((height - 1 - y * 8) * image_stride) + (x * 8 * 4)], -image_stride, pixels);
+      } else if (num_mcu_blocks == 3) {
+        // assume 4:4:4 YCbCr
+        color_convert_444(&image_base[((height - 1 - y * 8) * image_stride) + (x * 8 * 4)], -image_stride, pixels);
+      } else if (num_mcu_blocks == 6) {
+        // assume 4:2:0 YCbCr
+        color_convert_411(&image_base[((height - 1 - y * 16) * image_stride) + (x * 16 * 4)], -image_stride, pixels);
+      }
+    }
+
+    // Find the restart intervals of the scan starting at src and return the end of the scan.
+    // Intervals are separated by RSTn markers and start on a byte boundary.
+    const uint8_t *find_restart_intervals(const uint8_t *src) {
+      interval_starts.resize(0);
+      interval_starts.push_back(src);
+      const uint8_t *p = src;
+      while (p + 1 < file_end) {
+        p = (const uint8_t *)memchr(p, 0xff, file_end - 1 - p);
+        if (!p) return file_end;
+        uint8_t marker = p[1];
+        if (marker == 0x00) {
+          // an escaped 0xff byte of data
+          p += 2;
+        } else if (marker == 0xff) {
+          // fill byte before a marker
+          p++;
+        } else if (marker >= 0xd0 && marker <= 0xd7) {
+          p += 2;
+          if (restart_interval) interval_starts.push_back(p);
+        } else {
+          return p;
+        }
+      }
+      return file_end;
+    }
+
+    unsigned get_num_mcus() const {
+      return mcus_x * mcus_y;
+    }
+
+    unsigned get_mcus_per_interval() const {
+      return restart_interval ? restart_interval : get_num_mcus();
+    }
+
+    // the last interval takes any MCUs left over if markers are missing.
+    unsigned get_interval_end(unsigned interval) const {
+      unsigned end = (interval + 1) * get_mcus_per_interval();
+      return interval + 1 == interval_starts.size() || end > get_num_mcus() ? get_num_mcus() : end;
+    }
+
+    unsigned get_interval(unsigned mcu) const {
+      unsigned interval = mcu / get_mcus_per_interval();
+      return interval < interval_starts.size() ? interval : interval_starts.size() - 1;
+    }
+
+    // Entropy decode one restart interval. The DC predictions and the bit reader start afresh.
+    // With no coefficient buffer, convert each MCU to pixels straight away (the serial decoder),
+    // otherwise store the coefficients and count the MCUs done in progress (the first pass).
+    void decode_interval(mcu_context &ctx, unsigned interval, int16_t *coeff_buffer, std::atomic<unsigned> *progress) {
+      unsigned acc = 0;
+      int shift = 0;
+      const uint8_t *src = interval_starts[interval];
+      skip_bits(16, acc, src, shift);
+      memset(ctx.last_dc, 0, sizeof(ctx.last_dc));
+
+      unsigned begin = interval * get_mcus_per_interval();
+      unsigned end = get_interval_end(interval);
+      unsigned mcu_size = num_mcu_blocks * 64;
+      for (unsigned mcu = begin; mcu < end; ++mcu) {
+        if (coeff_buffer) {
+          decode_mcu(coeff_buffer + mcu * mcu_size, ctx.last_dc, acc, src, shift);
+          progress->store(mcu + 1 - begin, std::memory_order_release);
+        } else {
+          decode_mcu(ctx.coeffs, ctx.last_dc, acc, src, shift);
+          convert_mcu(ctx.pixels, ctx.coeffs, mcu);
+        }
+      }
+    }
+
+    // Decode the scan on several jobs in two passes: entropy decoding of the restart intervals
+    // and inverse DCT + colour conversion of rows of MCUs. A thread converts a row as soon as its
+    // intervals have been decoded, so the passes overlap. Without restart markers there is
+    // one interval, decoded by one thread while the others convert the rows behind it.
+    void decode_scan_parallel(unsigned num_jobs) {
+      unsigned mcu_size = num_mcu_blocks * 64;
+      unsigned num_intervals = interval_starts.size();
+      dynarray<int16_t> coeffs(get_num_mcus() * mcu_size);
+      dynarray<std::atomic<unsigned> > progress(num_intervals);
+      for (unsigned i = 0; i != num_intervals; ++i) {
+        progress[i].store(0, std::memory_order_relaxed);
+      }
+      std::atomic<unsigned> next_interval(0);
+      std::atomic<unsigned> next_row(0);
+
+      // have all the MCUs of a row been entropy decoded?
+      auto row_ready = [&](unsigned row) {
+        unsigned begin = row * mcus_x;
+        unsigned end = begin + mcus_x;
+        for (unsigned i = get_interval(begin); i <= get_interval(end - 1); ++i) {
+          unsigned interval_begin = i * get_mcus_per_interval();
+          unsigned interval_end = get_interval_end(i);
+          unsigned needed = (end < interval_end ? end : interval_end) - interval_begin;
+          if (progress[i].load(std::memory_order_acquire) < needed) return false;
+        }
+        return true;
+      };
+
+      auto worker = [&]() {
+        mcu_context ctx;
+        for (;;) {
+          // convert a row if one is ready, otherwise entropy decode an interval.
+          unsigned row = next_row.load();
+          if (row == mcus_y) break;
+          if (row_ready(row)) {
+            if (next_row.compare_exchange_weak(row, row + 1)) {
+              for (unsigned mcu = row * mcus_x; mcu != (row + 1) * mcus_x; ++mcu) {
+                convert_mcu(ctx.pixels, coeffs.data() + mcu * mcu_size, mcu);
+              }
+            }
+            continue;
+          }
+          unsigned interval = next_interval.load();
+          if (interval < num_intervals) {
+            if (next_interval.compare_exchange_weak(interval, interval + 1)) {
+              decode_interval(ctx, interval, coeffs.data(), &progress[interval]);
+            }
+          } else {
+            // the intervals we need are being decoded by other threads.
+            std::this_thread::yield();
+          }
+        }
+      };
+
+      // a job only waits for intervals that other running jobs have taken, so this cannot deadlock.
+      resources::job_scheduler::get().parallel_for(0, num_jobs, [&](unsigned) { worker(); });
+    }
+
     // JPEG files are split up into chunks starting with 0xff
     unsigned decode_chunk(const uint8_t *src, dynarray<uint8_t> &image, uint16_t &format) {
       if (debug) printf("decode_chunk %02x\n", src[1]);
@@ -487,10 +949,8 @@ namespace octet { namespace loaders {
               m.dc_table = &huffman_tables[0][sc.dc_table];
               m.ac_table = &huffman_tables[1][sc.ac_table];
               m.quant = &quant_tables[c.quantisation_table];
-              m.scan_comp = &sc;
+              m.scan_index = i;
             }
-
-            sc.last_dc = 0;
           }
 
           // at present, we only support YCrCb in 4:4:4
@@ -518,41 +978,38 @@ namespace octet { namespace loaders {
           unsigned xmax = ( width + max_hsamp * 8 - 1 ) / (max_hsamp * 8);
           unsigned ymax = ( height + max_vsamp * 8 - 1 ) / (max_vsamp * 8);
 
-          unsigned acc = 0;
-          int shift = 0;
-          skip_bits(16, acc, src, shift);
-          
-          int stride = width * 4;
+          mcus_x = xmax;
+          mcus_y = ymax;
+          image_stride = width * 4;
 
           unsigned size = width * height * 4;
           size_t base = image.size();
           image.resize(base + size);
           format = 0x1908; // GL_RGBA
 
-          uint8_t *image_base = image.data() + base;
+          image_base = image.data() + base;
 
-          for (unsigned y = 0; y != ymax; ++y) {
-            for (unsigned x = 0; x != xmax; ++x) {
-              float *coeffs = dct_coeffs;
-              memset(coeffs, 0, 64 * num_mcu_blocks * sizeof(float));
-              for (unsigned b = 0; b < num_mcu_blocks; ++b) {
-                decode_mcu_block(b, acc, src, shift, coeffs);
-                inverse_dct(coeffs);
-                coeffs += 64;
-              }
-              if (num_mcu_blocks == 1) {
-                // assume 4:4:4 Greyscale
-                color_convert_444_greyscale(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 3) {
-                // assume 4:4:4 YCbCr
-                color_convert_444(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 6) {
-                // assume 4:1:1 YCbCr
-                color_convert_411(&image_base[((height - 1 - y * 16) * stride) + (x * 16 * 4)], -stride, dct_coeffs);
-              }
+          // where each block of the MCU goes: Y blocks fill the Y plane left to right, top to bottom.
+          unsigned num_y = num_mcu_blocks == 6 ? 4 : 1;
+          unsigned y_stride = num_mcu_blocks == 6 ? 16 : 8;
+          for (unsigned b = 0; b != num_mcu_blocks; ++b) {
+            mcu_block &m = mcu_blocks[b];
+            m.pixel_offset = b < num_y ? (b & 1) * 8 + (b >> 1) * 8 * y_stride : b == num_y ? cb_offset : cr_offset;
+            m.pixel_stride = b < num_y ? y_stride : 8;
+          }
+
+          src = find_restart_intervals(src);
+
+          // small images are quicker on one thread.
+          unsigned threads = num_threads ? num_threads : resources::job_scheduler::get().get_num_threads();
+          if (threads > 1 && ymax > 1 && width * height >= 256 * 256) {
+            decode_scan_parallel(threads);
+          } else {
+            mcu_context ctx;
+            for (unsigned i = 0; i != interval_starts.size(); ++i) {
+              decode_interval(ctx, i, NULL, NULL);
             }
           }
-          skip_bits(shift, acc, src, shift);
           length = (unsigned)(src - src0);
         } break;
 
@@ -566,13 +1023,20 @@ namespace octet { namespace loaders {
             unsigned n = src[0] & 0x0f;
             src++;
             for (unsigned i = 0; i != 64; ++i) {
-              quant_tables[n&3].table[i] = (float)( prec ? u2(src) : *src );
+              quant_tables[n&3].table[i] = (uint16_t)( prec ? u2(src) : *src );
               src += prec + 1;
             }
             if (debug) printf("DQT %d %d\n", prec, n);
           }
         } break;
 
+        // restart interval
+        case 0xdd: {
+          length = u2(src + 2) + 2;
+          restart_interval = u2(src + 4);
+          if (debug) printf("DRI %d\n", restart_interval);
+        } break;
+
         // JFIF stubset of JPEG
         case 0xe0: {
           length = u2(src + 2) + 2;
@@ -588,8 +1052,29 @@ namespace octet { namespace loaders {
       return length;
     }
   public:
+    jpeg_decoder() {
+      use_simd = OCTET_SSE2 != 0;
+      num_threads = 0;
+      restart_interval = 0;
+    }
+
+    /// Use SSE2 for the inverse DCT and colour conversion if it is available (the default).
+    /// The scalar code is the reference and gives exactly the same pixels.
+    /// Builds without SSE2 always use the floating point path.
+    void set_use_simd(bool value) {
+      use_simd = value && OCTET_SSE2 != 0;
+    }
+
+    /// Number of jobs for large images: 1 decodes on the calling thread only, 0 (the default) uses every core.
+    /// The pixels are the same however many threads are used.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
     // get an opengl texture from a file in memory
     void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
+      file_end = src_max;
+      restart_interval = 0;
       while (src < src_max) {
         if (src[0] != 0xff) {
           printf("warning: bad JPEG file\n");
@@ -16,21 +16,24 @@ namespace octet { namespace loaders {
     /// Load an OBJ file
     /// http://en.wikipedia.org/wiki/Wavefront_.obj_file
     bool load(const char *url, resource_dict &dict, visual_scene *scene) {
-      dynarray<uint8_t> file;
+      // the file is mapped, not copied, so we must not read past eof.
+      mapped_url file;
       app_utils::get_url(file, url);
-      if (file.size() == 0) return false;
+      if (file.get_size() == 0) return false;
 
-      const uint8_t *eof = file.data() + file.size();
+      const uint8_t *eof = file.get_src_max();
       this->dict = &dict;
       material_index = 0;
       
-      for (const uint8_t *src = file.data(); src != eof; ) {
-        while (*src == ' ' && src != eof) ++src;
+      for (const uint8_t *src = file.get_src(); src != eof; ) {
+        while (src != eof && *src == ' ') ++src;
         const uint8_t *begin = src;
-        while (*src != '\n' && *src != '\r' && src != eof) ++src;
+        while (src != eof && *src != '\n' && *src != '\r') ++src;
         const uint8_t *end = src;
         src += src != eof && *src == '\r';
         src += src != eof && *src == '\n';
+        // lines can be one byte long, so check the length before looking at begin[1] or begin[2].
+        size_t length = end - begin;
         if (begin != end ) switch (begin[0]) {
           case '#': {
             fwrite(begin, 1, end-begin, stdout);
@@ -38,26 +41,26 @@ namespace octet { namespace loaders {
           case 'o': {
             flush();
             fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') obj_name.assign((const char*)begin + 2, (const char*)end);
+            if (length >= 2 && begin[1] == ' ') obj_name.assign((const char*)begin + 2, (const char*)end);
             node = new scene_node(mat4t(), atom_);
           } break;
           case 'g': {
             fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') group_name.assign((const char*)begin + 2, (const char*)end);
+            if (length >= 2 && begin[1] == ' ') group_name.assign((const char*)begin + 2, (const char*)end);
           } break;
           case 'v': {
             //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
+            if (length >= 2 && begin[1] == ' ') {
               atofv(values, begin+2, end);
               if (values.size() == 3) {
                 src_vertices.push_back(vec3p(values[0], values[1], values[2]));
               }
-            } else if (begin[1] == 't' && begin[2] == ' ') {
+            } else if (length >= 3 && begin[1] == 't' && begin[2] == ' ') {
               atofv(values, begin+3, end);
               if (values.size() == 2) {
                 src_uvs.push_back(vec2p(values[0], values[1]));
               }
-            } else if (begin[1] == 'n' && begin[2] == ' ') {
+            } else if (length >= 3 && begin[1] == 'n' && begin[2] == ' ') {
               atofv(values, begin+3, end);
               if (values.size() == 3) {
                 src_normals.push_back(vec3p(values[0], values[1], values[2]));
@@ -66,7 +69,7 @@ namespace octet { namespace loaders {
           } break;
           case 'f': {
             //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
+            if (length >= 2 && begin[1] == ' ') {
               unsigned slashes = 0;
               mesh::vertex v[6];
               atoiv(ivalues, slashes, begin + 2, end);
@@ -194,29 +197,29 @@ namespace octet { namespace loaders {
     void atofv(dynarray<float> &values, const uint8_t *src, const uint8_t *end) {
       values.resize(0);
 
-      while (*src > 0 && *src <= ' ') ++src;
+      while (src != end && *src > 0 && *src <= ' ') ++src;
       while(src != end) {
         double whole = 0, msign = 1;
         if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
+        if (src == end || (!(*src >= '0' && *src <= '9') && *src != '.')) break;
+        while (src != end && *src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
+        if (src != end && *src == '.') {
           src++;
           double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
+          while (src != end && *src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
           whole += frac / v;
         }
-        if (*src == 'e' || *src == 'E') {
+        if (src != end && (*src == 'e' || *src == 'E')) {
           int esign = 1;
           src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
+          if (src != end && *src == '-') { esign = -1; src++; }
+          else if (src != end && *src == '+') src++;
           int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
+          while (src != end && *src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
           whole = whole * pow(10.0, exp * esign);
         }
         values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
+        while (src != end && *src > 0 && *src <= ' ') ++src;
       }
     }
 
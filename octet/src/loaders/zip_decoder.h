@@ -6,318 +6,398 @@
 //
 //
 // zip deflate format decoder
-// 
+//
 namespace octet { namespace loaders {
+  /// Decoder for the "deflate" format used in zip files (RFC 1951).
+  ///
+  /// Huffman codes are decoded with lookup tables: the first few bits of the stream index a
+  /// primary table and longer codes continue in a small subtable. Table entries already contain
+  /// the length or distance base and the number of extra bits, so one lookup decodes a symbol.
+  ///
+  /// Bits are read from a 64 bit buffer that is refilled eight bytes at a time.
+  /// Away from the ends of the input and output, the loop skips the bounds checks.
   class zip_decoder {
-    enum { debug = 1 };
-
-    struct huffman_table {
-      uint8_t min_lit_length;
-      uint8_t max_lit_length;
-      uint8_t min_dist_length;
-      uint8_t max_dist_length;
-
-      //uint8_t lit_lengths[288];
-      uint16_t lit_codes[288];
-      uint16_t lit_limits[18];
-      uint16_t lit_base[18];
-
-      //uint8_t dist_lengths[32];
-      uint16_t dist_codes[32];
-      uint16_t dist_limits[18];
-      uint16_t dist_base[18];
+    // table entry layout:
+    //   bits 0-7    code length in bits (bits to consume)
+    //   bits 8-11   extra bits (length and distance) or subtable bits
+    //   bits 12-15  flags
+    //   bits 16-31  literal, length base, distance base or subtable offset
+    enum {
+      flag_invalid = 0x1000,
+      flag_end = 0x2000,
+      flag_literal = 0x4000,
+      flag_subtable = 0x8000,
+
+      lit_bits = 10,
+      dist_bits = 8,
+      code_length_bits = 7,
+
+      // primary table + worst case subtables for 286 symbols of up to 15 bits.
+      lit_table_size = 2048,
+      dist_table_size = 1024,
+      code_length_table_size = 1 << code_length_bits,
+
+      // longest match + a safety margin for the eight byte copy
+      max_match = 258,
+      copy_slack = 8,
     };
 
-    huffman_table fixed_;
-    huffman_table var_;
-
-    // on ARM we can do this faster with the "rev" instruction
-    inline static uint16_t rev16(uint16_t value) {
-      // small table version.
-      //static const uint8_t r16[] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
-      //return r16[value&0x0f] * 0x1000 | r16[(value>>4)&0x0f] * 0x100 | r16[(value>>8)&0x0f] * 0x10 | r16[value>>12];
-
-      // this table is probably too big to be efficient. L1 cache misses are very expensive.
-      static const uint8_t r256[] = {
-        0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 
-        0x00+0x10, 0x80+0x10, 0x40+0x10, 0xc0+0x10, 0x20+0x10, 0xa0+0x10, 0x60+0x10, 0xe0+0x10, 
-        0x00+8, 0x80+8, 0x40+8, 0xc0+8, 0x20+8, 0xa0+8, 0x60+8, 0xe0+8, 
-        0x00+0x10+8, 0x80+0x10+8, 0x40+0x10+8, 0xc0+0x10+8, 0x20+0x10+8, 0xa0+0x10+8, 0x60+0x10+8, 0xe0+0x10+8, 
-        0x00+ 4, 0x80+ 4, 0x40+ 4, 0xc0+ 4, 0x20+ 4, 0xa0+ 4, 0x60+ 4, 0xe0+ 4, 
-        0x00+0x10+ 4, 0x80+0x10+ 4, 0x40+0x10+ 4, 0xc0+0x10+ 4, 0x20+0x10+ 4, 0xa0+0x10+ 4, 0x60+0x10+ 4, 0xe0+0x10+ 4, 
-        0x00+8+ 4, 0x80+8+ 4, 0x40+8+ 4, 0xc0+8+ 4, 0x20+8+ 4, 0xa0+8+ 4, 0x60+8+ 4, 0xe0+8+ 4, 
-        0x00+0x10+8+ 4, 0x80+0x10+8+ 4, 0x40+0x10+8+ 4, 0xc0+0x10+8+ 4, 0x20+0x10+8+ 4, 0xa0+0x10+8+ 4, 0x60+0x10+8+ 4, 0xe0+0x10+8+ 4, 
-        0x00+ 2, 0x80+ 2, 0x40+ 2, 0xc0+ 2, 0x20+ 2, 0xa0+ 2, 0x60+ 2, 0xe0+ 2, 
-        0x00+0x10+ 2, 0x80+0x10+ 2, 0x40+0x10+ 2, 0xc0+0x10+ 2, 0x20+0x10+ 2, 0xa0+0x10+ 2, 0x60+0x10+ 2, 0xe0+0x10+ 2, 
-        0x00+8+ 2, 0x80+8+ 2, 0x40+8+ 2, 0xc0+8+ 2, 0x20+8+ 2, 0xa0+8+ 2, 0x60+8+ 2, 0xe0+8+ 2, 
-        0x00+0x10+8+ 2, 0x80+0x10+8+ 2, 0x40+0x10+8+ 2, 0xc0+0x10+8+ 2, 0x20+0x10+8+ 2, 0xa0+0x10+8+ 2, 0x60+0x10+8+ 2, 0xe0+0x10+8+ 2, 
-        0x00+ 4+ 2, 0x80+ 4+ 2, 0x40+ 4+ 2, 0xc0+ 4+ 2, 0x20+ 4+ 2, 0xa0+ 4+ 2, 0x60+ 4+ 2, 0xe0+ 4+ 2, 
-        0x00+0x10+ 4+ 2, 0x80+0x10+ 4+ 2, 0x40+0x10+ 4+ 2, 0xc0+0x10+ 4+ 2, 0x20+0x10+ 4+ 2, 0xa0+0x10+ 4+ 2, 0x60+0x10+ 4+ 2, 0xe0+0x10+ 4+ 2, 
-        0x00+8+ 4+ 2, 0x80+8+ 4+ 2, 0x40+8+ 4+ 2, 0xc0+8+ 4+ 2, 0x20+8+ 4+ 2, 0xa0+8+ 4+ 2, 0x60+8+ 4+ 2, 0xe0+8+ 4+ 2, 
-        0x00+0x10+8+ 4+ 2, 0x80+0x10+8+ 4+ 2, 0x40+0x10+8+ 4+ 2, 0xc0+0x10+8+ 4+ 2, 0x20+0x10+8+ 4+ 2, 0xa0+0x10+8+ 4+ 2, 0x60+0x10+8+ 4+ 2, 0xe0+0x10+8+ 4+ 2, 
-        0x00+ 1, 0x80+ 1, 0x40+ 1, 0xc0+ 1, 0x20+ 1, 0xa0+ 1, 0x60+ 1, 0xe0+ 1, 
-        0x00+0x10+ 1, 0x80+0x10+ 1, 0x40+0x10+ 1, 0xc0+0x10+ 1, 0x20+0x10+ 1, 0xa0+0x10+ 1, 0x60+0x10+ 1, 0xe0+0x10+ 1, 
-        0x00+8+ 1, 0x80+8+ 1, 0x40+8+ 1, 0xc0+8+ 1, 0x20+8+ 1, 0xa0+8+ 1, 0x60+8+ 1, 0xe0+8+ 1, 
-        0x00+0x10+8+ 1, 0x80+0x10+8+ 1, 0x40+0x10+8+ 1, 0xc0+0x10+8+ 1, 0x20+0x10+8+ 1, 0xa0+0x10+8+ 1, 0x60+0x10+8+ 1, 0xe0+0x10+8+ 1, 
-        0x00+ 4+ 1, 0x80+ 4+ 1, 0x40+ 4+ 1, 0xc0+ 4+ 1, 0x20+ 4+ 1, 0xa0+ 4+ 1, 0x60+ 4+ 1, 0xe0+ 4+ 1, 
-        0x00+0x10+ 4+ 1, 0x80+0x10+ 4+ 1, 0x40+0x10+ 4+ 1, 0xc0+0x10+ 4+ 1, 0x20+0x10+ 4+ 1, 0xa0+0x10+ 4+ 1, 0x60+0x10+ 4+ 1, 0xe0+0x10+ 4+ 1, 
-        0x00+8+ 4+ 1, 0x80+8+ 4+ 1, 0x40+8+ 4+ 1, 0xc0+8+ 4+ 1, 0x20+8+ 4+ 1, 0xa0+8+ 4+ 1, 0x60+8+ 4+ 1, 0xe0+8+ 4+ 1, 
-        0x00+0x10+8+ 4+ 1, 0x80+0x10+8+ 4+ 1, 0x40+0x10+8+ 4+ 1, 0xc0+0x10+8+ 4+ 1, 0x20+0x10+8+ 4+ 1, 0xa0+0x10+8+ 4+ 1, 0x60+0x10+8+ 4+ 1, 0xe0+0x10+8+ 4+ 1, 
-        0x00+ 2+ 1, 0x80+ 2+ 1, 0x40+ 2+ 1, 0xc0+ 2+ 1, 0x20+ 2+ 1, 0xa0+ 2+ 1, 0x60+ 2+ 1, 0xe0+ 2+ 1, 
-        0x00+0x10+ 2+ 1, 0x80+0x10+ 2+ 1, 0x40+0x10+ 2+ 1, 0xc0+0x10+ 2+ 1, 0x20+0x10+ 2+ 1, 0xa0+0x10+ 2+ 1, 0x60+0x10+ 2+ 1, 0xe0+0x10+ 2+ 1, 
-        0x00+8+ 2+ 1, 0x80+8+ 2+ 1, 0x40+8+ 2+ 1, 0xc0+8+ 2+ 1, 0x20+8+ 2+ 1, 0xa0+8+ 2+ 1, 0x60+8+ 2+ 1, 0xe0+8+ 2+ 1, 
-        0x00+0x10+8+ 2+ 1, 0x80+0x10+8+ 2+ 1, 0x40+0x10+8+ 2+ 1, 0xc0+0x10+8+ 2+ 1, 0x20+0x10+8+ 2+ 1, 0xa0+0x10+8+ 2+ 1, 0x60+0x10+8+ 2+ 1, 0xe0+0x10+8+ 2+ 1, 
-        0x00+ 4+ 2+ 1, 0x80+ 4+ 2+ 1, 0x40+ 4+ 2+ 1, 0xc0+ 4+ 2+ 1, 0x20+ 4+ 2+ 1, 0xa0+ 4+ 2+ 1, 0x60+ 4+ 2+ 1, 0xe0+ 4+ 2+ 1, 
-        0x00+0x10+ 4+ 2+ 1, 0x80+0x10+ 4+ 2+ 1, 0x40+0x10+ 4+ 2+ 1, 0xc0+0x10+ 4+ 2+ 1, 0x20+0x10+ 4+ 2+ 1, 0xa0+0x10+ 4+ 2+ 1, 0x60+0x10+ 4+ 2+ 1, 0xe0+0x10+ 4+ 2+ 1, 
-        0x00+8+ 4+ 2+ 1, 0x80+8+ 4+ 2+ 1, 0x40+8+ 4+ 2+ 1, 0xc0+8+ 4+ 2+ 1, 0x20+8+ 4+ 2+ 1, 0xa0+8+ 4+ 2+ 1, 0x60+8+ 4+ 2+ 1, 0xe0+8+ 4+ 2+ 1, 
-        0x00+0x10+8+ 4+ 2+ 1, 0x80+0x10+8+ 4+ 2+ 1, 0x40+0x10+8+ 4+ 2+ 1, 0xc0+0x10+8+ 4+ 2+ 1, 0x20+0x10+8+ 4+ 2+ 1, 0xa0+0x10+8+ 4+ 2+ 1, 0x60+0x10+8+ 4+ 2+ 1, 0xe0+0x10+8+ 4+ 2+ 1, 
-      };
-      return r256[value&0xff] << 8 | r256[(value>>8)&0xff];
+    // the current position in the compressed data
+    struct bitstream {
+      const uint8_t *src;
+      const uint8_t *src_max;
+      uint64_t bits;
+      unsigned num_bits;
+
+      // number of zero bytes added past the end of the input
+      unsigned overrun;
+
+      // top up the bit buffer to at least 56 bits, one byte at a time
+      void refill() {
+        while (num_bits <= 56) {
+          uint64_t byte = 0;
+          if (src < src_max) byte = *src++; else overrun++;
+          bits |= byte << num_bits;
+          num_bits += 8;
+        }
+      }
 
-      //value = ( ( value >> 1 ) & 0x5555 ) | ( ( value & 0x5555 ) << 1 );
-      //value = ( ( value >> 2 ) & 0x3333 ) | ( ( value & 0x3333 ) << 2 );
-      //value = ( ( value >> 4 ) & 0x0f0f ) | ( ( value & 0x0f0f ) << 4 );
-      //value = ( ( value >> 8 ) & 0x00ff ) | ( ( value & 0x00ff ) << 8 );
-      //return value;
-    }
+      // top up the bit buffer with an unaligned eight byte read: needs src + 8 <= src_max
+      /// note: this will have to be fixed on PPC and other big-endian devices
+      void refill_fast() {
+        uint64_t word;
+        memcpy(&word, src, 8);
+        bits |= word << num_bits;
+        src += (63 - num_bits) >> 3;
+        num_bits |= 56;
+      }
+
+      unsigned peek(unsigned n) const {
+        return (unsigned)bits & ((1u << n) - 1);
+      }
 
-    bool build_huffman(uint8_t *lengths, unsigned num_lengths, uint8_t &min_length, uint8_t &max_length, uint16_t *codes, uint16_t *limits, uint16_t *base) {
-      min_length = 16;
-      max_length = 0;
-      for (unsigned i = 0; i != num_lengths; ++i) {
-        if (debug) printf("%d,", lengths[i]);
-        if (lengths[i]) {
-          if (min_length > lengths[i]) min_length = lengths[i];
-          if (max_length < lengths[i]) max_length = lengths[i];
+      void consume(unsigned n) {
+        bits >>= n;
+        num_bits -= n;
+      }
+
+      // have we used bits that were not in the input?
+      bool is_truncated() const {
+        return overrun * 8 > num_bits;
+      }
+
+      // go to the next byte boundary and give back the whole bytes in the bit buffer.
+      void align() {
+        consume(num_bits & 7);
+        unsigned bytes = num_bits >> 3;
+        if (overrun >= bytes) {
+          overrun -= bytes;
+        } else {
+          src -= bytes - overrun;
+          overrun = 0;
         }
+        bits = 0;
+        num_bits = 0;
       }
-      if (debug) printf("\n");
+    };
 
-      if (debug) printf("min_length=%d\n", min_length);
-      if (debug) printf("max_length=%d\n", max_length);
+    // pre-decoded entries for each symbol of the literal/length and distance alphabets.
+    uint32_t lit_values[288];
+    uint32_t dist_values[32];
+    uint32_t code_length_values[19];
+
+    uint32_t fixed_lit[lit_table_size];
+    uint32_t fixed_dist[dist_table_size];
+    uint32_t var_lit[lit_table_size];
+    uint32_t var_dist[dist_table_size];
+
+    // huffman codes are stored most significant bit first, so we reverse them to index the tables.
+    static unsigned reverse_bits(unsigned code, unsigned length) {
+      static const uint8_t r16[] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
+      unsigned value = r16[code&0x0f] * 0x1000 | r16[(code>>4)&0x0f] * 0x100 | r16[(code>>8)&0x0f] * 0x10 | r16[(code>>12)&0x0f];
+      return value >> (16 - length);
+    }
 
-      if ( min_length <= 0 || min_length > max_length || max_length > 16 ) {
-        return false;
+    /// Build a decoding table from code lengths.
+    /// Codes up to primary_bits long are looked up directly, longer codes use a subtable.
+    static bool build_table(uint32_t *table, unsigned table_size, unsigned primary_bits, const uint8_t *lengths, unsigned num_symbols, const uint32_t *values) {
+      unsigned count[16];
+      unsigned offset[17];
+      uint16_t sorted[288];
+      memset(count, 0, sizeof(count));
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        count[lengths[i]]++;
       }
+      count[0] = 0;
 
+      // an over-subscribed code cannot be decoded. Incomplete codes are allowed (the unused codes are invalid).
+      int left = 1;
+      for (unsigned length = 1; length != 16; ++length) {
+        left = left * 2 - (int)count[length];
+        if (left < 0) return false;
+      }
+
+      // sort the symbols by length, then by value: this is the order of the canonical codes.
+      offset[1] = 0;
+      for (unsigned length = 1; length != 16; ++length) {
+        offset[length+1] = offset[length] + count[length];
+      }
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        if (lengths[i]) sorted[offset[lengths[i]]++] = (uint16_t)i;
+      }
+      unsigned num_codes = offset[16];
+
+      // a complete code fills every entry, only incomplete codes leave gaps.
+      unsigned primary_size = 1u << primary_bits;
+      if (left != 0) {
+        for (unsigned i = 0; i != primary_size; ++i) {
+          table[i] = flag_invalid;
+        }
+      }
+
+      // codes sharing the first primary_bits bits are next to each other in canonical order
+      // and the last one is the longest, which sets the size of their subtable.
       unsigned code = 0;
-      unsigned huffcode = 0;
-      for (unsigned length = min_length; length <= max_length; ++length) {
-        base[length-min_length] = huffcode - code;
-        for (unsigned i = 0; i != num_lengths; ++i) {
-          if (lengths[i] == length) {
-            codes[code++] = i;
-            //dump_bits(huffcode << (16-length), 16, "huffcode");
-            huffcode++;
+      unsigned prev_length = 0;
+      unsigned sub_top = ~0u;
+      unsigned sub_offset = 0;
+      unsigned sub_bits = 0;
+      unsigned next_free = primary_size;
+      for (unsigned i = 0; i != num_codes; ++i) {
+        unsigned symbol = sorted[i];
+        unsigned length = lengths[symbol];
+        code <<= length - prev_length;
+        prev_length = length;
+        unsigned rev = reverse_bits(code, length);
+        uint32_t value = values[symbol] | length;
+
+        if (length <= primary_bits) {
+          for (unsigned j = rev; j < primary_size; j += 1u << length) {
+            table[j] = value;
+          }
+        } else {
+          unsigned top = code >> (length - primary_bits);
+          if (top != sub_top) {
+            // find the longest code with this prefix.
+            unsigned max_length = length;
+            unsigned c = code, pl = length;
+            for (unsigned k = i + 1; k != num_codes; ++k) {
+              unsigned l = lengths[sorted[k]];
+              c = (c + 1) << (l - pl);
+              pl = l;
+              if (c >> (l - primary_bits) != top) break;
+              max_length = l;
+            }
+            sub_top = top;
+            sub_bits = max_length - primary_bits;
+            sub_offset = next_free;
+            next_free += 1u << sub_bits;
+            if (next_free > table_size) return false;
+            for (unsigned j = sub_offset; j != next_free; ++j) {
+              table[j] = flag_invalid;
+            }
+            table[reverse_bits(top, primary_bits)] = flag_subtable | (sub_bits << 8) | (sub_offset << 16);
+          }
+          for (unsigned j = rev >> primary_bits; j < (1u << sub_bits); j += 1u << (length - primary_bits)) {
+            table[sub_offset + j] = value;
           }
         }
-        limits[length-min_length] = (uint16_t)( ( huffcode << (16-length) ) - 1 );
-        if (debug) printf("length %d: lim=%04x base=%04x\n", length, ( huffcode << (16-length) ) - 1, base[length-min_length]);
-        if (( huffcode << (16-length) ) - 1 > 0xffff) {
-          if (debug) printf("invalid huffman table\n");
-          return false;
-        }
-        huffcode *= 2;
+        code++;
       }
-
-      // prevent escape from bitstream decoding loop.
-      limits[max_length+1-min_length] = 0xffff;
       return true;
     }
 
-    /// debug function for dumping bit fields
-    void dump_bits(unsigned value, unsigned bits, const char *name) {
-      char tmp[64];
-      assert(bits<63);
-      for (unsigned i = 0; i != bits; ++i) tmp[i] = ( ( value >> (bits-1-i) ) & 1 ) + '0';
-      tmp[bits] = 0;
-      printf("[%s] %s\n", tmp, name);
-    }
-
-    /// peek a fixed number of little-endian bits from the bitstream
-    /// note: this will have to be fixed on PPC and other big-endian devices
-    unsigned peek(const uint8_t *src, unsigned bitptr, unsigned bits, const char *name) {
-      unsigned i = bitptr >> 3, j = bitptr & 7;
-      unsigned value = ( (unsigned&)src[i] >> j ) & ( (1u << bits) - 1 );
-      if (name) dump_bits(value, bits, name);
-      return value;
+    // look up one symbol, the caller must have at least 15 bits in the buffer.
+    static uint32_t decode_symbol(bitstream &bs, const uint32_t *table, unsigned primary_bits) {
+      uint32_t entry = table[bs.peek(primary_bits)];
+      if (entry & flag_subtable) {
+        unsigned sub_bits = (entry >> 8) & 15;
+        entry = table[(entry >> 16) + (((unsigned)bs.bits >> primary_bits) & ((1u << sub_bits) - 1))];
+      }
+      bs.consume(entry & 0xff);
+      return entry;
     }
 
-    unsigned decode_uncompressed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      bitptr = ( bitptr + 7 ) & ~7;
-      unsigned bytes_to_copy = peek(src, bitptr, 16, "bytes_to_copy");
-      unsigned clength = peek(src, bitptr + 16, 16, "store length check");
-      bitptr += 32;
+    bool decode_uncompressed(bitstream &bs, uint8_t *&dest, uint8_t *dest_max) {
+      bs.align();
+      if (bs.src_max - bs.src < 4) return false;
+      unsigned bytes_to_copy = bs.src[0] + bs.src[1] * 256;
+      unsigned clength = bs.src[2] + bs.src[3] * 256;
+      bs.src += 4;
 
-      if (bytes_to_copy != (clength^0xffff)) return ~0;
-      if (dest + bytes_to_copy > dest_max) return ~0;
-      if ((src + bitptr/8) + bytes_to_copy > src_max) return ~0;
+      if (bytes_to_copy != (clength^0xffff)) return false;
+      if ((size_t)(dest_max - dest) < bytes_to_copy) return false;
+      if ((size_t)(bs.src_max - bs.src) < bytes_to_copy) return false;
 
-      memcpy(dest, src + bitptr/8, bytes_to_copy);
+      memcpy(dest, bs.src, bytes_to_copy);
       dest += bytes_to_copy;
-      bitptr += bytes_to_copy * 8;
-      return bitptr;
+      bs.src += bytes_to_copy;
+      return true;
     }
 
-    unsigned decode_lz77(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr, huffman_table *table_) {
+    // decode literals and back-references until the end of block code.
+    bool decode_lz77(bitstream &bs, uint8_t *&dest, uint8_t *dest_min, uint8_t *dest_max, const uint32_t *lit, const uint32_t *dist) {
       for(;;) {
-        if (src + bitptr/8 > src_max) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > table_->lit_limits[index]) {
-          index++;
-        }
-        unsigned length = table_->min_lit_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = table_->lit_codes[offset - table_->lit_base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "code");
-
-        if (code < 256) {
-          if (dest+1 > dest_max) return ~0;
-          *dest++ = code;
-          if (debug) printf("%02x\n", code);
-        } else if (code == 256) {
-          return bitptr;
+        // a literal/length code, its extra bits, a distance code and its extra bits: 15+5+15+13 = 48 bits.
+        bool fast = bs.src_max - bs.src >= 8 && dest_max - dest >= max_match + copy_slack;
+        if (fast) {
+          bs.refill_fast();
         } else {
-          unsigned block_length;
-          unsigned distance;
-          {
-            if (debug) printf("[%d]\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
-            };
-            static const uint8_t base[] = {
-              3-3, 4-3, 5-3, 6-3, 7-3, 8-3, 9-3, 10-3,
-              11-3, 13-3, 15-3, 17-3, 19-3, 23-3, 27-3, 31-3,
-              35-3, 43-3, 51-3, 59-3, 67-3, 83-3, 99-3, 115-3,
-              131-3, 163-3, 195-3, 227-3, 258-3,
-            };
-            if (code-257 > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code-257 ];
-            block_length = base[ code-257 ] + 3 + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
-          }
-          {
-            //if (src + (bitptr + table_->max_dist_length)/8 > src_max ) return ~0;
-            unsigned peek16 = peek(src, bitptr, 16, NULL);
-            unsigned value = rev16(peek16);
-            unsigned index = 0;
-            while (value > table_->dist_limits[index]) {
-              index++;
+          // stop as soon as we run out of input rather than decoding zeros.
+          if (bs.is_truncated()) return false;
+          bs.refill();
+        }
+
+        uint32_t entry = decode_symbol(bs, lit, lit_bits);
+        if (entry & flag_literal) {
+          if (!fast && dest == dest_max) return false;
+          *dest++ = (uint8_t)(entry >> 16);
+          if (fast) {
+            // at least 41 bits are left: decode up to two more short literals without refilling.
+            entry = lit[bs.peek(lit_bits)];
+            if (entry & flag_literal) {
+              bs.consume(entry & 0xff);
+              *dest++ = (uint8_t)(entry >> 16);
+              entry = lit[bs.peek(lit_bits)];
+              if (entry & flag_literal) {
+                bs.consume(entry & 0xff);
+                *dest++ = (uint8_t)(entry >> 16);
+              }
             }
-            unsigned length = table_->min_dist_length + index;
-            unsigned offset = ( value >> ( 16 - length ) );
-            unsigned code = table_->dist_codes[offset - table_->dist_base[index]];
-            bitptr += length;
-
-            if (debug) printf("{%d}\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0, 0,
-            };
-            static const uint16_t base[] = {
-              1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
-            };
-            if (code > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code ];
-            distance = base[ code ] + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
           }
+          continue;
+        }
+        if (entry & (flag_end|flag_invalid)) {
+          return (entry & flag_end) != 0;
+        }
 
-          if (debug) printf("length=%d distance=%d\n", block_length, distance);
-
-          if (dest+block_length > dest_max) return ~0;
-
-          for(unsigned i = 0; i != block_length; ++i) {
-            dest[0] = dest[-(int)distance];
-            dest++;
+        unsigned extra = (entry >> 8) & 15;
+        unsigned length = (entry >> 16) + bs.peek(extra);
+        bs.consume(extra);
+
+        entry = decode_symbol(bs, dist, dist_bits);
+        if (entry & flag_invalid) return false;
+        extra = (entry >> 8) & 15;
+        unsigned distance = (entry >> 16) + bs.peek(extra);
+        bs.consume(extra);
+
+        if (distance > (size_t)(dest - dest_min)) return false;
+        const uint8_t *from = dest - distance;
+
+        if (fast) {
+          // we have at least max_match + copy_slack bytes of room, so we may overwrite the end.
+          uint8_t *end = dest + length;
+          if (distance >= 8) {
+            // copy eight bytes at a time, the source is always at least eight bytes behind.
+            do {
+              memcpy(dest, from, 8);
+              dest += 8;
+              from += 8;
+            } while (dest < end);
+          } else if (distance == 1) {
+            memset(dest, from[0], length);
+          } else {
+            do {
+              *dest++ = *from++;
+            } while (dest < end);
+          }
+          dest = end;
+        } else {
+          if ((size_t)(dest_max - dest) < length) return false;
+          for(unsigned i = 0; i != length; ++i) {
+            *dest++ = *from++;
           }
         }
       }
     }
 
-    unsigned decode_fixed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &fixed_);
-    }
-
-    unsigned decode_variable(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      unsigned num_lit_codes = peek(src, bitptr, 5, "num_lit_codes") + 257;
-      unsigned num_dist_codes = peek(src, bitptr+5, 5, "num_dist_codes") + 1;
-      unsigned num_length_codes = peek(src, bitptr+10, 4, "num_length_codes") + 4;
-      
-      bitptr += 14;
+    bool decode_variable(bitstream &bs, uint8_t *&dest, uint8_t *dest_min, uint8_t *dest_max) {
+      bs.refill();
+      unsigned num_lit_codes = bs.peek(5) + 257;
+      unsigned num_dist_codes = ((unsigned)bs.bits >> 5 & 31) + 1;
+      unsigned num_length_codes = ((unsigned)bs.bits >> 10 & 15) + 4;
+      bs.consume(14);
+      if (num_lit_codes > 286 || num_dist_codes > 30) return false;
 
       uint8_t lengths[288 + 32];
-      memset(lengths, 0, 20);
-      if (src + bitptr/8 + num_length_codes > src_max ) return ~0;
+      memset(lengths, 0, 19);
       for (unsigned i = 0; i != num_length_codes; ++i) {
         static const uint8_t order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-        lengths[order[i]] = peek(src, bitptr, 3, "length code lenghs");
-        bitptr += 3;
+        bs.refill();
+        lengths[order[i]] = (uint8_t)bs.peek(3);
+        bs.consume(3);
       }
-      
-      uint16_t codes[19];
-      uint16_t limits[18];
-      uint16_t base[18];
-      uint8_t min_length;
-      uint8_t max_length;
-      if (!build_huffman(lengths, 19, min_length, max_length, codes, limits, base)) return ~0;
-      
+
+      uint32_t code_length_table[code_length_table_size];
+      if (!build_table(code_length_table, code_length_table_size, code_length_bits, lengths, 19, code_length_values)) return false;
+
       unsigned todo = num_lit_codes + num_dist_codes;
       for(unsigned done = 0; done < todo;) {
-        if (src + bitptr/8 + max_length > src_max ) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > limits[index]) {
-          index++;
-        }
-        unsigned length = min_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = codes[offset - base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "length");
-        //fprintf(source_.debug(), "code=%03x\n", code);
+        bs.refill();
+        uint32_t entry = decode_symbol(bs, code_length_table, code_length_bits);
+        if (entry & flag_invalid) return false;
+        unsigned code = entry >> 16;
         unsigned copy = 1;
         if (code < 16) {
         } else if(code == 16) {
-          if (src + (bitptr+2)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 2, NULL) + 3;
-          bitptr += 2;
-          if (done == 0) return ~0;
+          if (done == 0) return false;
+          copy = bs.peek(2) + 3;
+          bs.consume(2);
           code = lengths[ done-1 ];
         } else if(code == 17) {
-          if (src + (bitptr+3)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 3, NULL) + 3;
-          bitptr += 3;
-          code = 0;
-        } else if(code == 18) {
-          if (src + (bitptr+7)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 7, NULL) + 11;
-          bitptr += 7;
+          copy = bs.peek(3) + 3;
+          bs.consume(3);
           code = 0;
         } else {
-          return ~0;
+          copy = bs.peek(7) + 11;
+          bs.consume(7);
+          code = 0;
         }
-        if (done + copy > todo) return ~0;
+        if (done + copy > todo) return false;
         do {
-          lengths[done++] = code;
+          lengths[done++] = (uint8_t)code;
         } while( --copy );
       }
 
-      if (debug) printf("lengths done\n");
-
-      if(
-        !build_huffman(lengths, num_lit_codes, var_.min_lit_length, var_.max_lit_length, var_.lit_codes, var_.lit_limits, var_.lit_base) ||
-        !build_huffman(lengths+num_lit_codes, num_dist_codes, var_.min_dist_length, var_.max_dist_length, var_.dist_codes, var_.dist_limits, var_.dist_base)
+      if (
+        !build_table(var_lit, lit_table_size, lit_bits, lengths, num_lit_codes, lit_values) ||
+        !build_table(var_dist, dist_table_size, dist_bits, lengths + num_lit_codes, num_dist_codes, dist_values)
       ) {
-        return ~0;
+        return false;
       }
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &var_);
+      return decode_lz77(bs, dest, dest_min, dest_max, var_lit, var_dist);
     }
   public:
     zip_decoder() {
+      static const uint16_t length_base[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+      };
+      static const uint8_t length_extra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+      };
+      static const uint16_t dist_base[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+      };
+      static const uint8_t dist_extra[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+      };
+
+      for (unsigned i = 0; i != 288; ++i) {
+        lit_values[i] =
+          i < 256 ? flag_literal | (i << 16) :
+          i == 256 ? flag_end :
+          i < 286 ? (length_extra[i-257] << 8) | (length_base[i-257] << 16) :
+          flag_invalid
+        ;
+      }
+      for (unsigned i = 0; i != 32; ++i) {
+        dist_values[i] = i < 30 ? (dist_extra[i] << 8) | (dist_base[i] << 16) : flag_invalid;
+      }
+      for (unsigned i = 0; i != 19; ++i) {
+        code_length_values[i] = i << 16;
+      }
+
       uint8_t lit_lengths[288];
       uint8_t dist_lengths[32];
       memset(lit_lengths +   0, 8, 144 - 0);
@@ -325,33 +405,38 @@ namespace octet { namespace loaders {
       memset(lit_lengths + 256, 7, 280-256);
       memset(lit_lengths + 280, 8, 288-280);
       memset(dist_lengths, 5, 32);
-      build_huffman(lit_lengths, 288, fixed_.min_lit_length, fixed_.max_lit_length, fixed_.lit_codes, fixed_.lit_limits, fixed_.lit_base);
-      build_huffman(dist_lengths, 32, fixed_.min_dist_length, fixed_.max_dist_length, fixed_.dist_codes, fixed_.dist_limits, fixed_.dist_base);
+      build_table(fixed_lit, lit_table_size, lit_bits, lit_lengths, 288, lit_values);
+      build_table(fixed_dist, dist_table_size, dist_bits, dist_lengths, 32, dist_values);
     }
 
-    void decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
-      unsigned bitptr = 0;
-      unsigned is_last_block;
+    /// Inflate deflate data in [src, src_max) to [dest, dest_max). Returns false if the data is bad.
+    bool decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
+      bitstream bs;
+      bs.src = src;
+      bs.src_max = src_max;
+      bs.bits = 0;
+      bs.num_bits = 0;
+      bs.overrun = 0;
+      uint8_t *dest_min = dest;
 
       // for each "deflate" block:
-      do {
-        // prevent (bitptr / 8) from overflowing (>512Mib)
-        src += bitptr / 8;
-        bitptr %= 8;
-
+      for (;;) {
         // three bits determine kind and exit condition
-        is_last_block = peek(src, bitptr, 1, "deflate last") != 0;
-        unsigned kind = peek(src, bitptr + 1, 2, "deflate kind");
+        bs.refill();
+        bool is_last_block = bs.peek(1) != 0;
+        unsigned kind = ((unsigned)bs.bits >> 1) & 3;
+        bs.consume(3);
 
-        bitptr += 3;
+        bool ok = false;
         switch (kind) {
-        case 0: bitptr = decode_uncompressed(dest, dest_max, src, src_max, bitptr); break;
-        case 1: bitptr = decode_fixed(dest, dest_max, src, src_max, bitptr); break;
-        case 2: bitptr = decode_variable(dest, dest_max, src, src_max, bitptr); break;
-        default: return;
+          case 0: ok = decode_uncompressed(bs, dest, dest_max); break;
+          case 1: ok = decode_lz77(bs, dest, dest_min, dest_max, fixed_lit, fixed_dist); break;
+          case 2: ok = decode_variable(bs, dest, dest_min, dest_max); break;
+          default: break;
         }
-      } while( !is_last_block && bitptr != ~0);
+        if (!ok || bs.is_truncated()) return false;
+        if (is_last_block) return true;
+      }
     }
   };
 }}
-
@@ -0,0 +1,386 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// point, box and matrix hierarchy kernels for arrays
+//
+
+namespace octet { namespace math {
+  /// Transforms for arrays of points and matrices and view tests for arrays of boxes and spheres.
+  /// Points and boxes are turned into x, y and z lanes, four at a time with SSE2 and eight with AVX2,
+  /// so that each matrix element or plane is loaded once for many of them. The level is the one simd uses.
+  /// Boxes with a matrix each are left to aabb::get_transform: turning the matrices into lanes as well
+  /// costs more shuffles than it saves.
+  ///
+  /// Unlike the simd products there are no fused multiply-adds here: at every level the results are the same
+  /// as vec3 * mat4t, mat4t::operator* and frustum::intersects give one at a time,
+  /// so culling and picking do not change with the CPU.
+  class batch {
+    // plane i of a frustum as nx, ny, nz, offset, |nx|, |ny|, |nz|.
+    enum { plane_size = 8 };
+
+    static void get_planes(float *planes, const frustum &view) {
+      for (unsigned i = 0; i != frustum::num_planes; ++i) {
+        half_space plane = view.get_plane(i);
+        vec3 normal = plane.get_normal();
+        float *p = planes + i * plane_size;
+        p[0] = normal.x(); p[1] = normal.y(); p[2] = normal.z(); p[3] = plane.get_offset();
+        p[4] = fabsf(p[0]); p[5] = fabsf(p[1]); p[6] = fabsf(p[2]); p[7] = 0;
+      }
+    }
+
+    #if OCTET_SSE2
+      // a vec3 in a __m128, whether or not vec3 is kept in one.
+      static __m128 load_vec3(const vec3 &v) {
+        #if OCTET_SSE
+          return v.get_m();
+        #else
+          return _mm_setr_ps(v.x(), v.y(), v.z(), 0);
+        #endif
+      }
+
+      // four vec3p (x0 y0 z0 x1, y1 z1 x2 y2, z2 x3 y3 z3) as x, y and z lanes.
+      static void load_points_sse2(const float *p, __m128 &x, __m128 &y, __m128 &z) {
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        __m128 xy = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+        __m128 yz = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+        x = _mm_shuffle_ps(a, xy, _MM_SHUFFLE(2, 0, 3, 0));
+        y = _mm_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+        z = _mm_shuffle_ps(yz, c, _MM_SHUFFLE(3, 0, 3, 1));
+      }
+
+      static void store_points_sse2(float *p, __m128 x, __m128 y, __m128 z) {
+        __m128 xy = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_ps(p, _mm_shuffle_ps(xy, zx, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(p + 4, _mm_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm_storeu_ps(p + 8, _mm_shuffle_ps(zx, yz, _MM_SHUFFLE(3, 1, 3, 1)));
+      }
+
+      // x * m0k + y * m1k + z * m2k + m3k, added in the order of vec3 * mat4t.
+      static __m128 affine_sse2(__m128 x, __m128 y, __m128 z, const float *m, unsigned k) {
+        return _mm_add_ps(_mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(x, _mm_set1_ps(m[k])),
+          _mm_mul_ps(y, _mm_set1_ps(m[k + 4]))),
+          _mm_mul_ps(z, _mm_set1_ps(m[k + 8]))),
+          _mm_set1_ps(m[k + 12])
+        );
+      }
+
+      static unsigned transform_points_sse2(vec3p *result, const vec3p *points, const mat4t &m, unsigned count) {
+        const float *mp = m.get();
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m128 x, y, z;
+          load_points_sse2((const float*)(points + i), x, y, z);
+          store_points_sse2((float*)(result + i), affine_sse2(x, y, z, mp, 0), affine_sse2(x, y, z, mp, 1), affine_sse2(x, y, z, mp, 2));
+        }
+        return i;
+      }
+
+      // each plane value in all four lanes, made once for all the boxes.
+      static void splat_planes(__m128 *splat, const float *planes) {
+        for (unsigned i = 0; i != frustum::num_planes * plane_size; ++i) {
+          splat[i] = _mm_set1_ps(planes[i]);
+        }
+      }
+
+      // min over the planes of (distance + radius) for four centers and radii, as frustum::intersects makes them.
+      static __m128 min_far_sse2(const __m128 *planes, __m128 cx, __m128 cy, __m128 cz, __m128 hx, __m128 hy, __m128 hz, __m128 radius) {
+        __m128 result = _mm_set1_ps(1e37f);
+        for (unsigned i = 0; i != frustum::num_planes; ++i) {
+          const __m128 *p = planes + i * plane_size;
+          __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(p[0], cx),
+            _mm_mul_ps(p[1], cy)),
+            _mm_mul_ps(p[2], cz)),
+            p[3]
+          );
+          __m128 r = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(p[4], hx),
+            _mm_mul_ps(p[5], hy)),
+            _mm_mul_ps(p[6], hz)
+          );
+          result = _mm_min_ps(result, _mm_add_ps(_mm_add_ps(d, r), radius));
+        }
+        return result;
+      }
+
+      // write a result for each lane from the sign bits of min_far and count the visible ones.
+      static unsigned store_visible(uint8_t *visible, int mask, unsigned lanes) {
+        unsigned num_visible = 0;
+        for (unsigned k = 0; k != lanes; ++k) {
+          visible[k] = (mask >> k) & 1;
+          num_visible += visible[k];
+        }
+        return num_visible;
+      }
+
+      static unsigned intersects_aabbs_sse2(uint8_t *visible, const float *planes, const aabb *boxes, unsigned count, unsigned &num_visible) {
+        __m128 zero = _mm_setzero_ps(), splat[frustum::num_planes * plane_size];
+        splat_planes(splat, planes);
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m128 c0 = load_vec3(boxes[i].get_center()), c1 = load_vec3(boxes[i+1].get_center());
+          __m128 c2 = load_vec3(boxes[i+2].get_center()), c3 = load_vec3(boxes[i+3].get_center());
+          __m128 h0 = load_vec3(boxes[i].get_half_extent()), h1 = load_vec3(boxes[i+1].get_half_extent());
+          __m128 h2 = load_vec3(boxes[i+2].get_half_extent()), h3 = load_vec3(boxes[i+3].get_half_extent());
+          _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+          _MM_TRANSPOSE4_PS(h0, h1, h2, h3);
+          __m128 min_far = min_far_sse2(splat, c0, c1, c2, h0, h1, h2, zero);
+          num_visible += store_visible(visible + i, _mm_movemask_ps(_mm_cmpge_ps(min_far, zero)), 4);
+        }
+        return i;
+      }
+
+      static unsigned intersects_spheres_sse2(uint8_t *visible, const float *planes, const sphere *spheres, unsigned count, unsigned &num_visible) {
+        __m128 zero = _mm_setzero_ps(), splat[frustum::num_planes * plane_size];
+        splat_planes(splat, planes);
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m128 c0 = load_vec3(spheres[i].get_center()), c1 = load_vec3(spheres[i+1].get_center());
+          __m128 c2 = load_vec3(spheres[i+2].get_center()), c3 = load_vec3(spheres[i+3].get_center());
+          __m128 radius = _mm_setr_ps(spheres[i].get_radius(), spheres[i+1].get_radius(), spheres[i+2].get_radius(), spheres[i+3].get_radius());
+          _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+          __m128 min_far = min_far_sse2(splat, c0, c1, c2, zero, zero, zero, radius);
+          num_visible += store_visible(visible + i, _mm_movemask_ps(_mm_cmpge_ps(min_far, zero)), 4);
+        }
+        return i;
+      }
+    #endif
+
+    #if OCTET_AVX2
+      // as above with eight points or boxes: k in the low half and k + 4 in the high half.
+      OCTET_TARGET_AVX2_EXACT static __m256 load_pair_avx2(const float *lo, const float *hi) {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+      }
+
+      OCTET_TARGET_AVX2_EXACT static __m256 load_pair_avx2(const vec3 &lo, const vec3 &hi) {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(load_vec3(lo)), load_vec3(hi), 1);
+      }
+
+      OCTET_TARGET_AVX2_EXACT static void store_pair_avx2(float *lo, float *hi, __m256 value) {
+        _mm_storeu_ps(lo, _mm256_castps256_ps128(value));
+        _mm_storeu_ps(hi, _mm256_extractf128_ps(value, 1));
+      }
+
+      OCTET_TARGET_AVX2_EXACT static __m256 affine_avx2(__m256 x, __m256 y, __m256 z, const float *m, unsigned k) {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+          _mm256_mul_ps(x, _mm256_broadcast_ss(m + k)),
+          _mm256_mul_ps(y, _mm256_broadcast_ss(m + k + 4))),
+          _mm256_mul_ps(z, _mm256_broadcast_ss(m + k + 8))),
+          _mm256_broadcast_ss(m + k + 12)
+        );
+      }
+
+      OCTET_TARGET_AVX2_EXACT static unsigned transform_points_avx2(vec3p *result, const vec3p *points, const mat4t &m, unsigned count) {
+        const float *mp = m.get();
+        unsigned i = 0;
+        for (; i + 8 <= count; i += 8) {
+          const float *p = (const float*)(points + i);
+          __m256 a = load_pair_avx2(p, p + 12), b = load_pair_avx2(p + 4, p + 16), c = load_pair_avx2(p + 8, p + 20);
+          __m256 xy = _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+          __m256 yz = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+          __m256 x = _mm256_shuffle_ps(a, xy, _MM_SHUFFLE(2, 0, 3, 0));
+          __m256 y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+          __m256 z = _mm256_shuffle_ps(yz, c, _MM_SHUFFLE(3, 0, 3, 1));
+
+          __m256 rx = affine_avx2(x, y, z, mp, 0), ry = affine_avx2(x, y, z, mp, 1), rz = affine_avx2(x, y, z, mp, 2);
+          xy = _mm256_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 0, 2, 0));
+          yz = _mm256_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 1, 3, 1));
+          __m256 zx = _mm256_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 1, 2, 0));
+          float *r = (float*)(result + i);
+          store_pair_avx2(r, r + 12, _mm256_shuffle_ps(xy, zx, _MM_SHUFFLE(2, 0, 2, 0)));
+          store_pair_avx2(r + 4, r + 16, _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0)));
+          store_pair_avx2(r + 8, r + 20, _mm256_shuffle_ps(zx, yz, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        return i;
+      }
+
+      // the x, y and z lanes of (k | k + 4) rows, as _MM_TRANSPOSE4_PS does for four.
+      OCTET_TARGET_AVX2_EXACT static void transpose_avx2(__m256 r0, __m256 r1, __m256 r2, __m256 r3, __m256 &x, __m256 &y, __m256 &z) {
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, r3);
+        x = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(t0), _mm256_castps_pd(t1)));
+        y = _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(t0), _mm256_castps_pd(t1)));
+        z = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(t2), _mm256_castps_pd(t3)));
+      }
+
+      OCTET_TARGET_AVX2_EXACT static __m256 min_far_avx2(const float *planes, __m256 cx, __m256 cy, __m256 cz, __m256 hx, __m256 hy, __m256 hz, __m256 radius) {
+        __m256 result = _mm256_set1_ps(1e37f);
+        for (unsigned i = 0; i != frustum::num_planes; ++i) {
+          const float *p = planes + i * plane_size;
+          __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 0), cx),
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 1), cy)),
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 2), cz)),
+            _mm256_broadcast_ss(p + 3)
+          );
+          __m256 r = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 4), hx),
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 5), hy)),
+            _mm256_mul_ps(_mm256_broadcast_ss(p + 6), hz)
+          );
+          result = _mm256_min_ps(result, _mm256_add_ps(_mm256_add_ps(d, r), radius));
+        }
+        return result;
+      }
+
+      OCTET_TARGET_AVX2_EXACT static unsigned intersects_aabbs_avx2(uint8_t *visible, const float *planes, const aabb *boxes, unsigned count, unsigned &num_visible) {
+        __m256 zero = _mm256_setzero_ps();
+        unsigned i = 0;
+        for (; i + 8 <= count; i += 8) {
+          const aabb *b = boxes + i;
+          __m256 cx, cy, cz, hx, hy, hz;
+          transpose_avx2(
+            load_pair_avx2(b[0].get_center(), b[4].get_center()), load_pair_avx2(b[1].get_center(), b[5].get_center()),
+            load_pair_avx2(b[2].get_center(), b[6].get_center()), load_pair_avx2(b[3].get_center(), b[7].get_center()),
+            cx, cy, cz
+          );
+          transpose_avx2(
+            load_pair_avx2(b[0].get_half_extent(), b[4].get_half_extent()), load_pair_avx2(b[1].get_half_extent(), b[5].get_half_extent()),
+            load_pair_avx2(b[2].get_half_extent(), b[6].get_half_extent()), load_pair_avx2(b[3].get_half_extent(), b[7].get_half_extent()),
+            hx, hy, hz
+          );
+          __m256 min_far = min_far_avx2(planes, cx, cy, cz, hx, hy, hz, zero);
+          num_visible += store_visible(visible + i, _mm256_movemask_ps(_mm256_cmp_ps(min_far, zero, _CMP_GE_OQ)), 8);
+        }
+        return i;
+      }
+
+      OCTET_TARGET_AVX2_EXACT static unsigned intersects_spheres_avx2(uint8_t *visible, const float *planes, const sphere *spheres, unsigned count, unsigned &num_visible) {
+        __m256 zero = _mm256_setzero_ps();
+        unsigned i = 0;
+        for (; i + 8 <= count; i += 8) {
+          const sphere *s = spheres + i;
+          __m256 cx, cy, cz;
+          transpose_avx2(
+            load_pair_avx2(s[0].get_center(), s[4].get_center()), load_pair_avx2(s[1].get_center(), s[5].get_center()),
+            load_pair_avx2(s[2].get_center(), s[6].get_center()), load_pair_avx2(s[3].get_center(), s[7].get_center()),
+            cx, cy, cz
+          );
+          __m256 radius = _mm256_setr_ps(
+            s[0].get_radius(), s[1].get_radius(), s[2].get_radius(), s[3].get_radius(),
+            s[4].get_radius(), s[5].get_radius(), s[6].get_radius(), s[7].get_radius()
+          );
+          __m256 min_far = min_far_avx2(planes, cx, cy, cz, zero, zero, zero, radius);
+          num_visible += store_visible(visible + i, _mm256_movemask_ps(_mm256_cmp_ps(min_far, zero, _CMP_GE_OQ)), 8);
+        }
+        return i;
+      }
+
+      // x * r0 + y * r1 + z * r2 + w * r3 for two rows, added in the order of mat4t::lmul.
+      OCTET_TARGET_AVX2_EXACT static __m256 lmul_avx2(__m256 l, __m256 r0, __m256 r1, __m256 r2, __m256 r3) {
+        __m256 res = _mm256_mul_ps(r0, _mm256_permute_ps(l, _MM_SHUFFLE(0, 0, 0, 0)));
+        res = _mm256_add_ps(res, _mm256_mul_ps(r1, _mm256_permute_ps(l, _MM_SHUFFLE(1, 1, 1, 1))));
+        res = _mm256_add_ps(res, _mm256_mul_ps(r2, _mm256_permute_ps(l, _MM_SHUFFLE(2, 2, 2, 2))));
+        return _mm256_add_ps(res, _mm256_mul_ps(r3, _mm256_permute_ps(l, _MM_SHUFFLE(3, 3, 3, 3))));
+      }
+
+      OCTET_TARGET_AVX2_EXACT static void multiply_parents_avx2(mat4t *world, const mat4t *local, const int *parents, const mat4t &root, unsigned count) {
+        for (unsigned i = 0; i != count; ++i) {
+          const float *rhs = (parents[i] < 0 ? root : world[parents[i]]).get();
+          __m256 r0 = _mm256_broadcast_ps((const __m128*)rhs), r1 = _mm256_broadcast_ps((const __m128*)(rhs + 4));
+          __m256 r2 = _mm256_broadcast_ps((const __m128*)(rhs + 8)), r3 = _mm256_broadcast_ps((const __m128*)(rhs + 12));
+          __m256 l01 = _mm256_loadu_ps(local[i].get()), l23 = _mm256_loadu_ps(local[i].get() + 8);
+          _mm256_storeu_ps(world[i].get(), lmul_avx2(l01, r0, r1, r2, r3));
+          _mm256_storeu_ps(world[i].get() + 8, lmul_avx2(l23, r0, r1, r2, r3));
+        }
+      }
+    #endif
+
+  public:
+    /// result[i] = points[i] * m, for an affine m. result may be the same array as points.
+    static void transform_points(vec3p *result, const vec3p *points, const mat4t &m, unsigned count) {
+      unsigned i = 0;
+      switch (simd::get_level()) {
+        #if OCTET_AVX2
+          case simd::level_avx2: i = transform_points_avx2(result, points, m, count); // fall through for the rest
+        #endif
+        #if OCTET_SSE2
+          case simd::level_sse2: i += transform_points_sse2(result + i, points + i, m, count - i); break;
+        #endif
+        default: break;
+      }
+      for (; i != count; ++i) {
+        result[i] = (vec3)points[i] * m;
+      }
+    }
+
+    /// world[i] = local[i] * world[parents[i]], or local[i] * root if parents[i] is -1.
+    /// Parents must come before their children. world may be the same array as local,
+    /// so a hierarchy's node to parent matrices can be turned into node to root matrices where they are.
+    static void multiply_parents(mat4t *world, const mat4t *local, const int *parents, const mat4t &root, unsigned count) {
+      mat4t r = root;
+      for (unsigned i = 0; i != count; ++i) assert(parents[i] < (int)i);
+      switch (simd::get_level()) {
+        #if OCTET_AVX2
+          case simd::level_avx2: multiply_parents_avx2(world, local, parents, r, count); return;
+        #endif
+        #if OCTET_SSE2
+          case simd::level_sse2: {
+            for (unsigned i = 0; i != count; ++i) {
+              simd::multiply_sse2(world + i, local + i, parents[i] < 0 ? &r : world + parents[i], 0, 1);
+            }
+            return;
+          }
+        #endif
+        default: {
+          for (unsigned i = 0; i != count; ++i) {
+            simd::multiply_scalar(world + i, local + i, parents[i] < 0 ? &r : world + parents[i], 0, 1);
+          }
+          return;
+        }
+      }
+    }
+
+    /// visible[i] = view.intersects(boxes[i]). Returns the number visible.
+    static unsigned intersects(uint8_t *visible, const frustum &view, const aabb *boxes, unsigned count) {
+      unsigned i = 0, num_visible = 0;
+      #if OCTET_SSE2
+        float planes[frustum::num_planes * plane_size];
+        get_planes(planes, view);
+      #endif
+      switch (simd::get_level()) {
+        #if OCTET_AVX2
+          case simd::level_avx2: i = intersects_aabbs_avx2(visible, planes, boxes, count, num_visible); // fall through for the rest
+        #endif
+        #if OCTET_SSE2
+          case simd::level_sse2: i += intersects_aabbs_sse2(visible + i, planes, boxes + i, count - i, num_visible); break;
+        #endif
+        default: break;
+      }
+      for (; i != count; ++i) {
+        visible[i] = view.intersects(boxes[i]);
+        num_visible += visible[i];
+      }
+      return num_visible;
+    }
+
+    /// visible[i] = view.intersects(spheres[i]). Returns the number visible.
+    static unsigned intersects(uint8_t *visible, const frustum &view, const sphere *spheres, unsigned count) {
+      unsigned i = 0, num_visible = 0;
+      #if OCTET_SSE2
+        float planes[frustum::num_planes * plane_size];
+        get_planes(planes, view);
+      #endif
+      switch (simd::get_level()) {
+        #if OCTET_AVX2
+          case simd::level_avx2: i = intersects_spheres_avx2(visible, planes, spheres, count, num_visible); // fall through for the rest
+        #endif
+        #if OCTET_SSE2
+          case simd::level_sse2: i += intersects_spheres_sse2(visible + i, planes, spheres + i, count - i, num_visible); break;
+        #endif
+        default: break;
+      }
+      for (; i != count; ++i) {
+        visible[i] = view.intersects(spheres[i]);
+        num_visible += visible[i];
+      }
+      return num_visible;
+    }
+  };
+}}
@@ -10,13 +10,31 @@
 namespace octet { namespace math {
   // boolean vector
   class bvec4 {
-    int v[4]; // (v < 0) = true, (v >= 0) = false
+    // (v < 0) = true, (v >= 0) = false
+    #if OCTET_SSE
+      union {
+        __m128 m;
+        int v[4];
+      };
+    #else
+      int v[4];
+    #endif
   public:
     bvec4() {}
 
     bvec4(bool x, bool y, bool z, bool w) { v[0] = x ? -1 : 0; v[1] = y ? -1 : 0; v[2] = z ? -1 : 0; v[3] = w ? -1 : 0; };
     bvec4(int x, int y, int z, int w) { v[0] = x; v[1] = y; v[2] = z; v[3] = w; };
 
+    #if OCTET_SSE
+      bvec4(__m128 m) {
+        this->m = m;
+      }
+
+      __m128 get_m() const {
+        return m;
+      }
+    #endif
+
     int &operator[](int i) { return v[i]; }
     const int &operator[](int i) const { return v[i]; }
     bvec4 operator&(int r) const { return bvec4(v[0]&r, v[1]&r, v[2]&r, v[3]&r); }
@@ -42,19 +60,68 @@ namespace octet { namespace math {
     int w() const { return v[3]; }
   };
 
-  inline bvec4 operator>(const vec4 &lhs, const vec4 &rhs) { return bvec4(fgt(lhs.x(), rhs.x()), fgt(lhs.y(), rhs.y()), fgt(lhs.z(), rhs.z()), fgt(lhs.w(), rhs.w())); }
-  inline bvec4 operator<(const vec4 &lhs, const vec4 &rhs) { return bvec4(flt(lhs.x(), rhs.x()), flt(lhs.y(), rhs.y()), flt(lhs.z(), rhs.z()), flt(lhs.w(), rhs.w())); }
-  inline bvec4 operator>=(const vec4 &lhs, const vec4 &rhs) { return bvec4(fge(lhs.x(), rhs.x()), fge(lhs.y(), rhs.y()), fge(lhs.z(), rhs.z()), fge(lhs.w(), rhs.w())); }
-  inline bvec4 operator<=(const vec4 &lhs, const vec4 &rhs) { return bvec4(fle(lhs.x(), rhs.x()), fle(lhs.y(), rhs.y()), fle(lhs.z(), rhs.z()), fle(lhs.w(), rhs.w())); }
-  inline bvec4 operator==(const vec4 &lhs, const vec4 &rhs) { return bvec4(feq(lhs.x(), rhs.x()), feq(lhs.y(), rhs.y()), feq(lhs.z(), rhs.z()), feq(lhs.w(), rhs.w())); }
-  inline bvec4 operator!=(const vec4 &lhs, const vec4 &rhs) { return bvec4(fne(lhs.x(), rhs.x()), fne(lhs.y(), rhs.y()), fne(lhs.z(), rhs.z()), fne(lhs.w(), rhs.w())); }
+  inline bvec4 operator>(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmpgt_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(fgt(lhs.x(), rhs.x()), fgt(lhs.y(), rhs.y()), fgt(lhs.z(), rhs.z()), fgt(lhs.w(), rhs.w()));
+    #endif
+  }
+
+  inline bvec4 operator<(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmplt_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(flt(lhs.x(), rhs.x()), flt(lhs.y(), rhs.y()), flt(lhs.z(), rhs.z()), flt(lhs.w(), rhs.w()));
+    #endif
+  }
+
+  inline bvec4 operator>=(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmpge_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(fge(lhs.x(), rhs.x()), fge(lhs.y(), rhs.y()), fge(lhs.z(), rhs.z()), fge(lhs.w(), rhs.w()));
+    #endif
+  }
+
+  inline bvec4 operator<=(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmple_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(fle(lhs.x(), rhs.x()), fle(lhs.y(), rhs.y()), fle(lhs.z(), rhs.z()), fle(lhs.w(), rhs.w()));
+    #endif
+  }
+
+  inline bvec4 operator==(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmpeq_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(feq(lhs.x(), rhs.x()), feq(lhs.y(), rhs.y()), feq(lhs.z(), rhs.z()), feq(lhs.w(), rhs.w()));
+    #endif
+  }
+
+  inline bvec4 operator!=(const vec4 &lhs, const vec4 &rhs) {
+    #if OCTET_SSE
+      return bvec4(_mm_cmpneq_ps(lhs.get_m(), rhs.get_m()));
+    #else
+      return bvec4(fne(lhs.x(), rhs.x()), fne(lhs.y(), rhs.y()), fne(lhs.z(), rhs.z()), fne(lhs.w(), rhs.w()));
+    #endif
+  }
 
   bool all(const bvec4 &b) {
-    return (b.x() & b.y() & b.z() & b.w()) < 0;
+    #if OCTET_SSE
+      return _mm_movemask_ps(b.get_m()) == 15;
+    #else
+      return (b.x() & b.y() & b.z() & b.w()) < 0;
+    #endif
   }
 
   bool any(const bvec4 &b) {
-    return (b.x() | b.y() | b.z() | b.w()) < 0;
+    #if OCTET_SSE
+      return _mm_movemask_ps(b.get_m()) != 0;
+    #else
+      return (b.x() | b.y() | b.z() | b.w()) < 0;
+    #endif
   }
 } }
 
@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// view frustum in 3d
+//
+
+namespace octet { namespace math {
+  /// frustum: the six half spaces of a camera's view volume, used for culling.
+  /// dot(normal, x) + offset >= 0 for each plane if point x can be seen.
+  ///
+  /// The planes are kept in x, y, z and offset arrays so that one box
+  /// is tested against four planes at once with SSE2.
+  class frustum {
+  public:
+    enum { left, right, bottom, top, near_plane, far_plane, num_planes };
+
+  private:
+    // two groups of four planes. The last two always pass: normal 0, offset 1.
+    float normal_x[8];
+    float normal_y[8];
+    float normal_z[8];
+    float offset[8];
+
+    // abs(normal) for the box radius.
+    float abs_x[8];
+    float abs_y[8];
+    float abs_z[8];
+
+    void set_plane(unsigned i, vec4_in value) {
+      float len = length(value.xyz());
+      float scale = len ? 1.0f / len : 0.0f;
+      normal_x[i] = value.x() * scale;
+      normal_y[i] = value.y() * scale;
+      normal_z[i] = value.z() * scale;
+      offset[i] = len ? value.w() * scale : 1.0f;
+      abs_x[i] = fabsf(normal_x[i]);
+      abs_y[i] = fabsf(normal_y[i]);
+      abs_z[i] = fabsf(normal_z[i]);
+    }
+
+    // the lowest of (distance + radius) and (distance - radius) over the planes, for a box.
+    void get_extremes(vec3_in center, vec3_in half_extent, float &min_far, float &min_near) const {
+      #if OCTET_SSE2
+        __m128 cx = _mm_set1_ps(center.x()), cy = _mm_set1_ps(center.y()), cz = _mm_set1_ps(center.z());
+        __m128 hx = _mm_set1_ps(half_extent.x()), hy = _mm_set1_ps(half_extent.y()), hz = _mm_set1_ps(half_extent.z());
+        __m128 far_side = _mm_set1_ps(1e37f), near_side = _mm_set1_ps(1e37f);
+        for (unsigned i = 0; i != 8; i += 4) {
+          __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_loadu_ps(normal_x + i), cx),
+            _mm_mul_ps(_mm_loadu_ps(normal_y + i), cy)),
+            _mm_mul_ps(_mm_loadu_ps(normal_z + i), cz)),
+            _mm_loadu_ps(offset + i)
+          );
+          __m128 r = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_loadu_ps(abs_x + i), hx),
+            _mm_mul_ps(_mm_loadu_ps(abs_y + i), hy)),
+            _mm_mul_ps(_mm_loadu_ps(abs_z + i), hz)
+          );
+          far_side = _mm_min_ps(far_side, _mm_add_ps(d, r));
+          near_side = _mm_min_ps(near_side, _mm_sub_ps(d, r));
+        }
+        // minimum of the four lanes.
+        far_side = _mm_min_ps(far_side, _mm_shuffle_ps(far_side, far_side, _MM_SHUFFLE(1, 0, 3, 2)));
+        far_side = _mm_min_ss(far_side, _mm_shuffle_ps(far_side, far_side, _MM_SHUFFLE(2, 3, 0, 1)));
+        near_side = _mm_min_ps(near_side, _mm_shuffle_ps(near_side, near_side, _MM_SHUFFLE(1, 0, 3, 2)));
+        near_side = _mm_min_ss(near_side, _mm_shuffle_ps(near_side, near_side, _MM_SHUFFLE(2, 3, 0, 1)));
+        min_far = _mm_cvtss_f32(far_side);
+        min_near = _mm_cvtss_f32(near_side);
+      #else
+        float cx = center.x(), cy = center.y(), cz = center.z();
+        float hx = half_extent.x(), hy = half_extent.y(), hz = half_extent.z();
+        min_far = min_near = 1e37f;
+        for (unsigned i = 0; i != num_planes; ++i) {
+          float d = normal_x[i] * cx + normal_y[i] * cy + normal_z[i] * cz + offset[i];
+          float r = abs_x[i] * hx + abs_y[i] * hy + abs_z[i] * hz;
+          min_far = std::min(min_far, d + r);
+          min_near = std::min(min_near, d - r);
+        }
+      #endif
+    }
+
+  public:
+    /// A frustum that contains everything.
+    frustum() {
+      for (unsigned i = 0; i != 8; ++i) {
+        set_plane(i, vec4(0, 0, 0, 1));
+      }
+    }
+
+    /// The frustum of a world to projection matrix, such as worldToCamera * cameraToProjection.
+    explicit frustum(const mat4t &worldToProjection) {
+      init(worldToProjection);
+    }
+
+    /// Extract the planes from a world to projection matrix.
+    /// A point p can be seen if -w <= x, y, z <= w where (x, y, z, w) = p.xyz1() * worldToProjection.
+    void init(const mat4t &worldToProjection) {
+      const mat4t &m = worldToProjection;
+      vec4 x(m[0][0], m[1][0], m[2][0], m[3][0]);
+      vec4 y(m[0][1], m[1][1], m[2][1], m[3][1]);
+      vec4 z(m[0][2], m[1][2], m[2][2], m[3][2]);
+      vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+      set_plane(left, w + x);
+      set_plane(right, w - x);
+      set_plane(bottom, w + y);
+      set_plane(top, w - y);
+      set_plane(near_plane, w + z);
+      set_plane(far_plane, w - z);
+      set_plane(6, vec4(0, 0, 0, 1));
+      set_plane(7, vec4(0, 0, 0, 1));
+    }
+
+    /// Get one of the planes, the normal points inwards.
+    half_space get_plane(unsigned i) const {
+      return half_space(vec3(normal_x[i], normal_y[i], normal_z[i]), offset[i]);
+    }
+
+    /// Is the box (center +/- half_extent) at least partly inside?
+    bool intersects(vec3_in center, vec3_in half_extent) const {
+      float min_far, min_near;
+      get_extremes(center, half_extent, min_far, min_near);
+      return min_far >= 0;
+    }
+
+    /// Is the aabb at least partly inside?
+    bool intersects(const aabb &rhs) const {
+      return intersects(rhs.get_center(), rhs.get_half_extent());
+    }
+
+    /// Is the sphere at least partly inside?
+    bool intersects(const sphere &rhs) const {
+      float min_far, min_near;
+      get_extremes(rhs.get_center(), vec3(0, 0, 0), min_far, min_near);
+      return min_far + rhs.get_radius() >= 0;
+    }
+
+    /// Is the box (center +/- half_extent) completely inside?
+    bool contains(vec3_in center, vec3_in half_extent) const {
+      float min_far, min_near;
+      get_extremes(center, half_extent, min_far, min_near);
+      return min_near >= 0;
+    }
+
+    /// Is the aabb completely inside?
+    bool contains(const aabb &rhs) const {
+      return contains(rhs.get_center(), rhs.get_half_extent());
+    }
+  };
+} }
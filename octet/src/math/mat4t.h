@@ -147,11 +147,8 @@ namespace octet { namespace math {
     /// Multiply operator: note this treats matrices as row-major unlike gl matrices which are column-major
     mat4t operator*(const mat4t &r) const
     {
-      mat4t res;
-      for (int i = 0; i != 4; ++i) {
-        res.v[i] = r[0] * v[i].xxxx() + r[1] * v[i].yyyy() + r[2] * v[i].zzzz() + r[3] * v[i].wwww();
-      }
-      return res;
+      // each row is r[0] * v[i].xxxx() + r[1] * v[i].yyyy() + r[2] * v[i].zzzz() + r[3] * v[i].wwww()
+      return mat4t(r.lmul(v[0]), r.lmul(v[1]), r.lmul(v[2]), r.lmul(v[3]));
     }
   
     /// Add operator
@@ -291,8 +288,11 @@ namespace octet { namespace math {
       return mat4t( colx(), coly(), colz(), colw() );
     }
 
-    /// Get the full inverse of the matrix
-    mat4t inverse4x4() const {
+    /// Get the full inverse of the matrix. With SSE2 this is the simd kernel (see simd.h).
+    mat4t inverse4x4() const;
+
+    /// The full inverse without the simd kernels.
+    mat4t inverse4x4_scalar() const {
       vec4 v0 = v[0];
       vec4 v1 = v[1];
       vec4 v2 = v[2];
@@ -366,7 +366,11 @@ namespace octet { namespace math {
     }
   
     /// Get the  general inverse of 3x4 matrix (with v[3] = vec4(0, 0, 0, 1))
-    mat4t inverse3x4() const {
+    /// With SSE2 this is the simd kernel (see simd.h).
+    mat4t inverse3x4() const;
+
+    /// The 3x4 inverse without the simd kernels.
+    mat4t inverse3x4_scalar() const {
       float rdet = 1.0f / det3x3();
       mat4t d = adjoint3x3();
       d[0] = d[0] * rdet;
@@ -72,6 +72,7 @@ namespace octet {
 #include "ivec4.h"
 #include "quat.h"
 #include "mat4t.h"
+#include "simd.h"
 #include "bvec2.h"
 #include "bvec3.h"
 #include "bvec4.h"
@@ -82,6 +83,8 @@ namespace octet {
 #include "sphere.h"
 #include "plane.h"
 #include "half_space.h"
+#include "frustum.h"
+#include "batch.h"
 #include "ray.h"
 #include "polygon.h"
 #include "zcylinder.h"
@@ -30,7 +30,10 @@ namespace octet { namespace math {
     }
 
     ray get_transform(const mat4t &mat) const {
-      return ray((origin.xyz1() * mat).xyz(), (distance.xyz0() * mat).xyz());
+      ray result;
+      result.origin = (origin.xyz1() * mat).xyz();
+      result.distance = (distance.xyz0() * mat).xyz();
+      return result;
     }
 
     const char *toString(char *dest, size_t len) const {
@@ -109,7 +112,7 @@ namespace octet { namespace math {
     }
 
     vec3 get_distance() const {
-      return origin + distance;
+      return distance;
     }
   };
 
@@ -21,12 +21,9 @@ namespace octet { namespace math {
     /// note we have to use a union because of GCC's
     /// type based alias analysis interpretation.
     #if OCTET_SSE
-      union { __m128 m; float f; int i; } fur, fua, fub;
-      /// negative numbers are 1.......
-      fua.f = a;
-      fub.f = b;
-      fur.m = _mm_cmple_ps(fua.m, fub.m);
-      return fur.i;
+      /// all 1s if a > b, kept in registers.
+      __m128 r = _mm_cmpgt_ss(_mm_set_ss(a), _mm_set_ss(b));
+      return _mm_cvtsi128_si32(_mm_castps_si128(r));
     #else
       union { float f; int i; } fu;
       /// negative numbers are 1.......
@@ -53,14 +50,10 @@ namespace octet { namespace math {
   /// return sel < 0 ? t : f
   inline float fsel(int sel, float t, float f) {
     #if OCTET_SSE
-      union { __m128 m; float f; int i; } fum, fua, fub;
-      fua.f = f;
-      fub.f = t;
-      fum.i = sel;
-      __m128 b = _mm_and_ps( fua.m, fum.m );
-      __m128 a = _mm_andnot_ps( fum.m, fub.m );
-      fum.m =_mm_or_ps( a, b );
-      return fum.f;
+      __m128 mask = _mm_castsi128_ps(_mm_cvtsi32_si128(sel >> 31)); /// all 1s or 0s
+      __m128 b = _mm_and_ps( _mm_set_ss(t), mask );
+      __m128 a = _mm_andnot_ps( mask, _mm_set_ss(f) );
+      return _mm_cvtss_f32(_mm_or_ps( a, b ));
     #else
       union { float f; int i; } fua, fub;
       fua.f = f;
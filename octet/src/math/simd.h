@@ -0,0 +1,431 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// matrix kernels for arrays, chosen at run time for the CPU
+//
+
+namespace octet { namespace math {
+  /// Matrix products, inverses and vector transforms for whole arrays, in plain C++, SSE2 and AVX2/FMA.
+  /// The best version the CPU can run is used unless set_level chooses another, for example to compare them.
+  ///
+  /// The scalar and SSE2 products give the same results as the mat4t operators. The inverses,
+  /// and the AVX2 versions which use fused multiply-adds, may differ from the scalar ones in the last bits.
+  /// mat4t::inverse4x4 and inverse3x4 use the SSE2 kernels. mat4t::operator* and vec4 * mat4t stay
+  /// inline SSE: for one matrix a call costs as much as the multiply.
+  class simd {
+    // batch uses the row kernels and mat4t the single matrix inverses.
+    friend class batch;
+    friend class mat4t;
+
+  public:
+    enum level_t { level_scalar, level_sse2, level_avx2, num_levels };
+
+  private:
+    static level_t &access_level() {
+      static level_t level = get_best_level();
+      return level;
+    }
+
+    // row i of a matrix in a __m128.
+    static const float *row(const mat4t &m, unsigned i) { return m.get() + i * 4; }
+    static float *row(mat4t &m, unsigned i) { return m.get() + i * 4; }
+
+    #if OCTET_SSE2
+      // (a[x], a[y], b[z], b[w])
+      #define OCTET_SIMD_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+      #define OCTET_SIMD_SWIZZLE(a, x, y, z, w) _mm_shuffle_ps(a, a, _MM_SHUFFLE(w, z, y, x))
+
+      // 2x2 matrices as (m00, m01, m10, m11): a * b, adj(a) * b and a * adj(b).
+      static __m128 mul2x2(__m128 a, __m128 b) {
+        return _mm_add_ps(_mm_mul_ps(a, OCTET_SIMD_SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 0, 3, 2), OCTET_SIMD_SWIZZLE(b, 2, 1, 2, 1)));
+      }
+
+      static __m128 adj_mul2x2(__m128 a, __m128 b) {
+        return _mm_sub_ps(_mm_mul_ps(OCTET_SIMD_SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 1, 2, 2), OCTET_SIMD_SWIZZLE(b, 2, 3, 0, 1)));
+      }
+
+      static __m128 mul_adj2x2(__m128 a, __m128 b) {
+        return _mm_sub_ps(_mm_mul_ps(a, OCTET_SIMD_SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 0, 3, 2), OCTET_SIMD_SWIZZLE(b, 2, 1, 2, 1)));
+      }
+
+      // yzxw for cross products.
+      static __m128 yzx(__m128 a) {
+        return OCTET_SIMD_SWIZZLE(a, 1, 2, 0, 3);
+      }
+
+      // x * r0 + y * r1 + z * r2 + w * r3, added in the order of mat4t::lmul.
+      static __m128 lmul_sse2(__m128 l, __m128 r0, __m128 r1, __m128 r2, __m128 r3) {
+        __m128 res = _mm_mul_ps(r0, OCTET_SIMD_SWIZZLE(l, 0, 0, 0, 0));
+        res = _mm_add_ps(res, _mm_mul_ps(r1, OCTET_SIMD_SWIZZLE(l, 1, 1, 1, 1)));
+        res = _mm_add_ps(res, _mm_mul_ps(r2, OCTET_SIMD_SWIZZLE(l, 2, 2, 2, 2)));
+        return _mm_add_ps(res, _mm_mul_ps(r3, OCTET_SIMD_SWIZZLE(l, 3, 3, 3, 3)));
+      }
+
+      static void multiply_sse2(mat4t *result, const mat4t *lhs, const mat4t *rhs, size_t rhs_stride, unsigned count) {
+        for (unsigned i = 0; i != count; ++i, rhs += rhs_stride) {
+          __m128 r0 = _mm_loadu_ps(row(*rhs, 0)), r1 = _mm_loadu_ps(row(*rhs, 1));
+          __m128 r2 = _mm_loadu_ps(row(*rhs, 2)), r3 = _mm_loadu_ps(row(*rhs, 3));
+          for (unsigned j = 0; j != 4; ++j) {
+            _mm_storeu_ps(row(result[i], j), lmul_sse2(_mm_loadu_ps(row(lhs[i], j)), r0, r1, r2, r3));
+          }
+        }
+      }
+
+      static void transform_sse2(vec4 *result, const vec4 *vecs, const mat4t &m, unsigned count) {
+        __m128 r0 = _mm_loadu_ps(row(m, 0)), r1 = _mm_loadu_ps(row(m, 1));
+        __m128 r2 = _mm_loadu_ps(row(m, 2)), r3 = _mm_loadu_ps(row(m, 3));
+        for (unsigned i = 0; i != count; ++i) {
+          _mm_storeu_ps(result[i].get(), lmul_sse2(_mm_loadu_ps(vecs[i].get()), r0, r1, r2, r3));
+        }
+      }
+
+      // the block method: see "Fast 4x4 Matrix Inverse with SSE SIMD, Explained" (Eric Zhang).
+      static void inverse4x4_sse2(mat4t *result, const mat4t *src, unsigned count) {
+        for (unsigned i = 0; i != count; ++i) {
+          __m128 m0 = _mm_loadu_ps(row(src[i], 0)), m1 = _mm_loadu_ps(row(src[i], 1));
+          __m128 m2 = _mm_loadu_ps(row(src[i], 2)), m3 = _mm_loadu_ps(row(src[i], 3));
+
+          // the four 2x2 blocks | A B |
+          //                     | C D |
+          __m128 a = _mm_movelh_ps(m0, m1), b = _mm_movehl_ps(m1, m0);
+          __m128 c = _mm_movelh_ps(m2, m3), d = _mm_movehl_ps(m3, m2);
+
+          // (|A|, |B|, |C|, |D|)
+          __m128 det_sub = _mm_sub_ps(
+            _mm_mul_ps(OCTET_SIMD_SHUFFLE(m0, m2, 0, 2, 0, 2), OCTET_SIMD_SHUFFLE(m1, m3, 1, 3, 1, 3)),
+            _mm_mul_ps(OCTET_SIMD_SHUFFLE(m0, m2, 1, 3, 1, 3), OCTET_SIMD_SHUFFLE(m1, m3, 0, 2, 0, 2))
+          );
+          __m128 det_a = OCTET_SIMD_SWIZZLE(det_sub, 0, 0, 0, 0), det_b = OCTET_SIMD_SWIZZLE(det_sub, 1, 1, 1, 1);
+          __m128 det_c = OCTET_SIMD_SWIZZLE(det_sub, 2, 2, 2, 2), det_d = OCTET_SIMD_SWIZZLE(det_sub, 3, 3, 3, 3);
+
+          __m128 d_c = adj_mul2x2(d, c);
+          __m128 a_b = adj_mul2x2(a, b);
+          __m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), mul2x2(b, d_c));
+          __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), mul2x2(c, a_b));
+          __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mul_adj2x2(d, a_b));
+          __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mul_adj2x2(a, d_c));
+
+          // |M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C)
+          __m128 tr = _mm_mul_ps(a_b, OCTET_SIMD_SWIZZLE(d_c, 0, 2, 1, 3));
+          tr = _mm_add_ps(tr, OCTET_SIMD_SWIZZLE(tr, 2, 3, 0, 1));
+          tr = _mm_add_ps(tr, OCTET_SIMD_SWIZZLE(tr, 1, 0, 3, 2));
+          __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+          __m128 rdet = _mm_div_ps(_mm_setr_ps(1, -1, -1, 1), det);
+
+          x = _mm_mul_ps(x, rdet);
+          y = _mm_mul_ps(y, rdet);
+          z = _mm_mul_ps(z, rdet);
+          w = _mm_mul_ps(w, rdet);
+
+          // the adjugates of the blocks, back in rows.
+          _mm_storeu_ps(row(result[i], 0), OCTET_SIMD_SHUFFLE(x, y, 3, 1, 3, 1));
+          _mm_storeu_ps(row(result[i], 1), OCTET_SIMD_SHUFFLE(x, y, 2, 0, 2, 0));
+          _mm_storeu_ps(row(result[i], 2), OCTET_SIMD_SHUFFLE(z, w, 3, 1, 3, 1));
+          _mm_storeu_ps(row(result[i], 3), OCTET_SIMD_SHUFFLE(z, w, 2, 0, 2, 0));
+        }
+      }
+
+      static void inverse3x4_sse2(mat4t *result, const mat4t *src, unsigned count) {
+        __m128 zero = _mm_setzero_ps(), unit_w = _mm_setr_ps(0, 0, 0, 1);
+        __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        for (unsigned i = 0; i != count; ++i) {
+          __m128 c0 = _mm_loadu_ps(row(src[i], 0)), c1 = _mm_loadu_ps(row(src[i], 1));
+          __m128 c2 = _mm_loadu_ps(row(src[i], 2)), c3 = zero;
+          // (-tx, -ty, -tz, 1)
+          __m128 t = _mm_or_ps(_mm_and_ps(_mm_sub_ps(zero, _mm_loadu_ps(row(src[i], 3))), xyz), unit_w);
+          _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+          // the rows of the adjoint are cross products of the columns, as in mat4t::adjoint3x3.
+          __m128 c0_yzx = yzx(c0), c1_yzx = yzx(c1), c2_yzx = yzx(c2);
+          __m128 d0 = yzx(_mm_sub_ps(_mm_mul_ps(c1, c2_yzx), _mm_mul_ps(c2, c1_yzx)));
+          __m128 d1 = yzx(_mm_sub_ps(_mm_mul_ps(c2, c0_yzx), _mm_mul_ps(c0, c2_yzx)));
+          __m128 d2 = yzx(_mm_sub_ps(_mm_mul_ps(c0, c1_yzx), _mm_mul_ps(c1, c0_yzx)));
+
+          __m128 det = _mm_mul_ps(c0, d0);
+          det = _mm_add_ps(det, OCTET_SIMD_SWIZZLE(det, 2, 3, 0, 1));
+          det = _mm_add_ps(det, OCTET_SIMD_SWIZZLE(det, 1, 0, 3, 2));
+          __m128 rdet = _mm_div_ps(_mm_set1_ps(1), det);
+          d0 = _mm_mul_ps(d0, rdet);
+          d1 = _mm_mul_ps(d1, rdet);
+          d2 = _mm_mul_ps(d2, rdet);
+
+          _mm_storeu_ps(row(result[i], 0), d0);
+          _mm_storeu_ps(row(result[i], 1), d1);
+          _mm_storeu_ps(row(result[i], 2), d2);
+          _mm_storeu_ps(row(result[i], 3), lmul_sse2(t, d0, d1, d2, unit_w));
+        }
+      }
+
+      #undef OCTET_SIMD_SHUFFLE
+      #undef OCTET_SIMD_SWIZZLE
+    #endif
+
+    #if OCTET_AVX2
+      // as above with two rows or two matrices in a __m256, one in each half.
+      #define OCTET_SIMD_SHUFFLE(a, b, x, y, z, w) _mm256_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+      #define OCTET_SIMD_SWIZZLE(a, x, y, z, w) _mm256_permute_ps(a, _MM_SHUFFLE(w, z, y, x))
+
+      OCTET_TARGET_AVX2 static __m256 movelh_avx2(__m256 a, __m256 b) {
+        return _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(a), _mm256_castps_pd(b)));
+      }
+
+      OCTET_TARGET_AVX2 static __m256 movehl_avx2(__m256 a, __m256 b) {
+        return _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(b), _mm256_castps_pd(a)));
+      }
+
+      OCTET_TARGET_AVX2 static __m256 mul2x2_avx2(__m256 a, __m256 b) {
+        return _mm256_fmadd_ps(a, OCTET_SIMD_SWIZZLE(b, 0, 3, 0, 3), _mm256_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 0, 3, 2), OCTET_SIMD_SWIZZLE(b, 2, 1, 2, 1)));
+      }
+
+      OCTET_TARGET_AVX2 static __m256 adj_mul2x2_avx2(__m256 a, __m256 b) {
+        return _mm256_fmsub_ps(OCTET_SIMD_SWIZZLE(a, 3, 3, 0, 0), b, _mm256_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 1, 2, 2), OCTET_SIMD_SWIZZLE(b, 2, 3, 0, 1)));
+      }
+
+      OCTET_TARGET_AVX2 static __m256 mul_adj2x2_avx2(__m256 a, __m256 b) {
+        return _mm256_fmsub_ps(a, OCTET_SIMD_SWIZZLE(b, 3, 0, 3, 0), _mm256_mul_ps(OCTET_SIMD_SWIZZLE(a, 1, 0, 3, 2), OCTET_SIMD_SWIZZLE(b, 2, 1, 2, 1)));
+      }
+
+      // row j of matrices m and n.
+      OCTET_TARGET_AVX2 static __m256 load_rows_avx2(const mat4t &m, const mat4t &n, unsigned j) {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(row(m, j))), _mm_loadu_ps(row(n, j)), 1);
+      }
+
+      OCTET_TARGET_AVX2 static void store_rows_avx2(mat4t &m, mat4t &n, unsigned j, __m256 value) {
+        _mm_storeu_ps(row(m, j), _mm256_castps256_ps128(value));
+        _mm_storeu_ps(row(n, j), _mm256_extractf128_ps(value, 1));
+      }
+
+      // x * r0 + y * r1 + z * r2 + w * r3 for the vector in each half of l.
+      OCTET_TARGET_AVX2 static __m256 lmul_avx2(__m256 l, __m256 r0, __m256 r1, __m256 r2, __m256 r3) {
+        __m256 res = _mm256_mul_ps(r0, OCTET_SIMD_SWIZZLE(l, 0, 0, 0, 0));
+        res = _mm256_fmadd_ps(r1, OCTET_SIMD_SWIZZLE(l, 1, 1, 1, 1), res);
+        res = _mm256_fmadd_ps(r2, OCTET_SIMD_SWIZZLE(l, 2, 2, 2, 2), res);
+        return _mm256_fmadd_ps(r3, OCTET_SIMD_SWIZZLE(l, 3, 3, 3, 3), res);
+      }
+
+      OCTET_TARGET_AVX2 static void multiply_avx2(mat4t *result, const mat4t *lhs, const mat4t *rhs, size_t rhs_stride, unsigned count) {
+        for (unsigned i = 0; i != count; ++i, rhs += rhs_stride) {
+          __m256 r0 = _mm256_broadcast_ps((const __m128*)row(*rhs, 0)), r1 = _mm256_broadcast_ps((const __m128*)row(*rhs, 1));
+          __m256 r2 = _mm256_broadcast_ps((const __m128*)row(*rhs, 2)), r3 = _mm256_broadcast_ps((const __m128*)row(*rhs, 3));
+          __m256 l01 = _mm256_loadu_ps(row(lhs[i], 0)), l23 = _mm256_loadu_ps(row(lhs[i], 2));
+          _mm256_storeu_ps(row(result[i], 0), lmul_avx2(l01, r0, r1, r2, r3));
+          _mm256_storeu_ps(row(result[i], 2), lmul_avx2(l23, r0, r1, r2, r3));
+        }
+      }
+
+      OCTET_TARGET_AVX2 static void transform_avx2(vec4 *result, const vec4 *vecs, const mat4t &m, unsigned count) {
+        __m256 r0 = _mm256_broadcast_ps((const __m128*)row(m, 0)), r1 = _mm256_broadcast_ps((const __m128*)row(m, 1));
+        __m256 r2 = _mm256_broadcast_ps((const __m128*)row(m, 2)), r3 = _mm256_broadcast_ps((const __m128*)row(m, 3));
+        unsigned i = 0;
+        for (; i + 2 <= count; i += 2) {
+          _mm256_storeu_ps(result[i].get(), lmul_avx2(_mm256_loadu_ps(vecs[i].get()), r0, r1, r2, r3));
+        }
+        if (i != count) {
+          __m256 res = lmul_avx2(_mm256_castps128_ps256(_mm_loadu_ps(vecs[i].get())), r0, r1, r2, r3);
+          _mm_storeu_ps(result[i].get(), _mm256_castps256_ps128(res));
+        }
+      }
+
+      // two matrices at a time; an odd one at the end is done with itself.
+      OCTET_TARGET_AVX2 static void inverse4x4_avx2(mat4t *result, const mat4t *src, unsigned count) {
+        for (unsigned i = 0; i < count; i += 2) {
+          unsigned i1 = i + 1 < count ? i + 1 : i;
+          __m256 m0 = load_rows_avx2(src[i], src[i1], 0), m1 = load_rows_avx2(src[i], src[i1], 1);
+          __m256 m2 = load_rows_avx2(src[i], src[i1], 2), m3 = load_rows_avx2(src[i], src[i1], 3);
+
+          __m256 a = movelh_avx2(m0, m1), b = movehl_avx2(m1, m0);
+          __m256 c = movelh_avx2(m2, m3), d = movehl_avx2(m3, m2);
+
+          __m256 det_sub = _mm256_fmsub_ps(
+            OCTET_SIMD_SHUFFLE(m0, m2, 0, 2, 0, 2), OCTET_SIMD_SHUFFLE(m1, m3, 1, 3, 1, 3),
+            _mm256_mul_ps(OCTET_SIMD_SHUFFLE(m0, m2, 1, 3, 1, 3), OCTET_SIMD_SHUFFLE(m1, m3, 0, 2, 0, 2))
+          );
+          __m256 det_a = OCTET_SIMD_SWIZZLE(det_sub, 0, 0, 0, 0), det_b = OCTET_SIMD_SWIZZLE(det_sub, 1, 1, 1, 1);
+          __m256 det_c = OCTET_SIMD_SWIZZLE(det_sub, 2, 2, 2, 2), det_d = OCTET_SIMD_SWIZZLE(det_sub, 3, 3, 3, 3);
+
+          __m256 d_c = adj_mul2x2_avx2(d, c);
+          __m256 a_b = adj_mul2x2_avx2(a, b);
+          __m256 x = _mm256_fmsub_ps(det_d, a, mul2x2_avx2(b, d_c));
+          __m256 w = _mm256_fmsub_ps(det_a, d, mul2x2_avx2(c, a_b));
+          __m256 y = _mm256_fmsub_ps(det_b, c, mul_adj2x2_avx2(d, a_b));
+          __m256 z = _mm256_fmsub_ps(det_c, b, mul_adj2x2_avx2(a, d_c));
+
+          __m256 tr = _mm256_mul_ps(a_b, OCTET_SIMD_SWIZZLE(d_c, 0, 2, 1, 3));
+          tr = _mm256_add_ps(tr, OCTET_SIMD_SWIZZLE(tr, 2, 3, 0, 1));
+          tr = _mm256_add_ps(tr, OCTET_SIMD_SWIZZLE(tr, 1, 0, 3, 2));
+          __m256 det = _mm256_sub_ps(_mm256_fmadd_ps(det_a, det_d, _mm256_mul_ps(det_b, det_c)), tr);
+          __m256 rdet = _mm256_div_ps(_mm256_setr_ps(1, -1, -1, 1, 1, -1, -1, 1), det);
+
+          x = _mm256_mul_ps(x, rdet);
+          y = _mm256_mul_ps(y, rdet);
+          z = _mm256_mul_ps(z, rdet);
+          w = _mm256_mul_ps(w, rdet);
+
+          mat4t &r0 = result[i], &r1 = result[i1];
+          store_rows_avx2(r0, r1, 0, OCTET_SIMD_SHUFFLE(x, y, 3, 1, 3, 1));
+          store_rows_avx2(r0, r1, 1, OCTET_SIMD_SHUFFLE(x, y, 2, 0, 2, 0));
+          store_rows_avx2(r0, r1, 2, OCTET_SIMD_SHUFFLE(z, w, 3, 1, 3, 1));
+          store_rows_avx2(r0, r1, 3, OCTET_SIMD_SHUFFLE(z, w, 2, 0, 2, 0));
+        }
+      }
+
+      #undef OCTET_SIMD_SHUFFLE
+      #undef OCTET_SIMD_SWIZZLE
+    #endif
+
+    static void multiply_scalar(mat4t *result, const mat4t *lhs, const mat4t *rhs, size_t rhs_stride, unsigned count) {
+      for (unsigned i = 0; i != count; ++i, rhs += rhs_stride) {
+        const float *b = rhs->get();
+        float r[16];
+        for (unsigned j = 0; j != 4; ++j) {
+          const float *a = row(lhs[i], j);
+          for (unsigned k = 0; k != 4; ++k) {
+            r[j*4+k] = b[k] * a[0] + b[k+4] * a[1] + b[k+8] * a[2] + b[k+12] * a[3];
+          }
+        }
+        memcpy(result[i].get(), r, sizeof(r));
+      }
+    }
+
+    static void transform_scalar(vec4 *result, const vec4 *vecs, const mat4t &m, unsigned count) {
+      const float *b = m.get();
+      for (unsigned i = 0; i != count; ++i) {
+        const float *a = vecs[i].get();
+        float r[4];
+        for (unsigned k = 0; k != 4; ++k) {
+          r[k] = b[k] * a[0] + b[k+4] * a[1] + b[k+8] * a[2] + b[k+12] * a[3];
+        }
+        result[i] = vec4(r[0], r[1], r[2], r[3]);
+      }
+    }
+
+  public:
+    /// The fastest version this CPU can run.
+    static level_t get_best_level() {
+      #if OCTET_AVX2
+        #if defined(_MSC_VER)
+          int info[4];
+          __cpuid(info, 0);
+          if (info[0] >= 7) {
+            __cpuid(info, 1);
+            bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+            __cpuidex(info, 7, 0);
+            bool avx2 = (info[1] & (1 << 5)) != 0;
+            // the OS must also save the upper halves of the registers.
+            if (fma && avx2 && osxsave && (_xgetbv(0) & 6) == 6) return level_avx2;
+          }
+        #else
+          __builtin_cpu_init();
+          if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return level_avx2;
+        #endif
+      #endif
+      return OCTET_SSE2 ? level_sse2 : level_scalar;
+    }
+
+    /// The version in use.
+    static level_t get_level() {
+      return access_level();
+    }
+
+    /// Use another version, for example to compare them. Versions the CPU cannot run are not used.
+    static void set_level(level_t value) {
+      level_t best = get_best_level();
+      access_level() = value < best ? value : best;
+    }
+
+    /// "scalar", "sse2" or "avx2"
+    static const char *get_level_name(level_t value) {
+      static const char *names[] = { "scalar", "sse2", "avx2" };
+      return value < num_levels ? names[value] : "";
+    }
+
+    /// result[i] = lhs[i] * rhs[i], for example to make modelToWorld for many nodes.
+    /// result may be the same array as lhs or rhs.
+    static void multiply(mat4t *result, const mat4t *lhs, const mat4t *rhs, unsigned count) {
+      switch (get_level()) {
+        #if OCTET_AVX2
+          case level_avx2: multiply_avx2(result, lhs, rhs, 1, count); return;
+        #endif
+        #if OCTET_SSE2
+          case level_sse2: multiply_sse2(result, lhs, rhs, 1, count); return;
+        #endif
+        default: multiply_scalar(result, lhs, rhs, 1, count); return;
+      }
+    }
+
+    /// result[i] = lhs[i] * rhs, for example to take many matrices to camera space.
+    static void multiply(mat4t *result, const mat4t *lhs, const mat4t &rhs, unsigned count) {
+      mat4t r = rhs;
+      switch (get_level()) {
+        #if OCTET_AVX2
+          case level_avx2: multiply_avx2(result, lhs, &r, 0, count); return;
+        #endif
+        #if OCTET_SSE2
+          case level_sse2: multiply_sse2(result, lhs, &r, 0, count); return;
+        #endif
+        default: multiply_scalar(result, lhs, &r, 0, count); return;
+      }
+    }
+
+    /// result[i] = vecs[i] * m. result may be the same array as vecs.
+    static void transform(vec4 *result, const vec4 *vecs, const mat4t &m, unsigned count) {
+      switch (get_level()) {
+        #if OCTET_AVX2
+          case level_avx2: transform_avx2(result, vecs, m, count); return;
+        #endif
+        #if OCTET_SSE2
+          case level_sse2: transform_sse2(result, vecs, m, count); return;
+        #endif
+        default: transform_scalar(result, vecs, m, count); return;
+      }
+    }
+
+    /// result[i] = src[i].inverse4x4(). result may be the same array as src.
+    static void inverse4x4(mat4t *result, const mat4t *src, unsigned count) {
+      switch (get_level()) {
+        #if OCTET_AVX2
+          case level_avx2: inverse4x4_avx2(result, src, count); return;
+        #endif
+        #if OCTET_SSE2
+          case level_sse2: inverse4x4_sse2(result, src, count); return;
+        #endif
+        default: for (unsigned i = 0; i != count; ++i) result[i] = src[i].inverse4x4_scalar(); return;
+      }
+    }
+
+    /// result[i] = src[i].inverse3x4(). result may be the same array as src.
+    /// There is no AVX2 version: transposing two matrices at once cost more than it saved.
+    static void inverse3x4(mat4t *result, const mat4t *src, unsigned count) {
+      switch (get_level()) {
+        #if OCTET_SSE2
+          case level_avx2:
+          case level_sse2: inverse3x4_sse2(result, src, count); return;
+        #endif
+        default: for (unsigned i = 0; i != count; ++i) result[i] = src[i].inverse3x4_scalar(); return;
+      }
+    }
+  };
+
+  inline mat4t mat4t::inverse4x4() const {
+    #if OCTET_SSE2
+      mat4t result;
+      simd::inverse4x4_sse2(&result, this, 1);
+      return result;
+    #else
+      return inverse4x4_scalar();
+    #endif
+  }
+
+  inline mat4t mat4t::inverse3x4() const {
+    #if OCTET_SSE2
+      mat4t result;
+      simd::inverse3x4_sse2(&result, this, 1);
+      return result;
+    #else
+      return inverse3x4_scalar();
+    #endif
+  }
+}}
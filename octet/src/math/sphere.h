@@ -59,7 +59,7 @@ namespace octet { namespace math {
     bool intersects(const aabb &rhs) const {
       vec3 diff = abs(get_center() - rhs.get_center());
       vec3 closest = min(diff, rhs.get_half_extent());
-      float d2 = squared(get_center() - closest);
+      float d2 = squared(diff - closest);
       return d2 <= squared(get_radius());
     }
 
@@ -327,14 +327,13 @@ namespace octet { namespace math {
 
     // sum of terms
     float sum() const {
-      return v[0] + v[1] + v[2];
-      /*#if OCTET_SSE
-        __m128 a = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,0,3,2)));
-        __m128 b = _mm_add_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,0,0,0)));
-        return b.m128_f32[0];
+      #if OCTET_SSE
+        // (x + y) + z without leaving the registers.
+        __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(m, m)));
       #else
         return v[0] + v[1] + v[2];
-      #endif*/
+      #endif
     }
 
     // convert to a string
@@ -438,12 +437,10 @@ namespace octet { namespace math {
     vec3p(const vec3p &in) { v[0] = in.v[0]; v[1] = in.v[1]; v[2] = in.v[2]; }
     vec3p(const vec3 &in) {
       #if OCTET_SSE
-        static const u_m128_i4 mask = { -1, -1, -1, 0 };
-        #ifdef OCTET_MAC
-          _mm_maskmoveu_si128(in.get_m(), (__m128i&)mask.m, (char*)v);
-        #else
-          _mm_maskmoveu_si128((__m128i&)in.get_m(), (__m128i&)mask.m, (char*)v);
-        #endif
+        // x and y then z; maskmovdqu would bypass the cache.
+        __m128 m = in.get_m();
+        _mm_storel_pi((__m64*)v, m);
+        _mm_store_ss(v + 2, _mm_movehl_ps(m, m));
       #else
         v[0] = in[0]; v[1] = in[1]; v[2] = in[2];
       #endif
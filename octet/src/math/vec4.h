@@ -202,7 +202,7 @@ namespace octet { namespace math {
       #if OCTET_SSE
         return vec4(_mm_div_ps(m, r.m));
       #else
-        return vec4(v[0]*r.v[0], v[1]*r.v[1], v[2]*r.v[2], v[3]*r.v[3]);
+        return vec4(v[0]/r.v[0], v[1]/r.v[1], v[2]/r.v[2], v[3]/r.v[3]);
       #endif
     }
 
@@ -369,6 +369,10 @@ namespace octet { namespace math {
       return v[3];
     }
 
+    #if OCTET_SSE
+      OCTET_HOT __m128 get_m() const { return m; }
+    #endif
+
     // quaternion multiply
     OCTET_HOT vec4 qmul(const vec4 &r) const {
       return vec4(
@@ -109,6 +109,9 @@
   // CG, GLSL, C++ compiler
   #include "compiler/compiler.h"
 
+  // job scheduler for running work on every core
+  #include "resources/job.h"
+
   // loaders (low dependency, so you can use them in other projects)
   #include "loaders/loaders.h"
 
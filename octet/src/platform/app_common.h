@@ -22,6 +22,7 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_model_to_world = 9, // a mat4 per instance, uses 9 to 12
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -106,6 +107,9 @@ namespace octet {
 
     void end_frame() {
       prev_keys = keys;
+
+      // temporary containers on the frame_allocator die here.
+      frame_allocator::reset();
     }
 
     virtual void draw_world(int x, int y, int w, int h) = 0;
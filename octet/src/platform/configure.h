@@ -27,15 +27,93 @@
 #endif
 
 #if defined(WIN32)
-  #define OCTET_SSE 1
+  #ifndef OCTET_SSE
+    #define OCTET_SSE 1
+  #endif
   #pragma warning(disable : 4996)
 #endif
 
 #if OCTET_MAC
-  #define OCTET_SSE 1
+  #ifndef OCTET_SSE
+    #define OCTET_SSE 1
+  #endif
   #define GL_UNIFORM_BUFFER 0
 #endif
 
+// vec2, vec3, vec4, bvec3 and mat4t in SSE registers on x86 Linux as on Windows and the Mac.
+// Build with -D OCTET_SSE=0 to keep them as arrays of floats.
+#if defined(OCTET_LINUX) && !defined(OCTET_SSE) && defined(__SSE2__)
+  #define OCTET_SSE 1
+#endif
+
+// SSE2 integer intrinsics, available on every x64 compiler.
+// Build with -D OCTET_SSE2=0 to use the scalar code instead.
+#ifndef OCTET_SSE2
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCTET_SSE2 1
+  #else
+    #define OCTET_SSE2 0
+  #endif
+#endif
+
+// AVX2 and FMA versions of the math::simd kernels, used only when the CPU has them.
+// Build with -D OCTET_AVX2=0 to leave them out.
+#ifndef OCTET_AVX2
+  #if OCTET_SSE2 && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1800))
+    #define OCTET_AVX2 1
+  #else
+    #define OCTET_AVX2 0
+  #endif
+#endif
+
+// hardware instancing (glDrawElementsInstanced and glVertexAttribDivisor).
+// OpenGL ES 2 and the legacy OpenGL on the Mac do not have it. Build with -D OCTET_INSTANCING=0 to turn it off.
+#ifndef OCTET_INSTANCING
+  #if defined(OCTET_GLES2) || defined(__APPLE__)
+    #define OCTET_INSTANCING 0
+  #else
+    #define OCTET_INSTANCING 1
+  #endif
+#endif
+
+// skinning on the GPU with the bone matrices in a float texture read by the vertex shader.
+// Without it, skinned meshes are skinned on the CPU. Build with -D OCTET_GPU_SKINNING=0 to turn it off.
+#ifndef OCTET_GPU_SKINNING
+  #if defined(OCTET_GLES2) || defined(__APPLE__)
+    #define OCTET_GPU_SKINNING 0
+  #else
+    #define OCTET_GPU_SKINNING 1
+  #endif
+#endif
+
+// fences to tell when the GPU has finished with a copy in a streaming buffer (see gl_resource::allocate_stream).
+// Without them, streaming buffers are orphaned instead. Build with -D OCTET_STREAM_FENCES=0 to turn them off.
+#ifndef OCTET_STREAM_FENCES
+  #if defined(OCTET_GLES2) || defined(__APPLE__)
+    #define OCTET_STREAM_FENCES 0
+  #else
+    #define OCTET_STREAM_FENCES 1
+  #endif
+#endif
+
+// thread local storage for plain old data
+#if defined(_MSC_VER)
+  #define OCTET_THREAD_LOCAL __declspec(thread)
+#else
+  #define OCTET_THREAD_LOCAL __thread
+#endif
+
+// compile a function for AVX2 and FMA whatever the compiler flags. Call it only if the CPU has them.
+// OCTET_TARGET_AVX2_EXACT leaves out FMA, which GCC would otherwise use to fuse separate multiplies and adds,
+// for functions that must give the same results as SSE2.
+#if defined(_MSC_VER)
+  #define OCTET_TARGET_AVX2
+  #define OCTET_TARGET_AVX2_EXACT
+#else
+  #define OCTET_TARGET_AVX2 __attribute__((target("avx2,fma")))
+  #define OCTET_TARGET_AVX2_EXACT __attribute__((target("avx2")))
+#endif
+
 // use <> to include from standard directories
 // use "" to include from our own project
 #include <stdio.h>
@@ -54,9 +132,31 @@
 #include <numeric>
 #include <iostream>
 #include <fstream>
+#include <utility>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if OCTET_SSE || OCTET_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if OCTET_AVX2
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #endif
+#endif
 
 #if defined(WIN32)
   #include <direct.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
 #endif
 
 namespace octet {
@@ -341,9 +341,9 @@ namespace octet {
         // waste some time. (do not do this in real games!)
         Sleep(1000/30);
 
-        for (int i = 0; i != m.size(); ++i) {
+        for (int i = 0; i != m.get_num_indices(); ++i) {
           // note: because Win8 generates an invisible window, we need to check m.value(i)
-          if (m.get_key(i) && m.get_value(i)) {
+          if (m.is_used(i) && m.get_value(i)) {
             m.get_value(i)->render();
           }
         }
@@ -25,6 +25,68 @@ namespace octet {
 }
 
 namespace octet { namespace resources {
+  class app_utils;
+
+  /// The bytes of a URL, mapped into memory rather than copied where possible.
+  ///
+  /// Local files use file_map and stored zip entries point into the mapped archive.
+  /// Compressed zip entries and other URLs are read into a buffer.
+  /// Decoders take the range [get_src(), get_src_max()), which is valid while the mapped_url lives.
+  ///
+  /// Example:
+  ///
+  ///     mapped_url file;
+  ///     app_utils::get_url(file, "assets/duck.jpg");
+  ///     jpeg_decoder dec;
+  ///     dec.get_image(bytes, format, width, height, file.get_src(), file.get_src_max());
+  ///
+  class mapped_url {
+    friend class app_utils;
+
+    file_map *map;
+    dynarray<uint8_t> buffer;
+    const uint8_t *src;
+    const uint8_t *src_max;
+
+    // non-copyable
+    mapped_url(const mapped_url &);
+    mapped_url &operator=(const mapped_url &);
+
+    void use_buffer() {
+      src = buffer.data();
+      src_max = src + buffer.size();
+    }
+  public:
+    mapped_url() {
+      map = 0;
+      src = src_max = 0;
+    }
+
+    ~mapped_url() {
+      reset();
+    }
+
+    /// unmap the file or free the buffer
+    void reset() {
+      delete map;
+      map = 0;
+      buffer.reset();
+      src = src_max = 0;
+    }
+
+    /// first byte of the data
+    const uint8_t *get_src() const { return src; }
+
+    /// one past the last byte of the data
+    const uint8_t *get_src_max() const { return src_max; }
+
+    /// number of bytes of data
+    size_t get_size() const { return (size_t)(src_max - src); }
+
+    /// true if the data is mapped from a file rather than copied to a buffer.
+    bool is_mapped() const { return src && src != buffer.data(); }
+  };
+
   /// A set of utilities   
   class app_utils {
   public:
@@ -85,17 +147,25 @@ namespace octet { namespace resources {
       return path;
     }
 
+    /// Split a "zip://path/archive.zip/file" URL into the open archive and the file name.
+    /// Returns NULL if the URL has no .zip in it.
+    static zip_file *get_zip_entry(const char *url, const char *&file) {
+      const char *zip = strstr(url + 6, ".zip");
+      if (!zip) return NULL;
+      int path_len = (int)(zip - (url + 6) + 4);
+      string zip_url;
+      zip_url.set(url + 6, path_len);
+      file = (url + 6) + path_len;
+      file += file[0] == '/';
+      return get_zip_file(zip_url.c_str());
+    }
+
     /// Get a file into a buffer, given a URL.
     static void get_url(dynarray<unsigned char> &buffer, const char *url) {
       if (!strncmp(url, "zip://", 6)) {
-        const char *zip = strstr(url + 6, ".zip");
+        const char *file = NULL;
+        zip_file *zip = get_zip_entry(url, file);
         if (zip) {
-          int path_len = (int)(zip - (url + 6) + 4);
-          string zip_url;
-          zip_url.set(url + 6, path_len);
-          const char *file = (url + 6) + path_len;
-          file += file[0] == '/';
-          zip_file *zip = get_zip_file(zip_url.c_str());
           zip->get_file(buffer, file);
         }
       } else if (!strncmp(url, "http://", 7)) {
@@ -118,6 +188,38 @@ namespace octet { namespace resources {
       }
     }
 
+    /// Get a file given a URL without copying it: local files are mapped into memory.
+    ///
+    /// Use this for binary files that go straight to a decoder.
+    /// The data is not zero terminated, so text parsers must stop at get_src_max().
+    static void get_url(mapped_url &result, const char *url) {
+      result.reset();
+      if (strncmp(url, "zip://", 6) && strncmp(url, "http://", 7)) {
+        const char *path = get_path(url);
+        file_map *map = new file_map(path);
+        if (map->get_data()) {
+          result.map = map;
+          result.src = map->get_data();
+          result.src_max = result.src + (size_t)map->get_size();
+          return;
+        }
+        delete map;
+      }
+
+      // stored zip entries are used in place, the archive stays mapped.
+      if (!strncmp(url, "zip://", 6)) {
+        const char *file = NULL;
+        zip_file *zip = get_zip_entry(url, file);
+        if (zip && zip->get_stored_file(result.src, result.src_max, string_key(file))) {
+          return;
+        }
+      }
+
+      // compressed zip entries, web pages and empty files.
+      get_url(result.buffer, url);
+      result.use_buffer();
+    }
+
     /// Generate a stock texture. To be deprecated.
     static GLuint get_stock_texture(unsigned gl_kind, const char *name) {
       //stock_texture_generator stock;
@@ -232,12 +334,14 @@ namespace octet { namespace resources {
           (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
         }
       }
-      if (dict->contains(name)) {
-        //log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
+      string_key key(name);
+      int index = dict->get_index(key);
+      if (index >= 0) {
+        //log("old atom %s %d\n", name, dict->get_value(index));
+        return dict->get_value(index);
       } else {
         //log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
+        return (*dict)[key] = (atom_t)num_atoms++;
       }
     }
 
@@ -144,3 +144,5 @@ OCTET_ATOM(npos)
 OCTET_ATOM(diffuse_light)
 OCTET_ATOM(specular_light)
 OCTET_ATOM(first_index)
+OCTET_ATOM(bone_palette)
+OCTET_ATOM(bone_palette_coord)
@@ -6,6 +6,12 @@
 //
 // map a file to memory
 
+/// Map a file into memory for reading.
+///
+/// The operating system pages the file in as it is read, so there is no copy
+/// into a heap buffer. The data is valid until the file_map is destroyed.
+///
+/// Empty files and missing files have no data; get_error() says why.
 class file_map {
   #ifdef WIN32
     HANDLE file_handle;
@@ -16,23 +22,40 @@ class file_map {
   uint64_t size;
   const uint8_t *data;
   const char *error;
+
+  // non-copyable
+  file_map(const file_map &);
+  file_map &operator=(const file_map &);
 public:
-  file_map(const char *file_name) {
+  /// How the file will be read. This is a hint to the pager.
+  enum access_t {
+    /// read from start to finish once, as decoders do: read ahead aggressively.
+    sequential,
+    /// jump around the file, as zip directories do.
+    random
+  };
+
+  file_map(const char *file_name, access_t access = sequential) {
     error = 0;
     data = 0;
     size = 0;
 
+    #ifdef WIN32
+      file_handle = INVALID_HANDLE_VALUE;
+      mapping_handle = 0;
+    #else
+      file_handle = -1;
+    #endif
+
     if (file_name == NULL) {
       error = "no file name";
       return;
     }
 
     #ifdef WIN32
-      mapping_handle = INVALID_HANDLE_VALUE;
-
       file_handle = CreateFileA(
         file_name, GENERIC_READ, FILE_SHARE_READ, 0,
-        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+        OPEN_EXISTING, access == sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, 0
       );
 
       if (file_handle == INVALID_HANDLE_VALUE) {
@@ -42,26 +65,63 @@ public:
 
       DWORD sizehi = 0, sizelo = GetFileSize(file_handle, &sizehi);
       size = ((uint64_t)sizehi << 32) | sizelo;
+      if (size == 0) {
+        return;
+      }
+
       mapping_handle = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
 
-      if (mapping_handle == INVALID_HANDLE_VALUE) {
+      if (mapping_handle == 0) {
         error = "could not map file";
+        size = 0;
         return;
       }
 
       data = (const uint8_t *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+      if (!data) {
+        error = "could not map file";
+        size = 0;
+      }
     #else
-      //file_handle = open(file_name, O_RDONLY);
-      //mmap
+      file_handle = open(file_name, O_RDONLY);
+      if (file_handle < 0) {
+        error = "could not open file";
+        return;
+      }
+
+      struct stat st;
+      if (fstat(file_handle, &st) != 0) {
+        error = "could not stat file";
+        return;
+      }
+
+      size = (uint64_t)st.st_size;
+      if (size == 0) {
+        return;
+      }
+
+      void *ptr = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE, file_handle, 0);
+      if (ptr == MAP_FAILED) {
+        error = "could not map file";
+        size = 0;
+        return;
+      }
+
+      // start reading now, we will need the pages soon.
+      madvise(ptr, (size_t)size, access == sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+      madvise(ptr, (size_t)size, MADV_WILLNEED);
+      data = (const uint8_t *)ptr;
     #endif
   }
 
   ~file_map() {
     #ifdef WIN32
-      UnmapViewOfFile(data);
-      CloseHandle(file_handle);
-      CloseHandle(mapping_handle);
+      if (data) UnmapViewOfFile(data);
+      if (mapping_handle) CloseHandle(mapping_handle);
+      if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
     #else
+      if (data) munmap((void*)data, (size_t)size);
+      if (file_handle >= 0) close(file_handle);
     #endif
   }
 
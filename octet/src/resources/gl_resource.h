@@ -23,6 +23,59 @@ namespace octet { namespace resources {
     // GL_ARRAY_BUFFER etc.
     GLuint target;
 
+    // changes whenever the contents may have changed.
+    mutable uint32_t version;
+
+    // streaming buffers hold num_copies copies of get_size() bytes, so that one can be written
+    // while the GPU draws from the others. lock_write_only moves on to the next copy.
+    enum { max_copies = 4 };
+    unsigned num_copies;
+    mutable unsigned copy_index;
+    GLuint usage;
+    #if OCTET_STREAM_FENCES
+      // a fence for each copy, set when the next copy is started: it passes when the GPU has finished the draws.
+      mutable GLsync fences[max_copies];
+    #endif
+
+    // can fences be used? This needs OpenGL 3.2 or later.
+    static bool has_fences() {
+      #if OCTET_STREAM_FENCES
+        static int supported = -1;
+        if (supported == -1) {
+          supported = get_gl_version() >= 32;
+          #ifdef WIN32
+            supported = supported && glFenceSync && glClientWaitSync && glDeleteSync;
+          #endif
+        }
+        return supported != 0;
+      #else
+        return false;
+      #endif
+    }
+
+    // start writing the next copy of a streaming buffer, waiting if the GPU is still drawing from it.
+    void next_copy() const {
+      #if OCTET_STREAM_FENCES
+        if (has_fences()) {
+          // this passes when the draws from the copy just written have finished.
+          fences[copy_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+          copy_index = (copy_index + 1) % num_copies;
+          if (fences[copy_index]) {
+            while (glClientWaitSync(fences[copy_index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fences[copy_index]);
+            fences[copy_index] = 0;
+          }
+          return;
+        }
+      #endif
+      copy_index = (copy_index + 1) % num_copies;
+      // without fences, give the buffer new storage (orphaning): the GPU keeps the old one until it has finished.
+      // In GLES2 the new copy is then sent with glBufferSubData by unlock_write_only.
+      glBindBuffer(target, buffer);
+      glBufferData(target, get_size() * num_copies, NULL, usage);
+    }
+
   public:
     /// Helper class to make a write-only lock
     class wolock {
@@ -70,6 +123,15 @@ namespace octet { namespace resources {
     /// Make a new OpenGL Resource
     gl_resource(unsigned target=0, unsigned size=0) {
       buffer = 0;
+      version = 0;
+      num_copies = 1;
+      copy_index = 0;
+      usage = GL_STATIC_DRAW;
+      #if OCTET_STREAM_FENCES
+        for (unsigned i = 0; i != max_copies; ++i) {
+          fences[i] = 0;
+        }
+      #endif
       this->target = target;
       if (size) {
         allocate(target, size);
@@ -96,11 +158,76 @@ namespace octet { namespace resources {
         this->size = size;
       #endif
       this->target = target;
+      this->usage = kind;
+      glBindBuffer(target, 0);
+    }
+
+    /// Allocate a buffer for data that is written every frame, such as particles or text.
+    /// It holds num_copies copies of size bytes. Each lock_write_only starts a new copy, waiting
+    /// only if the GPU may still be drawing from it, so the whole copy must be written. Draws must
+    /// add get_stream_offset() to their offsets into the buffer.
+    void allocate_stream(GLuint target, size_t size, unsigned num_copies = 3, GLuint kind = GL_STREAM_DRAW) {
+      reset();
+      num_copies = std::max(1u, std::min(num_copies, (unsigned)max_copies));
+      glGenBuffers(1, &buffer);
+      glBindBuffer(target, buffer);
+      glBufferData(target, size * num_copies, NULL, kind);
+      #ifdef OCTET_GLES2
+        bytes.resize((unsigned)(size * num_copies));
+      #else
+        this->size = size;
+      #endif
+      this->target = target;
+      this->usage = kind;
+      this->num_copies = num_copies;
       glBindBuffer(target, 0);
     }
 
+    /// Allocate a new OpenGL object and fill it with data in one step.
+    /// This saves mapping the buffer and copying the data in with assign().
+    void allocate(GLuint target, const void *data, size_t size, GLuint kind = GL_STATIC_DRAW) {
+      reset();
+      glGenBuffers(1, &buffer);
+      glBindBuffer(target, buffer);
+      glBufferData(target, size, data, kind);
+      #ifdef OCTET_GLES2
+        bytes.resize((unsigned)size);
+        memcpy(bytes.data(), data, size);
+      #else
+        this->size = size;
+      #endif
+      this->target = target;
+      this->usage = kind;
+      glBindBuffer(target, 0);
+    }
+
+    /// Allocate a new OpenGL object from an array of bytes.
+    /// In GLES2 we keep the array itself as our copy of the data, so nothing gets copied on the CPU.
+    void allocate(GLuint target, dynarray<uint8_t> &&data, GLuint kind = GL_STATIC_DRAW) {
+      #ifdef OCTET_GLES2
+        reset();
+        bytes = std::move(data);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferData(target, bytes.size(), bytes.data(), kind);
+        this->target = target;
+        this->usage = kind;
+        glBindBuffer(target, 0);
+      #else
+        allocate(target, data.data(), data.size(), kind);
+        data.reset();
+      #endif
+    }
+
     /// Clear the OpenGL object
     void reset() {
+      version++;
+      #if OCTET_STREAM_FENCES
+        for (unsigned i = 0; i != max_copies; ++i) {
+          if (fences[i]) glDeleteSync(fences[i]);
+          fences[i] = 0;
+        }
+      #endif
       if (buffer != 0) {
         glDeleteBuffers(1, &buffer);
       }
@@ -108,6 +235,8 @@ namespace octet { namespace resources {
         bytes.reset();
       #endif
       buffer = 0;
+      num_copies = 1;
+      copy_index = 0;
     }
 
     /// Destructor
@@ -120,32 +249,59 @@ namespace octet { namespace resources {
       return target;
     }
 
-    /// get the buffer size
+    /// get the buffer size, or the size of one copy of a streaming buffer.
     size_t get_size() const {
       #ifdef OCTET_GLES2
-        return bytes.size();
+        return bytes.size() / num_copies;
       #else
         return size;
       #endif
     }
 
+    /// Is this a streaming buffer? (see allocate_stream)
+    bool is_stream() const {
+      return num_copies > 1;
+    }
+
+    /// The offset of the copy of a streaming buffer that was written last, zero for other buffers.
+    size_t get_stream_offset() const {
+      return copy_index * get_size();
+    }
+
+    /// The OpenGL version times ten, eg. 31 for OpenGL 3.1, or 0 for OpenGL ES.
+    static int get_gl_version() {
+      static int version = -1;
+      if (version == -1) {
+        const char *str = (const char*)glGetString(GL_VERSION);
+        int major = 0, minor = 0;
+        version = str && sscanf(str, "%d.%d", &major, &minor) == 2 ? major * 10 + minor : 0;
+      }
+      return version;
+    }
+
     /// get the GL buffer object we are wrapping.
     GLuint get_buffer() const {
       return buffer;
     }
 
+    /// Get a number that changes every time the buffer is allocated or locked for writing.
+    /// Use this to see if data copied from the buffer is out of date.
+    uint32_t get_version() const {
+      return version;
+    }
+
     /// get a read-only lock on this buffer
     /// deprecated
     const void *lock_read_only() const {
       #ifdef OCTET_GLES2
-        return (const void*)&bytes[0];
+        return (const void*)&bytes[get_stream_offset()];
       #else
         glBindBuffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
-          return glMapBuffer(target, GL_READ_ONLY);
+          return (const uint8_t*)glMapBuffer(target, GL_READ_ONLY) + get_stream_offset();
         #else
-          return glMapBufferRange(target, 0, size, GL_MAP_READ_BIT);
+          return glMapBufferRange(target, get_stream_offset(), size, GL_MAP_READ_BIT);
         #endif
       #endif
     }
@@ -162,16 +318,17 @@ namespace octet { namespace resources {
     /// get a read-write lock on this buffer. Do not use this by preference.
     /// deprecated
     void *lock() const {
+      version++;
       #ifdef OCTET_GLES2
-        return (void*)&bytes[0];
+        return (void*)&bytes[get_stream_offset()];
       #else
         glBindBuffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
           void *res = glMapBuffer(target, GL_READ_WRITE);
-          return res;
+          return (uint8_t*)res + get_stream_offset();
         #else
-          return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT|GL_MAP_WRITE_BIT);
+          return glMapBufferRange(target, get_stream_offset(), size, GL_MAP_WRITE_BIT|GL_MAP_WRITE_BIT);
         #endif
       #endif
     }
@@ -181,24 +338,29 @@ namespace octet { namespace resources {
     void unlock() const {
       #ifdef OCTET_GLES2
         glBindBuffer(target, buffer);
-        glBufferSubData(target, 0, bytes.size(), &bytes[0]);
+        glBufferSubData(target, get_stream_offset(), get_size(), &bytes[get_stream_offset()]);
       #else
         glUnmapBuffer(target);
       #endif
     }
 
-    /// get a read-write lock on this buffer
+    /// get a write-only lock on this buffer. For a streaming buffer, this is a new copy.
     /// deprecated
     void *lock_write_only() const {
+      version++;
+      if (num_copies > 1) next_copy();
       #ifdef OCTET_GLES2
-        return (void*)&bytes[0];
+        return (void*)&bytes[get_stream_offset()];
       #else
         glBindBuffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
-          return glMapBuffer(target, GL_WRITE_ONLY);
+          return (uint8_t*)glMapBuffer(target, GL_WRITE_ONLY) + get_stream_offset();
         #else
-          return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT);
+          // the GPU has finished with the copy (or it is new storage), so there is no need to wait for it.
+          GLbitfield access = GL_MAP_WRITE_BIT;
+          if (num_copies > 1) access |= GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+          return glMapBufferRange(target, get_stream_offset(), size, access);
         #endif
       #endif
     }
@@ -208,7 +370,7 @@ namespace octet { namespace resources {
     void unlock_write_only() const {
       #ifdef OCTET_GLES2
         glBindBuffer(target, buffer);
-        glBufferSubData(target, 0, bytes.size(), &bytes[0]);
+        glBufferSubData(target, get_stream_offset(), get_size(), &bytes[get_stream_offset()]);
       #else
         glUnmapBuffer(target);
       #endif
@@ -219,12 +381,23 @@ namespace octet { namespace resources {
       glBindBuffer(target, buffer);
     }
 
-    /// copy data into the resource
+    /// copy data into the resource. Only offset to offset + size is sent to OpenGL, with glBufferSubData,
+    /// so small parts of large buffers can be updated cheaply. A streaming buffer starts a new copy.
     void assign(const void *ptr, size_t offset, size_t size) {
       assert(offset + size <= this->get_size());
 
-      memcpy((void*)((char*)lock_write_only() + offset), ptr, size);
-      unlock_write_only();
+      if (num_copies > 1) {
+        memcpy((void*)((char*)lock_write_only() + offset), ptr, size);
+        unlock_write_only();
+        return;
+      }
+
+      version++;
+      #ifdef OCTET_GLES2
+        memcpy(&bytes[(unsigned)offset], ptr, size);
+      #endif
+      glBindBuffer(target, buffer);
+      glBufferSubData(target, offset, size, ptr);
     }
 
     /// copy data from another gl resource.
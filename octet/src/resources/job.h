@@ -4,52 +4,345 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// work in progress
+// Jobs and a work stealing scheduler to run them on every core.
+//
+// example:
+//
+//   job_scheduler &sch = job_scheduler::get();
+//   sch.parallel_for(0, num_meshes, [&](unsigned i) { skin(meshes[i]); });
+//
 
 namespace octet { namespace resources {
-  class job : public resource {
-    ref<job> next;
+  class job_scheduler;
 
-    enum state_t {
-      state_waiting,
-      state_running,
-    };
+  /// Counts unfinished jobs. job_scheduler::wait() returns when it gets to zero.
+  class job_counter {
+    friend class job_scheduler;
+    std::atomic<int> value;
+
+    // non-copyable
+    job_counter(const job_counter &);
+    job_counter &operator=(const job_counter &);
+  public:
+    job_counter() {
+      value.store(0);
+    }
+
+    /// number of jobs added with this counter that have not finished.
+    int get_value() const {
+      return value.load(std::memory_order_acquire);
+    }
+
+    /// true when every job added with this counter has finished.
+    bool is_done() const {
+      return get_value() == 0;
+    }
+  };
+
+  /// A piece of work for the job_scheduler: override kernel().
+  ///
+  /// A job runs once, on any thread. Jobs belong to whoever made them and must
+  /// live until they have finished, so wait on their counter before deleting them.
+  class job {
+    friend class job_scheduler;
+
+    // reasons not to run yet: one until the job is added, plus one for each unfinished dependency.
+    std::atomic<int> wait_count;
+
+    // jobs that are waiting for this one to finish.
+    dynarray<job*> dependents;
+
+    // counter to decrement when the job has finished.
+    job_counter *counter;
+
+    // non-copyable
+    job(const job &);
+    job &operator=(const job &);
+  public:
+    job() {
+      wait_count.store(1);
+      counter = 0;
+    }
+
+    virtual ~job() {
+    }
+
+    /// the work to do.
+    virtual void kernel() = 0;
+
+    /// Do not start this job until other has finished.
+    /// Call this before adding either job to the scheduler.
+    void depends_on(job *other) {
+      wait_count++;
+      other->dependents.push_back(this);
+    }
+  };
+
+  /// Work stealing thread pool.
+  ///
+  /// There is a worker thread for each extra core. Each worker, and the other threads together,
+  /// have a queue of jobs. A thread runs the newest job from its own queue and when that is empty,
+  /// steals the oldest job from another queue. Threads that wait for jobs run jobs too,
+  /// so a job can add more jobs and wait for them.
+  class job_scheduler {
+    // Jobs for one thread, in a ring buffer with a spin lock.
+    // The owner pushes and pops at the back, thieves take from the front.
+    class job_queue {
+      std::atomic_flag busy;
+      dynarray<job*> ring;
+      unsigned head;
+      unsigned tail;
+
+      void lock() {
+        while (busy.test_and_set(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+      }
+
+      void unlock() {
+        busy.clear(std::memory_order_release);
+      }
+    public:
+      job_queue() : ring(64) {
+        busy.clear();
+        head = tail = 0;
+      }
+
+      void push(job *jb) {
+        lock();
+        unsigned size = ring.size();
+        if (tail - head == size) {
+          dynarray<job*> bigger(size * 2);
+          for (unsigned i = head; i != tail; ++i) {
+            bigger[i - head] = ring[i & (size - 1)];
+          }
+          tail -= head;
+          head = 0;
+          ring = std::move(bigger);
+        }
+        ring[tail++ & (ring.size() - 1)] = jb;
+        unlock();
+      }
 
-    state_t state;
+      job *pop() {
+        lock();
+        job *jb = tail != head ? ring[--tail & (ring.size() - 1)] : 0;
+        unlock();
+        return jb;
+      }
 
-    class scheduler {
-      job *waiting;
-      job *running;
+      job *steal() {
+        lock();
+        job *jb = tail != head ? ring[head++ & (ring.size() - 1)] : 0;
+        unlock();
+        return jb;
+      }
+    };
+
+    // runs a function object as a job.
+    template <class fn_t> class function_job : public job {
+      fn_t *fn;
     public:
-      scheduler() {
-        waiting = 0;
-        running = 0;
+      function_job() {
+        fn = 0;
       }
 
-      void add_to_waiting(job *jb) {
-        jb->next = waiting;
-        waiting = this;
+      void set_function(fn_t *value) {
+        fn = value;
+      }
+
+      void kernel() {
+        (*fn)();
       }
     };
 
-    scheduler *get_scheduler() {
-      static scheduler sch;
-      return &sch;
+    // which scheduler and queue the current thread belongs to.
+    struct thread_info {
+      job_scheduler *scheduler;
+      unsigned index;
+    };
+
+    static thread_info &get_thread_info() {
+      static OCTET_THREAD_LOCAL thread_info info;
+      return info;
+    }
+
+    // queue 0 is shared by threads that are not workers, such as the main thread.
+    dynarray<job_queue> queues;
+    dynarray<std::thread*> threads;
+
+    // jobs in the queues. This is incremented before a push, so it may be more than there are.
+    std::atomic<int> num_queued;
+
+    // idle workers sleep on the condition variable.
+    std::atomic<int> num_sleeping;
+    std::atomic<bool> quit;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    // non-copyable
+    job_scheduler(const job_scheduler &);
+    job_scheduler &operator=(const job_scheduler &);
+
+    unsigned get_queue_index() {
+      thread_info &info = get_thread_info();
+      return info.scheduler == this ? info.index : 0;
+    }
+
+    void push(job *jb) {
+      num_queued++;
+      queues[get_queue_index()].push(jb);
+      if (num_sleeping.load() > 0) {
+        // taking the lock means a worker is either asleep or will see num_queued.
+        { std::lock_guard<std::mutex> lock(mutex); }
+        wake.notify_one();
+      }
+    }
+
+    // get a job from our own queue or steal one from another thread.
+    job *take() {
+      unsigned num_queues = queues.size();
+      unsigned index = get_queue_index();
+      job *jb = queues[index].pop();
+      for (unsigned i = 1; !jb && i != num_queues; ++i) {
+        jb = queues[(index + i) % num_queues].steal();
+      }
+      if (jb) num_queued--;
+      return jb;
+    }
+
+    void run(job *jb) {
+      jb->kernel();
+
+      for (unsigned i = 0; i != jb->dependents.size(); ++i) {
+        job *dependent = jb->dependents[i];
+        if (--dependent->wait_count == 0) {
+          push(dependent);
+        }
+      }
+
+      // the job may be deleted as soon as its counter is decremented.
+      job_counter *counter = jb->counter;
+      if (counter) {
+        counter->value.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    void worker_loop(unsigned index) {
+      thread_info &info = get_thread_info();
+      info.scheduler = this;
+      info.index = index;
+
+      for (;;) {
+        job *jb = take();
+        if (jb) {
+          run(jb);
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        num_sleeping++;
+        while (num_queued.load() == 0 && !quit.load()) {
+          wake.wait(lock);
+        }
+        num_sleeping--;
+        if (quit.load()) break;
+      }
     }
   public:
-    job() {
-      scheduler *sch = get_scheduler();
-      sch->add_to_waiting(this);
+    /// Start a scheduler with a number of worker threads.
+    /// The threads that add jobs and wait for them also run jobs, so use one less than the number of cores.
+    job_scheduler(unsigned num_workers) : queues(num_workers + 1) {
+      num_queued.store(0);
+      num_sleeping.store(0);
+      quit.store(false);
+      for (unsigned i = 0; i != num_workers; ++i) {
+        threads.push_back(new std::thread(&job_scheduler::worker_loop, this, i + 1));
+      }
     }
 
-    virtual ~job() {
+    /// Stop the workers. Jobs that have not started are not run.
+    ~job_scheduler() {
+      quit.store(true);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+      }
+      wake.notify_all();
+      for (unsigned i = 0; i != threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+      }
     }
 
-    virtual void kernel() = 0;
-    virtual bool is_ready() = 0;
+    /// The scheduler shared by the whole program, with a worker for each extra core.
+    static job_scheduler &get() {
+      static job_scheduler instance(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+      return instance;
+    }
+
+    /// number of threads that run jobs: the workers and the calling thread.
+    unsigned get_num_threads() const {
+      return threads.size() + 1;
+    }
 
-    state_t get_state() {
-      return state;
+    /// Add a job. It starts when its dependencies have finished.
+    /// If counter is not NULL, it counts the job until it has finished.
+    void add(job *jb, job_counter *counter = 0) {
+      jb->counter = counter;
+      if (counter) counter->value++;
+      if (--jb->wait_count == 0) {
+        push(jb);
+      }
+    }
+
+    /// Run jobs until every job counted by counter has finished.
+    void wait(job_counter &counter) {
+      while (!counter.is_done()) {
+        job *jb = take();
+        if (jb) {
+          run(jb);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /// Call fn(i) for each i in [begin, end) on every thread and return when all the calls have finished.
+    /// Threads take batches of grain indices; use a bigger grain when fn does very little.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, fn_t fn, unsigned grain = 1) {
+      if (end <= begin) return;
+      if (grain == 0) grain = 1;
+      unsigned num_batches = (end - begin - 1) / grain + 1;
+      unsigned num_helpers = get_num_threads() - 1;
+      num_helpers = num_helpers < num_batches - 1 ? num_helpers : num_batches - 1;
+      if (num_helpers == 0) {
+        for (unsigned i = begin; i != end; ++i) {
+          fn(i);
+        }
+        return;
+      }
+
+      std::atomic<unsigned> next_batch(0);
+      auto run_batches = [&]() {
+        for (unsigned batch = next_batch++; batch < num_batches; batch = next_batch++) {
+          unsigned first = begin + batch * grain;
+          unsigned last = end - first > grain ? first + grain : end;
+          for (unsigned i = first; i != last; ++i) {
+            fn(i);
+          }
+        }
+      };
+
+      // helpers join in on other threads while this one works through the batches too.
+      typedef function_job<decltype(run_batches)> helper_t;
+      dynarray<helper_t> helpers(num_helpers);
+      job_counter counter;
+      for (unsigned i = 0; i != num_helpers; ++i) {
+        helpers[i].set_function(&run_batches);
+        add(&helpers[i], &counter);
+      }
+      run_batches();
+      wait(counter);
     }
   };
 } }
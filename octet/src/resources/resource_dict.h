@@ -83,6 +83,11 @@ namespace octet { namespace resources {
       return dict.contains(name);
     }
 
+    /// does the dictionary have this resource? (precomputed hash)
+    bool has_resource(const string_key &name) {
+      return dict.contains(name);
+    }
+
     /// Get a generic resource by name
     /// Note: you can get a specific type using get_<typename>
     /// For example, scene_node *node = dict.get_scene_node("name");
@@ -92,11 +97,25 @@ namespace octet { namespace resources {
       }
       if (name[0] == '#') name++;
 
-      if (!dict.contains(name)) {
+      int index = dict.get_index(name);
+      return index < 0 ? NULL : (resource*)dict.get_value(index);
+    }
+
+    /// Get a generic resource by a key with a precomputed hash.
+    /// Interned keys skip the string compare if the resource was added with the same interned key.
+    resource *get_resource(const string_key &name) {
+      if (name.get_length() == 0) {
         return NULL;
-      } else {
-        return dict[name];
       }
+      if (name.get_text()[0] == '#') {
+        // the key text need not be zero terminated.
+        if (name.get_length() == 1) return NULL;
+        int index = dict.get_index(string_key(name.get_text() + 1, name.get_length() - 1));
+        return index < 0 ? NULL : (resource*)dict.get_value(index);
+      }
+
+      int index = dict.get_index(name);
+      return index < 0 ? NULL : (resource*)dict.get_value(index);
     }
 
     /// As this dict represents a game world, what is the active scene?
@@ -109,12 +128,21 @@ namespace octet { namespace resources {
       active_scene = value;
     }
 
+    /// Add a resource. The name is copied into the dictionary.
     void set_resource(const char *name, resource *value) {
       if (name && name[0]) {
         dict[name] = value;
       }
     }
 
+    /// Add a resource with a key with a precomputed hash.
+    /// Keys from string_table::intern() are stored without copying and later found by pointer.
+    void set_resource(const string_key &name, resource *value) {
+      if (name.get_length()) {
+        dict[name] = value;
+      }
+    }
+
     /// factory for textures: Deprecated will use Image object in future
     static GLuint get_texture_handle(unsigned gl_kind, const char *name) {
       GLuint &result = textures()[name];
@@ -133,7 +161,9 @@ namespace octet { namespace resources {
       return result;
     }
 
-    #define OCTET_CLASS(N, X) N::X *get_##X(const char *id) { resource *res = get_resource(id); return res ? res->get_##X() : 0; }
+    #define OCTET_CLASS(N, X) \
+      N::X *get_##X(const char *id) { resource *res = get_resource(id); return res ? res->get_##X() : 0; } \
+      N::X *get_##X(const string_key &id) { resource *res = get_resource(id); return res ? res->get_##X() : 0; }
     //#pragma message("resource_dict.h")
     #include "classes.h"
     #undef OCTET_CLASS
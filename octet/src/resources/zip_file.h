@@ -9,21 +9,26 @@ namespace octet { namespace resources {
   /// Zip file reader, uses zip_decoder to inflate compressed files.
   /// Zip files are smaller and faster than regular files.
   /// They make updates easier and work will over the internet.
+  ///
+  /// The archive is mapped into memory once and the directory is read when it is opened,
+  /// so get_file() does not seek or read and can be called from many threads at once.
+  /// Use get_files() to inflate a batch of files on all cores.
   class zip_file {
     int ref_cnt;
-    FILE *the_file;
+    file_map map;
 
     struct dir_entry {
       uint32_t offset;
       uint32_t csize;
       uint32_t usize;
       uint32_t compression;
+
+      // offset of the file data after the local header, zero if the entry is bad.
+      uint32_t data_offset;
     };
 
     dictionary<dir_entry> directory;
 
-    zip_decoder decoder;
-
     // read little endian bytes on any machine
     static unsigned u4(const uint8_t *src) {
       return src[0] + src[1] * 256 + src[2] * 65536 + src[3] * 0x1000000;
@@ -41,56 +46,99 @@ namespace octet { namespace resources {
       return (int16_t)(src[0] + src[1] * 256);
     }
 
+    // find the start of the file data, which follows the local file header.
+    // the local header may have a different extra field to the central directory.
+    /*local file header signature     4 bytes  (0x04034b50) 0
+    version needed to extract       2 bytes 4
+    general purpose bit flag        2 bytes 6
+    compression method              2 bytes 8
+    last mod file time              2 bytes 10
+    last mod file date              2 bytes 12
+    crc-32                          4 bytes 14
+    compressed size                 4 bytes 18
+    uncompressed size               4 bytes 22
+    file name length                2 bytes 26
+    extra field length              2 bytes 28 / 30*/
+    uint32_t get_data_offset(const dir_entry &d) const {
+      const uint8_t *src = map.get_data();
+      uint64_t size = map.get_size();
+      if ((uint64_t)d.offset + 30 > size) return 0;
+      const uint8_t *p = src + d.offset;
+      if (u4(p) != 0x04034b50) return 0;
+      uint64_t data_offset = (uint64_t)d.offset + 30 + u2(p + 26) + u2(p + 28);
+      if (data_offset + d.csize > size) return 0;
+      return (uint32_t)data_offset;
+    }
+
+    // get a file given its directory index, safe to call from any thread.
+    void get_file(dynarray<uint8_t> &buffer, int index) {
+      if (index < 0) return;
+      const dir_entry &d = directory.get_value(index);
+      if (!d.data_offset) return;
+      const uint8_t *src = map.get_data() + d.data_offset;
+      buffer.resize(d.usize);
+      if (d.compression == 0) {
+        memcpy(buffer.data(), src, d.usize < d.csize ? d.usize : d.csize);
+      } else if (d.compression == 8) {
+        // a decoder per call: it holds the huffman tables for the current block.
+        zip_decoder decoder;
+        if (!decoder.decode(buffer.data(), buffer.data() + d.usize, src, src + d.csize)) {
+          printf("warning: bad zip file entry\n");
+        }
+      }
+    }
+
+    // non-copyable
+    zip_file(const zip_file &);
+    zip_file &operator=(const zip_file &);
   public:
     /// Open a zip file for reading
-    zip_file(const char *filename) {
+    zip_file(const char *filename) : map(filename, file_map::random) {
       ref_cnt = 0;
-      the_file = fopen(filename, "rb");
-      if (!the_file) {
+      const uint8_t *src = map.get_data();
+      uint64_t file_size = map.get_size();
+      if (!src) {
         printf("file %s not found\n", filename);
-      } else {
-        uint8_t tmp[256];
-        unsigned tmp_size = (unsigned)sizeof(tmp);
-        fseek(the_file, 0, SEEK_END);
-        long file_size = ftell(the_file);
-        long search_offset = file_size - (long)tmp_size;
-        search_offset = search_offset < 0 ? 0 : search_offset;
-        fseek(the_file, search_offset, SEEK_SET);
-        fread(&tmp, 1, tmp_size, the_file);
-        for( unsigned i = 0; i != tmp_size; ++i) {
-          if (u4(tmp + i) == 0x06054b50) {
-            dynarray<uint8_t> dir;
-            dir.resize(u4(tmp + i + 12));
-            fseek(the_file, (long)u4(tmp + i + 16), SEEK_SET);
-            fread(&dir[0], 1, dir.size(), the_file);
-            for (unsigned i = 0; i + 4 < dir.size();) {
-              uint8_t *p = &dir[i];
-              if (u4(p) != 0x02014b50) break;
-              struct dir_entry d;
-              d.compression = u2(p + 10);
-              d.csize = u4(p + 20);
-              d.usize = u4(p + 24);
-              unsigned file_name_len = u2(p + 28);
-              unsigned extra_len = u2(p + 30);
-              string file;
-              file.set((const char*)(p + 46), file_name_len);
-              i += 46 + file_name_len + extra_len;
-              d.offset = u4(p + 42);// + (46 + file_name_len + extra_len);
-              for (unsigned i = 0; file[i]; ++i) {
-                if (file[i] == '\\') file[i] = '/';
-              }
-              //printf("%s\n", file.c_str());
-              directory[file] = d;
+        return;
+      }
+
+      // the end of central directory record is in the last 64k + 22 bytes.
+      uint64_t search_min = file_size > 0x10000 + 22 ? file_size - 0x10000 - 22 : 0;
+      for (uint64_t i = file_size < 22 ? 0 : file_size - 22 + 1; i-- > search_min; ) {
+        if (u4(src + i) == 0x06054b50) {
+          uint64_t dir_size = u4(src + i + 12);
+          uint64_t dir_offset = u4(src + i + 16);
+          if (dir_offset + dir_size > file_size) break;
+          const uint8_t *dir = src + dir_offset;
+          for (unsigned i = 0; i + 46 <= dir_size;) {
+            const uint8_t *p = dir + i;
+            if (u4(p) != 0x02014b50) break;
+            struct dir_entry d;
+            d.compression = u2(p + 10);
+            d.csize = u4(p + 20);
+            d.usize = u4(p + 24);
+            unsigned file_name_len = u2(p + 28);
+            unsigned extra_len = u2(p + 30);
+            unsigned comment_len = u2(p + 32);
+            if (i + 46 + file_name_len > dir_size) break;
+            string file;
+            file.set((const char*)(p + 46), file_name_len);
+            i += 46 + file_name_len + extra_len + comment_len;
+            d.offset = u4(p + 42);
+            d.data_offset = get_data_offset(d);
+            for (unsigned i = 0; file[i]; ++i) {
+              if (file[i] == '\\') file[i] = '/';
             }
-            break;
+            //printf("%s\n", file.c_str());
+            directory[string_key(file.c_str(), file_name_len)] = d;
           }
+          break;
         }
       }
     }
 
     /// close the zip file
     ~zip_file() {
-      if (the_file) fclose(the_file);
     }
 
     /// allow ref<zip_file>
@@ -100,43 +148,52 @@ namespace octet { namespace resources {
 
     /// allow ref<zip_file>
     void release() {
-      if (--ref_cnt) {
+      if (--ref_cnt == 0) {
         delete this;
       }
     }
 
+    /// does the zip file contain this file?
+    bool contains(const char *file) {
+      return directory.get_index(file) >= 0;
+    }
+
     /// get a file from a zip file, this is called from get_url with a zip:// prefix.
+    /// This is safe to call from several threads at once.
     void get_file(dynarray<uint8_t> &buffer, const char *file) {
+      get_file(buffer, string_key(file));
+    }
+
+    /// get a file from a zip file using a key with a precomputed hash.
+    void get_file(dynarray<uint8_t> &buffer, const string_key &file) {
+      get_file(buffer, directory.get_index(file));
+    }
+
+    /// If a file is stored without compression, point [src, src_max) at its bytes in the mapped archive.
+    /// The bytes are valid while the zip_file lives. Returns false for compressed or missing files.
+    bool get_stored_file(const uint8_t *&src, const uint8_t *&src_max, const string_key &file) {
       int index = directory.get_index(file);
-      if (index < 0) return;
-      if (!the_file) return;
+      if (index < 0) return false;
       const dir_entry &d = directory.get_value(index);
-      buffer.resize(d.usize);
-      fseek(the_file, d.offset, SEEK_SET);
-      /*local file header signature     4 bytes  (0x04034b50) 0
-      version needed to extract       2 bytes 4
-      general purpose bit flag        2 bytes 6
-      compression method              2 bytes 8
-      last mod file time              2 bytes 10
-      last mod file date              2 bytes 12
-      crc-32                          4 bytes 14
-      compressed size                 4 bytes 18
-      uncompressed size               4 bytes 22
-      file name length                2 bytes 26
-      extra field length              2 bytes 28 / 30*/
-
-      uint8_t tmp[30];
-      fread(tmp, 1, sizeof(tmp), the_file);
-      if (u4(tmp) != 0x04034b50) return;
-      unsigned extra = u2(tmp + 26) + u2(tmp + 28);
-      fseek(the_file, d.offset + 30 + extra, SEEK_SET);
-      if (d.compression == 0) {
-        fread(buffer.data(), 1, d.usize, the_file);
-      } else if (d.compression == 8) {
-        dynarray<uint8_t> uncomp(d.csize + 4); // note: + 4 bytes prevents decode() overflowing
-        fread(uncomp.data(), 1, d.csize, the_file);
-        decoder.decode(buffer.data(), buffer.data() + d.usize, uncomp.data(), uncomp.data() + d.csize);
+      if (d.compression != 0 || !d.data_offset || d.csize != d.usize) return false;
+      src = map.get_data() + d.data_offset;
+      src_max = src + d.usize;
+      return true;
+    }
+
+    /// Get many files at once, inflating them in parallel on the job_scheduler.
+    ///
+    /// buffers[i] receives files[i]. Missing files give empty buffers.
+    void get_files(dynarray<uint8_t> *buffers, const char *const *files, unsigned num_files) {
+      // look up the files on this thread: the directory is only read by the jobs.
+      dynarray<int> indices(num_files);
+      for (unsigned i = 0; i != num_files; ++i) {
+        indices[i] = directory.get_index(files[i]);
       }
+
+      job_scheduler::get().parallel_for(0, num_files, [&](unsigned i) {
+        get_file(buffers[i], indices[i]);
+      });
     }
   };
 } }
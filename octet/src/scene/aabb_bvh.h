@@ -0,0 +1,420 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Bounding volume hierarchy of axis aligned boxes
+//
+
+namespace octet { namespace scene {
+  /// Bounding volume hierarchy of numbered boxes.
+  ///
+  /// The tree is built with the surface area heuristic from binned box centres
+  /// and stored as a flat array of nodes. When boxes move, set_box() and refit()
+  /// grow and shrink only the nodes above them; rebuild when needs_rebuild() says the tree has got baggy.
+  ///
+  /// A box with min > max is never found, use this for things that are not there.
+  ///
+  /// mesh_bvh uses this for triangles and visual_scene for mesh instances.
+  class aabb_bvh {
+  public:
+    /// 32 byte node. Children are next to each other: first and first + 1.
+    struct node {
+      vec3p min;
+      // first child for an interior node, first position in the leaf order for a leaf.
+      uint32_t first;
+      vec3p max;
+      // number of boxes in a leaf, zero for an interior node.
+      uint32_t count;
+    };
+
+  private:
+    enum {
+      num_bins = 16,
+      max_depth = 64,
+    };
+
+    dynarray<node> nodes;
+
+    // the parent of each node, ~0 for the root.
+    dynarray<uint32_t> parents;
+
+    // box numbers in leaf order.
+    dynarray<uint32_t> order;
+
+    // the leaf node that holds each box.
+    dynarray<uint32_t> leaves;
+
+    // the boxes, by number.
+    dynarray<vec3p> box_min;
+    dynarray<vec3p> box_max;
+
+    // leaves with boxes that have changed since the last refit.
+    dynarray<uint32_t> dirty;
+
+    // sum of the node areas now and after the last build; a measure of the cost of a ray.
+    float cost;
+    float built_cost;
+
+    struct bin {
+      vec3 min;
+      vec3 max;
+      unsigned count;
+    };
+
+    // which bin a centre falls in. Careful with NaNs from bad boxes.
+    static unsigned get_bin(float value, float base, float scale) {
+      float b = (value - base) * scale;
+      return b > 0 ? std::min((unsigned)b, (unsigned)num_bins - 1) : 0;
+    }
+
+    // half the surface area, zero for empty boxes.
+    static float half_area(const vec3 &min, const vec3 &max) {
+      vec3 d = max - min;
+      if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+      return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    }
+
+    // set the bounds of a node from its boxes or children. Returns true if they changed.
+    bool calc_bounds(unsigned index) {
+      node &nd = nodes[index];
+      vec3 bmin, bmax;
+      if (nd.count) {
+        bmin = box_min[order[nd.first]];
+        bmax = box_max[order[nd.first]];
+        for (unsigned i = nd.first + 1; i != nd.first + nd.count; ++i) {
+          bmin = min(bmin, (vec3)box_min[order[i]]);
+          bmax = max(bmax, (vec3)box_max[order[i]]);
+        }
+      } else {
+        const node &lhs = nodes[nd.first], &rhs = nodes[nd.first + 1];
+        bmin = min((vec3)lhs.min, (vec3)rhs.min);
+        bmax = max((vec3)lhs.max, (vec3)rhs.max);
+      }
+
+      vec3 old_min = nd.min, old_max = nd.max;
+      if (all(old_min == bmin) && all(old_max == bmax)) return false;
+      cost += half_area(bmin, bmax) - half_area(old_min, old_max);
+      nd.min = bmin;
+      nd.max = bmax;
+      return true;
+    }
+
+    // split nodes[root] which holds order[first..first+count) until the leaves are small.
+    void subdivide(unsigned root, unsigned max_leaf_size) {
+      unsigned stack[max_depth];
+      unsigned sp = 0;
+      stack[sp++] = root;
+
+      while (sp) {
+        unsigned index = stack[--sp];
+        node &nd = nodes[index];
+        unsigned first = nd.first;
+        unsigned count = nd.count;
+
+        vec3 bmin = box_min[order[first]], bmax = box_max[order[first]];
+        vec3 cmin = (bmin + bmax) * 0.5f, cmax = cmin;
+        for (unsigned i = first + 1; i != first + count; ++i) {
+          vec3 lo = box_min[order[i]], hi = box_max[order[i]];
+          vec3 centre = (lo + hi) * 0.5f;
+          bmin = min(bmin, lo);
+          bmax = max(bmax, hi);
+          cmin = min(cmin, centre);
+          cmax = max(cmax, centre);
+        }
+        nd.min = bmin;
+        nd.max = bmax;
+
+        if (count == 1 || sp + 2 > max_depth) continue;
+
+        // find the cheapest split over all three axes with binned centres.
+        float best_cost = 1e30f;
+        unsigned best_axis = 0, best_split = 0;
+        for (unsigned axis = 0; axis != 3; ++axis) {
+          float extent = cmax[axis] - cmin[axis];
+          if (extent <= 0) continue;
+          float scale = num_bins / extent;
+
+          bin bins[num_bins];
+          for (unsigned b = 0; b != num_bins; ++b) {
+            bins[b].min = vec3(1e30f);
+            bins[b].max = vec3(-1e30f);
+            bins[b].count = 0;
+          }
+          for (unsigned i = first; i != first + count; ++i) {
+            vec3 lo = box_min[order[i]], hi = box_max[order[i]];
+            unsigned b = get_bin((lo[axis] + hi[axis]) * 0.5f, cmin[axis], scale);
+            bins[b].min = min(bins[b].min, lo);
+            bins[b].max = max(bins[b].max, hi);
+            bins[b].count++;
+          }
+
+          // sweep from the right to get the area of everything right of each split.
+          float right_area[num_bins];
+          vec3 rmin(1e30f), rmax(-1e30f);
+          for (unsigned b = num_bins - 1; b != 0; --b) {
+            rmin = min(rmin, bins[b].min);
+            rmax = max(rmax, bins[b].max);
+            right_area[b] = half_area(rmin, rmax);
+          }
+
+          // then from the left, splitting before bin "split".
+          vec3 lmin(1e30f), lmax(-1e30f);
+          unsigned left_count = 0;
+          for (unsigned split = 1; split != num_bins; ++split) {
+            lmin = min(lmin, bins[split-1].min);
+            lmax = max(lmax, bins[split-1].max);
+            left_count += bins[split-1].count;
+            unsigned right_count = count - left_count;
+            if (left_count == 0 || right_count == 0) continue;
+            float cost = half_area(lmin, lmax) * left_count + right_area[split] * right_count;
+            if (cost < best_cost) {
+              best_cost = cost;
+              best_axis = axis;
+              best_split = split;
+            }
+          }
+        }
+
+        // a leaf is cheaper if the node is small and no split saves much.
+        float node_area = half_area(bmin, bmax);
+        bool is_leaf = count <= max_leaf_size && (best_split == 0 || best_cost + node_area >= node_area * count);
+        if (is_leaf) continue;
+
+        unsigned left_count = count / 2;
+        if (best_split != 0) {
+          float scale = num_bins / (cmax[best_axis] - cmin[best_axis]);
+          float base = cmin[best_axis];
+          uint32_t *mid = std::partition(
+            order.data() + first, order.data() + first + count,
+            [&](uint32_t i) {
+              vec3 centre = ((vec3)box_min[i] + (vec3)box_max[i]) * 0.5f;
+              return get_bin(centre[best_axis], base, scale) < best_split;
+            }
+          );
+          left_count = (unsigned)(mid - (order.data() + first));
+        }
+        // else the centres are all in the same place: split anywhere.
+
+        unsigned child = nodes.size();
+        nodes.resize(child + 2);
+        // nodes may have moved.
+        node &parent = nodes[index];
+        parent.first = child;
+        parent.count = 0;
+
+        nodes[child].first = first;
+        nodes[child].count = left_count;
+        nodes[child+1].first = first + left_count;
+        nodes[child+1].count = count - left_count;
+        stack[sp++] = child;
+        stack[sp++] = child + 1;
+      }
+    }
+  public:
+    aabb_bvh() {
+      cost = built_cost = 0;
+    }
+
+    /// Free the tree and the boxes.
+    void reset() {
+      nodes.reset();
+      parents.reset();
+      order.reset();
+      leaves.reset();
+      box_min.reset();
+      box_max.reset();
+      dirty.reset();
+      cost = built_cost = 0;
+    }
+
+    /// Set the number of boxes. This frees the tree: set the boxes and build() again.
+    void resize(unsigned num_boxes) {
+      nodes.reset();
+      dirty.reset();
+      box_min.resize(num_boxes);
+      box_max.resize(num_boxes);
+    }
+
+    /// Set a box. If the tree has been built, refit() will make it fit again.
+    void set_box(unsigned index, vec3_in min, vec3_in max) {
+      vec3 old_min = box_min[index], old_max = box_max[index];
+      if (all(old_min == min) && all(old_max == max)) return;
+      box_min[index] = min;
+      box_max[index] = max;
+      if (nodes.size()) {
+        dirty.push_back(leaves[index]);
+      }
+    }
+
+    /// Set a box.
+    void set_box(unsigned index, const aabb &box) {
+      set_box(index, box.get_min(), box.get_max());
+    }
+
+    /// Get the smallest corner of a box.
+    vec3 get_box_min(unsigned index) const {
+      return box_min[index];
+    }
+
+    /// Get the largest corner of a box.
+    vec3 get_box_max(unsigned index) const {
+      return box_max[index];
+    }
+
+    /// Build the tree from the boxes. Leaves have up to max_leaf_size boxes.
+    void build(unsigned max_leaf_size = 4) {
+      unsigned num_boxes = box_min.size();
+      nodes.reset();
+      dirty.reset();
+      order.resize(num_boxes);
+      leaves.resize(num_boxes);
+      if (num_boxes == 0) return;
+
+      for (unsigned i = 0; i != num_boxes; ++i) {
+        order[i] = i;
+      }
+
+      nodes.reserve(num_boxes * 2);
+      nodes.resize(1);
+      nodes[0].first = 0;
+      nodes[0].count = num_boxes;
+      subdivide(0, max_leaf_size);
+
+      parents.resize(nodes.size());
+      parents[0] = ~0;
+      cost = 0;
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        const node &nd = nodes[i];
+        cost += half_area(nd.min, nd.max);
+        if (nd.count) {
+          for (unsigned j = nd.first; j != nd.first + nd.count; ++j) {
+            leaves[order[j]] = i;
+          }
+        } else {
+          parents[nd.first] = parents[nd.first + 1] = i;
+        }
+      }
+      built_cost = cost;
+    }
+
+    /// Make the nodes above boxes that have moved fit them again.
+    void refit() {
+      for (unsigned i = 0; i != dirty.size(); ++i) {
+        // stop going up when a node has not changed: the rest of the way has been done already.
+        for (unsigned index = dirty[i]; index != ~0 && calc_bounds(index); index = parents[index]) {
+        }
+      }
+      dirty.resize(0);
+    }
+
+    /// True if refitting has made the tree much worse than a new one would be.
+    bool needs_rebuild() const {
+      return cost > built_cost * 2;
+    }
+
+    /// True if there is no tree.
+    bool is_empty() const {
+      return nodes.size() == 0;
+    }
+
+    /// number of boxes.
+    unsigned get_num_boxes() const {
+      return box_min.size();
+    }
+
+    /// number of nodes in the tree.
+    unsigned get_num_nodes() const {
+      return nodes.size();
+    }
+
+    /// The box at a position in leaf order. Leaves hold [first, first + count) in this order.
+    unsigned get_leaf_box(unsigned position) const {
+      return order[position];
+    }
+
+    /// Visit the leaves hit by the line org + lambda * dir with 0 <= lambda <= max_lambda, nearest first.
+    /// fn(first, count, max_lambda) tests the leaf boxes and returns max_lambda, smaller when it has found something.
+    template <class fn_t> void ray_query(vec3_in org, vec3_in dir, float max_lambda, fn_t fn) const {
+      if (nodes.size() == 0) return;
+
+      // a zero direction would give 0 * infinity below.
+      float inv_dir[3], org_v[3], dir_v[3];
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        inv_dir[axis] = dir[axis] != 0 ? 1.0f / dir[axis] : 1e30f;
+        org_v[axis] = org[axis];
+        dir_v[axis] = dir[axis];
+      }
+
+      unsigned stack[max_depth];
+      unsigned sp = 0;
+      stack[sp++] = 0;
+      while (sp) {
+        const node &nd = nodes[stack[--sp]];
+
+        // slab test
+        const float *bmin = (const float*)&nd.min;
+        const float *bmax = (const float*)&nd.max;
+        float tnear = 0, tfar = max_lambda;
+        for (unsigned axis = 0; axis != 3; ++axis) {
+          float t0 = (bmin[axis] - org_v[axis]) * inv_dir[axis];
+          float t1 = (bmax[axis] - org_v[axis]) * inv_dir[axis];
+          tnear = std::max(tnear, std::min(t0, t1));
+          tfar = std::min(tfar, std::max(t0, t1));
+        }
+        if (!(tnear <= tfar)) continue;
+
+        if (nd.count == 0) {
+          // visit the nearer child first: it goes on the top of the stack.
+          unsigned near_child = nd.first, far_child = nd.first + 1;
+          const float *c0 = (const float*)&nodes[near_child].min;
+          const float *c1 = (const float*)&nodes[far_child].min;
+          float d0 = 0, d1 = 0;
+          for (unsigned axis = 0; axis != 3; ++axis) {
+            d0 += (c0[axis] - org_v[axis]) * dir_v[axis];
+            d1 += (c1[axis] - org_v[axis]) * dir_v[axis];
+          }
+          if (d1 < d0) std::swap(near_child, far_child);
+          stack[sp++] = far_child;
+          stack[sp++] = near_child;
+        } else {
+          max_lambda = fn(nd.first, nd.count, max_lambda);
+        }
+      }
+    }
+
+    /// Visit the leaves that are at least partly inside a frustum.
+    /// fn(first, count, is_inside) tests the leaf boxes; is_inside is true when the whole leaf
+    /// is inside the frustum, so the boxes do not need testing.
+    template <class fn_t> void frustum_query(const frustum &view, fn_t fn) const {
+      if (nodes.size() == 0) return;
+
+      // the low bit of each entry is set when the node is known to be inside.
+      unsigned stack[max_depth];
+      unsigned sp = 0;
+      stack[sp++] = 0;
+      while (sp) {
+        unsigned entry = stack[--sp];
+        const node &nd = nodes[entry >> 1];
+        bool is_inside = (entry & 1) != 0;
+
+        if (!is_inside) {
+          vec3 bmin = nd.min, bmax = nd.max;
+          // empty nodes have min > max.
+          if (!all(bmin <= bmax)) continue;
+          vec3 center = (bmin + bmax) * 0.5f, half_extent = (bmax - bmin) * 0.5f;
+          if (!view.intersects(center, half_extent)) continue;
+          is_inside = view.contains(center, half_extent);
+        }
+
+        if (nd.count == 0) {
+          stack[sp++] = nd.first * 2 + is_inside;
+          stack[sp++] = (nd.first + 1) * 2 + is_inside;
+        } else {
+          fn(nd.first, nd.count, is_inside);
+        }
+      }
+    }
+  };
+}}
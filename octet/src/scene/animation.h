@@ -31,8 +31,68 @@ namespace octet { namespace scene {
     dynarray<ref<resource> > targets;
 
     float end_time;
+
+    // the times come first, padded so that the values are aligned floats.
+    static unsigned get_times_size(unsigned num_times) {
+      return (num_times * sizeof(unsigned short) + 3) & ~3;
+    }
+
+    // copy the data of every channel between the saved layout, where the values follow the times
+    // with no padding, and the padded layout, changing the channels' offsets to match.
+    static void copy_data(dynarray<unsigned char> &dest, const dynarray<unsigned char> &src, dynarray<channel> &chans, bool pad) {
+      unsigned size = 0;
+      for (unsigned i = 0; i != chans.size(); ++i) {
+        const channel &ch = chans[i];
+        size += (pad ? get_times_size(ch.num_times) : ch.num_times * sizeof(unsigned short)) + ch.component_size * ch.num_times;
+      }
+      dest.resize(size);
+      if (size) memset(dest.data(), 0, size);
+
+      unsigned offset = 0;
+      for (unsigned i = 0; i != chans.size(); ++i) {
+        channel &ch = chans[i];
+        unsigned times_bytes = ch.num_times * sizeof(unsigned short);
+        unsigned src_times = pad ? times_bytes : get_times_size(ch.num_times);
+        unsigned dest_times = pad ? get_times_size(ch.num_times) : times_bytes;
+        unsigned values_bytes = ch.component_size * ch.num_times;
+        memcpy(dest.data() + offset, src.data() + ch.offset, times_bytes);
+        memcpy(dest.data() + offset + dest_times, src.data() + ch.offset + src_times, values_bytes);
+        ch.offset = (int)offset;
+        offset += dest_times + values_bytes;
+      }
+    }
+
+    // find a with p[a] <= time_ms < p[a+1], starting at the last key found. Needs two or more keys.
+    static unsigned find_key(const unsigned short *p, unsigned num_times, int time_ms, unsigned a) {
+      if (a > num_times - 2 || time_ms < p[a]) {
+        // time went backwards, for example when looping: binary search.
+        a = 0;
+        unsigned b = num_times - 1;
+        while (b - a > 1) {
+          unsigned mid = a + ((b - a) >> 1);
+          if (time_ms >= p[mid]) {
+            a = mid;
+          } else {
+            b = mid;
+          }
+        }
+        return a;
+      }
+      while (a + 2 < num_times && time_ms >= p[a + 1]) {
+        ++a;
+      }
+      return a;
+    }
   public:
     RESOURCE_META(animation)
+
+    /// Where the values of a channel go when evaluating all the channels together (see animation_instance).
+    struct binding {
+      mat4t *matrix;      /// transform channels are written straight into this matrix if it is not NULL
+      scene_node *node;   /// the node that owns matrix, to be marked as moved
+      resource *target;   /// if there is no matrix, target->set_value is called
+      unsigned cursor;    /// the key found last time, so that playing forwards does not search
+    };
   
     /// Default constructor. Use add_channel to add channels to the animation,
     animation() {
@@ -40,9 +100,20 @@ namespace octet { namespace scene {
     }
 
     /// Serialisation, script etc.
+    /// The data is saved without the padding after the times, as it always has been, so old saves still load.
     void visit(visitor &v) {
-      v.visit(data, atom_data);
-      v.visit(channels, atom_channels);
+      dynarray<unsigned char> saved_data;
+      if (v.is_reader()) {
+        v.visit(saved_data, atom_data);
+        v.visit(channels, atom_channels);
+        if (v.get_error()) return;
+        copy_data(data, saved_data, channels, true);
+      } else {
+        dynarray<channel> saved_channels = channels;
+        copy_data(saved_data, data, saved_channels, false);
+        v.visit(saved_data, atom_data);
+        v.visit(saved_channels, atom_channels);
+      }
       v.visit(targets, atom_targets);
       v.visit(end_time, atom_end_time);
     }
@@ -93,7 +164,7 @@ namespace octet { namespace scene {
       ch.component_size = component_size;
 
       int offset = ch.offset = (int)data.size();
-      int bytes = num_times * sizeof(unsigned short) + component_size * num_times;
+      int bytes = get_times_size(num_times) + component_size * num_times;
       data.resize(ch.offset + bytes);
       end_time = times[num_times-1] > end_time ? times[num_times-1] : end_time;
       for (int i = 0; i != num_times; ++i) {
@@ -101,7 +172,8 @@ namespace octet { namespace scene {
         *((unsigned short*)&data[offset]) = it;
         offset += sizeof(unsigned short);
       }
-      
+
+      offset = ch.offset + get_times_size(num_times);
       memcpy(&data[offset], &values[0], component_size * num_times);
       channels.push_back(ch);
       targets.push_back(target);
@@ -135,7 +207,7 @@ namespace octet { namespace scene {
 
       //log("t=%d a=%d b=%d p[a]=%d p[b]=%d\n", time_ms, a, b, p[a], p[b]);
 
-      unsigned data_offset = ch.offset + ch.num_times * sizeof(unsigned short);
+      unsigned data_offset = ch.offset + get_times_size(ch.num_times);
 
       float t = float(time_ms - p[a]) / (p[b] - p[a]);
       float tmp1[16];
@@ -150,5 +222,48 @@ namespace octet { namespace scene {
         target->set_value(ch.sid, ch.sub_target, ch.component, tmp1);
       }
     }
+
+    /// Evaluate all the channels at once, with a binding for each channel.
+    /// Each channel starts looking for its keys where it was last time, so playing forwards
+    /// costs one or two compares per channel. Transform channels with a matrix are interpolated
+    /// straight into it; the caller must mark binding.node as moved.
+    /// This writes nothing but the bindings' matrices and cursors, so different instances
+    /// with different matrices can be evaluated on different threads.
+    void eval(float time, binding *bindings) const {
+      int time_ms = int(time * 1000);
+      for (unsigned chan = 0; chan != channels.size(); ++chan) {
+        const channel &ch = channels[chan];
+        binding &b = bindings[chan];
+        const unsigned short *p = (const unsigned short *)&data[ch.offset];
+        const float *values = (const float *)&data[ch.offset + get_times_size(ch.num_times)];
+        unsigned num_components = ch.component_size / sizeof(float);
+
+        const float *va = values, *vb = values;
+        float t = 0;
+        if (ch.num_times >= 2) {
+          unsigned a = b.cursor = find_key(p, ch.num_times, time_ms, b.cursor);
+          int key_ms = std::max((int)p[a], std::min(time_ms, (int)p[a + 1]));
+          t = p[a + 1] != p[a] ? float(key_ms - p[a]) / (p[a + 1] - p[a]) : 1.0f;
+          va = values + a * num_components;
+          vb = va + num_components;
+        }
+
+        if (b.matrix && num_components == 16) {
+          // the values are a transposed matrix, as for scene_node::set_value.
+          float *dest = b.matrix->get();
+          for (unsigned i = 0; i != 4; ++i) {
+            for (unsigned j = 0; j != 4; ++j) {
+              dest[i * 4 + j] = va[j * 4 + i] * (1 - t) + vb[j * 4 + i] * t;
+            }
+          }
+        } else if (b.target && num_components <= 16) {
+          float tmp[16];
+          for (unsigned i = 0; i != num_components; ++i) {
+            tmp[i] = va[i] * (1 - t) + vb[i] * t;
+          }
+          b.target->set_value(ch.sid, ch.sub_target, ch.component, tmp);
+        }
+      }
+    }
   };
 }}
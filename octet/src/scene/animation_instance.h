@@ -15,6 +15,21 @@ namespace octet { namespace scene {
     float time;
     bool is_looping;
     bool is_paused;
+
+    // where each channel of the animation goes.
+    dynarray<animation::binding> bindings;
+
+    // find the matrix a transform channel sets, if there is one.
+    static mat4t *find_matrix(resource *res, atom_t sid, scene_node *&node) {
+      node = res->get_scene_node();
+      if (node) {
+        return &node->access_nodeToParent();
+      }
+      mesh_instance *mi = res->get_mesh_instance();
+      skeleton *skel = mi ? mi->get_skeleton() : NULL;
+      int index = skel ? skel->get_bone_index(sid) : -1;
+      return index != -1 ? &skel->access_bone(index) : NULL;
+    }
   public:
     RESOURCE_META(animation_instance)
 
@@ -46,20 +61,46 @@ namespace octet { namespace scene {
       return time;
     }
 
-    /// update the animation and the resources it connects to.
-    void update(float delta_time) {
-      if (target) {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          anim->eval_chan(ch, time, target);
-        }
-      } else {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          resource *anim_target = anim->get_target(ch);
-          anim->eval_chan(ch, time, anim_target);
+    /// Find where each channel goes. update and eval do this the first time.
+    /// Call it again if the target's nodes or skeleton change.
+    void bind() {
+      int num_channels = anim->get_num_channels();
+      bindings.resize(num_channels);
+      for (int ch = 0; ch != num_channels; ++ch) {
+        animation::binding &b = bindings[ch];
+        b.target = target ? (resource*)target : anim->get_target(ch);
+        b.matrix = NULL;
+        b.node = NULL;
+        b.cursor = 0;
+        if (b.target && anim->get_sub_target(ch) == atom_transform) {
+          b.matrix = find_matrix(b.target, anim->get_sid(ch), b.node);
         }
       }
+    }
+
+    /// get the bindings of the channels, one per channel.
+    const dynarray<animation::binding> &get_bindings() {
+      if (bindings.size() != anim->get_num_channels()) bind();
+      return bindings;
+    }
 
-      //log("update %f\n", delta_time);
+    /// Set the targets to the current time, all channels at once.
+    /// This writes only to this instance and its targets, so instances with different targets
+    /// can be evaluated in parallel; call mark_moved afterwards on one thread.
+    void eval() {
+      if (bindings.size() != anim->get_num_channels()) bind();
+      anim->eval(time, bindings.data());
+    }
+
+    /// Mark the nodes that eval moved, so that their world matrices are made again.
+    void mark_moved() {
+      for (unsigned ch = 0; ch != bindings.size(); ++ch) {
+        if (bindings[ch].node) bindings[ch].node->mark_moved();
+      }
+    }
+
+    /// Move the time on, looping or stopping at the end.
+    void advance(float delta_time) {
       if (!is_paused) {
         time += delta_time;
         //log("..update %f\n", time);
@@ -72,5 +113,12 @@ namespace octet { namespace scene {
         }
       }
     }
+
+    /// update the animation and the resources it connects to.
+    void update(float delta_time) {
+      eval();
+      mark_moved();
+      advance(delta_time);
+    }
   };
 }}
@@ -335,23 +335,25 @@ namespace octet { namespace scene {
     }
 
     void load_part(const char *_url) {
-      dynarray<uint8_t> buffer;
-      app_utils::get_url(buffer, _url);
-      const unsigned char *src = &buffer[0];
-      const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+      // decode straight from the mapped file
+      mapped_url file;
+      app_utils::get_url(file, _url);
+      const unsigned char *src = file.get_src();
+      const unsigned char *src_max = file.get_src_max();
+      size_t size = file.get_size();
+      if (size >= 6 && !memcmp(src, "GIF89a", 6)) {
         gif_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
+      } else if (size >= 6 && src[0] == 0xff && src[1] == 0xd8) {
         jpeg_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
+      } else if (size >= 6 && src[0] == 0 && src[1] == 0 && src[2] == 2) {
         tga_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
+      } else if (size >= 4 && src[0] == 'D' && src[1] == 'D' && src[2] == 'S' && src[3] == ' ') {
         dds_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 348 && (!memcmp(&buffer[344], "ni1", 4) || !memcmp(&buffer[344], "n+1", 4))) {
+      } else if (size >= 348 && (!memcmp(src + 344, "ni1", 4) || !memcmp(src + 344, "n+1", 4))) {
         nifti_decoder dec;
         gl_target = GL_TEXTURE_3D;
         dec.get_image(bytes, format, width, height, depth, frames, src, src_max);
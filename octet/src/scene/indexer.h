@@ -58,10 +58,12 @@ namespace octet { namespace scene {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
       hash_map<vertex, unsigned, vertex_cmp> vertex_to_index;
+      vertex_to_index.reserve(get_num_vertices());
 
       dynarray<uint8_t> dest_vertices;
       dynarray<uint32_t> dest_indices;
       dest_indices.reserve(get_num_indices());
+      dest_vertices.reserve(get_num_vertices() * get_stride());
 
       gl_resource::rolock idx_lock(get_indices());
       gl_resource::rolock vtx_lock(get_vertices());
@@ -87,11 +89,10 @@ namespace octet { namespace scene {
       //printf("%d/%d\n", get_num_vertices(), num_vertices);
 
       unsigned isize = dest_indices.size() * sizeof(dest_indices[0]);
-      unsigned vsize = dest_vertices.size() * sizeof(dest_vertices[0]);
-      gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
-      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
-      indices->assign(&dest_indices[0], 0, isize);
-      vertices->assign(&dest_vertices[0], 0, vsize);
+      gl_resource *indices = new gl_resource();
+      gl_resource *vertices = new gl_resource();
+      indices->allocate(GL_ELEMENT_ARRAY_BUFFER, dest_indices.data(), isize);
+      vertices->allocate(GL_ARRAY_BUFFER, std::move(dest_vertices));
 
       set_indices(indices);
       set_vertices(vertices);
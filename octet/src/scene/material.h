@@ -24,6 +24,33 @@ namespace octet { namespace scene {
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // the parameters set on every draw, found once rather than by name each time.
+    enum { dyn_modelToProjection, dyn_modelToCamera, dyn_lighting, dyn_num_lights, dyn_bone_palette_coord, num_dynamic_params };
+    param_uniform *dynamic_params[num_dynamic_params];
+    bool dynamic_params_found;
+
+    void find_dynamic_params() {
+      if (dynamic_params_found) return;
+      dynamic_params[dyn_modelToProjection] = get_param_uniform(atom_modelToProjection);
+      dynamic_params[dyn_modelToCamera] = get_param_uniform(atom_modelToCamera);
+      dynamic_params[dyn_lighting] = get_param_uniform(atom_lighting);
+      dynamic_params[dyn_num_lights] = get_param_uniform(atom_num_lights);
+      dynamic_params[dyn_bone_palette_coord] = get_param_uniform(atom_bone_palette_coord);
+      dynamic_params_found = true;
+    }
+
+    // put the matrices and, if lighting is true, the lights in the buffer.
+    void set_dynamic_params(bool lighting, const mat4t &modelToProjection, const mat4t &modelToCamera, vec2_in bone_palette_coord, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      find_dynamic_params();
+      param_uniform **dyn = dynamic_params;
+      if (dyn[dyn_modelToProjection]) dyn[dyn_modelToProjection]->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      if (dyn[dyn_modelToCamera]) dyn[dyn_modelToCamera]->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+      if (dyn[dyn_bone_palette_coord]) dyn[dyn_bone_palette_coord]->set_value(buffer.data(), &bone_palette_coord, sizeof(bone_palette_coord));
+      if (!lighting) return;
+      if (dyn[dyn_lighting]) dyn[dyn_lighting]->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      if (dyn[dyn_num_lights]) dyn[dyn_num_lights]->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
@@ -33,6 +60,34 @@ namespace octet { namespace scene {
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToCamera, GL_FLOAT_MAT4, 1, param::stage_vertex));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_lighting, GL_FLOAT_VEC4, ambient_size + max_lights * light_size, param::stage_fragment));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
+
+      // bone matrices for skinning on the GPU, in a texture on a slot of their own.
+      GLint slot = bone_palette_slot;
+      params.push_back(new param_uniform(dynamic_pbi, &slot, atom_bone_palette, GL_SAMPLER_2D, 1, param::stage_vertex));
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_bone_palette_coord, GL_FLOAT_VEC2, 1, param::stage_vertex));
+    }
+
+    // set the uniforms, or only the ones that change between draws if the state has this material.
+    void render_impl(render_state &state, const mat4t &modelToProjection, const mat4t &modelToCamera, vec2_in bone_palette_coord, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      state.use_program(custom_shader->get_program());
+
+      if (state.set_material(this)) {
+        set_dynamic_params(true, modelToProjection, modelToCamera, bone_palette_coord, light_uniforms, num_light_uniforms, num_lights);
+        for (unsigned i = 0; i != params.size(); ++i) {
+          param_uniform *pu = params[i]->get_param_uniform();
+          param_sampler *ps = params[i]->get_param_sampler();
+          if (ps) {
+            ps->render(buffer.data(), state);
+          } else if (pu) {
+            pu->render(buffer.data());
+          }
+        }
+      } else {
+        set_dynamic_params(false, modelToProjection, modelToCamera, bone_palette_coord, light_uniforms, num_light_uniforms, num_lights);
+        if (dynamic_params[dyn_modelToProjection]) dynamic_params[dyn_modelToProjection]->render(buffer.data());
+        if (dynamic_params[dyn_modelToCamera]) dynamic_params[dyn_modelToCamera]->render(buffer.data());
+        if (dynamic_params[dyn_bone_palette_coord]) dynamic_params[dyn_bone_palette_coord]->render(buffer.data());
+      }
     }
 
     // create the attribute parameters
@@ -49,16 +104,19 @@ namespace octet { namespace scene {
       ambient_size = 1,
       max_lights = 4,
       light_size = 4,
+      bone_palette_slot = 15, ///< texture slot of the bone matrices for GPU skinning
     };
 
     /// Default constructor makes a blank material.
     material() {
+      dynamic_params_found = false;
     }
 
     /// Alternative constructor.
     material(const vec4 &color, param_shader *shader = NULL) {
       // materials are constructed from parameters which build the final shader.
       // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
+      dynamic_params_found = false;
       params.reserve(16);
 
       create_dynamic_params();
@@ -78,6 +136,7 @@ namespace octet { namespace scene {
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
       if (!smpl) smpl = new sampler();
 
+      dynamic_params_found = false;
       params.reserve(16);
 
       create_dynamic_params();
@@ -94,6 +153,7 @@ namespace octet { namespace scene {
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      dynamic_params_found = false;
     }
 
     /// Serialize.
@@ -107,23 +167,18 @@ namespace octet { namespace scene {
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
-
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+      // matrices and lighting go in the dynamic uniform buffer
+      set_dynamic_params(true, modelToProjection, modelToCamera, vec2(0, 0), light_uniforms, num_light_uniforms, num_lights);
 
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      custom_shader->render();
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+      if (custom_shader->has_model_to_world()) {
+        // one instance: the model matrix is already in the uniforms.
+        for (unsigned col = 0; col != 4; ++col) {
+          glVertexAttrib4f(attribute_model_to_world + col, col == 0, col == 1, col == 2, col == 3);
+        }
       }
 
-      custom_shader->render();
-
       {
         // colours and textures go in the static uniform buffer
         for (unsigned i = 0; i != params.size(); ++i) {
@@ -136,10 +191,37 @@ namespace octet { namespace scene {
       }
     }
 
-    /// Set the uniforms for this material on skinned meshes.
-    void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_nodes, vec4 *light_uniforms, int num_light_uniforms, int num_lights) const {
-      //shader.render_skinned(cameraToProjection, modelToCamera, num_nodes, light_uniforms, num_light_uniforms, num_lights);
-      //bind_textures();
+    /// Set the uniforms for this material, skipping what the render state says is already set.
+    /// The shader is only changed if it is not in use. If this was the last material to
+    /// set its uniforms, only the matrices are set; the lighting must not change between draws.
+    void render(render_state &state, const mat4t &modelToProjection, const mat4t &modelToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      render_impl(state, modelToProjection, modelToCamera, vec2(0, 0), light_uniforms, num_light_uniforms, num_lights);
+    }
+
+    /// Set the uniforms for a skinned mesh whose bone matrices (skin to camera space) are in a palette texture
+    /// bound to bone_palette_slot. bone_palette_coord is one over the palette width and the v coordinate of the mesh's row.
+    void render_skinned(render_state &state, const mat4t &cameraToProjection, vec2_in bone_palette_coord, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      mat4t identity;
+      identity.loadIdentity();
+      render_impl(state, cameraToProjection, identity, bone_palette_coord, light_uniforms, num_light_uniforms, num_lights);
+    }
+
+    /// Can the shader skin meshes on the GPU? If not, skinned meshes must be skinned on the CPU.
+    bool can_render_skinned() {
+      find_dynamic_params();
+      param_uniform *coord = dynamic_params[dyn_bone_palette_coord];
+      return coord && coord->get_uniform() != -1;
+    }
+
+    /// Can meshes with this material be drawn many at once with mesh::render_instanced?
+    /// For these draws, pass worldToProjection and worldToCamera to render() instead of the model matrices.
+    bool can_render_instanced() const {
+      return custom_shader && custom_shader->has_model_to_world();
+    }
+
+    /// the OpenGL program of the shader, used to sort draws.
+    GLuint get_program() const {
+      return custom_shader ? custom_shader->get_program() : 0;
     }
 
     /// get a named parameter
@@ -170,6 +252,8 @@ namespace octet { namespace scene {
     }
 
     dynarray<ref<param> > &get_params() {
+      // the caller may change the parameters.
+      dynamic_params_found = false;
       return params;
     }
 
@@ -177,6 +261,7 @@ namespace octet { namespace scene {
       param_buffer_info pbi(buffer);
       param_uniform *result = new param_uniform(pbi, data, name, _type, _repeat, _stage);
       params.push_back(result);
+      dynamic_params_found = false;
 
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
@@ -189,6 +274,7 @@ namespace octet { namespace scene {
       pbi.texture_slot = texture_slot;
       param_sampler *result = new param_sampler(pbi, name, _image, _sampler, _stage);
       params.push_back(result);
+      dynamic_params_found = false;
 
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
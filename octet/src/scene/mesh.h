@@ -54,8 +54,29 @@ namespace octet { namespace scene {
     // optional skin
     ref<skin> mesh_skin;
     
-    // bounding box
+    // bounding box, which is only used when it has been set or calculated.
     aabb mesh_aabb;
+    bool aabb_is_set;
+
+    // triangle tree for ray_cast, built the first time it is needed.
+    mesh_bvh bvh;
+    bool use_bvh;
+
+    // incremented when the box of any mesh changes, so that copies of the boxes know when to update.
+    static unsigned &aabb_version() {
+      static unsigned value = 0;
+      return value;
+    }
+
+    // what the tree was built from, so that we can tell when it is out of date.
+    const gl_resource *bvh_vertices;
+    const gl_resource *bvh_indices;
+    uint32_t bvh_vertex_version;
+    uint32_t bvh_index_version;
+    uint32_t bvh_first_index;
+    uint32_t bvh_num_indices;
+    uint32_t bvh_stride;
+    uint32_t bvh_pos_offset;
 
     struct general_vertex {
       const uint8_t *bytes;
@@ -177,6 +198,12 @@ namespace octet { namespace scene {
       mode = rhs.mode;
 
       mesh_skin = rhs.mesh_skin;
+
+      mesh_aabb = rhs.mesh_aabb;
+      aabb_is_set = rhs.aabb_is_set;
+
+      use_bvh = rhs.use_bvh;
+      invalidate_bvh();
     }
 
     /// Init function used for aggregated meshes.
@@ -200,6 +227,11 @@ namespace octet { namespace scene {
 
       mesh_skin = _skin;
 
+      aabb_is_set = false;
+
+      use_bvh = true;
+      invalidate_bvh();
+
       if (max_vertices || max_indices) {
         set_default_attributes();
         allocate(max_vertices * sizeof(vertex), max_indices * sizeof(uint32_t));
@@ -221,6 +253,11 @@ namespace octet { namespace scene {
       v.visit(num_slots, atom_num_slots);
       v.visit(mesh_skin, atom_mesh_skin);
       v.visit(mesh_aabb, atom_aabb);
+      if (v.is_reader()) {
+        // whether the box was set is not saved, so take a zero size box as unset.
+        aabb_is_set = any(mesh_aabb.get_half_extent() != vec3(0, 0, 0));
+      }
+      aabb_version()++;
     }
 
     // Destructor
@@ -355,6 +392,8 @@ namespace octet { namespace scene {
     /// set the axis aligned bounding box of the untransformed mesh
     void set_aabb(const aabb &value) {
       mesh_aabb = value;
+      aabb_is_set = true;
+      aabb_version()++;
     }
 
     /// get the axis aligned bounding box of the untransformed mesh
@@ -362,6 +401,17 @@ namespace octet { namespace scene {
       return mesh_aabb;
     }
 
+    /// true if the box has been set or calculated. Meshes built by hand may not have one,
+    /// in which case visual_scene always draws them and tries every ray against them.
+    bool has_aabb() const {
+      return aabb_is_set;
+    }
+
+    /// This changes when the box of any mesh changes.
+    static unsigned get_aabb_version() {
+      return aabb_version();
+    }
+
     /// return true if this mesh has a particular attribute. eg. attribute_pos
     bool has_attribute(unsigned attr) {
       for (unsigned i = 0; i != num_slots; ++i) {
@@ -433,6 +483,12 @@ namespace octet { namespace scene {
       indices->allocate(GL_ELEMENT_ARRAY_BUFFER, isize);
     }
 
+    /// Allocate VBO and IBO objects for data that changes every frame (see gl_resource::allocate_stream).
+    void allocate_stream(size_t vsize, size_t isize) {
+      vertices->allocate_stream(GL_ARRAY_BUFFER, vsize);
+      indices->allocate_stream(GL_ELEMENT_ARRAY_BUFFER, isize);
+    }
+
     /// allocate and assign data to IBO and VBO
     void assign(size_t vsize, size_t isize, uint8_t *vsrc, uint8_t *isrc) {
       vertices->assign(vsrc, 0, vsize);
@@ -472,17 +528,23 @@ namespace octet { namespace scene {
       fprintf(file, "</model>\n");
     }
 
+    /// The offset of the first index in the index buffer, as glDrawElements takes it.
+    GLvoid *get_index_pointer() const {
+      return (GLvoid*)(indices->get_stream_offset() + get_index_size() * first_index);
+    }
+
     /// When rendering a mesh, call this first to enable the attributes.
     /// assume the shader, uniforms and render params are already set up.
     void enable_attributes() const {
       vertices->bind();
 
       unsigned n = normalized;
+      size_t base = vertices->get_stream_offset();
       for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
         unsigned size = get_size(slot);
         unsigned kind = get_kind(slot);
         unsigned attr = get_attr(slot);
-        unsigned offset = get_offset(slot);
+        size_t offset = base + get_offset(slot);
         glVertexAttribPointer(attr, size, kind, n & 1, get_stride(), (void*)(offset));
         glEnableVertexAttribArray(attr);
         n >>= 1;
@@ -494,7 +556,7 @@ namespace octet { namespace scene {
       //printf("de %04x %d %d\n", get_mode(), get_num_vertices(), get_index_type());
       if (get_index_type()) {
         indices->bind();
-        glDrawElements(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index));
+        glDrawElements(get_mode(), get_num_indices(), get_index_type(), get_index_pointer());
       } else {
         glDrawArrays(get_mode(), 0, get_num_vertices());
       }
@@ -508,6 +570,25 @@ namespace octet { namespace scene {
       }
     }
 
+    /// Point the attributes at the vertices if this was not the last mesh drawn, and note them
+    /// in the state. render(state) enables them.
+    void set_attributes(render_state &state) {
+      if (!state.set_mesh(this)) return;
+
+      state.bind_buffer(GL_ARRAY_BUFFER, vertices->get_buffer());
+
+      unsigned n = normalized;
+      uint32_t mask = 0;
+      size_t base = vertices->get_stream_offset();
+      for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
+        unsigned attr = get_attr(slot);
+        glVertexAttribPointer(attr, get_size(slot), get_kind(slot), n & 1, get_stride(), (void*)(base + get_offset(slot)));
+        mask |= 1 << attr;
+        n >>= 1;
+      }
+      state.set_mesh_attributes(mask);
+    }
+
     /// render in one pass.
     void render() {
       enable_attributes();
@@ -515,9 +596,99 @@ namespace octet { namespace scene {
       disable_attributes();
     }
 
+    /// render in one pass, skipping the binds and attribute changes that the state says are already done.
+    /// Drawing the same mesh again only draws. The attributes are left enabled for the next mesh:
+    /// call render_state::finish after the last one.
+    void render(render_state &state) {
+      set_attributes(state);
+      state.set_attributes(state.get_mesh_attributes());
+      state.set_model_to_world_identity();
+
+      if (get_index_type()) {
+        state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indices->get_buffer());
+        glDrawElements(get_mode(), get_num_indices(), get_index_type(), get_index_pointer());
+      } else {
+        glDrawArrays(get_mode(), 0, get_num_vertices());
+      }
+      state.add_draw();
+    }
+
+    /// render num_instances copies in one draw call, each with a modelToWorld matrix from an array of mat4t
+    /// at offset in buffer. The shader must have a modelToWorld attribute (see shader::has_model_to_world)
+    /// and render_state::is_instancing_supported must be true.
+    void render_instanced(render_state &state, GLuint buffer, size_t offset, unsigned num_instances) {
+      #if OCTET_INSTANCING
+        set_attributes(state);
+        state.set_instance_matrices(buffer, offset);
+        state.set_attributes(state.get_mesh_attributes() | render_state::instance_attributes);
+
+        if (get_index_type()) {
+          state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indices->get_buffer());
+          glDrawElementsInstanced(get_mode(), get_num_indices(), get_index_type(), get_index_pointer(), num_instances);
+        } else {
+          glDrawArraysInstanced(get_mode(), 0, get_num_vertices(), num_instances);
+        }
+        state.add_instanced_draw(num_instances);
+      #else
+        assert(0 && "instancing is not available in this build");
+      #endif
+    }
+
+    /// Skin vertices first to first + count on the CPU, as default.vs does on the GPU: copy them from src to dest
+    /// (vertex arrays in this mesh's format) with the positions and normals blended by num_joints palette matrices.
+    /// This only reads the mesh, so different ranges can be done on different threads.
+    /// Returns false if the positions, blend weights or blend indices are missing or are not floats.
+    bool skin_vertices(uint8_t *dest, const uint8_t *src, const mat4t *palette, unsigned num_joints, unsigned first, unsigned count) const {
+      unsigned pos_slot = get_slot(attribute_pos);
+      unsigned normal_slot = get_slot(attribute_normal);
+      unsigned weight_slot = get_slot(attribute_blendweight);
+      unsigned index_slot = get_slot(attribute_blendindices);
+      if (pos_slot == ~0 || weight_slot == ~0 || index_slot == ~0 || !num_joints) return false;
+      if (get_kind(pos_slot) != GL_FLOAT || get_size(pos_slot) < 3) return false;
+      if (get_kind(weight_slot) != GL_FLOAT || get_size(weight_slot) != 3) return false;
+      if (get_kind(index_slot) != GL_FLOAT || get_size(index_slot) != 4) return false;
+      bool has_normal = normal_slot != ~0 && get_kind(normal_slot) == GL_FLOAT && get_size(normal_slot) == 3;
+
+      unsigned pos_offset = get_offset(pos_slot);
+      unsigned pos_size = get_size(pos_slot);
+      unsigned normal_offset = has_normal ? get_offset(normal_slot) : 0;
+      unsigned weight_offset = get_offset(weight_slot);
+      unsigned index_offset = get_offset(index_slot);
+
+      memcpy(dest + first * stride, src + first * stride, count * stride);
+      for (unsigned i = first; i != first + count; ++i) {
+        const uint8_t *sv = src + i * stride;
+        uint8_t *dv = dest + i * stride;
+        const float *w = (const float*)(sv + weight_offset);
+        const float *idx = (const float*)(sv + index_offset);
+
+        // the weight of the first bone is whatever is left over.
+        mat4t skin = palette[std::min((unsigned)idx[0], num_joints - 1)] * (1 - w[0] - w[1] - w[2]);
+        for (unsigned j = 0; j != 3; ++j) {
+          skin = skin + palette[std::min((unsigned)idx[j + 1], num_joints - 1)] * w[j];
+        }
+
+        const float *sp = (const float*)(sv + pos_offset);
+        vec4 pos = vec4(sp[0], sp[1], sp[2], pos_size == 4 ? sp[3] : 1.0f) * skin;
+        float *dp = (float*)(dv + pos_offset);
+        dp[0] = pos.x(); dp[1] = pos.y(); dp[2] = pos.z();
+        if (pos_size == 4) dp[3] = pos.w();
+
+        if (has_normal) {
+          const float *sn = (const float*)(sv + normal_offset);
+          vec3 normal = normalize((vec4(sn[0], sn[1], sn[2], 0) * skin).xyz());
+          float *dn = (float*)(dv + normal_offset);
+          dn[0] = normal.x(); dn[1] = normal.y(); dn[2] = normal.z();
+        }
+      }
+      return true;
+    }
+
     /// Compute the axis aligned bounding box for this mesh in model space and set it.
     void calc_aabb() {
       unsigned num_vertices = get_num_vertices();
+      aabb_version()++;
+      aabb_is_set = true;
       if (get_num_vertices() == 0) {
         mesh_aabb = aabb();
         return;
@@ -531,15 +702,70 @@ namespace octet { namespace scene {
       for (unsigned i = 1; i < num_vertices; ++i) {
         vec3 pos = get_value(vtx_lock.u8(), slot, i).xyz();
         vmin = min(pos, vmin);
-        vmax = max(pos, vmin);
+        vmax = max(pos, vmax);
       }
       mesh_aabb = aabb((vmax + vmin) * 0.5f, (vmax - vmin) * 0.5f);
     }
 
-    /// *very* slow ray cast.
+    /// Use a triangle tree (mesh_bvh) to speed up ray_cast. This is on by default.
+    /// The tree is built on the first ray_cast and takes about 70 bytes per triangle.
+    void set_use_bvh(bool value) {
+      use_bvh = value;
+      if (!value) invalidate_bvh();
+    }
+
+    /// Does ray_cast use a triangle tree?
+    bool get_use_bvh() const {
+      return use_bvh;
+    }
+
+    /// Free the triangle tree. It will be built again by the next ray_cast.
+    /// There is no need to call this after changing the vertices or indices: ray_cast notices.
+    void invalidate_bvh() {
+      bvh.reset();
+      bvh_vertices = 0;
+      bvh_indices = 0;
+    }
+
+    /// Build the triangle tree now if it is out of date.
+    /// ray_cast does this itself, but call this first to cast rays from more than one thread.
+    void build_bvh() {
+      unsigned pos_slot = get_slot(attribute_pos);
+      if (pos_slot == ~0 || get_index_type() != GL_UNSIGNED_INT) return;
+      if (get_size(pos_slot) < 3 || get_kind(pos_slot) != GL_FLOAT) return;
+
+      unsigned pos_offset = get_offset(pos_slot);
+      if (
+        bvh_vertices == vertices && bvh_indices == indices &&
+        bvh_vertex_version == vertices->get_version() && bvh_index_version == indices->get_version() &&
+        bvh_first_index == first_index && bvh_num_indices == num_indices &&
+        bvh_stride == stride && bvh_pos_offset == pos_offset
+      ) {
+        return;
+      }
+
+      {
+        gl_resource::rolock idx_lock(get_indices());
+        gl_resource::rolock vtx_lock(get_vertices());
+        bvh.build(vtx_lock.u8(), stride, pos_offset, idx_lock.u32() + first_index, num_indices);
+      }
+
+      bvh_vertices = vertices;
+      bvh_indices = indices;
+      bvh_vertex_version = vertices->get_version();
+      bvh_index_version = indices->get_version();
+      bvh_first_index = first_index;
+      bvh_num_indices = num_indices;
+      bvh_stride = stride;
+      bvh_pos_offset = pos_offset;
+    }
+
+    /// Find the nearest triangle hit by a ray. The ray is infinitely long.
     /// returns "barycentric" coordinates.
     /// eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
     /// eg. hit uv = bary[0] * uv0 + bary[1] * uv1 + bary[2] * uv2
+    /// This uses a triangle tree unless set_use_bvh(false) has been called,
+    /// in which case it tests every triangle.
     bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
       unsigned pos_slot = get_slot(attribute_pos);
       if (get_index_type() != GL_UNSIGNED_INT) return false;
@@ -550,6 +776,23 @@ namespace octet { namespace scene {
       vec3 dir = the_ray.get_distance();
       //log("ray_cast: org=%s dir=%s\n", org.toString(), dir.toString());
 
+      if (use_bvh) {
+        build_bvh();
+        mesh_bvh::hit hit;
+        if (bvh.ray_cast(org, dir, hit) && fabsf(hit.bary_denom) >= 1e-6f) {
+          indices[0] = hit.indices[0];
+          indices[1] = hit.indices[1];
+          indices[2] = hit.indices[2];
+          bary_numer = hit.bary_numer;
+          bary_denom = hit.bary_denom;
+          return true;
+        } else {
+          bary_numer = vec4(0, 0, 0, 0);
+          bary_denom = 0;
+          return false;
+        }
+      }
+
       unsigned pos_offset = get_offset(pos_slot);
       gl_resource::rolock idx_lock(get_indices());
       gl_resource::rolock vtx_lock(get_vertices());
@@ -562,35 +805,10 @@ namespace octet { namespace scene {
         vec3 a = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+0]) - org;
         vec3 b = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+1]) - org;
         vec3 c = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+2]) - org;
-        vec3 d = dir;
-
-        // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
-        //
-        // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
-        //
-        // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
 
-        // The last line of the inverse matrix is the solution (vector triple products)
-
-        // numerator
-        vec4 numer(
-          dot(cross(b, c), d),
-          dot(cross(c, a), d),
-          dot(cross(a, b), d),
-          dot(cross(a, b), c)
-        );
-
-        // denominator
-        float denom = numer[0] + numer[1] + numer[2];
-
-        //log("a=%s b=%s c=%s d=%s denom=%f\n", a.toString(), b.toString(), c.toString(), d.toString(), denom);
-        //log("numer=%s\n", numer.toString());
-        //log("res=%s\n", (numer / denom).toString());
-
-        // using a multiply lets us check the sign without using a divide.
-        vec4 bary2 = numer * denom;
-
-        if (all(bary2 >= vec4(0, 0, 0, 0))) {
+        vec4 numer;
+        float denom;
+        if (mesh_bvh::intersect(a, b, c, dir, numer, denom)) {
           rational best_distance(best_numer[3], best_denom);
           rational new_distance(numer[3], denom);
           /*printf(
@@ -634,34 +852,40 @@ namespace octet { namespace scene {
     /// set a new VBO object
     void set_vertices(gl_resource *value) {
       vertices = value;
+      invalidate_bvh();
     }
 
     /// assign a vector to the vertex buffer and set params
     template <class elem_t> void set_vertices(const dynarray<elem_t> &rhs) {
       if (!vertices || vertices->get_size() != rhs.size() * sizeof(elem_t)) {
         vertices = new gl_resource();
-        vertices->allocate(GL_ARRAY_BUFFER, rhs.size() * sizeof(elem_t));
+        vertices->allocate(GL_ARRAY_BUFFER, rhs.data(), rhs.size() * sizeof(elem_t));
+      } else {
+        vertices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       }
-      vertices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       stride = sizeof(elem_t);
       set_num_vertices(rhs.size());
+      invalidate_bvh();
     }
 
     /// set a new IBO object
     void set_indices(gl_resource *value) {
       indices = value;
+      invalidate_bvh();
     }
 
     /// assign a vector to the index buffer and set params
     template <class elem_t> void set_indices(const dynarray<elem_t> &rhs) {
       if (!indices || indices->get_size() != rhs.size() * sizeof(elem_t)) {
         indices = new gl_resource();
-        indices->allocate(GL_ELEMENT_ARRAY_BUFFER, rhs.size() * sizeof(elem_t));
+        indices->allocate(GL_ELEMENT_ARRAY_BUFFER, rhs.data(), rhs.size() * sizeof(elem_t));
+      } else {
+        indices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       }
-      indices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       set_index_type(sizeof(elem_t) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
       set_num_indices(rhs.size());
       set_first_index(0);
+      invalidate_bvh();
     }
 
     /// Get all the edges in a hash map to avoid duplicates.
@@ -752,14 +976,21 @@ namespace octet { namespace scene {
       const uint32_t *ip = idx_lock.u32();
       const uint8_t *vp = vtx_lock.u8();
       unsigned stride = get_stride();
-      for (unsigned i = 0; i != get_num_indices(); ++i) {
-        vec4 pos_in = vec4((vec3)*(const vec3p*)(vp + ip[i] * stride + pos_offset), 1.0f );
-        vec4 pos_out = pos_in * modelToProjection;
-        vec3 res = pos_out.perspectiveDivide();
+
+      // gather the positions, then transform them in one batch.
+      unsigned num_indices = get_num_indices();
+      dynarray<vec4> pos_in(num_indices), pos_out(num_indices);
+      for (unsigned i = 0; i != num_indices; ++i) {
+        pos_in[i] = vec4((vec3)*(const vec3p*)(vp + ip[i] * stride + pos_offset), 1.0f );
+      }
+      simd::transform(pos_out.data(), pos_in.data(), modelToProjection, num_indices);
+
+      for (unsigned i = 0; i != num_indices; ++i) {
+        vec3 res = pos_out[i].perspectiveDivide();
         //vec3 ares = abs(res);
         bool err = any(abs(res) > vec3(1));
         char tmp[2][256];
-        log("%5d %s -> %s %s\n", i, pos_in.toString(tmp[0], sizeof(tmp[0])), res.toString(tmp[1], sizeof(tmp[1])), err ? "FAIL" : "");
+        log("%5d %s -> %s %s\n", i, pos_in[i].toString(tmp[0], sizeof(tmp[0])), res.toString(tmp[1], sizeof(tmp[1])), err ? "FAIL" : "");
       }
     }
 
@@ -793,10 +1024,12 @@ namespace octet { namespace scene {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
       hash_map<general_vertex, unsigned, vertex_cmp> vertex_to_index;
+      vertex_to_index.reserve(get_num_vertices());
 
       dynarray<uint8_t> dest_vertices;
       dynarray<uint32_t> dest_indices;
       dest_indices.reserve(get_num_indices());
+      dest_vertices.reserve(get_num_vertices() * get_stride());
 
       //The code below is inside a new scope { ... } with the purpose of be sure that outside the scope idx_lock will be deleted
       //  why do we want to delete idx_lock? When the object is created it locks indices to read only, and we want to unlock it after using it
@@ -831,11 +1064,10 @@ namespace octet { namespace scene {
       // if we have fewer vertices now, update the index and vertices.
       if (num_vertices != get_num_vertices()) {
         unsigned isize = dest_indices.size() * sizeof(uint32_t);
-        unsigned vsize = dest_vertices.size() * sizeof(uint8_t);
         gl_resource *indices = get_indices();
-        gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
-        indices->assign(&dest_indices[0], 0, isize);
-        vertices->assign(&dest_vertices[0], 0, vsize);
+        gl_resource *vertices = new gl_resource();
+        indices->allocate(GL_ELEMENT_ARRAY_BUFFER, dest_indices.data(), isize);
+        vertices->allocate(GL_ARRAY_BUFFER, std::move(dest_vertices));
 
         set_vertices(vertices);
         set_num_vertices(num_vertices);
@@ -969,9 +1201,8 @@ namespace octet { namespace scene {
       }
 
       ~sink() {
-        mesh_->allocate(sizeof(vertex_t) * vertices.size(), sizeof(uint32_t) * indices.size());
-        mesh_->get_vertices()->assign(vertices.data(), 0, sizeof(vertex_t) * vertices.size());
-        mesh_->get_indices()->assign(indices.data(), 0, sizeof(uint32_t) * indices.size());
+        mesh_->get_vertices()->allocate(GL_ARRAY_BUFFER, vertices.data(), sizeof(vertex_t) * vertices.size());
+        mesh_->get_indices()->allocate(GL_ELEMENT_ARRAY_BUFFER, indices.data(), sizeof(uint32_t) * indices.size());
         mesh_->set_num_vertices(vertices.size());
         mesh_->set_num_indices(indices.size());
       }
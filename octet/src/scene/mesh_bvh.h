@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Bounding volume hierarchy for casting rays against mesh triangles
+//
+
+namespace octet { namespace scene {
+  /// Bounding volume hierarchy of the triangles of a mesh, kept in CPU memory.
+  ///
+  /// The tree is an aabb_bvh of the triangle bounds. The triangle positions are copied into
+  /// separate x, y and z arrays in leaf order so that a leaf is a few contiguous floats.
+  ///
+  /// mesh::ray_cast builds one of these the first time it is called.
+  class mesh_bvh {
+  public:
+    /// The result of a ray cast: see mesh::ray_cast.
+    struct hit {
+      vec4 bary_numer;
+      float bary_denom;
+      // the triangle's position in the index buffer, divided by three.
+      uint32_t triangle;
+      uint32_t indices[3];
+    };
+
+  private:
+    enum { max_leaf_size = 8 };
+
+    aabb_bvh tree;
+
+    // positions[vertex*3 + axis][i] is coordinate axis of vertex 0, 1 or 2 of the i'th triangle in leaf order.
+    dynarray<float> positions[9];
+
+    // the original triangle number and its three vertex indices, in leaf order.
+    dynarray<uint32_t> triangles;
+    dynarray<uint32_t> indices;
+  public:
+    mesh_bvh() {
+    }
+
+    /// Free the tree.
+    void reset() {
+      tree.reset();
+      for (unsigned i = 0; i != 9; ++i) {
+        positions[i].reset();
+      }
+      triangles.reset();
+      indices.reset();
+    }
+
+    /// Build the tree from triangles.
+    /// vtx points to the vertices with a vec3p position at pos_offset in each, idx points to the indices.
+    void build(const uint8_t *vtx, unsigned stride, unsigned pos_offset, const uint32_t *idx, unsigned num_indices) {
+      reset();
+      unsigned num_triangles = num_indices / 3;
+      if (num_triangles == 0) return;
+
+      tree.resize(num_triangles);
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        vec3 a = *(const vec3p*)(vtx + pos_offset + stride * idx[t*3+0]);
+        vec3 b = *(const vec3p*)(vtx + pos_offset + stride * idx[t*3+1]);
+        vec3 c = *(const vec3p*)(vtx + pos_offset + stride * idx[t*3+2]);
+        vec3 tmin = min(min(a, b), c);
+        vec3 tmax = max(max(a, b), c);
+
+        // grow the boxes a little so that rounding in the triangle test never finds a hit outside them.
+        vec3 pad = (abs(tmin) + abs(tmax)) * 1e-5f + vec3(1e-30f);
+        tree.set_box(t, tmin - pad, tmax + pad);
+      }
+      tree.build(max_leaf_size);
+
+      for (unsigned i = 0; i != 9; ++i) {
+        positions[i].resize(num_triangles);
+      }
+      triangles.resize(num_triangles);
+      indices.resize(num_triangles * 3);
+      for (unsigned i = 0; i != num_triangles; ++i) {
+        unsigned t = tree.get_leaf_box(i);
+        triangles[i] = t;
+        for (unsigned v = 0; v != 3; ++v) {
+          unsigned index = idx[t*3+v];
+          const float *pos = (const float*)(vtx + pos_offset + stride * index);
+          positions[v*3+0][i] = pos[0];
+          positions[v*3+1][i] = pos[1];
+          positions[v*3+2][i] = pos[2];
+          indices[i*3+v] = index;
+        }
+      }
+    }
+
+    /// true if there are no triangles in the tree.
+    bool is_empty() const {
+      return tree.is_empty();
+    }
+
+    /// number of triangles in the tree.
+    unsigned get_num_triangles() const {
+      return triangles.size();
+    }
+
+    /// number of nodes in the tree.
+    unsigned get_num_nodes() const {
+      return tree.get_num_nodes();
+    }
+
+    /// Intersect the line org + lambda * d (lambda >= 0) with the triangle (a, b, c).
+    /// The vertices are relative to org. The hit is at lambda = numer[3] / denom and
+    /// numer[0..2] / denom are the barycentric coordinates.
+    /// This is shared with the brute force path in mesh::ray_cast so both give the same answers.
+    static bool intersect(vec3_in a, vec3_in b, vec3_in c, vec3_in d, vec4 &numer, float &denom) {
+      // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
+      //
+      // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
+      //
+      // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
+
+      // The last line of the inverse matrix is the solution (vector triple products)
+      numer = vec4(
+        dot(cross(b, c), d),
+        dot(cross(c, a), d),
+        dot(cross(a, b), d),
+        dot(cross(a, b), c)
+      );
+
+      denom = numer[0] + numer[1] + numer[2];
+
+      // a ray parallel to the triangle does not hit it.
+      if (denom == 0) return false;
+
+      // using a multiply lets us check the sign without using a divide.
+      vec4 bary2 = numer * denom;
+      return all(bary2 >= vec4(0, 0, 0, 0));
+    }
+
+    /// Find the nearest triangle hit by the line org + lambda * dir (lambda >= 0).
+    /// When triangles are hit at the same distance, the last one in the index buffer wins.
+    bool ray_cast(vec3_in org, vec3_in dir, hit &result) const {
+      bool found = false;
+      float best_lambda = 0;
+      tree.ray_query(org, dir, 1e30f, [&](unsigned first, unsigned count, float limit) {
+        for (unsigned i = first; i != first + count; ++i) {
+          vec3 a = vec3(positions[0][i], positions[1][i], positions[2][i]) - org;
+          vec3 b = vec3(positions[3][i], positions[4][i], positions[5][i]) - org;
+          vec3 c = vec3(positions[6][i], positions[7][i], positions[8][i]) - org;
+          vec4 numer;
+          float denom;
+          if (!intersect(a, b, c, dir, numer, denom)) continue;
+
+          float lambda = numer[3] / denom;
+          uint32_t tri = triangles[i];
+          if (!found || lambda < best_lambda || (lambda == best_lambda && tri > result.triangle)) {
+            found = true;
+            best_lambda = lambda;
+            // look at boxes a little further than the best hit so that we see ties.
+            limit = lambda + fabsf(lambda) * 1e-5f + 1e-30f;
+            result.bary_numer = numer;
+            result.bary_denom = denom;
+            result.triangle = tri;
+            result.indices[0] = indices[i*3+0];
+            result.indices[1] = indices[i*3+1];
+            result.indices[2] = indices[i*3+2];
+          }
+        }
+        return limit;
+      });
+      return found;
+    }
+  };
+}}
@@ -35,6 +35,17 @@ namespace octet { namespace scene {
     // if the object is further than this from the camera, do not draw.
     float max_draw_distance;
 
+    // for skinning on the CPU: a copy of the mesh with vertices of its own and the original vertices.
+    ref<mesh> skinned_msh;
+    const mesh *skinned_source;
+    dynarray<uint8_t> skin_source;
+
+    // incremented when the node or mesh of any instance changes.
+    static unsigned &instance_version() {
+      static unsigned value = 0;
+      return value;
+    }
+
   public:
     RESOURCE_META(mesh_instance)
 
@@ -47,6 +58,7 @@ namespace octet { namespace scene {
       flags = flag_enabled;
       min_draw_distance = -8.507059e37f;
       max_draw_distance = 8.507059e37f;
+      skinned_source = NULL;
     }
 
     /// metadata visitor. Used for serialisation and script interface.
@@ -56,6 +68,7 @@ namespace octet { namespace scene {
       v.visit(mat, atom_mat);
       v.visit(skel, atom_skel);
       v.visit(flags, atom_flags);
+      instance_version()++;
     }
 
     //////////////////////////////
@@ -124,6 +137,30 @@ namespace octet { namespace scene {
     /// Get the flags for this instance.
     unsigned get_flags() const { return flags; }
 
+    /// This changes when the node or mesh of any instance changes.
+    static unsigned get_instance_version() { return instance_version(); }
+
+    /// For skinning on the CPU (see mesh::skin_vertices): a copy of the mesh with vertices of its own
+    /// to skin into, made the first time. source is set to a copy of the mesh's own vertices.
+    mesh *get_skinned_mesh(const uint8_t *&source) {
+      if (!skinned_msh || skinned_source != msh) {
+        gl_resource *vertices = msh->get_vertices();
+        size_t size = vertices->get_size();
+        skin_source.resize((unsigned)size);
+        {
+          gl_resource::rolock lock(vertices);
+          memcpy(skin_source.data(), lock.u8(), size);
+        }
+        gl_resource *skinned_vertices = new gl_resource();
+        skinned_vertices->allocate(GL_ARRAY_BUFFER, skin_source.data(), size, GL_DYNAMIC_DRAW);
+        skinned_msh = new mesh(*msh);
+        skinned_msh->set_vertices(skinned_vertices);
+        skinned_source = msh;
+      }
+      source = skin_source.data();
+      return skinned_msh;
+    }
+
     /// Get the LOD min distance
     float get_min_draw_distance() const { return min_draw_distance; }
 
@@ -131,10 +168,10 @@ namespace octet { namespace scene {
     float get_max_draw_distance() const { return max_draw_distance; }
 
     /// Set the transformation for this instance.
-    void set_node(scene_node *value) { node = value; }
+    void set_node(scene_node *value) { node = value; instance_version()++; }
 
     /// Set the mesh for this instance.
-    void set_mesh(mesh *value) { msh = value; }
+    void set_mesh(mesh *value) { msh = value; instance_version()++; }
 
     /// Set the mesh for this instance.
     void set_material(material *value) { mat = value; }
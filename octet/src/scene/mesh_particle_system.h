@@ -86,10 +86,29 @@ namespace octet { namespace scene {
     dynarray<particle_animator> particle_animators;
     int free_particle_animator;
 
+    // Animated billboards with one array for each component (structure of arrays), so that
+    // they can be moved four at a time. A dead billboard is replaced by the last one, so
+    // the first num_animated of each array are in use.
+    dynarray<float> pos_x, pos_y, pos_z;
+    dynarray<float> vel_x, vel_y, vel_z;
+    dynarray<float> acc_x, acc_y, acc_z;
+    dynarray<vec2p> sizes;
+    dynarray<vec2p> uvs_bottom_left;
+    dynarray<vec2p> uvs_top_right;
+    dynarray<uint32_t> angles, spins, ages, lifetimes;
+    unsigned num_animated;
+
+    // the number of billboards and trails the buffers have room for. They are made on the first update().
+    unsigned max_quads;
+    unsigned max_trail_vertices;
+
     // camera matrix
     mat4t cameraToWorld;
 
-    void init(const aabb &size, int bbcap, int tpcap, int pacap) {
+    // animated billboards are moved and drawn in chunks of this many, on many threads.
+    enum { chunk_size = 4096 };
+
+    void init(const aabb &size, int bbcap, int tpcap, int pacap, int abcap) {
       set_default_attributes();
       set_aabb(size);
       billboard_particles.reserve(bbcap);
@@ -99,9 +118,101 @@ namespace octet { namespace scene {
       free_trail_particle = -1;
       free_particle_animator = -1;
 
-      unsigned vsize = (bbcap * 4 + tpcap * 2) * sizeof(vertex);
-      unsigned isize = (bbcap * 6 + tpcap * 6) * sizeof(uint32_t);
-      mesh::allocate(vsize, isize);
+      dynarray<float> *floats[] = { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &acc_x, &acc_y, &acc_z };
+      for (unsigned i = 0; i != sizeof(floats)/sizeof(floats[0]); ++i) {
+        floats[i]->resize(abcap);
+      }
+      sizes.resize(abcap);
+      uvs_bottom_left.resize(abcap);
+      uvs_top_right.resize(abcap);
+      angles.resize(abcap);
+      spins.resize(abcap);
+      ages.resize(abcap);
+      lifetimes.resize(abcap);
+      num_animated = 0;
+
+      max_quads = bbcap + abcap;
+      max_trail_vertices = tpcap * 2;
+    }
+
+    // make the vertex and index buffers. The vertices are streamed, a new copy each frame;
+    // the indices are the same every frame, two triangles for each quad.
+    void allocate_buffers() {
+      unsigned vsize = (max_quads * 4 + max_trail_vertices) * sizeof(vertex);
+      dynarray<uint8_t> indices((max_quads * 6 + max_trail_vertices * 3) * sizeof(uint32_t));
+      uint32_t *idx = (uint32_t*)indices.data();
+      for (unsigned i = 0; i != max_quads; ++i, idx += 6) {
+        uint32_t v = i * 4;
+        idx[0] = v; idx[1] = v+1; idx[2] = v+2;
+        idx[3] = v; idx[4] = v+2; idx[5] = v+3;
+      }
+      get_vertices()->allocate_stream(GL_ARRAY_BUFFER, vsize);
+      get_indices()->allocate(GL_ELEMENT_ARRAY_BUFFER, std::move(indices));
+    }
+
+    // a camera-facing quad: bottom left, top left, top right, bottom right as seen from the camera.
+    static void write_quad(vertex *vtx, float px, float py, float pz, vec2_in size, vec2_in bl, vec2_in tr, const float *cx, const float *cy, const vec3p &n) {
+      float dx[3] = { size.x() * cx[0], size.x() * cx[1], size.x() * cx[2] };
+      float dy[3] = { size.y() * cy[0], size.y() * cy[1], size.y() * cy[2] };
+      vtx[0].pos = vec3p(px - dx[0] + dy[0], py - dx[1] + dy[1], pz - dx[2] + dy[2]); vtx[0].normal = n; vtx[0].uv = vec2p(bl.x(), tr.y());
+      vtx[1].pos = vec3p(px + dx[0] + dy[0], py + dx[1] + dy[1], pz + dx[2] + dy[2]); vtx[1].normal = n; vtx[1].uv = tr;
+      vtx[2].pos = vec3p(px + dx[0] - dy[0], py + dx[1] - dy[1], pz + dx[2] - dy[2]); vtx[2].normal = n; vtx[2].uv = vec2p(tr.x(), bl.y());
+      vtx[3].pos = vec3p(px - dx[0] - dy[0], py - dx[1] - dy[1], pz - dx[2] - dy[2]); vtx[3].normal = n; vtx[3].uv = bl;
+    }
+
+    // a[i] += b[i] * t for first <= i < end.
+    static void add_scaled(float *a, const float *b, float t, unsigned first, unsigned end) {
+      unsigned i = first;
+      #if OCTET_SSE2
+        __m128 t4 = _mm_set1_ps(t);
+        for (; i + 4 <= end; i += 4) {
+          _mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_mul_ps(_mm_loadu_ps(b + i), t4)));
+        }
+      #endif
+      for (; i != end; ++i) {
+        a[i] += b[i] * t;
+      }
+    }
+
+    // move animated billboard src to dest.
+    void move_animated(unsigned dest, unsigned src) {
+      pos_x[dest] = pos_x[src]; pos_y[dest] = pos_y[src]; pos_z[dest] = pos_z[src];
+      vel_x[dest] = vel_x[src]; vel_y[dest] = vel_y[src]; vel_z[dest] = vel_z[src];
+      acc_x[dest] = acc_x[src]; acc_y[dest] = acc_y[src]; acc_z[dest] = acc_z[src];
+      sizes[dest] = sizes[src];
+      uvs_bottom_left[dest] = uvs_bottom_left[src];
+      uvs_top_right[dest] = uvs_top_right[src];
+      angles[dest] = angles[src];
+      spins[dest] = spins[src];
+      ages[dest] = ages[src];
+      lifetimes[dest] = lifetimes[src];
+    }
+
+    // remove the animated billboards that have lived their lifetime, then move the rest.
+    void animate_billboards(float time_step) {
+      for (unsigned i = 0; i < num_animated; ) {
+        if (ages[i] >= lifetimes[i]) {
+          move_animated(i, --num_animated);
+        } else {
+          ++i;
+        }
+      }
+
+      unsigned num_chunks = (num_animated + chunk_size - 1) / chunk_size;
+      job_scheduler::get().parallel_for(0, num_chunks, [&](unsigned chunk) {
+        unsigned first = chunk * chunk_size, end = std::min(first + chunk_size, num_animated);
+        // the same sums as animate() makes for particle_animators.
+        add_scaled(pos_x.data(), vel_x.data(), time_step, first, end);
+        add_scaled(pos_y.data(), vel_y.data(), time_step, first, end);
+        add_scaled(pos_z.data(), vel_z.data(), time_step, first, end);
+        add_scaled(vel_x.data(), acc_x.data(), time_step, first, end);
+        add_scaled(vel_y.data(), acc_y.data(), time_step, first, end);
+        add_scaled(vel_z.data(), acc_z.data(), time_step, first, end);
+        for (unsigned i = first; i != end; ++i) {
+          angles[i] += (uint32_t)(spins[i] * time_step);
+          ages[i]++;
+        }
+      });
     }
 
     // pool allocation of particles.
@@ -119,20 +230,22 @@ namespace octet { namespace scene {
 
     // return to pool
     template <class Type> void free(dynarray<Type> &array, int &free, int element) {
-      array[free].link = free;
+      array[element].link = free;
       free = element;
     }
 
   public:
     RESOURCE_META(mesh_particle_system)
 
-    /// Default constructor
-    mesh_particle_system(aabb_in size=aabb(vec3(0, 0, 0), vec3(1, 1, 1)), int bbcap=256, int tpcap=256, int pacap=256) {
-      init(size, bbcap, tpcap, pacap);
+    /// Default constructor. abcap is the number of animated billboards (see add_animated_billboard).
+    mesh_particle_system(aabb_in size=aabb(vec3(0, 0, 0), vec3(1, 1, 1)), int bbcap=256, int tpcap=256, int pacap=256, int abcap=0) {
+      init(size, bbcap, tpcap, pacap, abcap);
     }
 
     /// Update the vertices for newtonian physics.
     void animate(float time_step) {
+      animate_billboards(time_step);
+
       for (unsigned i = 0; i != particle_animators.size(); ++i) {
         particle_animator &g = particle_animators[i];
         if (g.link >= 0) {
@@ -157,47 +270,49 @@ namespace octet { namespace scene {
       cameraToWorld = mx;
     }
 
-    /// Generate mesh from particles
-    virtual void update() {
-      //unsigned np = billboard_particles.size();
-      //unsigned vsize = billboard_particles.capacity() * sizeof(vertex) * 4;
-      //unsigned isize = billboard_particles.capacity() * sizeof(uint32_t) * 4;
-
-      gl_resource::wolock vlock(get_vertices());
-      vertex *vtx = (vertex*)vlock.u8();
-      gl_resource::wolock ilock(get_indices());
-      uint32_t *idx = ilock.u32();
-      unsigned num_vertices = 0;
-      unsigned num_indices = 0;
-
-      vec3 cx = cameraToWorld.x().xyz();
-      vec3 cy = cameraToWorld.y().xyz();
+    /// Write four vertices for each billboard to vtx, which must have room for all of them,
+    /// and return the number of billboards. The billboards face the camera (see set_cameraToWorld).
+    /// Billboard n uses vertices 4n to 4n+3, and the animated billboards come last.
+    unsigned write_billboard_vertices(vertex *vtx) const {
+      float cx[3] = { cameraToWorld.x().x(), cameraToWorld.x().y(), cameraToWorld.x().z() };
+      float cy[3] = { cameraToWorld.y().x(), cameraToWorld.y().y(), cameraToWorld.y().z() };
       vec3p n = cameraToWorld.z().xyz();
 
+      unsigned num_quads = 0;
       for (unsigned i = 0; i != billboard_particles.size(); ++i) {
-        billboard_particle &p = billboard_particles[i];
+        const billboard_particle &p = billboard_particles[i];
         if (p.enabled) {
-          vec2 size = p.size;
-          vec3 dx = size.x() * cx;
-          vec3 dy = size.y() * cy;
-          vec2 bl = p.uv_bottom_left;
-          vec2 tr = p.uv_top_right;
-          vec2 tl = vec2(bl.x(), tr.y());
-          vec2 br = vec2(tr.x(), bl.y());
-          vtx->pos = (vec3)p.pos - dx + dy; vtx->normal = n; vtx->uv = tl; vtx++;
-          vtx->pos = (vec3)p.pos + dx + dy; vtx->normal = n; vtx->uv = tr; vtx++;
-          vtx->pos = (vec3)p.pos + dx - dy; vtx->normal = n; vtx->uv = br; vtx++;
-          vtx->pos = (vec3)p.pos - dx - dy; vtx->normal = n; vtx->uv = bl; vtx++;
-          idx[0] = num_vertices; idx[1] = num_vertices+1; idx[2] = num_vertices+2;
-          idx[3] = num_vertices; idx[4] = num_vertices+2; idx[5] = num_vertices+3;
-          idx += 6;
-          num_vertices += 4;
-          num_indices += 6;
+          vec3 pos = p.pos;
+          write_quad(vtx + num_quads * 4, pos.x(), pos.y(), pos.z(), p.size, p.uv_bottom_left, p.uv_top_right, cx, cy, n);
+          num_quads++;
         }
       }
 
-      set_num_vertices(num_vertices);
-      set_num_indices(num_indices);
+      vertex *animated = vtx + num_quads * 4;
+      unsigned num_chunks = (num_animated + chunk_size - 1) / chunk_size;
+      job_scheduler::get().parallel_for(0, num_chunks, [&](unsigned chunk) {
+        unsigned first = chunk * chunk_size, end = std::min(first + chunk_size, num_animated);
+        for (unsigned i = first; i != end; ++i) {
+          write_quad(animated + i * 4, pos_x[i], pos_y[i], pos_z[i], sizes[i], uvs_bottom_left[i], uvs_top_right[i], cx, cy, n);
+        }
+      });
+      return num_quads + num_animated;
+    }
+
+    /// Generate mesh from particles
+    virtual void update() {
+      if (!get_vertices()->get_buffer()) {
+        allocate_buffers();
+      }
+
+      unsigned num_quads = 0;
+      {
+        gl_resource::wolock vlock(get_vertices());
+        num_quads = write_billboard_vertices((vertex*)vlock.u8());
+      }
+
+      set_num_vertices(num_quads * 4);
+      set_num_indices(num_quads * 6);
       //dump(log("mesh\n"));
     }
 
@@ -219,6 +334,31 @@ namespace octet { namespace scene {
       return i;
     }
 
+    /// Add a billboard that moves by itself, which is faster than a billboard_particle with a particle_animator.
+    /// It is removed when it is lifetime frames old. a.link is not used. Returns false if capacity reached.
+    bool add_animated_billboard(const billboard_particle &p, const particle_animator &a) {
+      if (num_animated == lifetimes.size()) return false;
+      unsigned i = num_animated++;
+      vec3 pos = p.pos, vel = a.vel, acc = a.acceleration;
+      pos_x[i] = pos.x(); pos_y[i] = pos.y(); pos_z[i] = pos.z();
+      vel_x[i] = vel.x(); vel_y[i] = vel.y(); vel_z[i] = vel.z();
+      acc_x[i] = acc.x(); acc_y[i] = acc.y(); acc_z[i] = acc.z();
+      sizes[i] = p.size;
+      uvs_bottom_left[i] = p.uv_bottom_left;
+      uvs_top_right[i] = p.uv_top_right;
+      angles[i] = p.angle;
+      spins[i] = a.spin;
+      ages[i] = a.age;
+      lifetimes[i] = a.lifetime;
+      return true;
+    }
+
+    /// The number of animated billboards alive.
+    unsigned get_num_animated_billboards() const { return num_animated; }
+
+    /// The position of an animated billboard. They move when others are removed.
+    vec3 get_animated_billboard_pos(unsigned i) const { return vec3(pos_x[i], pos_y[i], pos_z[i]); }
+
     /// Add a trail particle. Returns -1 if capacity reached.
     int add_trail_particle(const trail_particle &p) {
       int i = allocate(trail_particles, free_trail_particle);
@@ -54,19 +54,20 @@ namespace octet { namespace scene {
 	      unsigned max_indices = max_quads * 6;
 	      unsigned vsize = sizeof(vertex) * max_vertices;
 	      unsigned isize = sizeof(uint32_t) * max_indices;
-	      allocate(vsize, isize);
+	      allocate_stream(vsize, isize);
       }
 
-      vertex *vtx = (vertex *)get_vertices()->lock();
-      uint32_t *idx = (uint32_t *)get_indices()->lock();
-
-      unsigned num_quads = font->build_mesh(
-        bb, vtx, idx, max_quads,
-        text.c_str(), text.c_str() + text.size()
-      );
+      unsigned num_quads = 0;
+      {
+        // new copies of the buffers, so that we do not wait for the GPU to draw the old text.
+        gl_resource::wolock vlock(get_vertices());
+        gl_resource::wolock ilock(get_indices());
+        num_quads = font->build_mesh(
+          bb, (vertex *)vlock.u8(), ilock.u32(), max_quads,
+          text.c_str(), text.c_str() + text.size()
+        );
+      }
 
-      get_vertices()->unlock();
-      get_indices()->unlock();
       set_num_indices(num_quads * 6);
       set_num_vertices(num_quads * 4);
     }
@@ -20,7 +20,7 @@ namespace octet { namespace scene {
       }
 
       for (int z = 0; z != dim; ++z) {
-        interface_t::add_bottoms( opaque[z*dim+0], 0, z );
+        interface_t::add_bottoms( opaque[z*dim+0], -1, z );
         for (int y = 0; y != dim-1; ++y) {
           uint32_t p00 = opaque[z*dim+y];
           uint32_t p01 = opaque[z*dim+(y+1)];
@@ -31,7 +31,7 @@ namespace octet { namespace scene {
       }
 
       for (int y = 0; y != dim; ++y) {
-        interface_t::add_backs( opaque[0*dim+y], y, 0 );
+        interface_t::add_backs( opaque[0*dim+y], y, -1 );
         for (int z = 0; z != dim-1; ++z) {
           uint32_t p00 = opaque[z*dim+y];
           uint32_t p10 = opaque[(z+1)*dim+y];
@@ -43,6 +43,125 @@ namespace octet { namespace scene {
     }
   };
 
+  /// the six directions of voxel faces: -x, +x, -y, +y, -z, +z.
+  enum { voxel_left, voxel_right, voxel_bottom, voxel_top, voxel_back, voxel_front };
+
+  /// Like mesh_iterate_faces, but faces that point the same way, lie in the same plane and have the
+  /// same key are joined into rectangles, each one call to interface_t::add_rect(face, pos, width, height, key).
+  /// pos is the voxel at the lowest corner; width runs along y for x faces and x for the others,
+  /// height along z for x and y faces and y for z faces. dim must be 32, the bits in a row.
+  template <class interface_t, int dim> class mesh_greedy_faces : public interface_t {
+    static unsigned index(ivec3_in pos) {
+      return (pos.z() * dim + pos.y()) * dim + pos.x();
+    }
+
+    // a[i] bit j <-> a[j] bit i, swapping ever smaller blocks of bits.
+    static void transpose(uint32_t *a) {
+      uint32_t m = 0x0000ffff;
+      for (int j = 16; j != 0; j >>= 1, m ^= m << j) {
+        for (int k = 0; k < 32; k = (k + j + 1) & ~j) {
+          uint32_t t = ((a[k] >> j) ^ a[k + j]) & m;
+          a[k] ^= t << j;
+          a[k + j] ^= t;
+        }
+      }
+    }
+
+    template <class pos_fn> static bool same_keys(const uint8_t *keys, unsigned key, uint32_t run, int r, pos_fn pos) {
+      if (!keys) return true;
+      for (uint32_t m = run; m; m &= m - 1) {
+        if (keys[index(pos(ilog2(m & (0 - m)), r))] != key) return false;
+      }
+      return true;
+    }
+
+    // join the faces of one plane. rows[r] has bit b set for a face of voxel pos(b, r).
+    template <class pos_fn> void add_plane(uint32_t *rows, unsigned face, const uint8_t *keys, pos_fn pos) {
+      for (int r = 0; r != dim; ++r) {
+        while (rows[r]) {
+          // the lowest run of ones, cut short where the key changes.
+          uint32_t m = rows[r];
+          uint32_t low = m & (0 - m);
+          uint32_t run = m & ~(m + low);
+          int b0 = ilog2(low);
+          unsigned key = keys ? keys[index(pos(b0, r))] : 0;
+          if (keys) {
+            for (int b = b0 + 1; b != dim && (run >> b & 1); ++b) {
+              if (keys[index(pos(b, r))] != key) {
+                run &= (1u << b) - 1;
+                break;
+              }
+            }
+          }
+
+          // then as many rows as have all of it.
+          int height = 1;
+          while (r + height != dim && (rows[r + height] & run) == run && same_keys(keys, key, run, r + height, pos)) {
+            height++;
+          }
+          for (int h = 0; h != height; ++h) {
+            rows[r + h] &= ~run;
+          }
+          interface_t::add_rect(face, pos(b0, r), pop_count(run), height, key);
+        }
+      }
+    }
+
+  public:
+    /// keys has a byte for each voxel, or is NULL if all are the same.
+    void iterate(const uint32_t *opaque, const uint8_t *keys) {
+      uint32_t rows[dim];
+      for (int y = 0; y != dim; ++y) {
+        auto pos = [y](int b, int r) { return ivec3(b, y, r); };
+        for (int z = 0; z != dim; ++z) {
+          rows[z] = opaque[z*dim+y] & ~(y != 0 ? opaque[z*dim+y-1] : 0);
+        }
+        add_plane(rows, voxel_bottom, keys, pos);
+        for (int z = 0; z != dim; ++z) {
+          rows[z] = opaque[z*dim+y] & ~(y != dim-1 ? opaque[z*dim+y+1] : 0);
+        }
+        add_plane(rows, voxel_top, keys, pos);
+      }
+
+      for (int z = 0; z != dim; ++z) {
+        auto pos = [z](int b, int r) { return ivec3(b, r, z); };
+        for (int y = 0; y != dim; ++y) {
+          rows[y] = opaque[z*dim+y] & ~(z != 0 ? opaque[(z-1)*dim+y] : 0);
+        }
+        add_plane(rows, voxel_back, keys, pos);
+        for (int y = 0; y != dim; ++y) {
+          rows[y] = opaque[z*dim+y] & ~(z != dim-1 ? opaque[(z+1)*dim+y] : 0);
+        }
+        add_plane(rows, voxel_front, keys, pos);
+      }
+
+      // x faces lie across the rows, so turn each z slice to make rows of y for each x.
+      uint32_t lefts[dim*dim];
+      uint32_t rights[dim*dim];
+      for (int z = 0; z != dim; ++z) {
+        for (int y = 0; y != dim; ++y) {
+          uint32_t p00 = opaque[z*dim+y];
+          lefts[z*dim+y] = p00 & ~(p00 << 1);
+          rights[z*dim+y] = p00 & ~(p00 >> 1);
+        }
+        transpose(lefts + z*dim);
+        transpose(rights + z*dim);
+      }
+
+      for (int x = 0; x != dim; ++x) {
+        auto pos = [x](int b, int r) { return ivec3(x, b, r); };
+        for (int z = 0; z != dim; ++z) {
+          rows[z] = lefts[z*dim+x];
+        }
+        add_plane(rows, voxel_left, keys, pos);
+        for (int z = 0; z != dim; ++z) {
+          rows[z] = rights[z*dim+x];
+        }
+        add_plane(rows, voxel_right, keys, pos);
+      }
+    }
+  };
+
   class face_counter {
   public:
     unsigned num_faces;
@@ -53,6 +172,7 @@ namespace octet { namespace scene {
     void add_bottoms(uint32_t v, int, int) { num_faces += pop_count(v); }
     void add_fronts(uint32_t v, int, int) { num_faces += pop_count(v); }
     void add_backs(uint32_t v, int, int) { num_faces += pop_count(v); }
+    void add_rect(unsigned, ivec3_in, int, int, unsigned) { num_faces++; }
   };
 
   class face_adder {
@@ -90,6 +210,35 @@ namespace octet { namespace scene {
       }
     }
 
+    // a rectangle of faces from mesh_greedy_faces. The key is not drawn.
+    void add_rect(unsigned face, ivec3_in pos, int width, int height, unsigned key) {
+      // normal, width and height axes of each face.
+      static const int axes[6][3] = { { 0, 1, 2 }, { 0, 1, 2 }, { 1, 0, 2 }, { 1, 0, 2 }, { 2, 0, 1 }, { 2, 0, 1 } };
+      static const ivec3 units[3] = { ivec3(1, 0, 0), ivec3(0, 1, 0), ivec3(0, 0, 1) };
+      const int *a = axes[face];
+      ivec3 n = units[a[0]], u = units[a[1]] * width, v = units[a[2]] * height;
+
+      // as with one face, faces on the + side start at the far corner and go backwards.
+      bool positive = (face & 1) != 0;
+      vec3 pos0 = origin + vec3(positive ? pos + n + u + v : pos) * voxel_size;
+      vec3 du = vec3(positive ? -u : u) * voxel_size;
+      vec3 dv = vec3(positive ? -v : v) * voxel_size;
+      vec3p normal = vec3(positive ? n : -n);
+      float w = (float)width, h = (float)height;
+
+      unsigned idx_val = num_faces * 4;
+      vtx->pos = pos0; vtx->normal = normal; vtx->uv = vec2p(0, 0); vtx++;
+      vtx->pos = pos0 + du; vtx->normal = normal; vtx->uv = vec2p(w, 0); vtx++;
+      vtx->pos = pos0 + du + dv; vtx->normal = normal; vtx->uv = vec2p(w, h); vtx++;
+      vtx->pos = pos0 + dv; vtx->normal = normal; vtx->uv = vec2p(0, h); vtx++;
+      idx[0] = idx_val + 0;
+      idx[3] = idx[1] = idx_val + 1;
+      idx[5] = idx[2] = idx_val + 3;
+      idx[4] = idx_val + 2;
+      idx += 6;
+      num_faces++;
+    }
+
     void add_lefts(uint32_t v, int y, int z) {
       if (v) add_faces(
         v,
@@ -148,6 +297,9 @@ namespace octet { namespace scene {
     };
 
     uint32_t opaque[dim*dim];
+
+    // material keys, a byte for each voxel, or empty if all are zero.
+    dynarray<uint8_t> keys;
     uint32_t any_opaque[num_lod];
     uint32_t all_opaque[num_lod];
 
@@ -271,17 +423,81 @@ namespace octet { namespace scene {
       add.iterate(opaque);
     }
 
-    template <class set> void add_voxels(mat4t_in voxelToWorld, const set &set_in) {
+    /// join faces into rectangles, see mesh_greedy_faces.
+    template <class interface_t> void add_greedy_faces(mesh_greedy_faces<interface_t, dim> &add) const {
+      add.iterate(opaque, keys.empty() ? 0 : keys.data());
+    }
+
+    /// fill (or with value false, empty) the voxels inside set_in. Returns true if any changed.
+    template <class set> bool add_voxels(mat4t_in voxelToWorld, const set &set_in, bool value = true) {
+      // transform a row of voxels at a time.
+      vec3p row[dim];
+      uint32_t changed = 0;
       for (int z = 0; z != dim; ++z) {
         for (int y = 0; y != dim; ++y) {
           for (int x = 0; x != dim; ++x) {
-            vec3 txyz = vec3(x, y, z) * voxelToWorld;
-            if (set_in.intersects(txyz)) {
-              opaque[z*dim+y] |= 1 << x;
+            row[x] = vec3p((float)x, (float)y, (float)z);
+          }
+          batch::transform_points(row, row, voxelToWorld, dim);
+          uint32_t mask = 0;
+          for (int x = 0; x != dim; ++x) {
+            if (set_in.intersects((vec3)row[x])) {
+              mask |= 1 << x;
             }
           }
+          uint32_t old = opaque[z*dim+y];
+          opaque[z*dim+y] = value ? old | mask : old & ~mask;
+          changed |= old ^ opaque[z*dim+y];
         }
       }
+      return changed != 0;
+    }
+
+    /// get one voxel.
+    bool get_voxel(ivec3_in pos) const {
+      return ((opaque[pos.z()*dim+pos.y()] >> pos.x()) & 1) != 0;
+    }
+
+    /// fill or empty every voxel. The LODs must be updated.
+    void fill(bool value) {
+      memset(opaque, value ? 0xff : 0, sizeof(opaque));
+    }
+
+    /// Are all the voxels empty, with no keys? The LODs must be up to date.
+    bool is_empty() const {
+      return any_opaque[d2] == 0 && keys.empty();
+    }
+
+    /// Are all the voxels solid, with no keys? The LODs must be up to date.
+    bool is_solid() const {
+      return all_opaque[d2] == 0xff && keys.empty();
+    }
+
+    /// get the material key of one voxel.
+    unsigned get_key(ivec3_in pos) const {
+      return keys.empty() ? 0 : keys[(pos.z()*dim+pos.y())*dim+pos.x()];
+    }
+
+    /// set the material key of one voxel; greedy meshing joins only faces with the same key.
+    /// Returns true if it changed.
+    bool set_key(ivec3_in pos, unsigned key) {
+      if (keys.empty()) {
+        if (key == 0) return false;
+        keys.resize(dim*dim*dim);
+        memset(keys.data(), 0, keys.size());
+      }
+      uint8_t &k = keys[(pos.z()*dim+pos.y())*dim+pos.x()];
+      if (k == (uint8_t)key) return false;
+      k = (uint8_t)key;
+      return true;
+    }
+
+    /// set one voxel. Returns true if it changed.
+    bool set_voxel(ivec3_in pos, bool value) {
+      uint32_t &word = opaque[pos.z()*dim+pos.y()];
+      uint32_t old = word;
+      word = value ? old | (1u << pos.x()) : old & ~(1u << pos.x());
+      return word != old;
     }
 
     void dump_lod(FILE *fp, const char *label, uint32_t *src) {
@@ -46,7 +46,7 @@ namespace octet { namespace scene {
         return all(pos >= ivec3(0, 0, 0)) && all(pos < size) ? 1 : 0;
       } else {
         mesh_voxel_subcube *subcube = get_subcube(pos>>level);
-        return subcube->is_any(pos & ivec3(subcube_dim-1), level);
+        return subcube ? subcube->is_any(pos & ivec3(subcube_dim-1), level) : 0;
       }
     }
 
@@ -64,61 +64,182 @@ namespace octet { namespace scene {
       return d[i];
     }
 
-    void update_mesh() {
-      mesh_iterate_faces<face_counter, subcube_dim> count;
-      for (unsigned i = 0; i != subcubes.size(); ++i) {
-        mesh_voxel_subcube *p = subcubes[i];
-        if (p) {
-          p->count_faces(count);
-        }
+    // subcube flags: the faces, the LODs or the uploaded copy of the faces are out of date.
+    enum { dirty_mesh = 1, dirty_lod = 2, dirty_upload = 4 };
+
+    // each subcube's faces have a slot of their own in the vertex and index buffers, with room to grow,
+    // so that an edit remeshes and uploads only the subcubes that changed.
+    struct slot {
+      unsigned first_face;
+      unsigned num_faces;
+      unsigned max_faces;
+    };
+
+    enum { min_spare_faces = 64 };
+
+    dynarray<uint8_t> dirty;
+    dynarray<slot> slots;
+
+    // faces left behind by subcubes that moved to bigger slots.
+    unsigned num_unused_faces;
+
+    // the faces of every slot, as sent to OpenGL. Indices past the end of a slot's faces are degenerate.
+    dynarray<vertex> cpu_vertices;
+    dynarray<uint32_t> cpu_indices;
+
+    // the slots have been laid out again since the last upload.
+    bool upload_all;
+
+    // faces are joined into rectangles by mesh_greedy_faces.
+    bool greedy;
+
+    // empty subcubes are NULL and all solid ones share this one, so that sparse worlds fit in memory.
+    static mesh_voxel_subcube *get_solid() {
+      static ref<mesh_voxel_subcube> solid = make_solid();
+      return solid;
+    }
+
+    static mesh_voxel_subcube *make_solid() {
+      mesh_voxel_subcube *result = new mesh_voxel_subcube();
+      result->fill(true);
+      result->update_lod();
+      return result;
+    }
+
+    // a subcube of its own for subcube i, to be changed, in place of NULL or the shared solid one.
+    mesh_voxel_subcube *get_writable(unsigned i) {
+      mesh_voxel_subcube *p = subcubes[i];
+      if (!p || p == get_solid()) {
+        mesh_voxel_subcube *own = new mesh_voxel_subcube();
+        own->fill(p != 0);
+        own->update_lod();
+        subcubes[i] = own;
       }
+      return subcubes[i];
+    }
+
+    unsigned get_subcube_index(ivec3_in pos) const {
+      return pos.x() + size.x() * (pos.y() + size.y() * pos.z());
+    }
 
-      allocate(sizeof(vertex)*count.num_faces*4, sizeof(uint32_t)*count.num_faces*6);
-      set_num_indices(count.num_faces*6);
-      set_num_vertices(count.num_faces*4);
+    // room for a subcube's faces to grow. Empty subcubes get none, so a sparse world costs nothing.
+    static unsigned get_max_faces(unsigned num_faces) {
+      return num_faces ? num_faces + num_faces / 4 + min_spare_faces : 0;
+    }
 
-      mesh_iterate_faces<face_adder, subcube_dim> add;
-      add.vtx = (vertex *)get_vertices()->lock();
-      add.idx = (uint32_t *)get_indices()->lock();
+    vec3 get_subcube_origin(unsigned i) const {
+      int x = i % size.x(), y = i / size.x() % size.y(), z = i / (size.x() * size.y());
+      vec3 offset = vec3(size) * (-0.5f * subcube_dim * voxel_size);
+      vec3 scale(subcube_dim * voxel_size);
+      return vec3((float)x, (float)y, (float)z) * scale + offset;
+    }
+
+    unsigned count_faces(unsigned i) const {
+      if (!subcubes[i]) {
+        return 0;
+      } else if (greedy) {
+        mesh_greedy_faces<face_counter, subcube_dim> count;
+        subcubes[i]->add_greedy_faces(count);
+        return count.num_faces;
+      } else {
+        mesh_iterate_faces<face_counter, subcube_dim> count;
+        subcubes[i]->count_faces(count);
+        return count.num_faces;
+      }
+    }
+
+    // start a face adder at the slot of a subcube.
+    void init_adder(face_adder &add, unsigned i) {
+      const slot &s = slots[i];
+      add.vtx = cpu_vertices.data() + s.first_face * 4;
+      add.idx = cpu_indices.data() + s.first_face * 6;
       add.dx = vec3(voxel_size, 0.0f, 0.0f);
       add.dy = vec3(0.0f, voxel_size, 0.0f);
       add.dz = vec3(0.0f, 0.0f, voxel_size);
       add.voxel_size = voxel_size;
+      add.origin = get_subcube_origin(i);
 
-      vec3 offset = vec3(size) * (-0.5f * subcube_dim * voxel_size);
-      vec3 scale(subcube_dim * voxel_size);
-      int idx = 0;
-      for (int z = 0; z != size.z(); ++z) {
-        for (int y = 0; y != size.y(); ++y) {
-          for (int x = 0; x != size.x(); ++x) {
-            mesh_voxel_subcube *p = subcubes[idx++];
-            add.origin = vec3(x, y, z) * scale + offset;
-            if (p) {
-              p->add_faces(add);
+      // the adder numbers the vertices from num_faces * 4.
+      add.num_faces = s.first_face;
+    }
+
+    // write the faces of a subcube to its slot.
+    void mesh_subcube(unsigned i) {
+      slot &s = slots[i];
+      mesh_greedy_faces<face_adder, subcube_dim> greedy_add;
+      mesh_iterate_faces<face_adder, subcube_dim> face_add;
+      face_adder &add = greedy ? (face_adder&)greedy_add : (face_adder&)face_add;
+      init_adder(add, i);
+      if (subcubes[i] && greedy) {
+        subcubes[i]->add_greedy_faces(greedy_add);
+      } else if (subcubes[i]) {
+        subcubes[i]->add_faces(face_add);
+      }
+      s.num_faces = add.num_faces - s.first_face;
+      assert(s.num_faces <= s.max_faces);
+
+      // the rest of the slot draws nothing.
+      uint32_t *end = cpu_indices.data() + (s.first_face + s.max_faces) * 6;
+      std::fill(add.idx, end, s.first_face * 4);
+    }
+
+    // remesh, then upload new buffers or just the slots that changed with glBufferSubData.
+    void update_mesh() {
+      remesh();
+
+      if (upload_all) {
+        get_vertices()->allocate(GL_ARRAY_BUFFER, cpu_vertices.data(), sizeof(vertex) * cpu_vertices.size());
+        get_indices()->allocate(GL_ELEMENT_ARRAY_BUFFER, cpu_indices.data(), sizeof(uint32_t) * cpu_indices.size());
+        set_num_vertices(cpu_vertices.size());
+        set_num_indices(cpu_indices.size());
+        upload_all = false;
+      } else {
+        for (unsigned i = 0; i != slots.size(); ++i) {
+          if (dirty[i] & dirty_upload) {
+            const slot &s = slots[i];
+            if (s.num_faces) {
+              get_vertices()->assign(&cpu_vertices[s.first_face * 4], sizeof(vertex) * s.first_face * 4, sizeof(vertex) * s.num_faces * 4);
             }
+            get_indices()->assign(&cpu_indices[s.first_face * 6], sizeof(uint32_t) * s.first_face * 6, sizeof(uint32_t) * s.max_faces * 6);
           }
         }
       }
 
-      assert(count.num_faces == add.num_faces);
-
-      get_vertices()->unlock();
-      get_indices()->unlock();
+      for (unsigned i = 0; i != dirty.size(); ++i) {
+        dirty[i] &= ~dirty_upload;
+      }
       //dump(log("voxels\n"));
     }
 
-    template <class set> void add_voxels(mat4t_in voxelToWorld, const set &set_in) {
+    void set_dirty(unsigned i) {
+      dirty[i] |= dirty_mesh | dirty_lod;
+    }
+
+    template <class set> void add_voxels(mat4t_in voxelToWorld, const set &set_in, bool value) {
       int idx = 0;
       vec3 offset = vec3(size) * (-0.5f * subcube_dim) + vec3(0.5f);
       vec3 scale = vec3(subcube_dim);
       for (int z = 0; z != size.z(); ++z) {
         for (int y = 0; y != size.y(); ++y) {
-          for (int x = 0; x != size.x(); ++x) {
+          for (int x = 0; x != size.x(); ++x, ++idx) {
             mat4t localVoxelToWorld = voxelToWorld;
             vec3 pos = vec3(x, y, z) * scale + offset;
             localVoxelToWorld.translate(pos.x(), pos.y(), pos.z());
             //localVoxelToWorld.w() += vec4(0.5f, 0.5f, 0.5f, 0.0f);
-            subcubes[idx++]->add_voxels(localVoxelToWorld, set_in);
+
+            // skip subcubes that set_in does not touch; the box is half a voxel larger than the voxel centres.
+            // There is nothing to add to a solid subcube or take from an empty one.
+            aabb bounds = aabb(vec3(subcube_dim * 0.5f - 0.5f), vec3(subcube_dim * 0.5f)).get_transform(localVoxelToWorld);
+            ref<mesh_voxel_subcube> old = subcubes[idx];
+            if ((value ? old == get_solid() : !old) || !set_in.intersects(bounds)) {
+              continue;
+            }
+
+            if (get_writable(idx)->add_voxels(localVoxelToWorld, set_in, value)) {
+              set_dirty(idx);
+            } else {
+              subcubes[idx] = old;
+            }
           }
         }
       }
@@ -168,33 +289,136 @@ namespace octet { namespace scene {
       size = size_in;
       //set_aabb(aabb(vec3(0, 0, 0), size));
 
+      // all the subcubes start empty.
       subcubes.resize(size.x() * size.y() * size.z());
       set_aabb(aabb(vec3(0, 0, 0), vec3(size)*(voxel_size*subcube_dim*0.5f)));
-      int idx = 0;
-      for (int z = 0; z != size.z(); ++z) {
-        for (int y = 0; y != size.y(); ++y) {
-          for (int x = 0; x != size.x(); ++x) {
-            ivec3 pos(x, y, z);
-            subcubes[idx++] = new mesh_voxel_subcube();
-          }
-        }
+
+      dirty.resize(subcubes.size());
+      for (unsigned i = 0; i != dirty.size(); ++i) {
+        dirty[i] = dirty_mesh | dirty_lod;
       }
+      upload_all = false;
+      greedy = false;
+      num_unused_faces = 0;
 
       //box(aabb(vec3(8, 8, 8), vec3(8, 8, 8)));
       update_lod();
     }
 
-    /// Update only the LODs used for collision detection.
+    /// Update only the LODs used for collision detection and ray casts, of the subcubes that have changed.
+    /// Subcubes that have become all empty or all solid are freed.
     void update_lod() {
+      dynarray<unsigned> changed;
       for (unsigned i = 0; i != subcubes.size(); ++i) {
-        mesh_voxel_subcube *p = subcubes[i];
+        if (dirty[i] & dirty_lod) {
+          changed.push_back(i);
+          dirty[i] &= ~dirty_lod;
+        }
+      }
+
+      job_scheduler::get().parallel_for(0, changed.size(), [&](unsigned c) {
+        mesh_voxel_subcube *p = subcubes[changed[c]];
         if (p) {
           p->update_lod();
         }
+      }, 1);
+
+      for (unsigned c = 0; c != changed.size(); ++c) {
+        mesh_voxel_subcube *p = subcubes[changed[c]];
+        if (p && p->is_empty()) {
+          subcubes[changed[c]] = 0;
+        } else if (p && p != get_solid() && p->is_solid()) {
+          subcubes[changed[c]] = get_solid();
+        }
+      }
+    }
+
+    /// Remesh the subcubes that have changed since the last call on the job threads, into a copy of the
+    /// vertex and index buffers; update() calls this before uploading. A subcube that has outgrown its slot
+    /// moves to a new one at the end; when too much space is unused, every subcube gets a new slot and
+    /// is remeshed. Returns the number of subcubes remeshed.
+    unsigned remesh() {
+      dynarray<unsigned> changed;
+      for (unsigned i = 0; i != subcubes.size(); ++i) {
+        if (dirty[i] & dirty_mesh) {
+          changed.push_back(i);
+        }
+      }
+
+      job_scheduler &sch = job_scheduler::get();
+      dynarray<unsigned> counts(changed.size());
+      bool new_slots = slots.size() != subcubes.size();
+      if (!new_slots) {
+        sch.parallel_for(0, changed.size(), [&](unsigned c) { counts[c] = count_faces(changed[c]); }, 1);
+
+        // subcubes that have outgrown their slots move to new ones at the end of the buffers.
+        unsigned num_faces = cpu_indices.size() / 6;
+        unsigned old_num_faces = num_faces;
+        for (unsigned c = 0; c != changed.size(); ++c) {
+          slot &s = slots[changed[c]];
+          if (counts[c] > s.max_faces) {
+            uint32_t *old_indices = cpu_indices.data() + s.first_face * 6;
+            std::fill(old_indices, old_indices + s.max_faces * 6, 0);
+            num_unused_faces += s.max_faces;
+            s.first_face = num_faces;
+            s.num_faces = 0;
+            s.max_faces = get_max_faces(counts[c]);
+            num_faces += s.max_faces;
+          }
+        }
+
+        // lay the slots out again when half the buffers are unused.
+        if (num_unused_faces * 2 > num_faces) {
+          new_slots = true;
+        } else if (num_faces != old_num_faces) {
+          cpu_vertices.resize(num_faces * 4);
+          cpu_indices.resize(num_faces * 6);
+          memset(&cpu_vertices[old_num_faces * 4], 0, sizeof(vertex) * (num_faces - old_num_faces) * 4);
+          upload_all = true;
+        }
+      }
+
+      if (new_slots) {
+        changed.resize(subcubes.size());
+        counts.resize(subcubes.size());
+        for (unsigned i = 0; i != subcubes.size(); ++i) {
+          changed[i] = i;
+        }
+        sch.parallel_for(0, subcubes.size(), [&](unsigned i) { counts[i] = count_faces(i); }, 1);
+
+        slots.resize(subcubes.size());
+        unsigned num_faces = 0;
+        for (unsigned i = 0; i != subcubes.size(); ++i) {
+          slots[i].first_face = num_faces;
+          slots[i].num_faces = 0;
+          slots[i].max_faces = get_max_faces(counts[i]);
+          num_faces += slots[i].max_faces;
+        }
+        num_unused_faces = 0;
+        cpu_vertices.resize(num_faces * 4);
+        cpu_indices.resize(num_faces * 6);
+        memset(cpu_vertices.data(), 0, sizeof(vertex) * cpu_vertices.size());
+        upload_all = true;
+      }
+
+      sch.parallel_for(0, changed.size(), [&](unsigned c) { mesh_subcube(changed[c]); }, 1);
+      for (unsigned c = 0; c != changed.size(); ++c) {
+        dirty[changed[c]] = (dirty[changed[c]] & ~dirty_mesh) | dirty_upload;
       }
+      return changed.size();
     }
 
-    /// Update both the mesh and the LODs.
+    /// The vertices as last made by remesh(), of which num_faces * 4 from first_face * 4 of each subcube are used.
+    const dynarray<vertex> &get_cpu_vertices() const {
+      return cpu_vertices;
+    }
+
+    /// The indices as last made by remesh(). Unused faces are degenerate triangles.
+    const dynarray<uint32_t> &get_cpu_indices() const {
+      return cpu_indices;
+    }
+
+    /// Update both the mesh and the LODs, for just the subcubes that have changed.
     void update() {
       update_lod();
       update_mesh();
@@ -205,11 +429,75 @@ namespace octet { namespace scene {
       mesh::visit(v);
     }
 
+    /// Fill the voxels inside bounds, which has intersects() for vec3 and aabb.
     template <class bounds_t> mesh_voxels &draw(mat4t_in voxelToWorld, const bounds_t &bounds) {
-      add_voxels(voxelToWorld, bounds);
+      add_voxels(voxelToWorld, bounds, true);
       return *this;
     }
 
+    /// Empty the voxels inside bounds, for example to blow a hole in terrain.
+    template <class bounds_t> mesh_voxels &erase(mat4t_in voxelToWorld, const bounds_t &bounds) {
+      add_voxels(voxelToWorld, bounds, false);
+      return *this;
+    }
+
+    /// Join faces that point the same way, lie in the same plane and have the same key into rectangles.
+    /// Large flat areas then need far fewer vertices. Every subcube is remeshed by the next update().
+    void set_greedy(bool value) {
+      if (value == greedy) return;
+      greedy = value;
+      slots.reset();
+      for (unsigned i = 0; i != dirty.size(); ++i) {
+        dirty[i] |= dirty_mesh;
+      }
+    }
+
+    /// Are faces joined into rectangles?
+    bool get_greedy() const {
+      return greedy;
+    }
+
+    /// get the material key of one voxel.
+    unsigned get_key(ivec3_in pos) const {
+      ivec3 sub(pos.x() >> log_subcube_dim, pos.y() >> log_subcube_dim, pos.z() >> log_subcube_dim);
+      mesh_voxel_subcube *p = get_subcube(sub);
+      return p ? p->get_key(pos - sub * subcube_dim) : 0;
+    }
+
+    /// set the material key of one voxel, from 0 to 255. Greedy meshing joins only faces with the same key.
+    void set_key(ivec3_in pos, unsigned key) {
+      if (key == get_key(pos)) return;
+      ivec3 sub(pos.x() >> log_subcube_dim, pos.y() >> log_subcube_dim, pos.z() >> log_subcube_dim);
+      unsigned idx = get_subcube_index(sub);
+      get_writable(idx)->set_key(pos - sub * subcube_dim, key);
+      dirty[idx] |= greedy ? dirty_mesh | dirty_lod : dirty_lod;
+    }
+
+    /// get one voxel, from 0 to size * 32 on each axis.
+    bool get_voxel(ivec3_in pos) const {
+      ivec3 sub(pos.x() >> log_subcube_dim, pos.y() >> log_subcube_dim, pos.z() >> log_subcube_dim);
+      mesh_voxel_subcube *p = get_subcube(sub);
+      return p ? p->get_voxel(pos - sub * subcube_dim) : false;
+    }
+
+    /// set one voxel, from 0 to size * 32 on each axis. Only its subcube is remeshed.
+    void set_voxel(ivec3_in pos, bool value) {
+      if (value == get_voxel(pos)) return;
+      ivec3 sub(pos.x() >> log_subcube_dim, pos.y() >> log_subcube_dim, pos.z() >> log_subcube_dim);
+      unsigned idx = get_subcube_index(sub);
+      get_writable(idx)->set_voxel(pos - sub * subcube_dim, value);
+      set_dirty(idx);
+    }
+
+    /// The number of subcubes with voxels of their own; empty ones take no memory and solid ones share one.
+    unsigned get_num_stored_subcubes() const {
+      unsigned result = 0;
+      for (unsigned i = 0; i != subcubes.size(); ++i) {
+        result += subcubes[i] && subcubes[i] != get_solid();
+      }
+      return result;
+    }
+
     void dump(FILE *fp) {
       int idx = 0;
       for (int z = 0; z != size.z(); ++z) {
@@ -225,7 +513,7 @@ namespace octet { namespace scene {
       mesh::dump(fp);
     }
 
-    /// get a subcube of 32x32x32 voxels.
+    /// get a subcube of 32x32x32 voxels, NULL if it is empty.
     mesh_voxel_subcube *get_subcube(ivec3_in pos) const {
       assert(all(pos < size));
       //assert(x < (unsigned)size.x() && y < (unsigned)size.y() && z < (unsigned)size.z());
@@ -243,8 +531,95 @@ namespace octet { namespace scene {
         //char b[3][128];
         //log("%d %s->%s/%s\n", level, pos.toString(b[0], sizeof(b[0])), cube_addr.toString(b[1], sizeof(b[1])), vox_addr.toString(b[2], sizeof(b[2])));
         mesh_voxel_subcube *subcube = get_subcube(cube_addr);
-        return subcube->is_any(vox_addr, level);
+        return subcube ? subcube->is_any(vox_addr, level) : 0;
+      }
+    }
+
+    /// Where a ray hits the voxels: see ray_cast.
+    struct hit {
+      // the voxel, from 0 to size * 32 on each axis.
+      ivec3 voxel;
+      // the face of the voxel the ray went in by; zero if the ray starts inside the voxel.
+      vec3 normal;
+      // lambda at the face.
+      float distance;
+    };
+
+    /// Find the first voxel hit by org + lambda * dir (0 <= lambda <= max_lambda), in the mesh's space.
+    /// Empty space is skipped a subcube or a LOD cell at a time, so the LODs must be up to date (see update_lod).
+    bool ray_cast(vec3_in org, vec3_in dir, float max_lambda, hit &result) const {
+      // work in voxels from the corner of the world.
+      vec3 corner = vec3(size) * (-0.5f * subcube_dim * voxel_size);
+      vec3 o = (org - corner) * (1.0f / voxel_size);
+      vec3 d = dir * (1.0f / voxel_size);
+      ivec3 dim = size * subcube_dim;
+
+      // clip the ray to the world.
+      float t = 0, t_max = max_lambda;
+      int axis = -1;
+      for (int k = 0; k != 3; ++k) {
+        if (d[k] == 0) {
+          if (o[k] < 0 || o[k] >= dim[k]) return false;
+        } else {
+          float ta = (0 - o[k]) / d[k], tb = (dim[k] - o[k]) / d[k];
+          if (ta > tb) std::swap(ta, tb);
+          if (ta > t) { t = ta; axis = k; }
+          t_max = std::min(t_max, tb);
+        }
       }
+      if (t > t_max) return false;
+
+      // the voxel where the ray starts, kept in the world against rounding.
+      ivec3 cell;
+      for (int k = 0; k != 3; ++k) {
+        cell[k] = std::max(0, std::min(dim[k] - 1, (int)floorf(o[k] + t * d[k])));
+      }
+
+      for (;;) {
+        // the largest empty cell of the LODs around the voxel.
+        int level = log_subcube_dim;
+        while (level >= 0 && is_any(ivec3(cell.x() >> level, cell.y() >> level, cell.z() >> level), level)) {
+          level--;
+        }
+
+        if (level < 0) {
+          result.voxel = cell;
+          result.normal = vec3(0, 0, 0);
+          if (axis != -1) {
+            result.normal[axis] = d[axis] > 0 ? -1.0f : 1.0f;
+          }
+          result.distance = t;
+          return true;
+        }
+
+        // skip to where the ray leaves the empty cell.
+        int cell_size = 1 << level;
+        ivec3 lo(cell.x() & -cell_size, cell.y() & -cell_size, cell.z() & -cell_size);
+        float t_exit = 1e30f;
+        for (int k = 0; k != 3; ++k) {
+          if (d[k] != 0) {
+            float tk = ((d[k] > 0 ? lo[k] + cell_size : lo[k]) - o[k]) / d[k];
+            if (tk < t_exit) { t_exit = tk; axis = k; }
+          }
+        }
+        t = std::max(t, t_exit);
+        if (t > t_max) return false;
+
+        // the next voxel is across the face it leaves by and in the cell on the other axes.
+        for (int k = 0; k != 3; ++k) {
+          if (k == axis) {
+            cell[k] = d[k] > 0 ? lo[k] + cell_size : lo[k] - 1;
+          } else {
+            cell[k] = std::max(lo[k], std::min(lo[k] + cell_size - 1, (int)floorf(o[k] + t * d[k])));
+          }
+        }
+        if (cell[axis] < 0 || cell[axis] >= dim[axis]) return false;
+      }
+    }
+
+    /// Find the first voxel hit by the_ray, between its start and end.
+    bool ray_cast(const ray &the_ray, hit &result) const {
+      return ray_cast(the_ray.get_start(), the_ray.get_distance(), 1, result);
     }
 
     /// Experimental: collide two orientated voxel meshes.
@@ -271,7 +646,7 @@ namespace octet { namespace scene {
         return false;
       }
 
-      while(!stack.is_empty()) {
+      while(!stack.empty()) {
         entry ta = stack.back().first;
         entry tb = stack.back().second;
         stack.pop_back();
@@ -295,6 +295,16 @@ namespace octet { namespace scene {
 
       //log("%s: u%d=ts%d targ=%04x tex=%d\n", get_atom_name(), get_uniform(), texture_slot, sampler_->get_gl_target(), sampler_->get_gl_texture(image_));
     }
+
+    /// Set the OpenGL state for this sampler, skipping the bind if the texture is already in its slot.
+    void render(const uint8_t *buffer, render_state &state) {
+      param_uniform::render(buffer);
+      bool is_new = !sampler_->has_gl_texture();
+      GLuint texture = sampler_->get_gl_texture(image_);
+      // making the texture binds it.
+      if (is_new) state.forget_textures();
+      state.bind_texture(texture_slot, sampler_->get_gl_target(), texture);
+    }
   };
 
   /// Shader that uses parameters.
@@ -316,6 +326,12 @@ namespace octet { namespace scene {
 
       vertex_shader.assign((const char*)vs.data(), (const char*)(vs.data() + vs.size()));
       fragment_shader.assign((const char*)fs.data(), (const char*)(fs.data() + fs.size()));
+
+      #if OCTET_GPU_SKINNING
+        // let vertex shaders that can skin on the GPU (such as default.vs) do so. #version must come first.
+        size_t pos = vertex_shader.compare(0, 8, "#version") ? 0 : vertex_shader.find('\n') + 1;
+        vertex_shader.insert(pos, "#define OCTET_SKINNING 1\n");
+      #endif
     }
 
     void init(dynarray<ref<param> > &params) {
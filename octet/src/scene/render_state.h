@@ -0,0 +1,301 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// OpenGL state tracking for drawing many meshes
+//
+
+namespace octet { namespace scene {
+  class material;
+  class mesh;
+
+  /// The OpenGL state set while drawing a list of meshes, so that binds which would
+  /// change nothing are skipped. It also counts draws and state changes.
+  ///
+  /// As with mesh::enable_attributes and disable_attributes, vertex attributes are expected to be disabled
+  /// between uses. Call reset() before drawing and finish() after drawing or before other code draws.
+  class render_state {
+    enum { max_textures = 16 };
+
+  public:
+    /// the vertex attributes holding the modelToWorld matrix of each instance.
+    enum { instance_attributes = 0xf << attribute_model_to_world };
+
+  private:
+
+    // what we think OpenGL has: ~0 or NULL for don't know.
+    GLuint program;
+    const material *mat;
+    const mesh *msh;
+    GLuint array_buffer;
+    GLuint element_buffer;
+    GLuint textures[max_textures];
+    GLuint active_texture;
+    uint32_t enabled_attributes;
+    uint32_t mesh_attributes;
+
+    // the modelToWorld attribute is the identity; after an instanced draw OpenGL does not say what it is.
+    bool model_to_world_is_identity;
+    bool instance_divisors_set;
+
+    unsigned num_draws;
+    unsigned num_instanced_draws;
+    unsigned num_instances;
+    unsigned num_program_changes;
+    unsigned num_material_changes;
+    unsigned num_mesh_changes;
+    unsigned num_buffer_binds;
+    unsigned num_texture_binds;
+    unsigned num_attribute_changes;
+  public:
+    render_state() {
+      instance_divisors_set = false;
+      reset();
+      reset_counters();
+    }
+
+    /// Forget the state: the next binds will all be done. The vertex attributes must be disabled.
+    void reset() {
+      program = ~0;
+      mat = 0;
+      msh = 0;
+      array_buffer = element_buffer = ~0;
+      forget_textures();
+      enabled_attributes = 0;
+      mesh_attributes = 0;
+      model_to_world_is_identity = false;
+    }
+
+    /// Zero the counters, for example at the start of a frame.
+    void reset_counters() {
+      num_draws = 0;
+      num_instanced_draws = 0;
+      num_instances = 0;
+      num_program_changes = 0;
+      num_material_changes = 0;
+      num_mesh_changes = 0;
+      num_buffer_binds = 0;
+      num_texture_binds = 0;
+      num_attribute_changes = 0;
+    }
+
+    /// Disable the attributes that were enabled and forget the state.
+    void finish() {
+      set_attributes(0);
+      #if OCTET_INSTANCING
+        if (instance_divisors_set) {
+          for (unsigned col = 0; col != 4; ++col) {
+            glVertexAttribDivisor(attribute_model_to_world + col, 0);
+          }
+          instance_divisors_set = false;
+        }
+      #endif
+      reset();
+    }
+
+    /// Can meshes be drawn many times in one call? This needs OpenGL 3.1 or later.
+    static bool is_instancing_supported() {
+      #if OCTET_INSTANCING
+        static int supported = -1;
+        if (supported == -1) {
+          supported = gl_resource::get_gl_version() >= 31;
+          #ifdef WIN32
+            supported = supported && glDrawElementsInstanced && glDrawArraysInstanced && glVertexAttribDivisor;
+          #endif
+        }
+        return supported != 0;
+      #else
+        return false;
+      #endif
+    }
+
+    /// Can vertex shaders read bone matrices from a float texture? This needs OpenGL 3.0 or later.
+    static bool is_gpu_skinning_supported() {
+      #if OCTET_GPU_SKINNING
+        static int supported = -1;
+        if (supported == -1) {
+          GLint vertex_textures = 0;
+          glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertex_textures);
+          supported = gl_resource::get_gl_version() >= 30 && vertex_textures > 0;
+        }
+        return supported != 0;
+      #else
+        return false;
+      #endif
+    }
+
+    /// glUseProgram if the program is not in use. Returns true if it changed.
+    bool use_program(GLuint value) {
+      if (program == value) return false;
+      glUseProgram(value);
+      program = value;
+      // uniforms belong to the program, so the material must set them again.
+      mat = 0;
+      num_program_changes++;
+      return true;
+    }
+
+    /// Note the material whose uniforms are set. Returns true if it changed.
+    bool set_material(const material *value) {
+      if (mat == value) return false;
+      mat = value;
+      num_material_changes++;
+      return true;
+    }
+
+    /// Note the mesh whose attributes are set up. Returns true if it changed.
+    bool set_mesh(const mesh *value) {
+      if (msh == value) return false;
+      msh = value;
+      num_mesh_changes++;
+      return true;
+    }
+
+    /// The attributes the current mesh uses, to pass to set_attributes.
+    uint32_t get_mesh_attributes() const {
+      return mesh_attributes;
+    }
+
+    /// Note the attributes the current mesh has set up.
+    void set_mesh_attributes(uint32_t mask) {
+      mesh_attributes = mask;
+    }
+
+    /// Make the modelToWorld attribute the identity, for drawing one instance with the default shader.
+    void set_model_to_world_identity() {
+      if (model_to_world_is_identity) return;
+      for (unsigned col = 0; col != 4; ++col) {
+        glVertexAttrib4f(attribute_model_to_world + col, col == 0, col == 1, col == 2, col == 3);
+      }
+      model_to_world_is_identity = true;
+    }
+
+    /// Point the modelToWorld attribute at an array of mat4t, one per instance, in a buffer.
+    /// For a streaming buffer, offset must include gl_resource::get_stream_offset().
+    void set_instance_matrices(GLuint buffer, size_t offset) {
+      #if OCTET_INSTANCING
+        bind_buffer(GL_ARRAY_BUFFER, buffer);
+        for (unsigned col = 0; col != 4; ++col) {
+          // row n of a mat4t is column n of a GLSL mat4.
+          glVertexAttribPointer(attribute_model_to_world + col, 4, GL_FLOAT, GL_FALSE, sizeof(mat4t), (void*)(offset + col * sizeof(vec4)));
+        }
+        if (!instance_divisors_set) {
+          for (unsigned col = 0; col != 4; ++col) {
+            glVertexAttribDivisor(attribute_model_to_world + col, 1);
+          }
+          instance_divisors_set = true;
+        }
+      #endif
+    }
+
+    /// glBindBuffer if the buffer is not bound to the target.
+    void bind_buffer(GLuint target, GLuint buffer) {
+      GLuint &current = target == GL_ELEMENT_ARRAY_BUFFER ? element_buffer : array_buffer;
+      if (current == buffer) return;
+      glBindBuffer(target, buffer);
+      current = buffer;
+      num_buffer_binds++;
+    }
+
+    /// glBindTexture on a texture unit if the texture is not already there.
+    void bind_texture(GLuint slot, GLuint target, GLuint texture) {
+      if (slot < max_textures && textures[slot] == texture) return;
+      if (active_texture != slot) {
+        glActiveTexture(GL_TEXTURE0 + slot);
+        active_texture = slot;
+      }
+      glBindTexture(target, texture);
+      if (slot < max_textures) textures[slot] = texture;
+      num_texture_binds++;
+    }
+
+    /// Forget the textures, for example after a texture has been made, which binds it.
+    void forget_textures() {
+      for (unsigned i = 0; i != max_textures; ++i) {
+        textures[i] = ~0;
+      }
+      active_texture = ~0;
+    }
+
+    /// Enable the vertex attributes in mask (bit n for attribute n) and disable the others.
+    void set_attributes(uint32_t mask) {
+      uint32_t changed = mask ^ enabled_attributes;
+      for (unsigned attr = 0; changed; ++attr, changed >>= 1) {
+        if (changed & 1) {
+          if (mask & (1 << attr)) {
+            glEnableVertexAttribArray(attr);
+          } else {
+            glDisableVertexAttribArray(attr);
+          }
+          num_attribute_changes++;
+        }
+      }
+      enabled_attributes = mask;
+    }
+
+    /// count a draw call.
+    void add_draw() {
+      num_draws++;
+    }
+
+    /// count a draw call of many instances.
+    void add_instanced_draw(unsigned instances) {
+      num_draws++;
+      num_instanced_draws++;
+      num_instances += instances;
+      model_to_world_is_identity = false;
+    }
+
+    /// number of glDraw* calls since reset_counters.
+    unsigned get_num_draws() const {
+      return num_draws;
+    }
+
+    /// number of glDraw*Instanced calls since reset_counters, which are included in get_num_draws.
+    unsigned get_num_instanced_draws() const {
+      return num_instanced_draws;
+    }
+
+    /// number of instances drawn by glDraw*Instanced calls since reset_counters.
+    unsigned get_num_instances() const {
+      return num_instances;
+    }
+
+    /// number of glUseProgram calls since reset_counters.
+    unsigned get_num_program_changes() const {
+      return num_program_changes;
+    }
+
+    /// number of times the material uniforms were set since reset_counters.
+    unsigned get_num_material_changes() const {
+      return num_material_changes;
+    }
+
+    /// number of times the vertex attributes were set up for a new mesh since reset_counters.
+    unsigned get_num_mesh_changes() const {
+      return num_mesh_changes;
+    }
+
+    /// number of glBindBuffer calls since reset_counters.
+    unsigned get_num_buffer_binds() const {
+      return num_buffer_binds;
+    }
+
+    /// number of glBindTexture calls since reset_counters.
+    unsigned get_num_texture_binds() const {
+      return num_texture_binds;
+    }
+
+    /// number of attributes enabled or disabled since reset_counters.
+    unsigned get_num_attribute_changes() const {
+      return num_attribute_changes;
+    }
+
+    /// all the state changes since reset_counters.
+    unsigned get_num_state_changes() const {
+      return num_program_changes + num_material_changes + num_mesh_changes + num_buffer_binds + num_texture_binds + num_attribute_changes;
+    }
+  };
+}}
@@ -71,6 +71,11 @@ namespace octet { namespace scene {
       return gl_texture;
     }
 
+    /// true once get_gl_texture has made the texture.
+    bool has_gl_texture() const {
+      return gl_texture != 0;
+    }
+
     unsigned get_sampler_type() {
       switch (gl_target) {
         case GL_TEXTURE_3D: return GL_SAMPLER_3D;
@@ -14,6 +14,9 @@
 #include "../scene/skin.h"
 #include "../scene/skeleton.h"
 #include "../scene/animation.h"
+#include "../scene/aabb_bvh.h"
+#include "../scene/mesh_bvh.h"
+#include "../scene/render_state.h"
 #include "../scene/mesh.h"
 #include "../scene/image.h"
 #include "../scene/sampler.h"
@@ -27,6 +27,83 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // cached node to world transform and enabled state of this node and its parents.
+    // These are valid when world_is_dirty is false.
+    // A dirty node has only dirty children, so a clean node has only clean parents.
+    mat4t modelToWorld;
+    bool world_enabled;
+    bool world_is_dirty;
+
+    // incremented each time modelToWorld is recalculated.
+    unsigned world_version;
+
+    // incremented when a child is added to any node, so that flattened copies of a hierarchy know when to rebuild.
+    static unsigned &hierarchy_version() {
+      static unsigned value = 0;
+      return value;
+    }
+
+    // incremented when any clean node becomes dirty, so that copies of world transforms know when to update.
+    static unsigned &transform_version() {
+      static unsigned value = 0;
+      return value;
+    }
+
+    // the world state must be recalculated for this node and its children.
+    // Dirty children already have dirty subtrees, so they are skipped. Chains of only children
+    // are walked without the stack.
+    void mark_dirty() {
+      if (world_is_dirty) return;
+      transform_version()++;
+      dynarray<scene_node*> stack;
+      scene_node *node = this;
+      for (;;) {
+        node->world_is_dirty = true;
+        scene_node *next = 0;
+        for (unsigned i = 0; i != node->children.size(); ++i) {
+          scene_node *child = node->children[i];
+          if (!child->world_is_dirty) {
+            if (next) stack.push_back(next);
+            next = child;
+          }
+        }
+        if (!next) {
+          if (stack.empty()) return;
+          next = stack.back();
+          stack.pop_back();
+        }
+        node = next;
+      }
+    }
+
+    // recalculate the world state, parents first.
+    // The dirty nodes form a chain up from here. The ones nearest the root are kept
+    // in a ring and updated top down; very deep chains take more than one pass.
+    void update_world() {
+      enum { max_path = 32 };
+      scene_node *path[max_path];
+      while (world_is_dirty) {
+        unsigned num = 0;
+        scene_node *clean_parent = this;
+        for (; clean_parent && clean_parent->world_is_dirty; clean_parent = clean_parent->parent) {
+          path[num++ & (max_path-1)] = clean_parent;
+        }
+        unsigned end = num > max_path ? num - max_path : 0;
+        for (unsigned i = num; i != end; ) {
+          scene_node *node = path[--i & (max_path-1)];
+          if (clean_parent) {
+            node->update_world(clean_parent);
+          } else {
+            node->modelToWorld = node->nodeToParent;
+            node->world_enabled = node->enabled;
+            node->world_is_dirty = false;
+            node->world_version++;
+          }
+          clean_parent = node;
+        }
+      }
+    }
+
   public:
     RESOURCE_META(scene_node)
 
@@ -35,6 +112,8 @@ namespace octet { namespace scene {
       nodeToParent.loadIdentity();
       sid = atom_;
       enabled = true;
+      world_is_dirty = true;
+      world_version = 0;
       if (parent) {
         parent->add_child(this);
       }
@@ -45,6 +124,8 @@ namespace octet { namespace scene {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
       enabled = true;
+      world_is_dirty = true;
+      world_version = 0;
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -61,6 +142,7 @@ namespace octet { namespace scene {
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
         nodeToParent.init_transpose(value);
+        mark_dirty();
       }
     }
 
@@ -73,6 +155,8 @@ namespace octet { namespace scene {
       //log("visit scene_node nodeToParent\n");
       v.visit(nodeToParent, atom_nodeToParent);
       v.visit(sid, atom_sid);
+      mark_dirty();
+      hierarchy_version()++;
     }
 
 
@@ -80,6 +164,8 @@ namespace octet { namespace scene {
     void add_child(scene_node *new_node) {
       new_node->parent = this;
       children.push_back(new_node);
+      new_node->mark_dirty();
+      hierarchy_version()++;
     }
 
     /// Get the parent node of this node.
@@ -98,20 +184,46 @@ namespace octet { namespace scene {
     }
 
     // compute the scene_node to world matrix for an individual scene_node;
+    // this is cached, so only nodes that have moved, or whose parents have moved, are recalculated.
     mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
-      }
-      return result;
+      update_world();
+      return modelToWorld;
     }
 
     // calculate whether this node is enabled (recursively)
     bool calcEnabled() {
-      for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
-      }
-      return true;
+      update_world();
+      return world_enabled;
+    }
+
+    /// Recalculate the world state of a dirty node from its clean parent.
+    /// visual_scene::update_transforms calls this for a whole hierarchy, parents first.
+    void update_world(const scene_node *clean_parent) {
+      if (!world_is_dirty) return;
+      modelToWorld = nodeToParent * clean_parent->modelToWorld;
+      world_enabled = enabled && clean_parent->world_enabled;
+      world_is_dirty = false;
+      world_version++;
+    }
+
+    /// true if calcModelToWorld or calcEnabled will recalculate.
+    bool is_world_dirty() const {
+      return world_is_dirty;
+    }
+
+    /// This changes each time this node's world matrix is recalculated.
+    unsigned get_world_version() const {
+      return world_version;
+    }
+
+    /// This changes when nodes are added to any hierarchy.
+    static unsigned get_hierarchy_version() {
+      return hierarchy_version();
+    }
+
+    /// This changes when any node moves, is enabled or disabled, or is added to a hierarchy.
+    static unsigned get_transform_version() {
+      return transform_version();
     }
 
     /// transform a point from model space to world space
@@ -134,10 +246,19 @@ namespace octet { namespace scene {
     }
 
     /// access the node to parent transform matrix for writing.
+    /// This marks the node as moved, so finish writing before calling calcModelToWorld
+    /// on it or its children. Use get_nodeToParent to read the matrix.
     mat4t &access_nodeToParent() {
+      mark_dirty();
       return nodeToParent;
     }
 
+    /// Mark the node as moved after writing the matrix from access_nodeToParent again later,
+    /// as animations do.
+    void mark_moved() {
+      mark_dirty();
+    }
+
     /// get the x axis (left, right) of the node
     vec3 get_x() {
       return calcModelToWorld().x().xyz();
@@ -166,26 +287,31 @@ namespace octet { namespace scene {
     /// set enabled state
     void set_enabled(bool value) {
       enabled = value;
+      mark_dirty();
     }
 
     /// reset the matrix
     void loadIdentity() {
       nodeToParent.loadIdentity();
+      mark_dirty();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
       nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
       nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      mark_dirty();
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
       nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Get the identifying sid
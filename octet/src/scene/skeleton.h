@@ -20,10 +20,37 @@ namespace octet { namespace scene {
     // cached skin components
     dynarray<mat4t> result;  /// uniforms to shader
     dynarray<int> indices;   /// map skeleton to skin indices
+
+    // the skin the indices are for and its skin to bind to model matrices, which do not change.
+    const skin *prepared_skin;
+    unsigned prepared_joints;
+    dynarray<mat4t> skinToModel;
+
+    // out = a * b, four lanes at a time. The sums are made in the same order as mat4t::operator*.
+    static void multiply(mat4t &out, const mat4t &a, const mat4t &b) {
+      #if OCTET_SSE2
+        const float *pa = a.get(), *pb = b.get();
+        __m128 b0 = _mm_loadu_ps(pb), b1 = _mm_loadu_ps(pb + 4), b2 = _mm_loadu_ps(pb + 8), b3 = _mm_loadu_ps(pb + 12);
+        float *po = out.get();
+        for (unsigned i = 0; i != 4; ++i) {
+          __m128 row = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(b0, _mm_set1_ps(pa[i * 4 + 0])),
+            _mm_mul_ps(b1, _mm_set1_ps(pa[i * 4 + 1]))),
+            _mm_mul_ps(b2, _mm_set1_ps(pa[i * 4 + 2]))),
+            _mm_mul_ps(b3, _mm_set1_ps(pa[i * 4 + 3]))
+          );
+          _mm_storeu_ps(po + i * 4, row);
+        }
+      #else
+        out = a * b;
+      #endif
+    }
   public:
     RESOURCE_META(skeleton)
 
     skeleton() {
+      prepared_skin = NULL;
+      prepared_joints = 0;
     }
 
     void visit(visitor &v) {
@@ -56,52 +83,62 @@ namespace octet { namespace scene {
       return -1;
     }
 
-    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
-      //static bool first_frame = true;
-      if (boneToNode.size() < nodeToParents.size()) {
-        boneToNode.resize(nodeToParents.size());
-      }
+    /// number of bones, the size of the scratch space for calc_palette.
+    unsigned get_num_nodes() const { return nodeToParents.size(); }
 
-      // todo: optionally drive animation directly to the skeleton.
-      for (int i = 0; i != nodes.size(); ++i) {
-        nodeToParents[i] = nodes[i]->access_nodeToParent();
+    /// Find the bones of a skin's joints and the fixed part of their matrices.
+    /// This is done again only if the skin changes. Call it on one thread before calc_palette.
+    void prepare(const skin *skn) {
+      unsigned num_joints = skn->get_num_joints();
+      if (prepared_skin == skn && prepared_joints == num_joints) return;
+      indices.resize(num_joints);
+      skinToModel.resize(num_joints);
+      for (unsigned i = 0; i != num_joints; ++i) {
+        indices[i] = find_joint(skn->get_joint(i));
+        // skin -> bind space -> skeleton
+        skinToModel[i] = skn->get_modelToBind() * skn->get_bindToModel(i);
       }
+      prepared_skin = skn;
+      prepared_joints = num_joints;
+    }
 
-      // compute matrix heirachy
-      for (int i = 0; i != nodeToParents.size(); ++i) {
-        int parent = parents[i];
-        // skeleton -> parent -> parent -> world -> camera
-        if (parent == -1) {
-          boneToNode[i] = nodeToParents[i] * worldToCamera;
-        } else {
-          boneToNode[i] = nodeToParents[i] * boneToNode[parent];
-        }
-        //log("%d %s p=%d\n", i, result[i].toString(), parent);
-      }
+    /// Has prepare been called for this skin, with nothing prepared since?
+    bool is_prepared(const skin *skn) const {
+      return prepared_skin == skn && prepared_joints == skn->get_num_joints();
+    }
 
-      unsigned num_joints = skn->get_num_joints();
-      if (result.size() < num_joints) {
-        result.resize(num_joints);
-        indices.resize(num_joints);
-        for (int i = 0; i != num_joints; ++i) {
-          // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
-          indices[i] = find_joint(skn->get_joint(i));
-        }
+    /// Make the skin to camera matrix of each of the skin's joints in palette (get_num_joints() of them)
+    /// using scratch (get_num_nodes() of them) for the bone to camera matrices.
+    /// This only reads the skeleton, so many can be made at once on different threads after prepare(skn).
+    void calc_palette(mat4t *palette, mat4t *scratch, const mat4t &modelToCamera, const skin *skn) const {
+      assert(is_prepared(skn));
+
+      // compute matrix heirachy: skeleton -> parent -> parent -> world -> camera
+      // The node to parent matrices are gathered first so that the products are made in one batch.
+      unsigned num_nodes = nodeToParents.size();
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        scratch[i] = nodes[i] ? nodes[i]->get_nodeToParent() : nodeToParents[i];
       }
+      batch::multiply_parents(scratch, scratch, parents.data(), modelToCamera, num_nodes);
 
-      // premultiply by skin matrices
-      for (int i = 0; i != num_joints; ++i) {
-        // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
+      // premultiply by skin matrices: skin -> bind space -> skeleton -> parent -> parent -> world -> camera
+      for (unsigned i = 0; i != prepared_joints; ++i) {
         int index = indices[i];
         if (index != -1) {
-          result[i] = skn->get_modelToBind() * skn->get_bindToModel(i) * boneToNode[index];
+          multiply(palette[i], skinToModel[i], scratch[index]);
         } else {
-          result[i] = worldToCamera;
+          palette[i] = modelToCamera;
         }
-        //if (first_frame) log("%d %d [%s]\n", i, index, result[i].toString());
       }
+    }
 
-      return &result[0];
+    /// Make the skin to camera matrices for one skin, as calc_palette does, and return them.
+    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
+      prepare(skn);
+      boneToNode.resize(nodeToParents.size());
+      result.resize(skn->get_num_joints());
+      calc_palette(result.data(), boneToNode.data(), worldToCamera, skn);
+      return result.data();
     }
 
     // convert an sid into an index. (should be cached!)
@@ -115,5 +152,10 @@ namespace octet { namespace scene {
     void set_bone(int index, const mat4t &value) {
       nodeToParents[index] = value;
     }
+
+    /// access a bone's node to parent matrix for writing, for example by an animation.
+    mat4t &access_bone(int index) {
+      return nodeToParents[index];
+    }
   };
 }}
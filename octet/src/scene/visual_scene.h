@@ -18,9 +18,79 @@ namespace octet { namespace scene {
     /// each of these is a set of (scene_node, mesh, material)
     dynarray<ref<mesh_instance> > mesh_instances;
 
+    /// tree of the world space boxes of mesh_instances, for ray casts.
+    aabb_bvh instance_bvh;
+
+    /// the world space boxes of mesh_instances.
+    dynarray<aabb> instance_boxes;
+
+    /// the node, mesh and instance versions instance_bvh was last made from.
+    unsigned bvh_transform_version;
+    unsigned bvh_aabb_version;
+    unsigned bvh_instance_version;
+
+    /// the world version of each instance's node when its box in instance_bvh was made.
+    dynarray<unsigned> instance_world_versions;
+
+    /// mesh instances whose mesh has no box, which ray casts must try one by one.
+    dynarray<unsigned> unboxed_instances;
+
+    /// the scene's nodes in parent first order and the index of each node's parent, -1 for the root.
+    dynarray<scene_node*> flat_nodes;
+    dynarray<int> flat_parents;
+    unsigned flat_version;
+
+    /// culling: which mesh instances to draw this frame and how many were drawn or culled.
+    bool use_culling;
+    bool use_cull_bvh;
+    dynarray<uint8_t> visible;
+    unsigned num_drawn;
+    unsigned num_culled;
+
+    /// the visible mesh instances in drawing order, with keys made from the shader, material, mesh and depth.
+    struct render_item {
+      uint64_t key;
+      unsigned index;
+      unsigned batch_size; // non zero for the first of a run drawn in one instanced call
+      bool operator<(const render_item &rhs) const { return key < rhs.key; }
+    };
+    dynarray<render_item> render_queue;
+    hash_map<void*, unsigned> sort_ids;
+    bool sort_draws;
+
+    /// the modelToWorld matrices of instanced draws, in queue order.
+    bool use_instancing;
+    dynarray<mat4t> instance_matrices;
+    ref<gl_resource> instance_buffer;
+
+    /// the skinned mesh instances in the queue and their bone matrices, made on many threads.
+    /// The matrices go in a float texture, a row for each instance, or into a copy of the mesh on the CPU.
+    struct skinned_item {
+      mat4t modelToCamera;
+      mesh *cpu_mesh;    // the mesh skinned on the CPU, or NULL if skinned on the GPU
+      float palette_v;   // the row of bone_texture for GPU skinning
+      unsigned palette;  // the first matrix in bone_palettes
+      unsigned scratch;  // the first matrix in bone_scratch
+      unsigned queue_index;
+    };
+    bool use_gpu_skinning;
+    dynarray<skinned_item> skinned_items;
+    dynarray<mat4t> bone_palettes;
+    dynarray<mat4t> bone_scratch;
+    GLuint bone_texture;
+    unsigned bone_texture_width;
+    unsigned bone_texture_height;
+
+    /// the OpenGL state while drawing, which counts the draws and state changes.
+    render_state state;
+
     /// animations playing at the moment
     dynarray<ref<animation_instance> > animation_instances;
 
+    // can the animations be evaluated on many threads? This is checked when animations are added.
+    bool animations_checked;
+    bool animations_are_parallel;
+
     /// cameras available
     dynarray<ref<camera_instance> > camera_instances;
 
@@ -31,7 +101,7 @@ namespace octet { namespace scene {
     bool render_aabbs;
     bool render_debug_lines;
     bool dump_vertices;
-    ref<material> debug_material;
+    ref<material> debug_material; // made on the first render, as it needs OpenGL
     dynarray<vec3p> debug_line_buffer;
     unsigned debug_in_ptr;
 
@@ -111,11 +181,11 @@ namespace octet { namespace scene {
     }
 
     void render_mesh_aabbs() {
+      update_instance_boxes();
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
-        mesh_instance *mi = mesh_instances[mesh_index];
-        aabb bb = mi->get_mesh()->get_aabb();
-        bb = bb.get_transform(mi->get_node()->calcModelToWorld());
-        draw_aabb(bb);
+        if (has_box(mesh_instances[mesh_index])) {
+          draw_aabb(instance_boxes[mesh_index]);
+        }
       }
     }
 
@@ -169,6 +239,9 @@ namespace octet { namespace scene {
       mat4t worldToWorld;
       worldToWorld.loadIdentity();
       cam.get_matrices(worldToProjection, worldToCamera, worldToWorld);
+      if (!debug_material) {
+        debug_material = new material(vec4(1, 0, 0, 1));
+      }
       debug_material->render(worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
 
       /// debug lines are a useful way of showing dynamic behaviour in the scene.
@@ -181,7 +254,268 @@ namespace octet { namespace scene {
       }
     }
 
+    // can this instance be drawn at this distance from the camera? (mesh_instance::flag_lod)
+    static bool is_in_lod_range(mesh_instance *mi, const mat4t &modelToWorld, const mat4t &worldToCamera) {
+      if (!(mi->get_flags() & mesh_instance::flag_lod)) return true;
+      float distance = -(modelToWorld.w() * worldToCamera).z();
+      return distance >= mi->get_min_draw_distance() && distance < mi->get_max_draw_distance();
+    }
+
+    // decide which mesh instances to draw: they must be enabled, in their LOD range
+    // and have world space boxes that are at least partly inside the view.
+    // Skinned meshes are not tested against the view as their bones may take them outside their boxes,
+    // nor are meshes built by hand that have never been given a box.
+    void cull(const frustum &view, const mat4t &worldToCamera) {
+      unsigned num_instances = mesh_instances.size();
+      visible.resize(num_instances);
+      num_drawn = num_culled = 0;
+
+      // the view test: either with the instance tree or all the boxes in one batch.
+      if (use_culling && use_cull_bvh) {
+        update_instance_bvh();
+        memset(visible.data(), 0, num_instances);
+        instance_bvh.frustum_query(view, [&](unsigned first, unsigned count, bool is_inside) {
+          for (unsigned i = first; i != first + count; ++i) {
+            unsigned box = instance_bvh.get_leaf_box(i);
+            vec3 bmin = instance_bvh.get_box_min(box), bmax = instance_bvh.get_box_max(box);
+            visible[box] = is_inside || view.intersects((bmin + bmax) * 0.5f, (bmax - bmin) * 0.5f);
+          }
+        });
+      } else if (use_culling) {
+        update_instance_boxes();
+        batch::intersects(visible.data(), view, instance_boxes.data(), num_instances);
+      } else {
+        memset(visible.data(), 1, num_instances);
+      }
+
+      for (unsigned i = 0; i != num_instances; ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        scene_node *node = mi ? mi->get_node() : NULL;
+        if (!node || !mi->get_mesh() || !(mi->get_flags() & mesh_instance::flag_enabled) || !node->calcEnabled()) {
+          visible[i] = 0;
+          continue;
+        }
+
+        bool is_skinned = mi->get_skeleton() && mi->get_mesh()->get_skin();
+        mat4t modelToWorld = node->calcModelToWorld();
+        bool in_view = !use_culling || is_skinned || !mi->get_mesh()->has_aabb() || visible[i] != 0;
+
+        visible[i] = in_view && is_in_lod_range(mi, modelToWorld, worldToCamera);
+        if (visible[i]) num_drawn++; else num_culled++;
+      }
+    }
+
+    // a small number for a material or mesh, the same for the whole frame.
+    unsigned get_sort_id(void *ptr) {
+      unsigned &id = sort_ids[ptr];
+      if (!id) id = sort_ids.get_size();
+      return id & 0xffff;
+    }
+
+    // put the visible instances in the order to draw them: by shader, then material, then mesh
+    // so that draws share as much state as possible, then front to back.
+    void build_render_queue(const mat4t &worldToCamera, float far_plane) {
+      render_queue.resize(0);
+      sort_ids.clear();
+      float depth_scale = far_plane > 0 ? 65535.0f / far_plane : 0.0f;
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        if (!visible[i]) continue;
+        render_item item;
+        item.index = i;
+        item.key = i;
+        item.batch_size = 0;
+        if (sort_draws) {
+          mesh_instance *mi = mesh_instances[i];
+          material *mat = mi->get_material();
+          float depth = -(mi->get_node()->calcModelToWorld().w() * worldToCamera).z() * depth_scale;
+          uint64_t program = mat ? mat->get_program() & 0xffff : 0;
+          item.key =
+            program << 48 |
+            (uint64_t)get_sort_id(mat) << 32 |
+            (uint64_t)get_sort_id(mi->get_mesh()) << 16 |
+            (uint64_t)(depth > 0 ? std::min(depth, 65535.0f) : 0.0f)
+          ;
+        }
+        render_queue.push_back(item);
+      }
+      if (sort_draws) {
+        std::sort(render_queue.data(), render_queue.data() + render_queue.size());
+      }
+    }
+
+    // can this instance be drawn with others in one call?
+    static bool can_render_instanced(mesh_instance *mi) {
+      if (mi->get_flags() & mesh_instance::flag_selected) return false;
+      if (mi->get_skeleton() && mi->get_mesh()->get_skin()) return false;
+      return mi->get_material()->can_render_instanced();
+    }
+
+    // join runs of queue items with the same mesh and material into instanced draws
+    // and put their world matrices in the instance buffer.
+    void build_instance_batches() {
+      instance_matrices.resize(0);
+      if (!use_instancing || !render_state::is_instancing_supported()) return;
+
+      unsigned size = render_queue.size();
+      for (unsigned begin = 0; begin != size; ) {
+        mesh_instance *mi = mesh_instances[render_queue[begin].index];
+        unsigned end = begin + 1;
+        if (can_render_instanced(mi)) {
+          while (end != size) {
+            mesh_instance *next = mesh_instances[render_queue[end].index];
+            if (next->get_mesh() != mi->get_mesh() || next->get_material() != mi->get_material() || !can_render_instanced(next)) break;
+            ++end;
+          }
+        }
+        if (end - begin >= 2) {
+          render_queue[begin].batch_size = end - begin;
+          for (unsigned i = begin; i != end; ++i) {
+            instance_matrices.push_back(mesh_instances[render_queue[i].index]->get_node()->calcModelToWorld());
+          }
+        }
+        begin = end;
+      }
+
+      size_t bytes = instance_matrices.size() * sizeof(mat4t);
+      if (bytes) {
+        if (!instance_buffer || instance_buffer->get_size() < bytes) {
+          instance_buffer = new gl_resource();
+          instance_buffer->allocate_stream(GL_ARRAY_BUFFER, bytes * 2);
+        }
+        // a new copy of the buffer each frame, which the GPU is not drawing from.
+        instance_buffer->assign(instance_matrices.data(), 0, bytes);
+      }
+    }
+
+    // make the bone matrices of the skinned instances in the queue and either put them
+    // in the bone texture or skin a copy of the mesh on the CPU.
+    void skin_meshes(const mat4t &worldToCamera) {
+      skinned_items.resize(0);
+      unsigned num_palette = 0, num_scratch = 0;
+      bool all_prepared = true;
+      for (unsigned q = 0; q != render_queue.size(); ++q) {
+        const render_item &item = render_queue[q];
+        if (item.batch_size) {
+          q += item.batch_size - 1;
+          continue;
+        }
+        mesh_instance *mi = mesh_instances[item.index];
+        skeleton *skel = mi->get_skeleton();
+        skin *skn = mi->get_mesh()->get_skin();
+        if (!skel || !skn) continue;
+
+        skel->prepare(skn);
+        skinned_item si;
+        si.modelToCamera = mi->get_node()->calcModelToWorld() * worldToCamera;
+        si.cpu_mesh = NULL;
+        si.palette_v = 0;
+        si.palette = num_palette;
+        si.scratch = num_scratch;
+        si.queue_index = q;
+        skinned_items.push_back(si);
+        num_palette += skn->get_num_joints();
+        num_scratch += skel->get_num_nodes();
+      }
+      if (skinned_items.size() == 0) return;
+
+      // a skeleton shared by two different skins has only the last one prepared.
+      for (unsigned i = 0; i != skinned_items.size(); ++i) {
+        mesh_instance *mi = mesh_instances[render_queue[skinned_items[i].queue_index].index];
+        all_prepared = all_prepared && mi->get_skeleton()->is_prepared(mi->get_mesh()->get_skin());
+      }
+
+      bone_palettes.resize(num_palette);
+      bone_scratch.resize(num_scratch);
+      auto calc_palette = [&](unsigned i) {
+        const skinned_item &si = skinned_items[i];
+        mesh_instance *mi = mesh_instances[render_queue[si.queue_index].index];
+        mi->get_skeleton()->calc_palette(&bone_palettes[si.palette], &bone_scratch[si.scratch], si.modelToCamera, mi->get_mesh()->get_skin());
+      };
+      if (all_prepared) {
+        job_scheduler::get().parallel_for(0, skinned_items.size(), calc_palette, 1);
+      } else {
+        for (unsigned i = 0; i != skinned_items.size(); ++i) {
+          mesh_instance *mi = mesh_instances[render_queue[skinned_items[i].queue_index].index];
+          mi->get_skeleton()->prepare(mi->get_mesh()->get_skin());
+          calc_palette(i);
+        }
+      }
+
+      upload_bone_palettes();
+
+      // the rest are skinned on the CPU into copies of their meshes, whose vertices are then in camera space.
+      for (unsigned i = 0; i != skinned_items.size(); ++i) {
+        skinned_item &si = skinned_items[i];
+        if (si.palette_v) continue;
+        mesh_instance *mi = mesh_instances[render_queue[si.queue_index].index];
+        const mesh *msh = mi->get_mesh();
+        const mat4t *palette = &bone_palettes[si.palette];
+        unsigned num_joints = msh->get_skin()->get_num_joints();
+        const uint8_t *source = NULL;
+        si.cpu_mesh = mi->get_skinned_mesh(source);
+
+        gl_resource::wolock lock(si.cpu_mesh->get_vertices());
+        uint8_t *dest = lock.u8();
+        unsigned stride = msh->get_stride();
+        unsigned num_vertices = stride ? (unsigned)(si.cpu_mesh->get_vertices()->get_size() / stride) : 0;
+        enum { chunk = 1024 };
+        job_scheduler::get().parallel_for(0, (num_vertices + chunk - 1) / chunk, [&](unsigned c) {
+          unsigned first = c * chunk, count = std::min((unsigned)chunk, num_vertices - first);
+          if (!msh->skin_vertices(dest, source, palette, num_joints, first, count)) {
+            // not a mesh we can skin: draw it as it is.
+            memcpy(dest + first * stride, source + first * stride, count * stride);
+          }
+        }, 1);
+      }
+    }
+
+    // put the palettes of the materials that can skin on the GPU in rows of the bone texture.
+    // The texture is made bigger when needed; palettes that do not fit are skinned on the CPU.
+    void upload_bone_palettes() {
+      if (!use_gpu_skinning || !render_state::is_gpu_skinning_supported()) return;
+      #if OCTET_GPU_SKINNING
+        static GLint max_size = 0;
+        if (!max_size) glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+        unsigned width = 0, height = 0;
+        for (unsigned i = 0; i != skinned_items.size(); ++i) {
+          mesh_instance *mi = mesh_instances[render_queue[skinned_items[i].queue_index].index];
+          unsigned texels = mi->get_mesh()->get_skin()->get_num_joints() * 4;
+          if (!mi->get_material()->can_render_skinned() || !texels || texels > (unsigned)max_size || height == (unsigned)max_size) continue;
+          width = std::max(width, texels);
+          height++;
+        }
+        if (!height) return;
+
+        if (!bone_texture) glGenTextures(1, &bone_texture);
+        glBindTexture(GL_TEXTURE_2D, bone_texture);
+        if (width > bone_texture_width || height > bone_texture_height) {
+          bone_texture_width = std::max(width, bone_texture_width);
+          bone_texture_height = std::min(std::max(height * 2, bone_texture_height), (unsigned)max_size);
+          glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, bone_texture_width, bone_texture_height, 0, GL_RGBA, GL_FLOAT, NULL);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        // one row of four texels per matrix for each instance.
+        unsigned row = 0;
+        for (unsigned i = 0; i != skinned_items.size() && row != height; ++i) {
+          skinned_item &si = skinned_items[i];
+          mesh_instance *mi = mesh_instances[render_queue[si.queue_index].index];
+          unsigned texels = mi->get_mesh()->get_skin()->get_num_joints() * 4;
+          if (!mi->get_material()->can_render_skinned() || !texels || texels > (unsigned)max_size) continue;
+          glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, texels, 1, GL_RGBA, GL_FLOAT, bone_palettes[si.palette].get());
+          si.palette_v = (row + 0.5f) / bone_texture_height;
+          row++;
+        }
+      #endif
+    }
+
     void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
+      update_transforms();
+
       mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
 
       mat4t worldToCamera;
@@ -194,16 +528,32 @@ namespace octet { namespace scene {
 
       draw_debug_data(cam);
 
-      for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
-        mesh_instance *mi = mesh_instances[mesh_index];
+      cull(frustum(worldToCamera * cameraToProjection), worldToCamera);
+      build_render_queue(worldToCamera, cam.get_far_plane());
+      build_instance_batches();
+      skin_meshes(worldToCamera);
+
+      // instanced draws get their model matrices from the instance buffer.
+      mat4t worldToProjection = worldToCamera * cameraToProjection;
+      size_t instance_offset = 0;
+      unsigned skinned_index = 0;
+
+      state.reset();
+      state.reset_counters();
+      for (unsigned queue_index = 0; queue_index != render_queue.size(); ) {
+        const render_item &item = render_queue[queue_index];
+        mesh_instance *mi = mesh_instances[item.index];
+
+        if (item.batch_size) {
+          mi->get_material()->render(state, worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
+          mi->get_mesh()->render_instanced(state, instance_buffer->get_buffer(), instance_buffer->get_stream_offset() + instance_offset * sizeof(mat4t), item.batch_size);
+          instance_offset += item.batch_size;
+          queue_index += item.batch_size;
+          continue;
+        }
+        queue_index++;
 
         scene_node *node = mi->get_node();
-        unsigned flags = mi->get_flags();
-
-        if (
-          !(flags & mesh_instance::flag_enabled) ||
-          !node->calcEnabled()
-        ) continue;
 
         mesh *msh = mi->get_mesh();
         skin *skn = msh->get_skin();
@@ -216,33 +566,23 @@ namespace octet { namespace scene {
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
         //printf("%d %f\n", mesh_index, modelToWorld.w().y());
 
-        // selecting LOD meshes by distance
-        if (flags & mesh_instance::flag_lod) {
-          float distance = -modelToCamera.w().z();
-          //printf("%f %f %f\n", distance, mi->get_min_draw_distance(), mi->get_max_draw_distance());
-          if (
-            distance < mi->get_min_draw_distance() ||
-            distance >= mi->get_max_draw_distance()
-          ) {
-            continue;
-          }
-        }
-
         if (!skel || !skn) {
           /// normal rendering for single matrix objects
           /// build a projection matrix: model -> world -> camera_instance -> projection
           /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          mat->render(state, modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
         } else {
-          /// multi-matrix rendering
-          mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
-          int num_bones = skel->get_num_bones();
-          if(num_bones > 192) {
-            GLint mvuv = 0;
-            //glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &mvuv);
-            printf("warning: too many bones (%d/%d)\n", num_bones, mvuv/4);
+          /// multi-matrix rendering: the bone matrices are in a row of the bone texture
+          /// or have already been applied to a copy of the mesh.
+          const skinned_item &si = skinned_items[skinned_index++];
+          if (!si.cpu_mesh) {
+            state.bind_texture(material::bone_palette_slot, GL_TEXTURE_2D, bone_texture);
+            mat->render_skinned(state, cameraToProjection, vec2(1.0f / bone_texture_width, si.palette_v), light_uniforms, num_light_uniforms, num_lights);
           } else {
-            mat->render_skinned(cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
+            mat4t identity;
+            identity.loadIdentity();
+            mat->render(state, cameraToProjection, identity, light_uniforms, num_light_uniforms, num_lights);
+            msh = si.cpu_mesh;
           }
         }
 
@@ -250,16 +590,17 @@ namespace octet { namespace scene {
           static bool dumped;
           if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
         }*/
-        msh->enable_attributes();
-        msh->draw();
-        msh->disable_attributes();
+        msh->render(state);
 
         if (mi->get_flags() & mesh_instance::flag_selected) {
           aabb bb = mi->get_mesh()->get_aabb();
           bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+          // draw_aabb sets its own buffers and attributes.
+          state.finish();
           draw_aabb(bb);
         }
       }
+      state.finish();
       frame_number++;
     }
   public:
@@ -273,11 +614,26 @@ namespace octet { namespace scene {
       render_aabbs = false;
       dump_vertices = false;
       render_debug_lines = false;
-      debug_material = new material(vec4(1, 0, 0, 1));
       debug_line_buffer.resize(256);
       assert(is_power_of_two(debug_line_buffer.size()));
       memset(&debug_line_buffer[0], 0, debug_line_buffer.size() * sizeof(debug_line_buffer[0]));
       debug_in_ptr = 0;
+      flat_version = 0;
+      bvh_transform_version = 0;
+      bvh_aabb_version = 0;
+      bvh_instance_version = 0;
+      use_culling = true;
+      use_cull_bvh = false;
+      sort_draws = true;
+      use_instancing = true;
+      use_gpu_skinning = true;
+      bone_texture = 0;
+      bone_texture_width = 0;
+      bone_texture_height = 0;
+      animations_checked = false;
+      animations_are_parallel = false;
+      num_drawn = 0;
+      num_culled = 0;
 
       #ifdef OCTET_BULLET
         dispatcher = new btCollisionDispatcher(&config);
@@ -339,6 +695,7 @@ namespace octet { namespace scene {
       scene_node::visit(v);
       v.visit(mesh_instances, atom_mesh_instances);
       v.visit(animation_instances, atom_animation_instances);
+      animations_checked = false;
       v.visit(camera_instances, atom_camera_instances);
       v.visit(light_instances, atom_light_instances);
     }
@@ -347,6 +704,7 @@ namespace octet { namespace scene {
     void reset() {
       mesh_instances.reset();
       animation_instances.reset();
+      animations_checked = false;
       camera_instances.reset();
       light_instances.reset();
     }
@@ -448,6 +806,7 @@ namespace octet { namespace scene {
 
     animation_instance *add_animation_instance(animation_instance *inst) {
       animation_instances.push_back(inst);
+      animations_checked = false;
       return inst;
     }
 
@@ -543,15 +902,76 @@ namespace octet { namespace scene {
         }
       #endif
 
-      for (int idx = 0; idx != animation_instances.size(); ++idx) {
-        animation_instance *inst = animation_instances[idx];
-        inst->update(delta_time);
-      }
+      update_animations(delta_time);
 
       for (int idx = 0; idx != mesh_instances.size(); ++idx) {
         mesh_instance *inst = mesh_instances[idx];
         inst->update(delta_time);
       }
+
+      update_transforms();
+    }
+
+    /// Evaluate all the animations, all channels at once. If every channel writes straight into
+    /// a matrix and no two animations write the same one, as with a crowd of characters,
+    /// the animations are evaluated on many threads.
+    void update_animations(float delta_time) {
+      unsigned num_instances = animation_instances.size();
+      if (!animations_checked) {
+        hash_map<void*, unsigned> written;
+        animations_are_parallel = true;
+        for (unsigned idx = 0; idx != num_instances; ++idx) {
+          const dynarray<animation::binding> &bindings = animation_instances[idx]->get_bindings();
+          for (unsigned ch = 0; ch != bindings.size(); ++ch) {
+            if (bindings[ch].matrix) {
+              if (written[bindings[ch].matrix]++) animations_are_parallel = false;
+            } else if (bindings[ch].target) {
+              // set_value may write anywhere.
+              animations_are_parallel = false;
+            }
+          }
+        }
+        animations_checked = true;
+      }
+
+      if (animations_are_parallel) {
+        job_scheduler::get().parallel_for(0, num_instances, [&](unsigned idx) {
+          animation_instances[idx]->eval();
+        }, 4);
+      } else {
+        for (unsigned idx = 0; idx != num_instances; ++idx) {
+          animation_instances[idx]->eval();
+        }
+      }
+
+      for (unsigned idx = 0; idx != num_instances; ++idx) {
+        animation_instance *inst = animation_instances[idx];
+        inst->mark_moved();
+        inst->advance(delta_time);
+      }
+    }
+
+    /// Bring the cached world matrices of all the scene's nodes up to date in one pass.
+    /// Parents come before their children, so each dirty node needs only one matrix multiply.
+    /// update, render and the ray casts call this.
+    void update_transforms() {
+      if (flat_nodes.empty() || flat_version != get_hierarchy_version()) {
+        flat_nodes.resize(0);
+        flat_parents.resize(0);
+        get_all_child_nodes(flat_nodes, flat_parents);
+        flat_version = get_hierarchy_version();
+      }
+
+      for (unsigned i = 0; i != flat_nodes.size(); ++i) {
+        scene_node *node = flat_nodes[i];
+        if (!node->is_world_dirty()) continue;
+        int parent = flat_parents[i];
+        if (parent == -1) {
+          node->calcModelToWorld();
+        } else {
+          node->update_world(flat_nodes[parent]);
+        }
+      }
     }
 
     /// render using specific shaders.
@@ -572,12 +992,14 @@ namespace octet { namespace scene {
     void play(animation *anim, resource *target, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, target, is_looping);
       animation_instances.push_back(inst);
+      animations_checked = false;
     }
 
     /// play an animation with built-in targets (as in the collada file)
     void play(animation *anim, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, NULL, is_looping);
       animation_instances.push_back(inst);
+      animations_checked = false;
     }
 
     /// find a mesh instance for a node
@@ -593,14 +1015,12 @@ namespace octet { namespace scene {
 
     /// get the approximate size of the scene, not including lights or cameras
     aabb get_world_aabb() {
+      update_instance_boxes();
       aabb world_aabb;
       bool first = true;
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        if (has_box(mesh_instances[i])) {
+          const aabb &bb = instance_boxes[i];
           if (first) {
             world_aabb = bb;
             first = false;
@@ -612,41 +1032,225 @@ namespace octet { namespace scene {
       return world_aabb;
     }
 
+    /// The result of cast_ray.
     struct cast_result {
+      /// the nearest mesh instance hit, NULL if there was none.
       mesh_instance *mi;
+      /// how far along the ray the hit is, from 0 at the start to 1 at the end.
       rational depth;
     };
 
-    /// brute force & ignorance ray cast.
-    /// return the mesh instance and location of hits.
-    /// todo: build a kd tree for mesh instance bbs & mesh triangles
-    void cast_ray(cast_result &result, const ray &the_ray) {
+  private:
+    // does this instance have a world space box?
+    // Meshes built by hand may never have been given one.
+    static bool has_box(mesh_instance *mi) {
+      return mi && mi->get_node() && mi->get_mesh() && mi->get_mesh()->has_aabb();
+    }
+
+    // put the world space box of each mesh instance in instance_boxes.
+    // Instances with no node, mesh or mesh box get an empty box.
+    void update_instance_boxes() {
+      update_transforms();
+
+      unsigned num_instances = mesh_instances.size();
+      instance_boxes.resize(num_instances);
+      for (unsigned i = 0; i != num_instances; ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        if (has_box(mi)) {
+          instance_boxes[i] = mi->get_mesh()->get_aabb().get_transform(mi->get_node()->calcModelToWorld());
+        } else {
+          instance_boxes[i] = aabb(vec3(0, 0, 0), vec3(-1, -1, -1));
+        }
+      }
+    }
+
+    // find the nearest hit with the instance tree, which must be up to date.
+    void cast_ray_impl(cast_result &result, const ray &the_ray) {
       result.mi = 0;
       result.depth = rational(0, 0);
 
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          mesh *mesh = mi->get_mesh();
-          aabb bb = mesh->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (the_ray.intersects(bb)) {
-            mat4t worldToNode = nodeToWorld.inverse3x4();
-            //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
-            ray model_ray = the_ray.get_transform(worldToNode);
-            int indices[3] = {0};
-            vec4 bary_numer(0, 0, 0, 0);
-            float bary_denom;
-            bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
-            if (hit) {
-              rational depth(bary_numer.w() / bary_denom);
-              result.depth = min(depth, result.depth);
-            }
-            //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
+      // instances of meshes without a box are not in the tree, so try them all first.
+      float limit = 1.0f;
+      for (unsigned i = 0; i != unboxed_instances.size(); ++i) {
+        limit = cast_ray_instance(result, the_ray, mesh_instances[unboxed_instances[i]], limit);
+      }
+
+      instance_bvh.ray_query(the_ray.get_start(), the_ray.get_distance(), limit, [&](unsigned first, unsigned count, float limit) {
+        for (unsigned i = first; i != first + count; ++i) {
+          limit = cast_ray_instance(result, the_ray, mesh_instances[instance_bvh.get_leaf_box(i)], limit);
+        }
+        return limit;
+      });
+    }
+
+    // cast a ray at one instance, keeping the hit in result if it is no further than limit.
+    // returns the new limit.
+    float cast_ray_instance(cast_result &result, const ray &the_ray, mesh_instance *mi, float limit) {
+      if (!mi || !mi->get_node() || !mi->get_mesh()) return limit;
+
+      mat4t worldToNode = mi->get_node()->calcModelToWorld().inverse3x4();
+      ray model_ray = the_ray.get_transform(worldToNode);
+      int indices[3] = {0};
+      vec4 bary_numer(0, 0, 0, 0);
+      float bary_denom;
+      if (mi->get_mesh()->ray_cast(model_ray, indices, bary_numer, bary_denom)) {
+        // the hit is the same fraction of the way along the ray in model and world space.
+        float depth = bary_numer.w() / bary_denom;
+        if (depth <= limit) {
+          limit = depth;
+          result.mi = mi;
+          result.depth = rational(bary_numer.w(), bary_denom);
+        }
+      }
+      return limit;
+    }
+  public:
+    /// Bring the tree of mesh instance boxes up to date after nodes have moved.
+    /// Only the boxes of instances that have moved and the parts of the tree above them are changed,
+    /// and nothing is done if no node, mesh box or instance has changed since the last call.
+    /// cast_ray and cast_rays call this.
+    void update_instance_bvh() {
+      unsigned num_instances = mesh_instances.size();
+      bool is_new = instance_bvh.is_empty() || instance_bvh.get_num_boxes() != num_instances;
+      bool same_instances =
+        !is_new &&
+        bvh_aabb_version == mesh::get_aabb_version() &&
+        bvh_instance_version == mesh_instance::get_instance_version()
+      ;
+      if (same_instances && bvh_transform_version == scene_node::get_transform_version()) {
+        return;
+      }
+
+      if (same_instances) {
+        // only nodes have moved, so only the instances whose world matrix has changed get new boxes.
+        for (unsigned i = 0; i != num_instances; ++i) {
+          mesh_instance *mi = mesh_instances[i];
+          if (!has_box(mi)) continue;
+          scene_node *node = mi->get_node();
+          if (node->is_world_dirty() || node->get_world_version() != instance_world_versions[i]) {
+            instance_boxes[i] = mi->get_mesh()->get_aabb().get_transform(node->calcModelToWorld());
+            instance_bvh.set_box(i, instance_boxes[i]);
+            instance_world_versions[i] = node->get_world_version();
+          }
+        }
+      } else {
+        update_instance_boxes();
+
+        if (is_new) {
+          instance_bvh.resize(num_instances);
+        }
+
+        unboxed_instances.resize(0);
+        instance_world_versions.resize(num_instances);
+        for (unsigned i = 0; i != num_instances; ++i) {
+          instance_bvh.set_box(i, instance_boxes[i]);
+          if (has_box(mesh_instances[i])) {
+            instance_world_versions[i] = mesh_instances[i]->get_node()->get_world_version();
+          } else {
+            unboxed_instances.push_back(i);
           }
         }
       }
+
+      if (!is_new) {
+        instance_bvh.refit();
+      }
+
+      if (is_new || instance_bvh.needs_rebuild()) {
+        instance_bvh.build(2);
+      }
+
+      bvh_transform_version = scene_node::get_transform_version();
+      bvh_aabb_version = mesh::get_aabb_version();
+      bvh_instance_version = mesh_instance::get_instance_version();
+    }
+
+    /// Decide which mesh instances the camera can see, as render does, without drawing anything.
+    /// get_num_drawn and get_num_culled give the result.
+    void cull(camera_instance &cam, float aspect_ratio) {
+      update_transforms();
+      mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
+      mat4t worldToCamera;
+      cameraToWorld.invertQuick(worldToCamera);
+      cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
+      cull(frustum(worldToCamera * cam.get_cameraToProjection()), worldToCamera);
+    }
+
+    /// Test mesh instances against the camera's view before drawing them (the default).
+    void set_use_culling(bool value) {
+      use_culling = value;
+    }
+
+    /// Use the tree of mesh instance boxes to skip groups of instances outside the view.
+    /// This helps most when there are many instances and few of them move.
+    void set_use_cull_bvh(bool value) {
+      use_cull_bvh = value;
+    }
+
+    /// number of mesh instances drawn by the last render.
+    unsigned get_num_drawn() const {
+      return num_drawn;
+    }
+
+    /// number of enabled mesh instances skipped by the last render because they were out of view or out of LOD range.
+    unsigned get_num_culled() const {
+      return num_culled;
+    }
+
+    /// Draw mesh instances in an order that shares shaders, materials and meshes (the default)
+    /// rather than the order they were added, which may matter for transparent objects.
+    void set_sort_draws(bool value) {
+      sort_draws = value;
+    }
+
+    /// Draw runs of instances that share a mesh and material with one call each (the default),
+    /// when OpenGL can and the material's shader takes a modelToWorld attribute.
+    void set_use_instancing(bool value) {
+      use_instancing = value;
+    }
+
+    /// Skin meshes in the vertex shader with the bone matrices in a texture (the default),
+    /// when OpenGL can and the material's shader reads them. Otherwise they are skinned on the CPU.
+    void set_use_gpu_skinning(bool value) {
+      use_gpu_skinning = value;
+    }
+
+    /// Draw calls and state changes made by the last render.
+    const render_state &get_render_state() const {
+      return state;
+    }
+
+    /// Find the nearest mesh instance hit by a ray between its start and end.
+    void cast_ray(cast_result &result, const ray &the_ray) {
+      update_instance_bvh();
+      cast_ray_impl(result, the_ray);
+    }
+
+    /// Cast many rays at once, for example for line of sight tests. results[i] is the hit for rays[i].
+    /// The rays are shared between the job_scheduler threads.
+    void cast_rays(cast_result *results, const ray *rays, unsigned num_rays) {
+      update_instance_bvh();
+
+      // build the triangle trees here: the meshes must not change while the rays are being cast.
+      bool is_thread_safe = true;
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        if (mi && mi->get_mesh()) {
+          mi->get_mesh()->build_bvh();
+          is_thread_safe = is_thread_safe && mi->get_mesh()->get_use_bvh();
+        }
+      }
+
+      if (is_thread_safe) {
+        job_scheduler::get().parallel_for(0, num_rays, [&](unsigned i) {
+          cast_ray_impl(results[i], rays[i]);
+        }, 16);
+      } else {
+        // without a tree, mesh::ray_cast locks the GL buffers, which we can only do on this thread.
+        for (unsigned i = 0; i != num_rays; ++i) {
+          cast_ray_impl(results[i], rays[i]);
+        }
+      }
     }
 
     /// Debug rendering: add a new line in world space (old ones will be lost)
@@ -13,6 +13,7 @@
 namespace octet { namespace shaders {
   class shader : public resource {
     GLuint program_;
+    bool has_model_to_world_;
 
     void link(GLuint vertex_shader, GLuint fragment_shader) {
           // assemble the program for use by glUseProgram
@@ -29,9 +30,11 @@ namespace octet { namespace shaders {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      glBindAttribLocation(program, attribute_model_to_world, "modelToWorld");
       glLinkProgram(program);
 
       program_ = program;
+      has_model_to_world_ = glGetAttribLocation(program, "modelToWorld") == attribute_model_to_world;
       GLsizei length;
       char buf[0x10000];
       glGetProgramInfoLog(program, sizeof(buf), &length, buf);
@@ -44,9 +47,13 @@ namespace octet { namespace shaders {
     }
   public:
     shader() {
+      has_model_to_world_ = false;
     }
 
     GLuint program() { return program_; }
+
+    /// Does the vertex shader take a modelToWorld attribute, so that it can draw many instances at once?
+    bool has_model_to_world() const { return has_model_to_world_; }
   
     void init(const char *vs, const char *fs) {
       //printf("creating shader program\n");